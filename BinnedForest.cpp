@@ -0,0 +1,190 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "BinnedForest.h"
+
+//Qt
+#include <QObject>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <cassert>
+
+using namespace masc;
+
+bool BinnedForest::build(const FlatForest& forest, QString& error)
+{
+	m_roots.clear();
+	m_thresholds.clear();
+
+	if (!forest.isValid())
+	{
+		error = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	const std::vector<int>& features = forest.features();
+	const std::vector<float>& thresholds = forest.thresholds();
+
+	try
+	{
+		//collect the (distinct) thresholds of each feature
+		m_thresholds.resize(forest.attributeCount());
+		for (size_t i = 0; i < features.size(); ++i)
+		{
+			if (features[i] >= 0)
+			{
+				m_thresholds[features[i]].push_back(thresholds[i]);
+			}
+		}
+		size_t maxThresholdCount = 0;
+		for (std::vector<float>& featureThresholds : m_thresholds)
+		{
+			std::sort(featureThresholds.begin(), featureThresholds.end());
+			featureThresholds.erase(std::unique(featureThresholds.begin(), featureThresholds.end()), featureThresholds.end());
+			featureThresholds.shrink_to_fit();
+			maxThresholdCount = std::max(maxThresholdCount, featureThresholds.size());
+		}
+
+		//codes: 0 to N (NaN values) + the missing value code
+		if (maxThresholdCount + 2 <= 256)
+		{
+			m_codeSize = 1;
+			m_missingCode = 255;
+		}
+		else if (maxThresholdCount + 2 <= 65536)
+		{
+			m_codeSize = 2;
+			m_missingCode = 65535;
+		}
+		else
+		{
+			error = QObject::tr("Too many thresholds per feature (%1)").arg(maxThresholdCount);
+			m_thresholds.clear();
+			return false;
+		}
+		m_missingValue = cv::ml::TrainData::missingValue();
+
+		//convert the nodes
+		m_feature = features;
+		m_child = forest.children();
+		m_defaultLeft = forest.defaultLeft();
+		m_classIndex = forest.classIndexes();
+		m_classLabels = forest.classLabels();
+		m_bin.resize(features.size(), 0);
+		for (size_t i = 0; i < features.size(); ++i)
+		{
+			if (features[i] >= 0)
+			{
+				const std::vector<float>& featureThresholds = m_thresholds[features[i]];
+				m_bin[i] = static_cast<uint16_t>(std::lower_bound(featureThresholds.begin(), featureThresholds.end(), thresholds[i]) - featureThresholds.begin());
+			}
+		}
+		m_roots = forest.roots();
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		m_roots.clear();
+		m_thresholds.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void BinnedForest::encode(const float* samples, int sampleCount, void* codes) const
+{
+	int attributeCount = static_cast<int>(m_thresholds.size());
+	size_t valueCount = static_cast<size_t>(sampleCount) * attributeCount;
+	if (m_codeSize == 1)
+	{
+		uint8_t* _codes = static_cast<uint8_t*>(codes);
+		for (size_t i = 0; i < valueCount; ++i)
+		{
+			_codes[i] = static_cast<uint8_t>(encode(static_cast<int>(i % attributeCount), samples[i]));
+		}
+	}
+	else
+	{
+		uint16_t* _codes = static_cast<uint16_t*>(codes);
+		for (size_t i = 0; i < valueCount; ++i)
+		{
+			_codes[i] = static_cast<uint16_t>(encode(static_cast<int>(i % attributeCount), samples[i]));
+		}
+	}
+}
+
+template <typename Code> void BinnedForest::vote(const Code* codes, int sampleCount, int* votes) const
+{
+	int attributeCount = static_cast<int>(m_thresholds.size());
+	size_t classCount = m_classLabels.size();
+	std::fill(votes, votes + static_cast<size_t>(sampleCount) * classCount, 0);
+
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		const Code* sample = codes + static_cast<size_t>(s) * attributeCount;
+		int* sampleVotes = votes + static_cast<size_t>(s) * classCount;
+
+		for (int root : m_roots)
+		{
+			int nodeIndex = root;
+			int feature = m_feature[nodeIndex];
+			while (feature >= 0)
+			{
+				unsigned code = sample[feature];
+				bool left = (code == m_missingCode ? m_defaultLeft[nodeIndex] != 0 : code <= m_bin[nodeIndex]);
+				nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+				feature = m_feature[nodeIndex];
+			}
+			++sampleVotes[m_classIndex[nodeIndex]];
+		}
+	}
+}
+
+bool BinnedForest::predict(	const void* codes,
+							int sampleCount,
+							int* labels,
+							float* confidences,
+							std::vector<int>& votes) const
+{
+	if (!isValid() || !codes || !labels || !confidences)
+	{
+		assert(false);
+		return false;
+	}
+
+	try
+	{
+		votes.resize(static_cast<size_t>(sampleCount) * m_classLabels.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	if (m_codeSize == 1)
+		vote(static_cast<const uint8_t*>(codes), sampleCount, votes.data());
+	else
+		vote(static_cast<const uint16_t*>(codes), sampleCount, votes.data());
+
+	FlatForest::VotesToLabels(votes.data(), sampleCount, m_classLabels, static_cast<int>(m_roots.size()), labels, confidences);
+
+	return true;
+}
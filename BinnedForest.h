@@ -0,0 +1,115 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FlatForest.h"
+
+//system
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace masc
+{
+	//! Random forest working on binned (quantized) features
+	/** Each feature is converted to a small integer code (8 or 16 bits) with the split thresholds
+		of the forest itself: the code of a value is the number of thresholds strictly below it.
+		Therefore (value <= threshold #k) is equivalent to (code <= k), and the nodes compare small
+		integers instead of floats, with exactly the same results. The binned samples are 2 to 4 times
+		smaller than the float ones.
+	**/
+	class BinnedForest
+	{
+	public:
+
+		//! Converts a flattened forest
+		/** Returns false if a feature has too many distinct thresholds (more than 65534: the codes 0 to N
+			and the missing value code must fit on 16 bits).
+		**/
+		bool build(const FlatForest& forest, QString& error);
+
+		//! Returns whether the forest has been built
+		inline bool isValid() const { return !m_roots.empty(); }
+
+		//! Returns the size of a code (1 or 2 bytes)
+		inline int codeSize() const { return m_codeSize; }
+		//! Returns the number of attributes per sample
+		inline int attributeCount() const { return static_cast<int>(m_thresholds.size()); }
+
+		//! Returns the code of a value
+		inline unsigned encode(int feature, float value) const
+		{
+			const std::vector<float>& thresholds = m_thresholds[feature];
+			if (value == m_missingValue)
+			{
+				return m_missingCode;
+			}
+			else if (value != value)
+			{
+				//NaN values are never <= to a threshold
+				return static_cast<unsigned>(thresholds.size());
+			}
+			return static_cast<unsigned>(std::lower_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin());
+		}
+
+		//! Encodes a block of samples (row-major, 'attributeCount' values per sample)
+		/** \param codes output codes (codeSize() bytes per value)
+		**/
+		void encode(const float* samples, int sampleCount, void* codes) const;
+
+		//! Predicts the label and the confidence of a block of binned samples
+		bool predict(	const void* codes,
+						int sampleCount,
+						int* labels,
+						float* confidences,
+						std::vector<int>& votes) const;
+
+	protected:
+
+		//! Computes the votes of a block of binned samples
+		template <typename Code> void vote(const Code* codes, int sampleCount, int* votes) const;
+
+		//! Missing value (as defined by OpenCV)
+		float m_missingValue = 0.0f;
+		//! Code of the missing values
+		unsigned m_missingCode = 0;
+		//! Code size (in bytes)
+		int m_codeSize = 1;
+
+		//! Sorted thresholds of each feature
+		std::vector< std::vector<float> > m_thresholds;
+
+		//! Split variable of each node (-1 for the leaves)
+		std::vector<int> m_feature;
+		//! Index of the threshold in the sorted thresholds of the split variable (the sample goes left if code <= index)
+		std::vector<uint16_t> m_bin;
+		//! Index of the left child of each node (the right child is the next one). Leaves point to themselves.
+		std::vector<int> m_child;
+		//! Direction of each node for the missing values (1 = left)
+		std::vector<unsigned char> m_defaultLeft;
+		//! Class index of each leaf (-1 for the other nodes)
+		std::vector<int> m_classIndex;
+
+		//! Root node of each tree
+		std::vector<int> m_roots;
+		//! Class labels (per class index)
+		std::vector<int> m_classLabels;
+	};
+
+}; //namespace masc
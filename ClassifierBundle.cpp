@@ -0,0 +1,261 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ClassifierBundle.h"
+
+//Local
+#include "q3DMASCClassifier.h"
+
+//Qt
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QTextStream>
+#include <QtEndian>
+
+//system
+#include <cstring>
+
+using namespace masc;
+
+//! Bundle file header
+static const char BundleMagic[16] = "3DMASC_BUNDLE";
+static const quint32 BundleVersion = 1;
+
+//! Section types
+enum SectionType : quint32
+{
+	DescriptionSection = 1,	//UTF-8 text
+	ForestSection = 2		//see FlatForest::serialize
+};
+
+//! Section descriptor (in the section table, after the header)
+struct SectionDescriptor
+{
+	quint32 type;
+	quint32 reserved;
+	quint64 offset;
+	quint64 size;
+};
+
+//! Cache of loaded bundles
+struct CachedBundle
+{
+	QDateTime lastModified;
+	qint64 size = 0;
+	ClassifierBundle::Shared bundle;
+};
+static QMap<QString, CachedBundle> s_cache;
+static QMutex s_cacheMutex;
+
+bool ClassifierBundle::IsBundle(QString filename)
+{
+	return QFileInfo(filename).suffix().compare(Extension, Qt::CaseInsensitive) == 0;
+}
+
+ClassifierBundle::Shared ClassifierBundle::Load(QString filename, QString& error)
+{
+	QFileInfo fi(filename);
+	if (!fi.exists())
+	{
+		error = QObject::tr("Can't find file '%1'").arg(filename);
+		return nullptr;
+	}
+	QString absoluteFilename = fi.absoluteFilePath();
+
+	QMutexLocker locker(&s_cacheMutex);
+	if (s_cache.contains(absoluteFilename))
+	{
+		const CachedBundle& cached = s_cache[absoluteFilename];
+		if (cached.lastModified == fi.lastModified() && cached.size == fi.size())
+		{
+			return cached.bundle;
+		}
+	}
+
+	QFile file(absoluteFilename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		error = QObject::tr("Can't open file '%1'").arg(filename);
+		return nullptr;
+	}
+
+	qint64 fileSize = file.size();
+	const uchar* data = file.map(0, fileSize);
+	if (!data)
+	{
+		error = QObject::tr("Failed to map file '%1'").arg(filename);
+		return nullptr;
+	}
+
+	//header
+	size_t headerSize = sizeof(BundleMagic) + 2 * sizeof(quint32);
+	if (	static_cast<size_t>(fileSize) < headerSize
+		||	memcmp(data, BundleMagic, sizeof(BundleMagic)) != 0)
+	{
+		error = QObject::tr("'%1' is not a 3DMASC bundle").arg(filename);
+		return nullptr;
+	}
+	quint32 version = qFromLittleEndian<quint32>(data + sizeof(BundleMagic));
+	quint32 sectionCount = qFromLittleEndian<quint32>(data + sizeof(BundleMagic) + sizeof(quint32));
+	if (version != BundleVersion)
+	{
+		error = QObject::tr("Unhandled bundle version (%1)").arg(version);
+		return nullptr;
+	}
+	if (static_cast<size_t>(fileSize) < headerSize + sectionCount * sizeof(SectionDescriptor))
+	{
+		error = QObject::tr("Truncated bundle");
+		return nullptr;
+	}
+
+	std::shared_ptr<ClassifierBundle> bundle(new ClassifierBundle);
+	const uchar* table = data + headerSize;
+	for (quint32 i = 0; i < sectionCount; ++i)
+	{
+		const uchar* descriptor = table + i * sizeof(SectionDescriptor);
+		quint32 type = qFromLittleEndian<quint32>(descriptor);
+		quint64 offset = qFromLittleEndian<quint64>(descriptor + 2 * sizeof(quint32));
+		quint64 size = qFromLittleEndian<quint64>(descriptor + 2 * sizeof(quint32) + sizeof(quint64));
+		if (offset > static_cast<quint64>(fileSize) || size > static_cast<quint64>(fileSize) - offset)
+		{
+			error = QObject::tr("Truncated bundle");
+			return nullptr;
+		}
+
+		switch (type)
+		{
+		case DescriptionSection:
+			bundle->m_description = QString::fromUtf8(reinterpret_cast<const char*>(data + offset), static_cast<int>(size));
+			break;
+		case ForestSection:
+			bundle->m_forest.reset(new FlatForest);
+			if (!bundle->m_forest->deserialize(data + offset, static_cast<qint64>(size), error))
+			{
+				return nullptr;
+			}
+			break;
+		default:
+			//unknown sections are ignored (forward compatibility)
+			break;
+		}
+	}
+
+	if (!bundle->m_forest || bundle->m_description.isEmpty())
+	{
+		error = QObject::tr("Incomplete bundle");
+		return nullptr;
+	}
+
+	CachedBundle cached;
+	cached.lastModified = fi.lastModified();
+	cached.size = fi.size();
+	cached.bundle = bundle;
+	s_cache[absoluteFilename] = cached;
+
+	return bundle;
+}
+
+bool ClassifierBundle::Save(QString filename, const QString& description, const FlatForest& forest, QString& error)
+{
+	if (!forest.isValid())
+	{
+		error = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	QByteArray descriptionData = description.toUtf8();
+	QByteArray forestData = forest.serialize();
+
+	const quint32 sectionCount = 2;
+	quint64 offset = sizeof(BundleMagic) + 2 * sizeof(quint32) + sectionCount * sizeof(SectionDescriptor);
+
+	QByteArray header;
+	header.append(BundleMagic, sizeof(BundleMagic));
+	auto AppendUInt32 = [&](quint32 value) { value = qToLittleEndian(value); header.append(reinterpret_cast<const char*>(&value), sizeof(quint32)); };
+	auto AppendUInt64 = [&](quint64 value) { value = qToLittleEndian(value); header.append(reinterpret_cast<const char*>(&value), sizeof(quint64)); };
+	AppendUInt32(BundleVersion);
+	AppendUInt32(sectionCount);
+	AppendUInt32(DescriptionSection);
+	AppendUInt32(0);
+	AppendUInt64(offset);
+	AppendUInt64(descriptionData.size());
+	AppendUInt32(ForestSection);
+	AppendUInt32(0);
+	AppendUInt64(offset + descriptionData.size());
+	AppendUInt64(forestData.size());
+
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly))
+	{
+		error = QObject::tr("Can't open file '%1' for writing").arg(filename);
+		return false;
+	}
+	if (	file.write(header) != header.size()
+		||	file.write(descriptionData) != descriptionData.size()
+		||	file.write(forestData) != forestData.size())
+	{
+		error = QObject::tr("Failed to write file '%1'").arg(filename);
+		return false;
+	}
+
+	return true;
+}
+
+bool ClassifierBundle::Convert(QString classifierFilename, QString bundleFilename, QString& error)
+{
+	QFile file(classifierFilename);
+	if (!file.open(QFile::Text | QFile::ReadOnly))
+	{
+		error = QObject::tr("Can't open file '%1'").arg(classifierFilename);
+		return false;
+	}
+
+	//copy the description, and load the classifier
+	QString description;
+	Classifier classifier;
+	QTextStream stream(&file);
+	while (!stream.atEnd())
+	{
+		QString line = stream.readLine();
+		if (line.trimmed().toUpper().startsWith("CLASSIFIER:"))
+		{
+			QString yamlFilename = line.trimmed().mid(11).trimmed();
+			QString yamlAbsoluteFilename = QFileInfo(classifierFilename).absoluteDir().absoluteFilePath(yamlFilename);
+			if (!classifier.fromFile(yamlAbsoluteFilename))
+			{
+				error = QObject::tr("Failed to load the classifier file from %1").arg(yamlAbsoluteFilename);
+				return false;
+			}
+			//the forest is stored in the bundle
+			continue;
+		}
+		description += line + '\n';
+	}
+
+	std::shared_ptr<const FlatForest> forest = classifier.getFlatForest(error);
+	if (!forest)
+	{
+		return false;
+	}
+
+	return Save(bundleFilename, description, *forest, error);
+}
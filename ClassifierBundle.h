@@ -0,0 +1,73 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FlatForest.h"
+
+//Qt
+#include <QString>
+
+//system
+#include <memory>
+
+namespace masc
+{
+	//! Single-file binary classifier bundle (.3dmasc)
+	/** A bundle holds the classifier description (i.e. the content of the classifier text file:
+		clouds/roles, core points role, features) and the flattened forest. It is memory-mapped
+		and read in a single pass (no YAML parsing), and loaded bundles are cached, so that the
+		multiple readers of the same file (cloud roles, features, classifier) only load it once.
+		A classifier text file + YAML file pair can be converted to a bundle with Convert.
+	**/
+	class ClassifierBundle
+	{
+	public:
+
+		//! Shared type
+		using Shared = std::shared_ptr<const ClassifierBundle>;
+
+		//! Bundle file extension
+		static constexpr const char* Extension = "3dmasc";
+
+		//! Returns whether a file is a bundle (based on its extension)
+		static bool IsBundle(QString filename);
+
+		//! Loads a bundle (or returns the cached version if the file hasn't changed)
+		static Shared Load(QString filename, QString& error);
+
+		//! Saves a bundle
+		static bool Save(QString filename, const QString& description, const FlatForest& forest, QString& error);
+
+		//! Converts a classifier text file (and its YAML file) to a bundle
+		static bool Convert(QString classifierFilename, QString bundleFilename, QString& error);
+
+		//! Returns the classifier description (content of the classifier text file, without the 'classifier:' line)
+		inline const QString& description() const { return m_description; }
+		//! Returns the forest
+		inline std::shared_ptr<const FlatForest> forest() const { return m_forest; }
+
+	protected:
+
+		//! Classifier description
+		QString m_description;
+		//! Flattened forest
+		std::shared_ptr<FlatForest> m_forest;
+	};
+
+}; //namespace masc
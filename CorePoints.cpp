@@ -17,8 +17,12 @@
 
 #include "CorePoints.h"
 
+//Local
+#include "q3DMASCTools.h"
+
 //qCC_db
 #include <ccPointCloud.h>
+#include <ccScalarField.h>
 
 //CCLib
 #include <CloudSamplingTools.h>
@@ -38,8 +42,14 @@ bool CorePoints::prepare(CCCoreLib::GenericProgressCallback* progressCb/*=nullpt
 
 	if (selection)
 	{
-		//nothing to do
-		return true;
+		if (cloud && cloud != origin)
+		{
+			//nothing to do
+			return true;
+		}
+
+		//the selection has been set by the caller, we only need the corresponding cloud
+		return cloneSelection();
 	}
 	
 	//now we can compute the subsampled version
@@ -100,13 +110,127 @@ bool CorePoints::prepare(CCCoreLib::GenericProgressCallback* progressCb/*=nullpt
 	}
 	selection.reset(ref);
 
-	//and create the subsampled version of the cloud
-	cloud = origin->partialClone(ref);
-	if (!cloud)
+	return cloneSelection();
+}
+
+//! Copies the values of a scalar field of the origin cloud at the core points
+static ccScalarField* ExtractSF(const CCCoreLib::ScalarField& originSF, const CorePoints& corePoints)
+{
+	ccScalarField* sf = new ccScalarField(originSF.getName());
+	if (!sf->resizeSafe(corePoints.size()))
+	{
+		sf->release();
+		return nullptr;
+	}
+
+	for (unsigned i = 0; i < corePoints.size(); ++i)
+	{
+		sf->setValue(i, originSF.getValue(corePoints.originIndex(i)));
+	}
+	sf->computeMinAndMax();
+
+	return sf;
+}
+
+bool CorePoints::cloneSelection()
+{
+	assert(origin && selection);
+
+	//create the subsampled version of the cloud (without a full partialClone, as the
+	//features only need the coordinates and read the other attributes on the origin cloud)
+	ccPointCloud* corePointsCloud = new ccPointCloud(origin->getName() + ".extract");
+	if (!corePointsCloud->reserve(selection->size()))
 	{
 		ccLog::Warning("[CorePoints::prepare] Failed to subsampled the origin cloud (not enough memory)");
+		delete corePointsCloud;
 		return false;
 	}
+	for (unsigned i = 0; i < selection->size(); ++i)
+	{
+		corePointsCloud->addPoint(*origin->getPoint(selection->getPointGlobalIndex(i)));
+	}
+	corePointsCloud->copyGlobalShiftAndScale(*origin);
+	cloud = corePointsCloud;
+
+	//the labels are required for training and evaluation
+	const CCCoreLib::ScalarField* classifSF = Tools::GetClassificationSF(origin);
+	if (classifSF)
+	{
+		ccScalarField* sf = ExtractSF(*classifSF, *this);
+		if (!sf)
+		{
+			ccLog::Warning("[CorePoints::prepare] Failed to subsampled the origin cloud (not enough memory)");
+			cloud = nullptr;
+			delete corePointsCloud;
+			return false;
+		}
+		cloud->addScalarField(sf);
+	}
+
+	return true;
+}
+
+bool CorePoints::materialize()
+{
+	if (!origin || !cloud)
+	{
+		assert(false);
+		return false;
+	}
+	if (cloud == origin || !selection)
+	{
+		//nothing to do
+		return true;
+	}
+
+	//scalar fields
+	for (unsigned sfIndex = 0; sfIndex < origin->getNumberOfScalarFields(); ++sfIndex)
+	{
+		const CCCoreLib::ScalarField* originSF = origin->getScalarField(sfIndex);
+		if (cloud->getScalarFieldIndexByName(originSF->getName()) >= 0)
+		{
+			//already extracted
+			continue;
+		}
+
+		ccScalarField* sf = ExtractSF(*originSF, *this);
+		if (!sf)
+		{
+			ccLog::Warning("[CorePoints::materialize] Not enough memory");
+			return false;
+		}
+		cloud->addScalarField(sf);
+	}
+
+	//colors
+	if (origin->hasColors() && !cloud->hasColors())
+	{
+		if (!cloud->reserveTheRGBTable())
+		{
+			ccLog::Warning("[CorePoints::materialize] Not enough memory");
+			return false;
+		}
+		for (unsigned i = 0; i < size(); ++i)
+		{
+			cloud->addColor(origin->getPointColor(originIndex(i)));
+		}
+		cloud->showColors(origin->colorsShown());
+	}
+
+	//normals
+	if (origin->hasNormals() && !cloud->hasNormals())
+	{
+		if (!cloud->reserveTheNormsTable())
+		{
+			ccLog::Warning("[CorePoints::materialize] Not enough memory");
+			return false;
+		}
+		for (unsigned i = 0; i < size(); ++i)
+		{
+			cloud->addNormIndex(origin->getPointNormalIndex(originIndex(i)));
+		}
+		cloud->showNormals(origin->normalsShown());
+	}
 
 	return true;
 }
@@ -41,6 +41,11 @@ namespace masc
 		//! Core points 'role'
 		QString role;
 
+		//! Whether each feature must have its own scalar field on the core points cloud (e.g. to be exported)
+		/** Otherwise, the scale-less point features directly reference their source field (see PointFeature::prepare).
+		**/
+		bool keepFeatureFields = false;
+
 		//! Return the size
 		inline unsigned size() const { return (cloud ? cloud->size() : 0); }
 		//! Return the point index
@@ -53,7 +58,21 @@ namespace masc
 		double selectionParam = std::numeric_limits<double>::quiet_NaN();
 
 		//! Prepares the selection (must be called once)
+		/** If the selection is already set, only the corresponding cloud is created.
+		**/
 		bool prepare(CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Copies the other attributes of the origin cloud (scalar fields, colors, normals) to the core points cloud
+		/** The core points cloud created from a selection only has the coordinates and the 'Classification'
+			field of the origin points (the features read the other attributes on the origin cloud, with
+			originIndex). This is only necessary to get a complete entity (e.g. to display it in the GUI).
+		**/
+		bool materialize();
+
+	protected:
+
+		//! Creates the core points cloud from the selection (coordinates and 'Classification' field only)
+		bool cloneSelection();
 	};
 
 }; //namespace masc
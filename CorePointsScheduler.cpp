@@ -0,0 +1,244 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "CorePointsScheduler.h"
+
+//CCLib
+#include <DgmOctree.h>
+#include <GenericIndexedCloud.h>
+
+//system
+#include <algorithm>
+#include <cassert>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+bool CorePointsScheduler::EstimateCosts(const CCCoreLib::DgmOctree& octree,
+										unsigned char level,
+										CCCoreLib::GenericIndexedCloud& corePoints,
+										std::vector<unsigned>& costs)
+{
+	//population of each (non empty) cell at the extraction level
+	CCCoreLib::DgmOctree::cellCodesContainer cellCodes;
+	CCCoreLib::DgmOctree::cellIndexesContainer cellIndexes;
+	try
+	{
+		octree.getCellCodes(level, cellCodes, true);
+		if (!octree.getCellIndexes(level, cellIndexes))
+		{
+			return false;
+		}
+		costs.resize(corePoints.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+	assert(cellCodes.size() == cellIndexes.size());
+
+	const unsigned projectedPointCount = octree.getNumberOfProjectedPoints();
+	const int cellCount = (1 << level);
+
+	int pointCount = static_cast<int>(corePoints.size());
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(std::max(1, omp_get_max_threads() - 2))
+#endif
+	for (int i = 0; i < pointCount; ++i)
+	{
+		//the minimal cost (for points lying in empty cells or outside of the octree)
+		unsigned cost = 1;
+
+		const CCVector3* P = corePoints.getPoint(static_cast<unsigned>(i));
+		Tuple3i cellPos;
+		octree.getTheCellPosWhichIncludesThePoint(P, cellPos, level);
+		if (	cellPos.x >= 0 && cellPos.x < cellCount
+			&&	cellPos.y >= 0 && cellPos.y < cellCount
+			&&	cellPos.z >= 0 && cellPos.z < cellCount)
+		{
+			CCCoreLib::DgmOctree::CellCode code = CCCoreLib::DgmOctree::GenerateTruncatedCellCode(cellPos, level);
+			CCCoreLib::DgmOctree::cellCodesContainer::const_iterator it = std::lower_bound(cellCodes.begin(), cellCodes.end(), code);
+			if (it != cellCodes.end() && *it == code)
+			{
+				size_t cellIndex = it - cellCodes.begin();
+				unsigned nextStart = (cellIndex + 1 < cellIndexes.size() ? cellIndexes[cellIndex + 1] : projectedPointCount);
+				cost += nextStart - cellIndexes[cellIndex];
+			}
+		}
+
+		costs[i] = cost;
+	}
+
+	return true;
+}
+
+bool CorePointsScheduler::BuildChunks(	const std::vector<unsigned>& costs,
+										int threadCount,
+										std::vector<Chunk>& chunks,
+										unsigned chunksPerThread/*=16*/)
+{
+	chunks.clear();
+	if (costs.empty())
+	{
+		return true;
+	}
+
+	double totalCost = 0.0;
+	for (unsigned c : costs)
+	{
+		totalCost += c;
+	}
+
+	size_t targetChunkCount = static_cast<size_t>(std::max(1, threadCount)) * std::max(1u, chunksPerThread);
+	double targetCost = totalCost / targetChunkCount;
+
+	try
+	{
+		chunks.reserve(targetChunkCount + 1);
+
+		Chunk chunk;
+		double chunkCost = 0.0;
+		for (size_t i = 0; i < costs.size(); ++i)
+		{
+			chunkCost += costs[i];
+			if (chunkCost >= targetCost)
+			{
+				chunk.last = static_cast<unsigned>(i + 1);
+				chunks.push_back(chunk);
+				chunk.first = chunk.last;
+				chunkCost = 0.0;
+			}
+		}
+		if (chunk.first < costs.size())
+		{
+			chunk.last = static_cast<unsigned>(costs.size());
+			chunks.push_back(chunk);
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool ThreadUtilizationMonitor::start(int threadCount)
+{
+	try
+	{
+		m_intervals.clear();
+		m_intervals.resize(static_cast<size_t>(std::max(1, threadCount)));
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	m_timer.start();
+	return true;
+}
+
+void ThreadUtilizationMonitor::record(double startTime, double stopTime)
+{
+#if defined(_OPENMP)
+	size_t threadIndex = static_cast<size_t>(omp_get_thread_num());
+#else
+	size_t threadIndex = 0;
+#endif
+	if (threadIndex >= m_intervals.size())
+	{
+		assert(false);
+		return;
+	}
+
+	try
+	{
+		m_intervals[threadIndex].push_back({ startTime, stopTime });
+	}
+	catch (const std::bad_alloc&)
+	{
+		//not a big deal (only used for reporting)
+	}
+}
+
+QString ThreadUtilizationMonitor::report(unsigned timeBinCount/*=10*/) const
+{
+	//the wall time is the end of the last busy period
+	double wallTime = 0.0;
+	for (const std::vector<Interval>& threadIntervals : m_intervals)
+	{
+		for (const Interval& interval : threadIntervals)
+		{
+			wallTime = std::max(wallTime, interval.stop);
+		}
+	}
+	if (wallTime <= 0.0 || m_intervals.empty() || timeBinCount == 0)
+	{
+		return QString("Thread utilization: no activity recorded");
+	}
+
+	//busy time per thread
+	double minBusy = 1.0;
+	double maxBusy = 0.0;
+	double sumBusy = 0.0;
+	std::vector<double> activeTimePerBin(timeBinCount, 0.0);
+	double binWidth = wallTime / timeBinCount;
+	for (const std::vector<Interval>& threadIntervals : m_intervals)
+	{
+		double busyTime = 0.0;
+		for (const Interval& interval : threadIntervals)
+		{
+			busyTime += interval.stop - interval.start;
+
+			//distribute the busy period over the time bins
+			unsigned firstBin = std::min(timeBinCount - 1, static_cast<unsigned>(interval.start / binWidth));
+			unsigned lastBin = std::min(timeBinCount - 1, static_cast<unsigned>(interval.stop / binWidth));
+			for (unsigned b = firstBin; b <= lastBin; ++b)
+			{
+				double binStart = b * binWidth;
+				double overlap = std::min(interval.stop, binStart + binWidth) - std::max(interval.start, binStart);
+				if (overlap > 0)
+				{
+					activeTimePerBin[b] += overlap;
+				}
+			}
+		}
+
+		double busyRatio = busyTime / wallTime;
+		minBusy = std::min(minBusy, busyRatio);
+		maxBusy = std::max(maxBusy, busyRatio);
+		sumBusy += busyRatio;
+	}
+
+	QString report = QString("Thread utilization: %1 threads, wall time %2 s, busy %3% on average (min %4% / max %5%)")
+		.arg(m_intervals.size())
+		.arg(wallTime, 0, 'f', 2)
+		.arg(100.0 * sumBusy / m_intervals.size(), 0, 'f', 1)
+		.arg(100.0 * minBusy, 0, 'f', 1)
+		.arg(100.0 * maxBusy, 0, 'f', 1);
+
+	report += "\nActive threads over time:";
+	for (unsigned b = 0; b < timeBinCount; ++b)
+	{
+		report += QString(" %1").arg(activeTimePerBin[b] / binWidth, 0, 'f', 1);
+	}
+
+	return report;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QElapsedTimer>
+#include <QString>
+
+//system
+#include <vector>
+
+namespace CCCoreLib
+{
+	class DgmOctree;
+	class GenericIndexedCloud;
+};
+
+namespace masc
+{
+	//! Cost-balanced scheduling of the core points
+	/** The cost of a core point is estimated from the population of the octree cell
+		(at the neighborhood extraction level) that contains it. The core points are then
+		split in contiguous chunks of (roughly) equal cost, meant to be processed with a
+		dynamic OpenMP schedule.
+	**/
+	namespace CorePointsScheduler
+	{
+		//! Range of core points [first, last[
+		struct Chunk
+		{
+			unsigned first = 0;
+			unsigned last = 0;
+		};
+
+		//! Estimates the cost of each core point
+		bool EstimateCosts(	const CCCoreLib::DgmOctree& octree,
+							unsigned char level,
+							CCCoreLib::GenericIndexedCloud& corePoints,
+							std::vector<unsigned>& costs);
+
+		//! Splits the core points in chunks of (roughly) equal cost
+		/** \param chunksPerThread number of chunks per thread (the more, the better the balance, but the higher the overhead)
+		**/
+		bool BuildChunks(	const std::vector<unsigned>& costs,
+							int threadCount,
+							std::vector<Chunk>& chunks,
+							unsigned chunksPerThread = 16);
+	};
+
+	//! Records the activity of the threads over time (to report the thread utilization)
+	class ThreadUtilizationMonitor
+	{
+	public:
+
+		//! Starts monitoring
+		bool start(int threadCount);
+
+		//! Returns the elapsed time since the start (in seconds)
+		inline double now() const { return m_timer.nsecsElapsed() / 1.0e9; }
+
+		//! Records a busy period for the current thread
+		void record(double startTime, double stopTime);
+
+		//! Returns the report (per-thread busy time and number of active threads over time)
+		QString report(unsigned timeBinCount = 10) const;
+
+	protected:
+
+		struct Interval
+		{
+			double start;
+			double stop;
+		};
+
+		QElapsedTimer m_timer;
+		std::vector< std::vector<Interval> > m_intervals; //per thread
+	};
+
+}; //namespace masc
@@ -0,0 +1,106 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "CpuFeatures.h"
+
+#if defined(MASC_X86_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//system
+#include <cstdlib>
+
+using namespace masc;
+
+static Cpu::InstructionSet DetectInstructionSet()
+{
+#if defined(MASC_X86_SIMD)
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4] = { 0, 0, 0, 0 };
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && fma)
+	{
+		//the OS must save the YMM registers
+		unsigned long long xcr0 = _xgetbv(0);
+		if ((xcr0 & 0x6) == 0x6)
+		{
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+	}
+#else
+	__builtin_cpu_init();
+	bool sse2 = __builtin_cpu_supports("sse2");
+	bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+
+	if (avx2)
+		return Cpu::InstructionSet::AVX2;
+	if (sse2)
+		return Cpu::InstructionSet::SSE2;
+#endif
+
+	return Cpu::InstructionSet::Scalar;
+}
+
+Cpu::InstructionSet Cpu::BestInstructionSet()
+{
+	static const InstructionSet s_instructionSet = []()
+	{
+		InstructionSet best = DetectInstructionSet();
+
+		//optional (lower) override
+		const char* userChoice = std::getenv("Q3DMASC_SIMD");
+		if (userChoice)
+		{
+			QString choice = QString(userChoice).toUpper();
+			if (choice == "SCALAR")
+				best = InstructionSet::Scalar;
+			else if (choice == "SSE2" && best == InstructionSet::AVX2)
+				best = InstructionSet::SSE2;
+		}
+
+		return best;
+	}();
+
+	return s_instructionSet;
+}
+
+QString Cpu::ToString(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+	case InstructionSet::Scalar:
+		return "Scalar";
+	case InstructionSet::SSE2:
+		return "SSE2";
+	case InstructionSet::AVX2:
+		return "AVX2";
+	default:
+		break;
+	}
+	return "Unknown";
+}
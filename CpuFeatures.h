@@ -0,0 +1,56 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QString>
+
+//x86 SIMD support (the AVX2 code paths are compiled per function, and only called after a runtime check)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MASC_X86_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define MASC_TARGET_AVX2
+#else
+#define MASC_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+namespace masc
+{
+	namespace Cpu
+	{
+		//! Instruction sets used by the plugin kernels
+		enum class InstructionSet
+		{
+			Scalar = 0,	/*!< Portable code */
+			SSE2,		/*!< 128 bits (2 doubles / 4 floats) */
+			AVX2		/*!< 256 bits (4 doubles / 8 floats) + FMA */
+		};
+
+		//! Returns the best instruction set supported by the current CPU
+		/** Detected once. Can be lowered with the Q3DMASC_SIMD environment variable
+			(SCALAR, SSE2 or AVX2) to compare the different code paths.
+		**/
+		InstructionSet BestInstructionSet();
+
+		//! Returns the instruction set name
+		QString ToString(InstructionSet instructionSet);
+	};
+
+}; //namespace masc
@@ -0,0 +1,205 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "CrossCloudNeighborhoods.h"
+
+//Local
+#include "CorePointsScheduler.h"
+
+//qCC_db
+#include <ccLog.h>
+#include <ccOctree.h>
+#include <ccPointCloud.h>
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//system
+#include <algorithm>
+
+using namespace masc;
+
+CrossCloudNeighborhoods::CrossCloudNeighborhoods(ccPointCloud* cloud1, ccPointCloud* cloud2, const std::vector<double>& scales)
+	: m_scales(scales)
+{
+	m_clouds[0] = cloud1;
+	m_clouds[1] = cloud2;
+
+	std::sort(m_scales.begin(), m_scales.end());
+	m_scales.erase(std::unique(m_scales.begin(), m_scales.end()), m_scales.end());
+
+	m_sqRadii.resize(m_scales.size());
+	for (size_t j = 0; j < m_scales.size(); ++j)
+	{
+		double radius = m_scales[j] / 2; //scale is the diameter!
+		m_sqRadii[j] = radius * radius;
+	}
+}
+
+bool CrossCloudNeighborhoods::run(	const CorePoints& corePoints,
+									const PointFunction& pointFunction,
+									QString& error,
+									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!m_clouds[0] || !m_clouds[1] || !corePoints.cloud || m_scales.empty() || !pointFunction)
+	{
+		//invalid input parameters
+		assert(false);
+		error = "invalid input parameters";
+		return false;
+	}
+
+	PointCoordinateType largestRadius = static_cast<PointCoordinateType>(m_scales.back() / 2); //scale is the diameter!
+
+	//get the octrees
+	ccOctree::Shared octrees[2];
+	unsigned char octreeLevels[2] = { 0, 0 };
+	for (unsigned c = 0; c < 2; ++c)
+	{
+		octrees[c] = m_clouds[c]->getOctree();
+		if (!octrees[c])
+		{
+			ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(m_clouds[c]->getName()).arg(m_clouds[c]->size()));
+			octrees[c] = m_clouds[c]->computeOctree(progressCb);
+			if (!octrees[c])
+			{
+				error = "failed to compute octree on cloud " + m_clouds[c]->getName();
+				return false;
+			}
+		}
+		octreeLevels[c] = octrees[c]->findBestLevelForAGivenNeighbourhoodSizeExtraction(largestRadius);
+	}
+
+	//per-thread scratch memory (one set per cloud)
+	ScratchArenas arenas[2];
+	if (!arenas[0].init() || !arenas[1].init())
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	//balance the core points between the threads, based on their estimated cost in both clouds
+#if defined(_OPENMP) && !defined(_DEBUG)
+	int threadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+	int threadCount = 1;
+#endif
+	std::vector<unsigned> costs, costs2;
+	std::vector<CorePointsScheduler::Chunk> chunks;
+	if (	!CorePointsScheduler::EstimateCosts(*octrees[0], octreeLevels[0], *corePoints.cloud, costs)
+		||	!CorePointsScheduler::EstimateCosts(*octrees[1], octreeLevels[1], *corePoints.cloud, costs2))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	for (size_t i = 0; i < costs.size(); ++i)
+	{
+		costs[i] += costs2[i];
+	}
+	costs2.clear();
+	if (!CorePointsScheduler::BuildChunks(costs, threadCount, chunks))
+	{
+		error = "Not enough memory";
+		return false;
+	}
+	costs.clear();
+	costs.shrink_to_fit();
+
+	unsigned pointCount = corePoints.size();
+	QString logMessage = QString("Extracting the neighborhoods of %1 core points in clouds %2 and %3").arg(pointCount).arg(m_clouds[0]->getName(), m_clouds[1]->getName());
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute dual-cloud features");
+		progressCb->setInfo(qPrintable(logMessage));
+		progressCb->start();
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	bool success = true;
+	bool cancelled = false;
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
+#endif
+#endif
+	for (int chunkIndex = 0; chunkIndex < static_cast<int>(chunks.size()); ++chunkIndex)
+	{
+		const CorePointsScheduler::Chunk& chunk = chunks[chunkIndex];
+		for (unsigned i = chunk.first; i < chunk.last; ++i)
+		{
+		if (!cancelled)
+		{
+			QString localErrorStr;
+			bool localSuccess = true;
+
+			Neighborhoods neighborhoods;
+			const CCVector3* P = corePoints.cloud->getPoint(i);
+			for (unsigned c = 0; c < 2; ++c)
+			{
+				ScratchArena& arena = arenas[c].local();
+				neighborhoods.arenas[c] = &arena;
+
+				CCCoreLib::DgmOctree::NearestNeighboursSearchStruct& nNSS = arena.nNSS;
+				arena.resetNeighborhood(*P, octreeLevels[c]);
+				octrees[c]->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+				octrees[c]->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+
+				//extract the neighbors (unsorted) and partition them by scale
+				unsigned kNN = octrees[c]->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, false);
+				if (!arena.bucketNeighborsByScale(kNN, m_sqRadii, false))
+				{
+					localErrorStr = "Not enough memory";
+					localSuccess = false;
+					break;
+				}
+			}
+
+			if (localSuccess && !pointFunction(i, neighborhoods, localErrorStr))
+			{
+				localSuccess = false;
+			}
+
+			if (!localSuccess)
+			{
+				cancelled = true;
+				success = false;
+				error = localErrorStr + " (core point #" + QString::number(i) + ")";
+			}
+
+			if (progressCb && !cancelled)
+			{
+				cancelled = !nProgress.oneStep();
+				if (cancelled)
+				{
+					//process cancelled by the user
+					error = "Process cancelled";
+					success = false;
+				}
+			}
+		}
+		} //for each point
+	} //for each chunk
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	return success;
+}
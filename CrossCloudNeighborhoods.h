@@ -0,0 +1,82 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeaturesInterface.h"
+#include "ScratchArena.h"
+
+//system
+#include <functional>
+#include <vector>
+
+class ccPointCloud;
+
+namespace masc
+{
+	//! Cross-cloud neighborhood engine
+	/** For each core point, the spherical neighborhoods are extracted in two clouds (at the same
+		scales) in a single parallel pass. The neighbors are partitioned by scale (see ScratchArena)
+		and the per-thread buffers are reused from one core point to the other.
+	**/
+	class CrossCloudNeighborhoods
+	{
+	public:
+
+		//! Neighborhoods of a core point in both clouds
+		struct Neighborhoods
+		{
+			//! Scratch arenas of the current thread (one per cloud)
+			ScratchArena* arenas[2] = { nullptr, nullptr };
+
+			//! Returns the number of neighbors of a given scale in a given cloud
+			inline unsigned count(unsigned cloudIndex, size_t scaleIndex) const { return arenas[cloudIndex]->neighborCountPerScale[scaleIndex]; }
+
+			//! Returns the neighbors in a given cloud
+			/** The neighbors of the scale j are the count(cloudIndex, j) first ones.
+			**/
+			inline const CCCoreLib::DgmOctree::NeighboursSet& neighbors(unsigned cloudIndex) const { return arenas[cloudIndex]->nNSS.pointsInNeighbourhood; }
+		};
+
+		//! Function called for each core point
+		/** Must be thread-safe. Should return false (and update the error) to stop the process.
+		**/
+		using PointFunction = std::function<bool(unsigned pointIndex, const Neighborhoods& neighborhoods, QString& error)>;
+
+		//! Default constructor
+		/** \param scales scales (diameters) of the neighborhoods
+		**/
+		CrossCloudNeighborhoods(ccPointCloud* cloud1, ccPointCloud* cloud2, const std::vector<double>& scales);
+
+		//! Returns the scales (increasing order)
+		inline const std::vector<double>& scales() const { return m_scales; }
+
+		//! Extracts the neighborhoods of all the core points and calls the given function for each of them
+		bool run(const CorePoints& corePoints, const PointFunction& pointFunction, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+	protected:
+
+		//! Clouds
+		ccPointCloud* m_clouds[2];
+		//! Scales (increasing order)
+		std::vector<double> m_scales;
+		//! Squared radii of the scales
+		std::vector<double> m_sqRadii;
+	};
+
+}; //namespace masc
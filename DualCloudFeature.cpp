@@ -17,6 +17,18 @@
 
 #include "DualCloudFeature.h"
 
+//Local
+#include "CrossCloudNeighborhoods.h"
+#include "PointFeature.h"
+
+//Qt
+#include <QMap>
+#include <QPair>
+
+//system
+#include <algorithm>
+#include <limits>
+
 using namespace masc;
 
 bool DualCloudFeature::prepare(	const CorePoints& corePoints,
@@ -24,14 +36,225 @@ bool DualCloudFeature::prepare(	const CorePoints& corePoints,
 								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
                                 SFCollector* generatedScalarFields/*=nullptr*/)
 {
-	//TODO
-	return false;
+	if (!cloud1 || !cloud2 || !corePoints.cloud)
+	{
+		//invalid input
+		assert(false);
+		error = "internal error (no input core points)";
+		return false;
+	}
+
+	if (!checkValidity(corePoints.role, error))
+	{
+		assert(false);
+		return false;
+	}
+
+	//retrieve the source fields
+	switch (type)
+	{
+	case IDIFF:
+	{
+		field1 = PointFeature::RetrieveField(PointFeature::Intensity, cloud1, error);
+		if (!field1)
+		{
+			error = QString("Cloud %1: %2").arg(cloud1Label, error);
+			return false;
+		}
+		field2 = PointFeature::RetrieveField(PointFeature::Intensity, cloud2, error);
+		if (!field2)
+		{
+			error = QString("Cloud %1: %2").arg(cloud2Label, error);
+			return false;
+		}
+	}
+	break;
+
+	default:
+		assert(false);
+		error = "invalid feature type";
+		return false;
+	}
+
+	//build the final SF name
+	QString resultSFName = ToString(type) + "_" + cloud1Label + "_" + cloud2Label + "@" + QString::number(scale);
+
+	//and the scalar field
+	assert(!sf);
+	sf1WasAlreadyExisting = CheckSFExistence(corePoints.cloud, resultSFName);
+	if (sf1WasAlreadyExisting)
+	{
+		sf = PrepareSF(corePoints.cloud, resultSFName, generatedScalarFields, SFCollector::ALWAYS_KEEP);
+		if (generatedScalarFields && generatedScalarFields->scalarFields.contains(sf)) // i.e. the SF is existing but was not present at the startup of the plugin
+			generatedScalarFields->setBehavior(sf, SFCollector::CAN_REMOVE);
+	}
+	else
+	{
+		sf = PrepareSF(corePoints.cloud, resultSFName, generatedScalarFields, SFCollector::CAN_REMOVE);
+	}
+	if (!sf)
+	{
+		error = QString("Failed to prepare scalar %1 @ scale %2").arg(resultSFName).arg(scale);
+		return false;
+	}
+	source.name = QString::fromStdString(sf->getName());
+
+	return true;
+}
+
+void DualCloudFeature::getRequiredAttributes(QStringList& sfNames, int& sfCount, bool& colors, bool& normals) const
+{
+	switch (type)
+	{
+	case IDIFF:
+		//the intensity of both clouds
+		PointFeature(PointFeature::Intensity).getRequiredAttributes(sfNames, sfCount, colors, normals);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+bool DualCloudFeature::finish(const CorePoints& corePoints, QString& error)
+{
+	if (!corePoints.cloud)
+	{
+		//invalid input
+		assert(false);
+		error = "internal error (no input core points)";
+		return false;
+	}
+
+	if (sf)
+	{
+		sf->computeMinAndMax();
+
+		//update display
+		int sfIndex = corePoints.cloud->getScalarFieldIndexByName(sf->getName());
+		corePoints.cloud->setCurrentDisplayedScalarField(sfIndex);
+	}
+
+	return true;
+}
+
+//! Returns the mean of a set of values
+static double Mean(const double* values, unsigned count)
+{
+	double sum = 0.0;
+	for (unsigned k = 0; k < count; ++k)
+	{
+		sum += values[k];
+	}
+	return sum / count;
+}
+
+bool DualCloudFeature::ComputeFeatures(	const CorePoints& corePoints,
+										const Feature::Set& features,
+										QString& error,
+										CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	//group the features by pair of clouds
+	typedef QPair<ccPointCloud*, ccPointCloud*> CloudPair;
+	QMap<CloudPair, std::vector<DualCloudFeature::Shared>> featuresPerCloudPair;
+	for (const Feature::Shared& feature : features)
+	{
+		if (feature->getType() != Feature::Type::DualCloudFeature || feature->sf1WasAlreadyExisting)
+		{
+			continue;
+		}
+		DualCloudFeature::Shared dualCloudFeature = qSharedPointerCast<DualCloudFeature>(feature);
+		if (!dualCloudFeature->sf || !dualCloudFeature->field1 || !dualCloudFeature->field2)
+		{
+			//the feature should have been prepared
+			assert(false);
+			error = "internal error (dual-cloud feature not prepared)";
+			return false;
+		}
+		featuresPerCloudPair[CloudPair(feature->cloud1, feature->cloud2)].push_back(dualCloudFeature);
+	}
+
+	for (QMap<CloudPair, std::vector<DualCloudFeature::Shared>>::const_iterator it = featuresPerCloudPair.constBegin(); it != featuresPerCloudPair.constEnd(); ++it)
+	{
+		const std::vector<DualCloudFeature::Shared>& pairFeatures = it.value();
+
+		std::vector<double> scales;
+		for (const DualCloudFeature::Shared& feature : pairFeatures)
+		{
+			scales.push_back(feature->scale);
+		}
+		CrossCloudNeighborhoods engine(it.key().first, it.key().second, scales);
+
+		//scale index of each feature
+		std::vector<size_t> scaleIndexes;
+		for (const DualCloudFeature::Shared& feature : pairFeatures)
+		{
+			scaleIndexes.push_back(std::lower_bound(engine.scales().begin(), engine.scales().end(), feature->scale) - engine.scales().begin());
+		}
+
+		auto computeValues = [&](unsigned pointIndex, const CrossCloudNeighborhoods::Neighborhoods& neighborhoods, QString& localError) -> bool
+		{
+			for (size_t f = 0; f < pairFeatures.size(); ++f)
+			{
+				const DualCloudFeature& feature = *pairFeatures[f];
+				size_t scaleIndex = scaleIndexes[f];
+
+				unsigned count1 = neighborhoods.count(0, scaleIndex);
+				unsigned count2 = neighborhoods.count(1, scaleIndex);
+				if (count1 == 0 || count2 == 0)
+				{
+					feature.sf->setValue(pointIndex, CCCoreLib::NAN_VALUE);
+					continue;
+				}
+
+				//gather the values of both neighborhoods (in contiguous buffers)
+				std::vector<double>& values1 = neighborhoods.arenas[0]->gatheredValues;
+				std::vector<double>& values2 = neighborhoods.arenas[1]->gatheredValues;
+				try
+				{
+					values1.resize(count1);
+					values2.resize(count2);
+				}
+				catch (const std::bad_alloc&)
+				{
+					localError = "Not enough memory";
+					return false;
+				}
+				feature.field1->gather(neighborhoods.neighbors(0), count1, values1.data());
+				feature.field2->gather(neighborhoods.neighbors(1), count2, values2.data());
+
+				double value = std::numeric_limits<double>::quiet_NaN();
+				switch (feature.type)
+				{
+				case IDIFF:
+					value = Mean(values1.data(), count1) - Mean(values2.data(), count2);
+					break;
+				default:
+					assert(false);
+					localError = "unhandled dual-cloud feature " + feature.toString();
+					return false;
+				}
+
+				feature.sf->setValue(pointIndex, static_cast<ScalarType>(value));
+			}
+
+			return true;
+		};
+
+		if (!engine.run(corePoints, computeValues, error, progressCb))
+		{
+			error = "Failed to compute the dual-cloud features: " + error;
+			return false;
+		}
+	}
+
+	return true;
 }
 
 QString DualCloudFeature::toString() const
 {
-	//use the default keyword + "_SC" + the scale
-	return ToString(type) + "_SC" + QString::number(scale);
+	//use the default keyword + "_SC" + the scale + the clouds
+	return ToString(type) + "_SC" + QString::number(scale) + "_" + cloud1Label + "_" + cloud2Label;
 }
 
 bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) const
@@ -44,7 +267,7 @@ bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) cons
 	unsigned char cloudCount = (cloud1 ? (cloud2 ? 2 : 1) : 0);
 	if (cloudCount < 2)
 	{
-		error = "at least two clouds are required to compute context-based features";
+		error = "at least two clouds are required to compute dual-cloud features";
 		return false;
 	}
 
@@ -54,5 +277,11 @@ bool DualCloudFeature::checkValidity(QString corePointRole, QString &error) cons
 		return false;
 	}
 
+	if (!scaled())
+	{
+		error = "dual-cloud features require a scale (SC0 is not supported)";
+		return false;
+	}
+
 	return true;
 }
@@ -19,18 +19,24 @@
 
 //Local
 #include "FeaturesInterface.h"
+#include "ScalarFieldWrappers.h"
 
 namespace masc
 {
 	//! Dual-cloud feature
+	/** The feature is computed on the neighborhoods of the core points in both clouds, at the same scale
+		(see CrossCloudNeighborhoods).
+	**/
 	struct DualCloudFeature : public Feature
 	{
 	public: //DualCloudFeatureType
 
+		typedef QSharedPointer<DualCloudFeature> Shared;
+
 		enum DualCloudFeatureType
 		{
 			Invalid = 0
-			, IDIFF
+			, IDIFF	/*!< Difference of the mean intensities (cloud #1 - cloud #2) */
 		};
 
 		static QString ToString(DualCloudFeatureType type)
@@ -62,6 +68,7 @@ namespace masc
 		//! Default constructor
 		DualCloudFeature(DualCloudFeatureType p_type)
 			: type(p_type)
+			, sf(nullptr)
 		{}
 
 		//inherited from Feature
@@ -69,12 +76,27 @@ namespace masc
 		virtual Feature::Shared clone() const override { return Feature::Shared(new DualCloudFeature(*this)); }
 		virtual bool prepare(const CorePoints& corePoints, QString& error,
                              CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr) override;
+		virtual bool finish(const CorePoints& corePoints, QString& error) override;
 		virtual bool checkValidity(QString corePointRole, QString &error) const override;
 		virtual QString toString() const override;
+		virtual void getRequiredAttributes(QStringList& sfNames, int& sfCount, bool& colors, bool& normals) const override;
+
+		//! Computes all the (prepared) dual-cloud features of a set
+		/** The features sharing the same pair of clouds are computed in a single pass.
+		**/
+		static bool ComputeFeatures(const CorePoints& corePoints, const Feature::Set& features, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+	public: //members
 
 		//! Dual-cloud feature type
 		/** \warning different from the feature type
 		**/
 		DualCloudFeatureType type;
+
+		//! Source fields (on each cloud)
+		IScalarFieldWrapper::Shared field1, field2;
+
+		//! Feature values
+		CCCoreLib::ScalarField* sf;
 	};
 }
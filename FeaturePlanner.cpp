@@ -0,0 +1,761 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FeaturePlanner.h"
+
+//qCC_db
+#include <ccOctree.h>
+
+//CCLib
+#include <ReferenceCloud.h>
+
+//Qt
+#include <QSet>
+
+//system
+#include <algorithm>
+#include <cmath>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+constexpr unsigned NearestNeighborJoin::InvalidIndex;
+
+bool NearestNeighborJoin::compute(const CorePoints& corePoints, ccPointCloud& cloud2, QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!corePoints.cloud)
+	{
+		//invalid input parameters
+		assert(false);
+		error = "invalid input parameters";
+		return false;
+	}
+
+	unsigned pointCount = corePoints.size();
+	try
+	{
+		nearestIndexes.resize(pointCount, InvalidIndex);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	ccOctree::Shared octree = cloud2.getOctree();
+	if (!octree)
+	{
+		octree = cloud2.computeOctree(progressCb);
+		if (!octree)
+		{
+			error = "failed to compute octree on cloud " + cloud2.getName();
+			return false;
+		}
+	}
+
+	//now extract the neighborhoods
+	unsigned char octreeLevel = octree->findBestLevelForAGivenPopulationPerCell(3);
+	ccLog::Print(QString("[Initial octree level] level = %1").arg(octreeLevel));
+
+	QString logMessage = QString("Extracting %1 core points nearest neighbors in cloud %2").arg(pointCount).arg(cloud2.getName());
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Compute math operation");
+		progressCb->setInfo(qPrintable(logMessage));
+	}
+	ccLog::Print(logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	int threadCount = 1;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+	threadCount = std::max(1, omp_get_max_threads() - 2);
+#endif
+#endif
+	error.clear();
+	bool cancelled = false;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(threadCount)
+#endif
+#endif
+	{
+		//the octree level is adapted by each thread, based on its own neighborhoods
+		unsigned char threadOctreeLevel = octreeLevel;
+		double meanNeighborhoodSize = 0;
+		int tenth = std::max(1, static_cast<int>(pointCount) / (10 * threadCount));
+		int processedCount = 0;
+
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp for
+#endif
+#endif
+		for (int i = 0; i < static_cast<int>(pointCount); ++i)
+		{
+		if (!cancelled)
+		{
+			const CCVector3* P = corePoints.cloud->getPoint(i);
+			CCCoreLib::ReferenceCloud Yk(&cloud2);
+			double maxSquareDist = 0;
+
+			int neighborhoodSize = 0;
+			if (octree->findPointNeighbourhood(P, &Yk, 1, threadOctreeLevel, maxSquareDist, 0.0, &neighborhoodSize) >= 1)
+			{
+				nearestIndexes[i] = Yk.getPointGlobalIndex(0);
+			}
+
+			++processedCount;
+			if ((processedCount % tenth) == 0)
+			{
+				double density = meanNeighborhoodSize / tenth;
+				if (density < 1.1)
+				{
+					if (threadOctreeLevel + 1 < CCCoreLib::DgmOctree::MAX_OCTREE_LEVEL)
+						++threadOctreeLevel;
+				}
+				else while (density > 2.9)
+				{
+					if (threadOctreeLevel <= 5)
+						break;
+					--threadOctreeLevel;
+					density /= 2.0;
+				}
+				meanNeighborhoodSize = 0;
+			}
+			else
+			{
+				meanNeighborhoodSize += neighborhoodSize;
+			}
+
+			if (progressCb)
+			{
+				if (!nProgress.oneStep())
+				{
+					//process cancelled by the user
+					cancelled = true;
+				}
+			}
+		}
+		}
+	}
+
+	if (cancelled)
+	{
+		error = "[Point feature] Process cancelled";
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	if (!error.isEmpty())
+	{
+		nearestIndexes.clear();
+		return false;
+	}
+
+	cloud = &cloud2;
+	return true;
+}
+
+QString FeaturePlan::ToString(NodeType type)
+{
+	switch (type)
+	{
+	case NodeType::Extraction:
+		return "Extraction";
+	case NodeType::FieldGather:
+		return "FieldGather";
+	case NodeType::Stat:
+		return "Stat";
+	case NodeType::LocalGeometry:
+		return "LocalGeometry";
+	case NodeType::NeighborhoodValue:
+		return "NeighborhoodValue";
+	case NodeType::ContextValue:
+		return "ContextValue";
+	case NodeType::NearestNeighborJoin:
+		return "NearestNeighborJoin";
+	case NodeType::MathOp:
+		return "MathOp";
+	case NodeType::DualCloudValue:
+		return "DualCloudValue";
+	default:
+		assert(false);
+		break;
+	}
+	return "Invalid";
+}
+
+size_t FeaturePlan::addNode(NodeType type,
+							const QString& key,
+							ccPointCloud* cloud,
+							double scale,
+							const std::vector<size_t>& inputs,
+							const Feature::Shared& consumer/*=Feature::Shared()*/,
+							Slot slot/*=Slot::Result*/)
+{
+	size_t index = 0;
+	if (m_nodeIndexes.contains(key))
+	{
+		//identical computation
+		index = m_nodeIndexes.value(key);
+		assert(m_nodes[index].type == type);
+	}
+	else
+	{
+		Node node;
+		node.type = type;
+		node.key = key;
+		node.cloud = cloud;
+		node.scale = scale;
+		node.inputs = inputs;
+		for (size_t inputIndex : inputs)
+		{
+			node.stage = std::max(node.stage, m_nodes[inputIndex].stage + 1);
+		}
+
+		index = m_nodes.size();
+		m_nodes.push_back(node);
+		m_nodeIndexes.insert(key, index);
+	}
+
+	Node& node = m_nodes[index];
+	++node.requestCount;
+	if (consumer)
+	{
+		node.consumers.push_back({ consumer, slot });
+	}
+
+	return index;
+}
+
+size_t FeaturePlan::extractionNode(ccPointCloud* cloud, const QString& cloudLabel, double scale)
+{
+	//a single extraction per cloud (at the largest scale)
+	size_t index = addNode(NodeType::Extraction, QString("NEIGHBORS(%1)").arg(cloudLabel), cloud, scale, {});
+	m_nodes[index].scale = std::max(m_nodes[index].scale, scale);
+	return index;
+}
+
+void FeaturePlan::addPointFeature(const CorePoints& corePoints, const PointFeature::Shared& feature)
+{
+	QString fieldKey = PointFeature::ToString(feature->type);
+	if (feature->type == PointFeature::SF)
+	{
+		fieldKey += QString::number(feature->sourceSFIndex);
+	}
+	bool withMathOp = (feature->cloud2 && feature->op != Feature::NO_OPERATION);
+
+	if (feature->scaled())
+	{
+		QString statName = Feature::StatToString(feature->stat);
+		QString scaleStr = "@" + QString::number(feature->scale);
+
+		size_t extraction1 = extractionNode(feature->cloud1, feature->cloud1Label, feature->scale);
+		size_t gather1 = addNode(NodeType::FieldGather, QString("GATHER(%1:%2%3)").arg(feature->cloud1Label, fieldKey, scaleStr), feature->cloud1, feature->scale, { extraction1 });
+		size_t stat1 = addNode(NodeType::Stat, QString("%1(%2:%3%4)").arg(statName, feature->cloud1Label, fieldKey, scaleStr), feature->cloud1, feature->scale, { gather1 }, feature, Slot::Value1);
+		m_nodes[stat1].stat = feature->stat;
+
+		if (withMathOp)
+		{
+			size_t extraction2 = extractionNode(feature->cloud2, feature->cloud2Label, feature->scale);
+			size_t gather2 = addNode(NodeType::FieldGather, QString("GATHER(%1:%2%3)").arg(feature->cloud2Label, fieldKey, scaleStr), feature->cloud2, feature->scale, { extraction2 });
+			size_t stat2 = addNode(NodeType::Stat, QString("%1(%2:%3%4)").arg(statName, feature->cloud2Label, fieldKey, scaleStr), feature->cloud2, feature->scale, { gather2 }, feature, Slot::Value2);
+			m_nodes[stat2].stat = feature->stat;
+
+			addNode(NodeType::MathOp, QString("%1(%2, %3)").arg(Feature::OpToString(feature->op), m_nodes[stat1].key, m_nodes[stat2].key), corePoints.cloud, feature->scale, { stat1, stat2 }, feature, Slot::Result);
+		}
+	}
+	else
+	{
+		//scale-less features are read on the core points (and on their nearest neighbor in the second cloud, if any)
+		if (withMathOp)
+		{
+			size_t gather1 = addNode(NodeType::FieldGather, QString("GATHER(%1:%2)").arg(feature->cloud1Label, fieldKey), feature->cloud1, feature->scale, {}, feature, Slot::Value1);
+			size_t join = addNode(NodeType::NearestNeighborJoin, QString("NN(%1->%2)").arg(corePoints.role, feature->cloud2Label), feature->cloud2, feature->scale, {}, feature, Slot::Value2);
+			size_t gather2 = addNode(NodeType::FieldGather, QString("GATHER(%1:%2@NN)").arg(feature->cloud2Label, fieldKey), feature->cloud2, feature->scale, { join });
+			addNode(NodeType::MathOp, QString("%1(%2, %3)").arg(Feature::OpToString(feature->op), m_nodes[gather1].key, m_nodes[gather2].key), corePoints.cloud, feature->scale, { gather1, gather2 }, feature, Slot::Result);
+		}
+		else
+		{
+			addNode(NodeType::FieldGather, QString("GATHER(%1:%2)").arg(feature->cloud1Label, fieldKey), feature->cloud1, feature->scale, {}, feature, Slot::Result);
+		}
+	}
+}
+
+void FeaturePlan::addNeighborhoodFeature(const NeighborhoodFeature::Shared& feature)
+{
+	//features relying on the local geometry
+	bool withGeometry = false;
+	switch (feature->type)
+	{
+	case NeighborhoodFeature::PCA1:
+	case NeighborhoodFeature::PCA2:
+	case NeighborhoodFeature::PCA3:
+	case NeighborhoodFeature::SPHER:
+	case NeighborhoodFeature::LINEA:
+	case NeighborhoodFeature::PLANA:
+	case NeighborhoodFeature::VERT:
+	case NeighborhoodFeature::Dip:
+	case NeighborhoodFeature::DipDir:
+	case NeighborhoodFeature::ROUGH:
+	case NeighborhoodFeature::FOM:
+	case NeighborhoodFeature::ANISO:
+		withGeometry = true;
+		break;
+	default:
+		break;
+	}
+
+	QString typeName = NeighborhoodFeature::ToString(feature->type);
+	QString scaleStr = "@" + QString::number(feature->scale);
+
+	size_t values[2] = { 0, 0 };
+	unsigned cloudCount = (feature->cloud2 && feature->op != Feature::NO_OPERATION ? 2 : 1);
+	for (unsigned c = 0; c < cloudCount; ++c)
+	{
+		ccPointCloud* cloud = (c == 0 ? feature->cloud1 : feature->cloud2);
+		const QString& cloudLabel = (c == 0 ? feature->cloud1Label : feature->cloud2Label);
+
+		size_t input = extractionNode(cloud, cloudLabel, feature->scale);
+		if (withGeometry)
+		{
+			input = addNode(NodeType::LocalGeometry, QString("GEOM(%1%2)").arg(cloudLabel, scaleStr), cloud, feature->scale, { input });
+		}
+		values[c] = addNode(NodeType::NeighborhoodValue, QString("%1(%2%3)").arg(typeName, cloudLabel, scaleStr), cloud, feature->scale, { input }, feature, c == 0 ? Slot::Value1 : Slot::Value2);
+	}
+
+	if (cloudCount == 2)
+	{
+		addNode(NodeType::MathOp, QString("%1(%2, %3)").arg(Feature::OpToString(feature->op), m_nodes[values[0]].key, m_nodes[values[1]].key), feature->cloud1, feature->scale, { values[0], values[1] }, feature, Slot::Result);
+	}
+}
+
+void FeaturePlan::addContextBasedFeature(const ContextBasedFeature::Shared& feature)
+{
+	QString typeName = ContextBasedFeature::ToString(feature->type);
+	if (feature->scaled())
+	{
+		size_t extraction = extractionNode(feature->cloud1, feature->cloud1Label, feature->scale);
+		addNode(NodeType::ContextValue, QString("%1(%2:%3@%4)").arg(typeName, feature->cloud1Label).arg(feature->ctxClassLabel).arg(feature->scale), feature->cloud1, feature->scale, { extraction }, feature, Slot::Result);
+	}
+	else
+	{
+		addNode(NodeType::ContextValue, QString("%1%2(%3:%4)").arg(typeName).arg(feature->kNN).arg(feature->cloud1Label).arg(feature->ctxClassLabel), feature->cloud1, feature->scale, {}, feature, Slot::Result);
+	}
+}
+
+void FeaturePlan::addDualCloudFeature(const DualCloudFeature::Shared& feature)
+{
+	//a single (joint) extraction per pair of clouds (at the largest scale)
+	size_t extraction = addNode(NodeType::Extraction, QString("NEIGHBORS(%1+%2)").arg(feature->cloud1Label, feature->cloud2Label), feature->cloud1, feature->scale, {});
+	m_nodes[extraction].scale = std::max(m_nodes[extraction].scale, feature->scale);
+
+	addNode(NodeType::DualCloudValue, QString("%1(%2,%3@%4)").arg(DualCloudFeature::ToString(feature->type), feature->cloud1Label, feature->cloud2Label).arg(feature->scale), feature->cloud1, feature->scale, { extraction }, feature, Slot::Result);
+}
+
+bool FeaturePlan::build(const CorePoints& corePoints, const Feature::Set& features, QString& error)
+{
+	m_nodes.clear();
+	m_nodeIndexes.clear();
+
+	try
+	{
+		for (const Feature::Shared& feature : features)
+		{
+			if (!feature)
+			{
+				assert(false);
+				error = "invalid feature";
+				return false;
+			}
+
+			switch (feature->getType())
+			{
+			case Feature::Type::PointFeature:
+				addPointFeature(corePoints, qSharedPointerCast<PointFeature>(feature));
+				break;
+			case Feature::Type::NeighborhoodFeature:
+				addNeighborhoodFeature(qSharedPointerCast<NeighborhoodFeature>(feature));
+				break;
+			case Feature::Type::ContextBasedFeature:
+				addContextBasedFeature(qSharedPointerCast<ContextBasedFeature>(feature));
+				break;
+			case Feature::Type::DualCloudFeature:
+				addDualCloudFeature(qSharedPointerCast<DualCloudFeature>(feature));
+				break;
+			default:
+				//not handled by the planner
+				break;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	return true;
+}
+
+size_t FeaturePlan::requestCount() const
+{
+	size_t count = 0;
+	for (const Node& node : m_nodes)
+	{
+		count += node.requestCount;
+	}
+	return count;
+}
+
+QString FeaturePlan::summary() const
+{
+	unsigned stageCount = 0;
+	for (const Node& node : m_nodes)
+	{
+		stageCount = std::max(stageCount, node.stage + 1);
+	}
+
+	size_t requests = requestCount();
+	return QString("Feature plan: %1 requested computations, %2 unique nodes (%3 deduplicated), %4 stages")
+		.arg(requests)
+		.arg(m_nodes.size())
+		.arg(requests - m_nodes.size())
+		.arg(stageCount);
+}
+
+QString FeaturePlan::toString() const
+{
+	QString str = summary();
+
+	//sort the nodes by stage (stable, to keep the creation order inside each stage)
+	std::vector<size_t> order(m_nodes.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return m_nodes[a].stage < m_nodes[b].stage; });
+
+	unsigned currentStage = std::numeric_limits<unsigned>::max();
+	for (size_t index : order)
+	{
+		const Node& node = m_nodes[index];
+		if (node.stage != currentStage)
+		{
+			currentStage = node.stage;
+			str += QString("\nStage %1").arg(currentStage);
+		}
+
+		str += QString("\n\t[%1] %2 %3").arg(index).arg(ToString(node.type), node.key);
+		if (!node.inputs.empty())
+		{
+			QStringList inputs;
+			for (size_t inputIndex : node.inputs)
+			{
+				inputs << QString::number(inputIndex);
+			}
+			str += " <- [" + inputs.join(", ") + "]";
+		}
+		if (node.requestCount > 1)
+		{
+			str += QString(" (requested %1 times)").arg(node.requestCount);
+		}
+		for (const Consumer& consumer : node.consumers)
+		{
+			if (consumer.slot == Slot::Result)
+			{
+				str += " => " + consumer.feature->toString();
+			}
+		}
+	}
+
+	return str;
+}
+
+bool FeaturePlan::attachJoins(QString& error)
+{
+	for (const Node& node : m_nodes)
+	{
+		if (node.type != NodeType::NearestNeighborJoin)
+		{
+			continue;
+		}
+
+		if (!node.cloud)
+		{
+			assert(false);
+			error = "internal error (no cloud associated to the nearest neighbor join)";
+			return false;
+		}
+
+		//the join is only computed once, on first use (the features results may already exist)
+		NearestNeighborJoin::Shared join(new NearestNeighborJoin);
+		for (const Consumer& consumer : node.consumers)
+		{
+			if (consumer.feature->getType() == Feature::Type::PointFeature)
+			{
+				qSharedPointerCast<PointFeature>(consumer.feature)->nearestNeighborJoin = join;
+			}
+		}
+	}
+
+	return true;
+}
+
+//! Checks that the two operands of a MATH feature computed by a single node are really the same values
+static bool SameOperandFields(const FeaturePlan::Node& node, const Feature::Shared& feature)
+{
+	if (feature->cloud1 != feature->cloud2 || feature->cloud1 != node.cloud)
+	{
+		return false;
+	}
+	if (node.type == FeaturePlan::NodeType::Stat)
+	{
+		//the two fields must be the same field of this cloud
+		const PointFeature* pointFeature = static_cast<const PointFeature*>(feature.data());
+		return pointFeature->field1 && pointFeature->field2 && pointFeature->field1->getName() == pointFeature->field2->getName();
+	}
+	return true;
+}
+
+bool FeaturePlan::buildTasks(std::vector<CloudTasks>& cloudTasks, QString& error) const
+{
+	cloudTasks.clear();
+
+	//tasks per cloud and per scale
+	QMap<ccPointCloud*, QMap<double, ScaleTasks> > tasks;
+	//gather task index per gather node
+	QMap<size_t, size_t> gatherTaskIndexes;
+	QMap<ccPointCloud*, bool> sortNeighbors;
+	QMap<ccPointCloud*, size_t> valueCounts;
+
+	try
+	{
+		for (size_t nodeIndex = 0; nodeIndex < m_nodes.size(); ++nodeIndex)
+		{
+			const Node& node = m_nodes[nodeIndex];
+			if (!std::isfinite(node.scale))
+			{
+				//scale-less computations are performed when the features are prepared
+				continue;
+			}
+
+			//collect the scalar fields to fill (once each)
+			std::vector<Output> outputs;
+			Feature::Shared firstConsumer;
+			Slot firstSlot = Slot::Result;
+			for (const Consumer& consumer : node.consumers)
+			{
+				const Feature::Shared& feature = consumer.feature;
+				if (feature->sf1WasAlreadyExisting)
+				{
+					//nothing to compute if the scalar field was already there
+					continue;
+				}
+
+				Output output;
+				output.slot = consumer.slot;
+				switch (node.type)
+				{
+				case NodeType::Stat:
+					output.sf = static_cast<PointFeature*>(feature.data())->statSF1;
+					break;
+
+				case NodeType::NeighborhoodValue:
+					output.sf = static_cast<NeighborhoodFeature*>(feature.data())->sf1;
+					break;
+
+				case NodeType::ContextValue:
+					output.sf = static_cast<ContextBasedFeature*>(feature.data())->sf;
+					break;
+
+				default:
+					break;
+				}
+
+				if (!output.sf)
+				{
+					continue;
+				}
+				if (output.slot != Slot::Result)
+				{
+					//both operands of a MATH feature are combined in its scalar field
+					output.op = (feature->cloud2 ? feature->op : Feature::NO_OPERATION);
+				}
+				if (!firstConsumer)
+				{
+					firstConsumer = feature;
+					firstSlot = consumer.slot;
+				}
+				std::vector<Output>::iterator existing = std::find_if(outputs.begin(), outputs.end(), [&](const Output& o) { return o.sf == output.sf; });
+				if (existing == outputs.end())
+				{
+					outputs.push_back(output);
+				}
+				else if (existing->slot != output.slot && output.op != Feature::NO_OPERATION)
+				{
+					//both operands of the MATH feature are given by this node (same field on the same cloud):
+					//the operation is directly applied instead of storing the first operand as a pending value
+					if (!SameOperandFields(node, feature))
+					{
+						assert(false);
+						error = "internal error (distinct operands merged in a single computation)";
+						return false;
+					}
+					existing->slot = Slot::Result;
+					existing->sameOperands = true;
+				}
+				if (feature->requiresSortedNeighbors())
+				{
+					sortNeighbors[node.cloud] = true;
+				}
+			}
+
+			if (outputs.empty())
+			{
+				//nothing to compute
+				continue;
+			}
+
+			ScaleTasks& scaleTasks = tasks[node.cloud][node.scale];
+			++valueCounts[node.cloud];
+
+			switch (node.type)
+			{
+			case NodeType::Stat:
+			{
+				assert(node.inputs.size() == 1);
+				size_t gatherNodeIndex = node.inputs.front();
+				if (!gatherTaskIndexes.contains(gatherNodeIndex))
+				{
+					//the field is gathered only once
+					//each operand is resolved independently (the clouds of the two operands may be the same)
+					const PointFeature* pointFeature = static_cast<const PointFeature*>(firstConsumer.data());
+					GatherTask gatherTask;
+					gatherTask.field = (firstSlot == Slot::Value2 ? pointFeature->field2 : pointFeature->field1);
+					if (!gatherTask.field)
+					{
+						assert(false);
+						error = "internal error (field not prepared)";
+						return false;
+					}
+					gatherTaskIndexes.insert(gatherNodeIndex, scaleTasks.gathers.size());
+					scaleTasks.gathers.push_back(gatherTask);
+				}
+
+				StatTask statTask;
+				statTask.stat = node.stat;
+				statTask.outputs = outputs;
+				scaleTasks.gathers[gatherTaskIndexes.value(gatherNodeIndex)].stats.push_back(statTask);
+			}
+			break;
+
+			case NodeType::NeighborhoodValue:
+			{
+				NeighborhoodTask task;
+				task.feature = qSharedPointerCast<NeighborhoodFeature>(firstConsumer);
+				task.outputs = outputs;
+				scaleTasks.neighborhoodValues.push_back(task);
+			}
+			break;
+
+			case NodeType::ContextValue:
+			{
+				ContextTask task;
+				task.feature = qSharedPointerCast<ContextBasedFeature>(firstConsumer);
+				task.outputs = outputs;
+				scaleTasks.contextValues.push_back(task);
+			}
+			break;
+
+			default:
+				assert(false);
+				break;
+			}
+		}
+
+		//convert to the final structure
+		for (QMap<ccPointCloud*, QMap<double, ScaleTasks> >::const_iterator it = tasks.constBegin(); it != tasks.constEnd(); ++it)
+		{
+			CloudTasks cloudTask;
+			cloudTask.cloud = it.key();
+			cloudTask.sortNeighbors = sortNeighbors.value(it.key(), false);
+			cloudTask.valueCount = valueCounts.value(it.key(), 0);
+			for (QMap<double, ScaleTasks>::const_iterator itScale = it.value().constBegin(); itScale != it.value().constEnd(); ++itScale)
+			{
+				//QMap keys are sorted (increasing scales)
+				cloudTask.scales.push_back(itScale.key());
+				cloudTask.tasksPerScale.push_back(itScale.value());
+			}
+			cloudTasks.push_back(cloudTask);
+		}
+
+		//the first computed operand of each MATH feature is stored, the second one is combined with it
+		QSet<CCCoreLib::ScalarField*> pendingSFs;
+		auto assignOutputs = [&](std::vector<Output>& outputs)
+		{
+			for (Output& output : outputs)
+			{
+				if (output.op == Feature::NO_OPERATION || output.sameOperands)
+				{
+					continue;
+				}
+				output.combine = pendingSFs.contains(output.sf);
+				if (!output.combine)
+				{
+					pendingSFs.insert(output.sf);
+				}
+			}
+		};
+		//same order as the execution (cloud by cloud, from the largest to the smallest scale)
+		for (CloudTasks& cloudTask : cloudTasks)
+		{
+			for (size_t scaleIndex = 0; scaleIndex < cloudTask.tasksPerScale.size(); ++scaleIndex)
+			{
+				ScaleTasks& scaleTasks = cloudTask.tasksPerScale[cloudTask.tasksPerScale.size() - 1 - scaleIndex];
+				for (GatherTask& gatherTask : scaleTasks.gathers)
+				{
+					for (StatTask& statTask : gatherTask.stats)
+					{
+						assignOutputs(statTask.outputs);
+					}
+				}
+				for (NeighborhoodTask& task : scaleTasks.neighborhoodValues)
+				{
+					assignOutputs(task.outputs);
+				}
+				for (ContextTask& task : scaleTasks.contextValues)
+				{
+					assignOutputs(task.outputs);
+				}
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	return true;
+}
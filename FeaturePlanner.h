@@ -0,0 +1,282 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "PointFeature.h"
+#include "NeighborhoodFeature.h"
+#include "ContextBasedFeature.h"
+#include "DualCloudFeature.h"
+
+//Qt
+#include <QMap>
+
+//system
+#include <limits>
+#include <vector>
+
+namespace masc
+{
+	//! Nearest neighbor of each core point in another cloud
+	/** Shared by all the scale-less (SC0) MATH features involving the same cloud.
+	**/
+	struct NearestNeighborJoin
+	{
+		typedef QSharedPointer<NearestNeighborJoin> Shared;
+
+		//! Invalid index (no neighbor found)
+		static constexpr unsigned InvalidIndex = std::numeric_limits<unsigned>::max();
+
+		//! Returns whether the join has already been computed
+		inline bool isComputed() const { return cloud != nullptr; }
+
+		//! Computes the nearest neighbor of each core point in the given cloud
+		bool compute(const CorePoints& corePoints, ccPointCloud& cloud, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Cloud in which the neighbors have been searched
+		ccPointCloud* cloud = nullptr;
+		//! Index of the nearest neighbor of each core point (or InvalidIndex)
+		std::vector<unsigned> nearestIndexes;
+	};
+
+	//! Feature computation plan
+	/** The features are decomposed in a DAG of primitive computations (neighborhood extraction,
+		field gathering, statistical measure, local geometry, neighborhood value, nearest neighbor
+		join and math operation). Identical nodes requested by several features are merged, so that
+		they are only computed once.
+	**/
+	class FeaturePlan
+	{
+	public: //nodes
+
+		//! Primitive computation type
+		enum class NodeType
+		{
+			Extraction,			/*!< Spherical neighborhood extraction (at the largest scale of a cloud) */
+			FieldGather,		/*!< Gathering of a field values (on the neighbors, or on the core points for SC0 features) */
+			Stat,				/*!< Statistical measure on a gathered field */
+			LocalGeometry,		/*!< Local geometry (covariance matrix and eigen decomposition) */
+			NeighborhoodValue,	/*!< Neighborhood feature value */
+			ContextValue,		/*!< Context-based feature value */
+			NearestNeighborJoin,/*!< Nearest neighbor of each core point in another cloud */
+			MathOp,				/*!< Math operation between two values */
+			DualCloudValue		/*!< Dual-cloud feature value (on the neighborhoods extracted in both clouds at once) */
+		};
+
+		//! Returns the node type name
+		static QString ToString(NodeType type);
+
+		//! Feature value fed by a node
+		enum class Slot
+		{
+			Value1,	/*!< Value computed on the first cloud */
+			Value2,	/*!< Value computed on the second cloud */
+			Result	/*!< Final feature value */
+		};
+
+		//! Feature consuming the output of a node
+		struct Consumer
+		{
+			Feature::Shared feature;
+			Slot slot;
+		};
+
+		//! Primitive computation
+		struct Node
+		{
+			NodeType type = NodeType::Extraction;
+			//! Unique key (identical computations share the same key)
+			QString key;
+			//! Input nodes
+			std::vector<size_t> inputs;
+			//! Cloud on which the computation is performed
+			ccPointCloud* cloud = nullptr;
+			//! Scale (NaN for scale-less computations)
+			double scale = std::numeric_limits<double>::quiet_NaN();
+			//! Stat. measure (Stat nodes only)
+			Feature::Stat stat = Feature::NO_STAT;
+			//! Number of times this computation has been requested
+			unsigned requestCount = 0;
+			//! Stage (longest path from the sources)
+			unsigned stage = 0;
+			//! Features consuming the result
+			std::vector<Consumer> consumers;
+		};
+
+	public: //execution tasks
+
+		//! Scalar field to fill with a computed value
+		/** For MATH features, the two operands are combined as soon as the second one is computed:
+			the first operand is stored in the result scalar field (pending value) and is then
+			replaced by the result of the operation.
+		**/
+		struct Output
+		{
+			CCCoreLib::ScalarField* sf = nullptr;
+			//! Feature value fed by the output
+			Slot slot = Slot::Result;
+			//! Math operation (MATH features only)
+			Feature::Operation op = Feature::NO_OPERATION;
+			//! Whether the value should be combined with the pending operand (= second operand)
+			bool combine = false;
+			//! Whether the value is both operands (same field on the same cloud, see FeaturePlan::buildTasks)
+			bool sameOperands = false;
+
+			//! Writes the value of a given core point
+			inline void write(unsigned pointIndex, ScalarType value) const
+			{
+				if (sameOperands)
+				{
+					sf->setValue(pointIndex, Feature::PerformMathOp(value, value, op));
+				}
+				else if (!combine)
+				{
+					sf->setValue(pointIndex, value);
+				}
+				else
+				{
+					ScalarType pending = sf->getValue(pointIndex);
+					sf->setValue(pointIndex, slot == Slot::Value2 ? Feature::PerformMathOp(pending, value, op) : Feature::PerformMathOp(value, pending, op));
+				}
+			}
+
+			//! Invalidates the result of a given core point if the second operand can't be computed
+			inline void invalidate(unsigned pointIndex) const
+			{
+				if (combine)
+				{
+					sf->setValue(pointIndex, CCCoreLib::NAN_VALUE);
+				}
+			}
+		};
+
+		//! Statistical measure to compute on a gathered field
+		struct StatTask
+		{
+			Feature::Stat stat = Feature::NO_STAT;
+			std::vector<Output> outputs;
+		};
+
+		//! Field to gather on the neighbors (and the stat. measures to compute on the gathered values)
+		struct GatherTask
+		{
+			IScalarFieldWrapper::Shared field;
+			std::vector<StatTask> stats;
+		};
+
+		//! Neighborhood feature value to compute
+		struct NeighborhoodTask
+		{
+			NeighborhoodFeature::Shared feature;
+			std::vector<Output> outputs;
+		};
+
+		//! Context-based feature value to compute
+		struct ContextTask
+		{
+			ContextBasedFeature::Shared feature;
+			std::vector<Output> outputs;
+		};
+
+		//! Tasks to perform at a given scale
+		struct ScaleTasks
+		{
+			std::vector<GatherTask> gathers;
+			std::vector<NeighborhoodTask> neighborhoodValues;
+			std::vector<ContextTask> contextValues;
+		};
+
+		//! Tasks to perform on a given cloud
+		struct CloudTasks
+		{
+			ccPointCloud* cloud = nullptr;
+			//! Scales (increasing order)
+			std::vector<double> scales;
+			//! Tasks per scale (same order as the scales)
+			std::vector<ScaleTasks> tasksPerScale;
+			//! Whether at least one feature requires the neighbors to be sorted
+			bool sortNeighbors = false;
+			//! Number of computed values (per core point)
+			size_t valueCount = 0;
+		};
+
+	public: //methods
+
+		//! Builds the plan from a set of (valid) features
+		/** The features don't need to be prepared.
+		**/
+		bool build(const CorePoints& corePoints, const Feature::Set& features, QString& error);
+
+		//! Returns the nodes
+		inline const std::vector<Node>& nodes() const { return m_nodes; }
+
+		//! Returns the total number of requested computations (before deduplication)
+		size_t requestCount() const;
+
+		//! Returns a one-line summary of the plan
+		QString summary() const;
+
+		//! Returns the detailed plan (one line per node, sorted by stage)
+		QString toString() const;
+
+		//! Attaches the (shared) nearest neighbor joins to the consuming features
+		/** Must be called before the features are prepared. Each join is computed on first use.
+		**/
+		bool attachJoins(QString& error);
+
+		//! Builds the (deduplicated) tasks to perform for the scaled features
+		/** Must be called once the features have been prepared. The scalar fields that were already
+			existing are not recomputed. The tasks must then be executed in order (cloud by cloud,
+			from the largest to the smallest scale).
+		**/
+		bool buildTasks(std::vector<CloudTasks>& cloudTasks, QString& error) const;
+
+	protected: //methods
+
+		//! Adds a node (or returns the index of the identical existing node)
+		size_t addNode(	NodeType type,
+						const QString& key,
+						ccPointCloud* cloud,
+						double scale,
+						const std::vector<size_t>& inputs,
+						const Feature::Shared& consumer = Feature::Shared(),
+						Slot slot = Slot::Result);
+
+		//! Adds the nodes corresponding to a single point feature
+		void addPointFeature(const CorePoints& corePoints, const PointFeature::Shared& feature);
+		//! Adds the nodes corresponding to a single neighborhood feature
+		void addNeighborhoodFeature(const NeighborhoodFeature::Shared& feature);
+		//! Adds the nodes corresponding to a single context-based feature
+		void addContextBasedFeature(const ContextBasedFeature::Shared& feature);
+		//! Adds the nodes corresponding to a single dual-cloud feature
+		/** Dual-cloud features are computed by a dedicated engine (see CrossCloudNeighborhoods).
+		**/
+		void addDualCloudFeature(const DualCloudFeature::Shared& feature);
+
+		//! Returns the extraction node of a given cloud (created if necessary)
+		size_t extractionNode(ccPointCloud* cloud, const QString& cloudLabel, double scale);
+
+	protected: //members
+
+		//! Nodes
+		std::vector<Node> m_nodes;
+		//! Node index per key
+		QMap<QString, size_t> m_nodeIndexes;
+	};
+
+}; //namespace masc
@@ -0,0 +1,580 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FeatureSelection.h"
+
+//qCC_db
+#include <ccLog.h>
+
+//Qt
+#include <QElapsedTimer>
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+void FeatureCosts::addPreparation(const Feature::Shared& feature, double seconds, unsigned pointCount)
+{
+	if (!feature || pointCount == 0)
+	{
+		assert(false);
+		return;
+	}
+
+	QString featureName = feature->toString();
+	QString key = QString("PREPARE(%1)").arg(featureName);
+	m_nodeCosts[key] = seconds / pointCount;
+	m_featureNodes[featureName].insert(key);
+}
+
+void FeatureCosts::addPhase(const FeaturePlan& plan, const std::vector<size_t>& nodeIndexes, double seconds, unsigned pointCount)
+{
+	if (nodeIndexes.empty() || pointCount == 0)
+	{
+		return;
+	}
+
+	double nodeCost = seconds / pointCount / nodeIndexes.size();
+	for (size_t nodeIndex : nodeIndexes)
+	{
+		assert(nodeIndex < plan.nodes().size());
+		m_nodeCosts[plan.nodes()[nodeIndex].key] = nodeCost;
+	}
+}
+
+bool FeatureCosts::addDependencies(const FeaturePlan& plan)
+{
+	const std::vector<FeaturePlan::Node>& nodes = plan.nodes();
+
+	//features depending on each node (the inputs of a node are always created before it)
+	std::vector< QSet<QString> > dependentFeatures;
+	try
+	{
+		dependentFeatures.resize(nodes.size());
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	for (size_t i = nodes.size(); i != 0; --i)
+	{
+		size_t nodeIndex = i - 1;
+		const FeaturePlan::Node& node = nodes[nodeIndex];
+		QSet<QString>& features = dependentFeatures[nodeIndex];
+		for (const FeaturePlan::Consumer& consumer : node.consumers)
+		{
+			features.insert(consumer.feature->toString());
+		}
+		for (size_t inputIndex : node.inputs)
+		{
+			assert(inputIndex < nodeIndex);
+			dependentFeatures[inputIndex].unite(features);
+		}
+		for (const QString& featureName : features)
+		{
+			m_featureNodes[featureName].insert(node.key);
+		}
+	}
+
+	return true;
+}
+
+double FeatureCosts::cost(const QStringList& featureNames) const
+{
+	QSet<QString> nodeKeys;
+	for (const QString& featureName : featureNames)
+	{
+		nodeKeys.unite(m_featureNodes.value(featureName));
+	}
+
+	double totalCost = 0.0;
+	for (const QString& key : nodeKeys)
+	{
+		totalCost += m_nodeCosts.value(key, 0.0);
+	}
+	return totalCost;
+}
+
+bool FeatureSelection::init(const Feature::Set& features,
+							const cv::Mat& trainSamples,
+							const cv::Mat& trainLabels,
+							const cv::Mat& testSamples,
+							const cv::Mat& testLabels,
+							const FeatureCosts& costs,
+							QString& error)
+{
+	m_subsets.clear();
+
+	if (features.empty())
+	{
+		error = "No feature";
+		return false;
+	}
+	if (	trainSamples.cols != static_cast<int>(features.size())
+		||	testSamples.cols != static_cast<int>(features.size())
+		||	trainSamples.rows != trainLabels.rows
+		||	testSamples.rows != testLabels.rows)
+	{
+		assert(false);
+		error = "Inconsistent samples";
+		return false;
+	}
+	if (trainSamples.rows == 0 || testSamples.rows == 0)
+	{
+		error = "Not enough training or test samples";
+		return false;
+	}
+
+	for (const Feature::Shared& feature : features)
+	{
+		if (!costs.contains(feature->toString()))
+		{
+			ccLog::Warning(QString("[3DMASC] The computation cost of feature %1 is unknown (it will be considered as free)").arg(feature->toString()));
+		}
+	}
+
+	m_features = features;
+	m_trainSamples = trainSamples;
+	m_trainLabels = trainLabels;
+	m_testSamples = testSamples;
+	m_testLabels = testLabels;
+	m_fitSamples = cv::Mat();
+	m_fitLabels = cv::Mat();
+	m_validationSamples = cv::Mat();
+	m_validationLabels = cv::Mat();
+	m_costs = costs;
+
+	return true;
+}
+
+//! Extracts some columns of a sample matrix
+static bool ExtractColumns(const cv::Mat& samples, const std::vector<int>& columns, cv::Mat& output, QString& error)
+{
+	try
+	{
+		output.create(samples.rows, static_cast<int>(columns.size()), CV_32FC1);
+		for (size_t i = 0; i < columns.size(); ++i)
+		{
+			samples.col(columns[i]).copyTo(output.col(static_cast<int>(i)));
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return false;
+	}
+
+	return true;
+}
+
+//! Extracts some rows of a sample (or label) matrix
+static bool ExtractRows(const cv::Mat& samples, const std::vector<int>& rows, cv::Mat& output, QString& error)
+{
+	try
+	{
+		output.create(static_cast<int>(rows.size()), samples.cols, samples.type());
+		for (size_t i = 0; i < rows.size(); ++i)
+		{
+			samples.row(rows[i]).copyTo(output.row(static_cast<int>(i)));
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		return false;
+	}
+
+	return true;
+}
+
+//! Returns the state of the RNG used to train a candidate
+/** It only depends on the selection seed and on the features of the candidate (not on the thread that trains it).
+**/
+static uint64_t CandidateRNGState(unsigned seed, const std::vector<int>& features)
+{
+	uint64_t state = 0xcbf29ce484222325ULL ^ seed;
+	for (int featureIndex : features)
+	{
+		state = (state ^ static_cast<uint64_t>(featureIndex + 1)) * 0x100000001b3ULL;
+	}
+	return (state != 0 ? state : 1); //a null state would stall the generator
+}
+
+bool FeatureSelection::splitValidation(float validationRatio, unsigned seed, QString& error)
+{
+	int sampleCount = m_trainSamples.rows;
+	int validationCount = static_cast<int>(validationRatio * sampleCount);
+	if (validationCount < 1 || validationCount >= sampleCount)
+	{
+		error = "Not enough training samples to hold out a validation split";
+		return false;
+	}
+
+	std::vector<int> fitRows, validationRows;
+	try
+	{
+		//random permutation of the training samples (reproducible)
+		std::vector<int> rows(sampleCount);
+		for (int i = 0; i < sampleCount; ++i)
+		{
+			rows[i] = i;
+		}
+		cv::RNG rng(static_cast<uint64_t>(seed) + 1);
+		for (int i = sampleCount - 1; i > 0; --i)
+		{
+			std::swap(rows[i], rows[rng.uniform(0, i + 1)]);
+		}
+
+		validationRows.assign(rows.begin(), rows.begin() + validationCount);
+		fitRows.assign(rows.begin() + validationCount, rows.end());
+		std::sort(validationRows.begin(), validationRows.end());
+		std::sort(fitRows.begin(), fitRows.end());
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	return (	ExtractRows(m_trainSamples, fitRows, m_fitSamples, error)
+			&&	ExtractRows(m_trainLabels, fitRows, m_fitLabels, error)
+			&&	ExtractRows(m_trainSamples, validationRows, m_validationSamples, error)
+			&&	ExtractRows(m_trainLabels, validationRows, m_validationLabels, error) );
+}
+
+bool FeatureSelection::train(const std::vector<int>& features, const RandomTreesParams& params, Classifier& classifier, QString& error) const
+{
+	cv::Mat samples;
+	if (!ExtractColumns(m_fitSamples, features, samples, error))
+	{
+		return false;
+	}
+
+	RandomTreesParams subsetParams = params;
+	subsetParams.activeVarCount = std::min(params.activeVarCount, static_cast<int>(features.size()));
+
+	return classifier.train(samples, m_fitLabels, subsetParams, error);
+}
+
+//! Returns the ratio of good guesses
+static float Accuracy(const std::vector<int>& predictedLabels, const cv::Mat& labels)
+{
+	int goodGuess = 0;
+	for (int i = 0; i < labels.rows; ++i)
+	{
+		if (predictedLabels[i] == static_cast<int>(labels.at<float>(i)))
+		{
+			++goodGuess;
+		}
+	}
+	return static_cast<float>(goodGuess) / labels.rows;
+}
+
+bool FeatureSelection::evaluate(Subset& subset, QString& error) const
+{
+	cv::Mat validationSamples;
+	std::vector<int> labels;
+	if (	!ExtractColumns(m_validationSamples, subset.features, validationSamples, error)
+		||	!subset.classifier.predict(validationSamples, labels, error))
+	{
+		return false;
+	}
+	subset.validationAccuracy = Accuracy(labels, m_validationLabels);
+
+	cv::Mat samples;
+	if (!ExtractColumns(m_testSamples, subset.features, samples, error))
+	{
+		return false;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	if (!subset.classifier.predict(samples, labels, error))
+	{
+		return false;
+	}
+	double seconds = timer.nsecsElapsed() / 1.0e9;
+
+	subset.accuracy = Accuracy(labels, m_testLabels);
+	subset.inferenceCost = seconds / samples.rows;
+	subset.featureCost = featureCost(subset.features);
+
+	return true;
+}
+
+double FeatureSelection::featureCost(const std::vector<int>& features) const
+{
+	QStringList featureNames;
+	for (int featureIndex : features)
+	{
+		featureNames << m_features[featureIndex]->toString();
+	}
+	return m_costs.cost(featureNames);
+}
+
+bool FeatureSelection::run(const Parameters& params, QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	m_subsets.clear();
+
+	int featureCount = static_cast<int>(m_features.size());
+	int minFeatureCount = std::max(1, params.minFeatureCount);
+	if (featureCount == 0)
+	{
+		error = "Selection not initialized";
+		return false;
+	}
+
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Feature selection");
+		progressCb->setInfo(qPrintable(QString("Backward elimination (%1 features)").arg(featureCount)));
+		progressCb->start();
+	}
+	CCCoreLib::NormalizedProgress nProgress(progressCb, std::max(1, featureCount - minFeatureCount + 1));
+
+	//the candidates are compared on samples held out from the training ones (the test samples are only used for the report)
+	if (!splitValidation(params.validationRatio, params.seed, error))
+	{
+		return false;
+	}
+
+	//start with all the features
+	try
+	{
+		Subset subset;
+		subset.features.resize(featureCount);
+		for (int i = 0; i < featureCount; ++i)
+		{
+			subset.features[i] = i;
+		}
+		cv::theRNG().state = CandidateRNGState(params.seed, subset.features);
+		if (!train(subset.features, params.rt, subset.classifier, error) || !evaluate(subset, error))
+		{
+			return false;
+		}
+		m_subsets.push_back(subset);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	if (progressCb && !nProgress.oneStep())
+	{
+		error = "Process cancelled by the user";
+		return false;
+	}
+
+#if defined(_OPENMP) && !defined(_DEBUG)
+	int maxThreadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+	int maxThreadCount = 1;
+#endif
+
+	while (static_cast<int>(m_subsets.back().features.size()) > minFeatureCount)
+	{
+		const Subset& current = m_subsets.back();
+		int currentCount = static_cast<int>(current.features.size());
+		double currentCost = featureCost(current.features);
+		//avoids divisions by zero for the (almost) free features
+		double minSavedCost = std::max(currentCost * 0.01, 1.0e-12);
+
+		//importance of the features of the current subset
+		std::vector<float> importances(currentCount, 0.0f);
+		{
+			cv::Mat importanceMat = current.classifier.getVarImportance();
+			if (importanceMat.rows == currentCount)
+			{
+				for (int i = 0; i < currentCount; ++i)
+				{
+					importances[i] = importanceMat.at<float>(i, 0);
+				}
+			}
+			else
+			{
+				ccLog::Warning("[3DMASC] Feature importance unavailable, the features will only be ranked by cost");
+			}
+		}
+
+		//cost saved by removing each feature (the shared computations are not saved)
+		std::vector<double> savedCosts(currentCount, 0.0);
+		std::vector<int> ranking(currentCount);
+		for (int i = 0; i < currentCount; ++i)
+		{
+			std::vector<int> others = current.features;
+			others.erase(others.begin() + i);
+			savedCosts[i] = std::max(0.0, currentCost - featureCost(others));
+			ranking[i] = i;
+		}
+
+		//the candidates are the least important features per unit of saved cost
+		std::sort(ranking.begin(), ranking.end(), [&](int a, int b)
+		{
+			return importances[a] / (savedCosts[a] + minSavedCost) < importances[b] / (savedCosts[b] + minSavedCost);
+		});
+		int candidateCount = std::min(std::max(1, params.candidateCount), currentCount);
+
+		std::vector<Subset> candidates;
+		std::vector<QString> candidateErrors;
+		try
+		{
+			candidates.resize(candidateCount);
+			candidateErrors.resize(candidateCount);
+			for (int c = 0; c < candidateCount; ++c)
+			{
+				int removedIndex = ranking[c];
+				candidates[c].features = current.features;
+				candidates[c].features.erase(candidates[c].features.begin() + removedIndex);
+				candidates[c].removedFeature = m_features[current.features[removedIndex]]->toString();
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = "Not enough memory";
+			return false;
+		}
+
+		//retrain the candidates in parallel
+		bool success = true;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1) num_threads(std::min(candidateCount, maxThreadCount))
+#endif
+#endif
+		for (int c = 0; c < candidateCount; ++c)
+		{
+			//the RNG is thread-local: each candidate is trained with a deterministic state, whatever the thread
+			cv::theRNG().state = CandidateRNGState(params.seed, candidates[c].features);
+			if (!train(candidates[c].features, params.rt, candidates[c].classifier, candidateErrors[c]))
+			{
+				success = false;
+			}
+		}
+		if (!success)
+		{
+			for (const QString& candidateError : candidateErrors)
+			{
+				if (!candidateError.isEmpty())
+				{
+					error = candidateError;
+					break;
+				}
+			}
+			return false;
+		}
+
+		//evaluate them (sequentially, so that the inference times are comparable)
+		int bestCandidate = -1;
+		double bestLossPerCost = 0.0;
+		for (int c = 0; c < candidateCount; ++c)
+		{
+			if (!evaluate(candidates[c], error))
+			{
+				return false;
+			}
+
+			double accuracyLoss = std::max(0.0, static_cast<double>(current.validationAccuracy) - candidates[c].validationAccuracy);
+			double lossPerCost = accuracyLoss / (savedCosts[ranking[c]] + minSavedCost);
+			if (	bestCandidate < 0
+				||	lossPerCost < bestLossPerCost
+				||	(lossPerCost == bestLossPerCost && candidates[c].validationAccuracy > candidates[bestCandidate].validationAccuracy))
+			{
+				bestCandidate = c;
+				bestLossPerCost = lossPerCost;
+			}
+		}
+
+		const Subset& best = candidates[bestCandidate];
+		ccLog::Print(QString("[3DMASC] Feature selection: %1 removed (%2 features left, validation accuracy = %3, test accuracy = %4)").arg(best.removedFeature).arg(best.features.size()).arg(best.validationAccuracy).arg(best.accuracy));
+		try
+		{
+			m_subsets.push_back(best);
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = "Not enough memory";
+			return false;
+		}
+
+		if (progressCb && !nProgress.oneStep())
+		{
+			//the subsets computed so far are kept
+			ccLog::Warning("[3DMASC] Feature selection cancelled by the user");
+			break;
+		}
+	}
+
+	updateParetoFront();
+
+	return true;
+}
+
+void FeatureSelection::updateParetoFront()
+{
+	for (Subset& subset : m_subsets)
+	{
+		subset.paretoOptimal = true;
+		for (const Subset& other : m_subsets)
+		{
+			if (	other.accuracy >= subset.accuracy
+				&&	other.runtime() <= subset.runtime()
+				&&	(other.accuracy > subset.accuracy || other.runtime() < subset.runtime()))
+			{
+				//dominated
+				subset.paretoOptimal = false;
+				break;
+			}
+		}
+	}
+}
+
+Feature::Set FeatureSelection::features(const Subset& subset) const
+{
+	Feature::Set features;
+	features.reserve(subset.features.size());
+	for (int featureIndex : subset.features)
+	{
+		features.push_back(m_features[featureIndex]);
+	}
+	return features;
+}
+
+QString FeatureSelection::toString() const
+{
+	QString str = "Features\tAccuracy\tValidation accuracy\tFeatures cost (us/pt)\tInference cost (us/pt)\tRuntime (us/pt)\tPareto\tRemoved feature";
+	for (const Subset& subset : m_subsets)
+	{
+		str += QString("\n%1\t%2\t%3\t%4\t%5\t%6\t%7\t%8")
+			.arg(subset.features.size())
+			.arg(subset.accuracy, 0, 'f', 4)
+			.arg(subset.validationAccuracy, 0, 'f', 4)
+			.arg(subset.featureCost * 1.0e6, 0, 'f', 2)
+			.arg(subset.inferenceCost * 1.0e6, 0, 'f', 2)
+			.arg(subset.runtime() * 1.0e6, 0, 'f', 2)
+			.arg(subset.paretoOptimal ? "yes" : "no")
+			.arg(subset.removedFeature);
+	}
+	return str;
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeaturePlanner.h"
+#include "q3DMASCClassifier.h"
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+//OpenCV
+#include <opencv2/core.hpp>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Measured computation cost of the features
+	/** The time spent in each phase of Tools::PrepareFeatures is distributed among the primitive
+		computations of the feature plan involved in this phase, and each feature depends on a set
+		of primitive computations. The cost of a set of features is the cost of the union of their
+		primitive computations, so that the shared computations (neighborhood extraction, local
+		geometry, etc.) are only counted once.
+	**/
+	class FeatureCosts
+	{
+	public:
+
+		//! Records the time spent to prepare a feature (scalar fields, scale-less values, etc.)
+		void addPreparation(const Feature::Shared& feature, double seconds, unsigned pointCount);
+
+		//! Records the time spent in a phase involving several primitive computations
+		/** The time is evenly distributed among the nodes (the last measurement of a node is kept).
+		**/
+		void addPhase(const FeaturePlan& plan, const std::vector<size_t>& nodeIndexes, double seconds, unsigned pointCount);
+
+		//! Records the primitive computations each feature of a plan depends on
+		bool addDependencies(const FeaturePlan& plan);
+
+		//! Returns whether the cost of a feature has been measured
+		inline bool contains(const QString& featureName) const { return m_featureNodes.contains(featureName); }
+
+		//! Returns the cost of a set of features (in seconds per core point)
+		double cost(const QStringList& featureNames) const;
+
+		//! Returns the cost of a single feature (in seconds per core point)
+		inline double cost(const QString& featureName) const { return cost(QStringList{ featureName }); }
+
+	protected:
+
+		//! Cost of each primitive computation (in seconds per core point)
+		QMap<QString, double> m_nodeCosts;
+		//! Primitive computations each feature depends on
+		QMap<QString, QSet<QString> > m_featureNodes;
+	};
+
+	//! Cost-aware feature selection (backward elimination)
+	/** Starting from all the features, the features with the lowest importance per unit of
+		(saved) cost are removed one at a time. At each step, a few candidates are retrained in
+		parallel, and the one losing the least accuracy per saved computation time is kept.
+		The candidates are compared on a validation split held out from the training samples, so
+		that the test samples are only used to report the accuracy of each subset.
+		Each step gives a trained classifier, and the ones that are not dominated in terms of
+		accuracy and classification runtime (feature computation + inference) form the Pareto front.
+	**/
+	class FeatureSelection
+	{
+	public:
+
+		//! Selection parameters
+		struct Parameters
+		{
+			//! Random trees parameters
+			RandomTreesParams rt;
+			//! Number of candidate features retrained at each step
+			int candidateCount = 4;
+			//! Minimum number of features
+			int minFeatureCount = 1;
+			//! Ratio of the training samples held out to compare the candidates
+			float validationRatio = 0.2f;
+			//! Seed of the validation split and of the candidates training
+			unsigned seed = 0;
+		};
+
+		//! Subset of features (one per step)
+		struct Subset
+		{
+			//! Indexes of the features (in the input features)
+			std::vector<int> features;
+			//! Name of the feature removed at this step (if any)
+			QString removedFeature;
+			//! Accuracy on the test samples
+			float accuracy = 0.0f;
+			//! Accuracy on the validation samples (used to select the candidates)
+			float validationAccuracy = 0.0f;
+			//! Features computation cost (in seconds per core point)
+			double featureCost = 0.0;
+			//! Inference cost (in seconds per core point)
+			double inferenceCost = 0.0;
+			//! Whether the subset is on the Pareto front
+			bool paretoOptimal = false;
+			//! Trained classifier
+			Classifier classifier;
+
+			//! Returns the classification runtime (in seconds per core point)
+			inline double runtime() const { return featureCost + inferenceCost; }
+		};
+
+		//! Initializes the selection
+		/** \param features (prepared) features (one per column of the sample matrices)
+			\param trainSamples training samples (one row per sample, CV_32FC1)
+			\param trainLabels training labels
+			\param testSamples test samples (same columns as the training samples)
+			\param testLabels test labels
+			\param costs measured features costs
+		**/
+		bool init(	const Feature::Set& features,
+					const cv::Mat& trainSamples,
+					const cv::Mat& trainLabels,
+					const cv::Mat& testSamples,
+					const cv::Mat& testLabels,
+					const FeatureCosts& costs,
+					QString& error);
+
+		//! Runs the backward elimination
+		bool run(const Parameters& params, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Returns the subsets (one per step, starting with all the features)
+		inline const std::vector<Subset>& subsets() const { return m_subsets; }
+
+		//! Returns the features of a given subset
+		Feature::Set features(const Subset& subset) const;
+
+		//! Returns a (multi-line) report
+		QString toString() const;
+
+	protected:
+
+		//! Trains a classifier on a subset of features (thread-safe)
+		bool train(const std::vector<int>& features, const RandomTreesParams& params, Classifier& classifier, QString& error) const;
+
+		//! Evaluates a trained subset (accuracies and inference cost)
+		bool evaluate(Subset& subset, QString& error) const;
+
+		//! Splits the training samples in fitting and validation samples
+		bool splitValidation(float validationRatio, unsigned seed, QString& error);
+
+		//! Returns the computation cost of a subset of features
+		double featureCost(const std::vector<int>& features) const;
+
+		//! Flags the subsets on the Pareto front
+		void updateParetoFront();
+
+	protected:
+
+		//! Input features
+		Feature::Set m_features;
+		//! Training samples (all features)
+		cv::Mat m_trainSamples;
+		//! Training labels
+		cv::Mat m_trainLabels;
+		//! Test samples (all features)
+		cv::Mat m_testSamples;
+		//! Test labels
+		cv::Mat m_testLabels;
+		//! Samples actually used to train the classifiers (training samples minus the validation ones)
+		cv::Mat m_fitSamples;
+		//! Fitting labels
+		cv::Mat m_fitLabels;
+		//! Validation samples (held out from the training samples)
+		cv::Mat m_validationSamples;
+		//! Validation labels
+		cv::Mat m_validationLabels;
+		//! Features costs
+		FeatureCosts m_costs;
+		//! Subsets (one per step)
+		std::vector<Subset> m_subsets;
+	};
+
+}; //namespace masc
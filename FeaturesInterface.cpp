@@ -203,7 +203,7 @@ bool Feature::LoadSources(Source::Set& sources, QString filename)
 		Source src;
 		bool ok = false;
 		int sourceType = tokens[0].toInt(&ok);
-		if (!ok || sourceType < Feature::Source::ScalarField || sourceType > Feature::Source::Blue)
+		if (!ok || sourceType < Feature::Source::ScalarField || sourceType > Feature::Source::Placeholder)
 		{
 			ccLog::Warning("Unhandled source type");
 			return false;
@@ -232,7 +232,15 @@ bool Feature::ExtractSources(const Set& features, Source::Set& sources)
 
 	for (Feature::Shared f : features)
 	{
-		sources.push_back(f->source);
+		if (f->unused)
+		{
+			//the column is kept (with a constant value)
+			sources.push_back(Source(Source::Placeholder, f->toString()));
+		}
+		else
+		{
+			sources.push_back(f->source);
+		}
 	}
 
 	return true;
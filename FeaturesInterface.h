@@ -25,6 +25,7 @@
 
 //Qt
 #include <QString>
+#include <QStringList>
 
 //system
 #include <assert.h>
@@ -131,7 +132,11 @@ namespace masc
 				DimZ,
 				Red,
 				Green,
-				Blue
+				Blue,
+				EchoRatio,	//'return number / number of returns'
+				NormDip,	//dip angle of the normals
+				NormDipDir,	//dip direction of the normals
+				Placeholder	//constant value (feature not used by the classifier)
 			};
 
 			Source(Type t = ScalarField, QString n = QString())
@@ -163,7 +168,7 @@ namespace masc
 			, stat(NO_STAT)
 			, op(NO_OPERATION)
 			, sf1WasAlreadyExisting(false)
-			, sf2WasAlreadyExisting(false)
+			, unused(false)
 		{}
 
 		//! Destructor
@@ -184,9 +189,22 @@ namespace masc
 		//! Finishes the feature preparation (update the scalar field, etc.)
 		virtual bool finish(const CorePoints& corePoints, QString& error) { /* does nothing by default*/return true; }
 
+		//! Returns the attributes of the input cloud(s) required to compute the feature (on top of the coordinates and the classification)
+		/** \param sfNames names of the required scalar fields (completed)
+			\param sfCount minimum number of scalar fields to keep, as the SFn features refer to the fields by index (updated)
+			\param colors whether the colors are required (updated)
+			\param normals whether the normals are required (updated)
+		**/
+		virtual void getRequiredAttributes(QStringList& sfNames, int& sfCount, bool& colors, bool& normals) const { /* coordinates only by default */ }
+
 		//! Returns whether the feature has an associated scale
 		inline bool scaled() const { return std::isfinite(scale); }
 
+		//! Returns whether the feature requires the neighbors to be sorted by increasing distance
+		/** By default the neighbors of a given scale are only guaranteed to lie inside the scale sphere.
+		**/
+		virtual bool requiresSortedNeighbors() const { return false; }
+
 		//! Checks the feature definition validity
 		virtual bool checkValidity(QString corePointRole, QString &error) const
 		{
@@ -243,6 +261,8 @@ namespace masc
 		Operation op; //only considered if 2 clouds are defined
 
 		bool sf1WasAlreadyExisting;
-		bool sf2WasAlreadyExisting; // only considered if a second scalar field may be necessary (PointFeature, NeighborhoodFeature)
+
+		//! Whether the feature is not used by the classifier (it is then not computed)
+		bool unused;
 	};
 }
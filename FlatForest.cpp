@@ -0,0 +1,876 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "FlatForest.h"
+
+//Local
+#include "CpuFeatures.h"
+
+//Qt
+#include <QDataStream>
+#include <QtEndian>
+#include <QFile>
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+
+using namespace masc;
+
+bool FlatForest::build(const cv::Ptr<cv::ml::RTrees>& rtrees, int attributeCount, QString& error)
+{
+	m_attributeCount = attributeCount;
+	m_feature.clear();
+	m_threshold.clear();
+	m_child.clear();
+	m_defaultLeft.clear();
+	m_classIndex.clear();
+	m_nodeClass.clear();
+	m_roots.clear();
+	m_classLabels.clear();
+
+	if (!rtrees || !rtrees->isTrained() || !rtrees->isClassifier() || attributeCount <= 0)
+	{
+		error = QObject::tr("Invalid classifier");
+		return false;
+	}
+
+	//the split variable indexes refer to the columns of the samples (OpenCV stores the original
+	//index even if the forest was trained on a subset of the variables, which the plugin never does)
+	if (rtrees->getVarCount() != attributeCount)
+	{
+		error = QObject::tr("The classifier variables don't match the samples (%1 vs %2)").arg(rtrees->getVarCount()).arg(attributeCount);
+		return false;
+	}
+
+	if (!rtrees->getSubsets().empty())
+	{
+		error = QObject::tr("Categorical variables are not supported");
+		return false;
+	}
+
+	try
+	{
+		const std::vector<int>& roots = rtrees->getRoots();
+		const std::vector<cv::ml::DTrees::Node>& nodes = rtrees->getNodes();
+		const std::vector<cv::ml::DTrees::Split>& splits = rtrees->getSplits();
+
+		//the class labels (per class index) are given by the first row of the votes matrix
+		{
+			cv::Mat sample = cv::Mat::zeros(1, attributeCount, CV_32FC1);
+			cv::Mat votes;
+			rtrees->getVotes(sample, votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+			m_classLabels.resize(votes.cols);
+			for (int col = 0; col < votes.cols; ++col)
+			{
+				m_classLabels[col] = votes.at<int>(0, col);
+			}
+		}
+
+		m_feature.reserve(nodes.size());
+		m_threshold.reserve(nodes.size());
+		m_child.reserve(nodes.size());
+		m_defaultLeft.reserve(nodes.size());
+		m_classIndex.reserve(nodes.size());
+		m_nodeClass.reserve(nodes.size());
+		m_roots.reserve(roots.size());
+
+		//breadth-first conversion of each tree
+		std::deque<int> queue; //original node indexes (in the new order)
+		for (int root : roots)
+		{
+			int rootIndex = static_cast<int>(m_feature.size());
+			m_roots.push_back(rootIndex);
+
+			queue.clear();
+			queue.push_back(root);
+			int nextFreeIndex = rootIndex + 1;
+			while (!queue.empty())
+			{
+				const cv::ml::DTrees::Node& node = nodes[queue.front()];
+				queue.pop_front();
+				int index = static_cast<int>(m_feature.size());
+
+				if (node.split < 0)
+				{
+					//leaf
+					if (node.classIdx < 0 || node.classIdx >= static_cast<int>(m_classLabels.size()))
+					{
+						error = QObject::tr("Invalid leaf class index");
+						return false;
+					}
+					m_feature.push_back(-1);
+					m_threshold.push_back(0.0f);
+					m_child.push_back(index);
+					m_defaultLeft.push_back(1);
+					m_classIndex.push_back(node.classIdx);
+					m_nodeClass.push_back(-1);
+				}
+				else
+				{
+					const cv::ml::DTrees::Split& split = splits[node.split];
+					if (split.varIdx < 0 || split.varIdx >= attributeCount || node.left < 0 || node.right < 0)
+					{
+						error = QObject::tr("Invalid split");
+						return false;
+					}
+					m_feature.push_back(split.varIdx);
+					m_threshold.push_back(split.c);
+					m_child.push_back(nextFreeIndex);
+					m_defaultLeft.push_back(node.defaultDir < 0 ? 1 : 0);
+					m_classIndex.push_back(-1);
+					m_nodeClass.push_back(node.classIdx >= 0 && node.classIdx < static_cast<int>(m_classLabels.size()) ? node.classIdx : -1);
+
+					//the children are contiguous
+					queue.push_back(node.left);
+					queue.push_back(node.right);
+					nextFreeIndex += 2;
+				}
+			}
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		error = cvex.msg.c_str();
+		m_roots.clear();
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		m_roots.clear();
+		return false;
+	}
+
+	if (m_roots.empty() || m_classLabels.empty())
+	{
+		error = QObject::tr("Empty forest");
+		m_roots.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void FlatForest::voteScalar(const float* sample, int* votes) const
+{
+	const float MissingValue = cv::ml::TrainData::missingValue();
+
+	for (int root : m_roots)
+	{
+		int nodeIndex = root;
+		int feature = m_feature[nodeIndex];
+		while (feature >= 0)
+		{
+			float value = sample[feature];
+			bool left = (value == MissingValue ? m_defaultLeft[nodeIndex] != 0 : value <= m_threshold[nodeIndex]);
+			nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+			feature = m_feature[nodeIndex];
+		}
+		++votes[m_classIndex[nodeIndex]];
+	}
+}
+
+#if defined(MASC_X86_SIMD)
+
+//! Votes of 8 samples at once (the samples must not contain missing values)
+MASC_TARGET_AVX2 static void Vote8AVX2(	const float* samples,
+										int attributeCount,
+										const int* roots,
+										int treeCount,
+										const int* featureArray,
+										const float* thresholdArray,
+										const int* childArray,
+										const int* classIndexArray,
+										int classCount,
+										int* votes)
+{
+	//offset of each sample (in number of floats)
+	const __m256i sampleOffsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(attributeCount));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i minusOne = _mm256_set1_epi32(-1);
+
+	alignas(32) int leaves[8];
+	for (int t = 0; t < treeCount; ++t)
+	{
+		__m256i nodes = _mm256_set1_epi32(roots[t]);
+		__m256i features = _mm256_i32gather_epi32(featureArray, nodes, 4);
+		__m256i internal = _mm256_cmpgt_epi32(features, minusOne);
+		while (_mm256_movemask_epi8(internal) != 0)
+		{
+			//leaves keep their (fake) feature 0, their comparison result is ignored
+			__m256i safeFeatures = _mm256_max_epi32(features, zero);
+			__m256 values = _mm256_i32gather_ps(samples, _mm256_add_epi32(sampleOffsets, safeFeatures), 4);
+			__m256 thresholds = _mm256_i32gather_ps(thresholdArray, nodes, 4);
+			//right = !(value <= threshold) (true for NaN values, as with OpenCV)
+			__m256i right = _mm256_castps_si256(_mm256_cmp_ps(values, thresholds, _CMP_NLE_UQ));
+			right = _mm256_and_si256(right, internal);
+			__m256i children = _mm256_i32gather_epi32(childArray, nodes, 4);
+			//right is -1 (all bits set) or 0
+			nodes = _mm256_sub_epi32(children, right);
+			features = _mm256_i32gather_epi32(featureArray, nodes, 4);
+			internal = _mm256_cmpgt_epi32(features, minusOne);
+		}
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(leaves), nodes);
+		for (int s = 0; s < 8; ++s)
+		{
+			++votes[s * classCount + classIndexArray[leaves[s]]];
+		}
+	}
+}
+
+#endif //MASC_X86_SIMD
+
+void FlatForest::vote(const float* samples, int sampleCount, int* votes) const
+{
+	assert(isValid());
+	int classCount = static_cast<int>(m_classLabels.size());
+	std::fill(votes, votes + static_cast<size_t>(sampleCount) * classCount, 0);
+
+	int s = 0;
+#if defined(MASC_X86_SIMD)
+	if (Cpu::BestInstructionSet() == Cpu::InstructionSet::AVX2)
+	{
+		const float MissingValue = cv::ml::TrainData::missingValue();
+		for (; s + 8 <= sampleCount; s += 8)
+		{
+			const float* group = samples + static_cast<size_t>(s) * m_attributeCount;
+
+			//the samples with missing values are processed with the scalar code
+			if (std::find(group, group + 8 * m_attributeCount, MissingValue) != group + 8 * m_attributeCount)
+			{
+				for (int k = 0; k < 8; ++k)
+				{
+					voteScalar(group + static_cast<size_t>(k) * m_attributeCount, votes + static_cast<size_t>(s + k) * classCount);
+				}
+				continue;
+			}
+
+			Vote8AVX2(	group,
+						m_attributeCount,
+						m_roots.data(),
+						static_cast<int>(m_roots.size()),
+						m_feature.data(),
+						m_threshold.data(),
+						m_child.data(),
+						m_classIndex.data(),
+						classCount,
+						votes + static_cast<size_t>(s) * classCount);
+		}
+	}
+#endif
+
+	//remaining samples
+	for (; s < sampleCount; ++s)
+	{
+		voteScalar(samples + static_cast<size_t>(s) * m_attributeCount, votes + static_cast<size_t>(s) * classCount);
+	}
+}
+
+bool FlatForest::predict(	const float* samples,
+							int sampleCount,
+							int* labels,
+							float* confidences,
+							std::vector<int>& votes) const
+{
+	if (!isValid() || !samples || !labels || !confidences)
+	{
+		assert(false);
+		return false;
+	}
+
+	size_t classCount = m_classLabels.size();
+	try
+	{
+		votes.resize(static_cast<size_t>(sampleCount) * classCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	vote(samples, sampleCount, votes.data());
+
+	VotesToLabels(votes.data(), sampleCount, m_classLabels, static_cast<int>(m_roots.size()), labels, confidences);
+
+	return true;
+}
+
+bool FlatForest::predictEarlyExit(	const float* samples,
+									int sampleCount,
+									int* labels,
+									float* confidences,
+									std::vector<int>& votes,
+									float minConfidence,
+									size_t& evaluatedTreeCount) const
+{
+	if (!isValid() || !samples || !labels || !confidences)
+	{
+		assert(false);
+		return false;
+	}
+
+	int classCount = static_cast<int>(m_classLabels.size());
+	try
+	{
+		votes.resize(classCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	const float MissingValue = cv::ml::TrainData::missingValue();
+	const int treeCount = static_cast<int>(m_roots.size());
+	//minimum number of trees before the confidence criterion is considered
+	const int minTreeCount = std::min(treeCount, 10);
+
+	evaluatedTreeCount = 0;
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		const float* sample = samples + static_cast<size_t>(s) * m_attributeCount;
+		std::fill(votes.begin(), votes.end(), 0);
+
+		int bestIndex = 0;
+		int t = 0;
+		while (t < treeCount)
+		{
+			int nodeIndex = m_roots[t];
+			int feature = m_feature[nodeIndex];
+			while (feature >= 0)
+			{
+				float value = sample[feature];
+				bool left = (value == MissingValue ? m_defaultLeft[nodeIndex] != 0 : value <= m_threshold[nodeIndex]);
+				nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+				feature = m_feature[nodeIndex];
+			}
+			int classIndex = m_classIndex[nodeIndex];
+			++votes[classIndex];
+			++t;
+
+			//the first class with the maximum number of votes wins (as with cv::ml::DTrees)
+			if (votes[bestIndex] < votes[classIndex] || (votes[bestIndex] == votes[classIndex] && classIndex < bestIndex))
+			{
+				bestIndex = classIndex;
+			}
+
+			if (t == treeCount)
+			{
+				break;
+			}
+
+			if (minConfidence > 0.0f && t >= minTreeCount && votes[bestIndex] >= minConfidence * t)
+			{
+				break;
+			}
+
+			//can the leading class still be overturned by the remaining trees?
+			int remainingTrees = treeCount - t;
+			bool overturnable = false;
+			for (int k = 0; k < classCount; ++k)
+			{
+				if (k == bestIndex)
+				{
+					continue;
+				}
+				//the classes before the leading one win the ties
+				int margin = votes[bestIndex] - votes[k];
+				if (k < bestIndex ? margin <= remainingTrees : margin < remainingTrees)
+				{
+					overturnable = true;
+					break;
+				}
+			}
+			if (!overturnable)
+			{
+				break;
+			}
+		}
+
+		evaluatedTreeCount += t;
+		labels[s] = m_classLabels[bestIndex];
+		//ratio of the whole forest, as with predict (the votes of the remaining trees are unknown, so this is a lower bound)
+		confidences[s] = static_cast<float>(votes[bestIndex]) / treeCount;
+	}
+
+	return true;
+}
+
+void FlatForest::VotesToLabels(	const int* votes,
+								int sampleCount,
+								const std::vector<int>& classLabels,
+								int treeCount,
+								int* labels,
+								float* confidences)
+{
+	size_t classCount = classLabels.size();
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		const int* sampleVotes = votes + static_cast<size_t>(s) * classCount;
+
+		//the first class with the maximum number of votes wins (as with cv::ml::DTrees)
+		size_t bestIndex = 0;
+		for (size_t k = 1; k < classCount; ++k)
+		{
+			if (sampleVotes[bestIndex] < sampleVotes[k])
+			{
+				bestIndex = k;
+			}
+		}
+
+		labels[s] = classLabels[bestIndex];
+		confidences[s] = static_cast<float>(sampleVotes[bestIndex]) / treeCount;
+	}
+}
+
+bool FlatForest::compact(	const CompactionParameters& params,
+							const float* samples,
+							const int* labels,
+							int sampleCount,
+							CompactionReport& report,
+							QString& error)
+{
+	if (!isValid() || !samples || !labels || sampleCount <= 0)
+	{
+		error = QObject::tr("Invalid input");
+		return false;
+	}
+
+	report.nodeCountBefore = m_feature.size();
+	report.treeCountBefore = treeCount();
+
+	const int classCount = static_cast<int>(m_classLabels.size());
+	const float MissingValue = cv::ml::TrainData::missingValue();
+
+	//returns the accuracy of the current forest on the reference samples
+	std::vector<int> predictedLabels(sampleCount);
+	auto Accuracy = [&]() -> double
+	{
+		std::vector<float> confidences(sampleCount);
+		std::vector<int> votes;
+		predict(samples, sampleCount, predictedLabels.data(), confidences.data(), votes);
+		int goodGuess = 0;
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			if (predictedLabels[s] == labels[s])
+				++goodGuess;
+		}
+		return static_cast<double>(goodGuess) / sampleCount;
+	};
+
+	try
+	{
+		report.accuracyBefore = Accuracy();
+		std::vector<int> referenceLabels = predictedLabels;
+
+		//number of samples reaching each node
+		std::vector<int> support(m_feature.size(), 0);
+		if (params.minSupport > 0)
+		{
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				const float* sample = samples + static_cast<size_t>(s) * m_attributeCount;
+				for (int root : m_roots)
+				{
+					int nodeIndex = root;
+					++support[nodeIndex];
+					int feature = m_feature[nodeIndex];
+					while (feature >= 0)
+					{
+						float value = sample[feature];
+						bool left = (value == MissingValue ? m_defaultLeft[nodeIndex] != 0 : value <= m_threshold[nodeIndex]);
+						nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+						++support[nodeIndex];
+						feature = m_feature[nodeIndex];
+					}
+				}
+			}
+		}
+
+		//class of each subtree if it can be replaced by a leaf (-1 otherwise)
+		//(the children come after their parent in breadth-first order)
+		std::vector<int> collapsedClass(m_feature.size(), -1);
+		for (size_t i = m_feature.size(); i-- > 0; )
+		{
+			if (m_feature[i] < 0)
+			{
+				collapsedClass[i] = m_classIndex[i];
+			}
+			else if (params.minSupport > 0 && support[i] < params.minSupport && m_nodeClass[i] >= 0)
+			{
+				//pruned subtree
+				collapsedClass[i] = m_nodeClass[i];
+			}
+			else
+			{
+				//sibling leaves voting for the same class
+				int leftClass = collapsedClass[m_child[i]];
+				int rightClass = collapsedClass[m_child[i] + 1];
+				if (leftClass >= 0 && leftClass == rightClass)
+				{
+					collapsedClass[i] = leftClass;
+				}
+			}
+		}
+
+		//drop the trees that barely change the predictions
+		std::vector<bool> keepTree(m_roots.size(), true);
+		if (params.maxTreeDropChange >= 0.0f && m_roots.size() > 1)
+		{
+			//leaf class reached by each sample in each (compacted) tree
+			std::vector<int> votes(static_cast<size_t>(sampleCount) * classCount, 0);
+			std::vector<int> leafClasses(static_cast<size_t>(sampleCount) * m_roots.size());
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				const float* sample = samples + static_cast<size_t>(s) * m_attributeCount;
+				for (size_t t = 0; t < m_roots.size(); ++t)
+				{
+					//stop at the first collapsed node
+					int nodeIndex = m_roots[t];
+					while (collapsedClass[nodeIndex] < 0)
+					{
+						float value = sample[m_feature[nodeIndex]];
+						bool left = (value == MissingValue ? m_defaultLeft[nodeIndex] != 0 : value <= m_threshold[nodeIndex]);
+						nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+					}
+					int classIndex = collapsedClass[nodeIndex];
+					leafClasses[s * m_roots.size() + t] = classIndex;
+					++votes[static_cast<size_t>(s) * classCount + classIndex];
+				}
+			}
+
+			//best class index (the first class with the maximum number of votes wins)
+			auto BestClass = [&](const int* sampleVotes) -> int
+			{
+				int bestIndex = 0;
+				for (int k = 1; k < classCount; ++k)
+				{
+					if (sampleVotes[bestIndex] < sampleVotes[k])
+						bestIndex = k;
+				}
+				return bestIndex;
+			};
+
+			//greedy removal (in the forest order), the changes being measured against the original predictions
+			int maxChangeCount = static_cast<int>(params.maxTreeDropChange * sampleCount);
+			size_t keptTreeCount = m_roots.size();
+			for (size_t t = 0; t < m_roots.size() && keptTreeCount > 1; ++t)
+			{
+				int changeCount = 0;
+				for (int s = 0; s < sampleCount; ++s)
+				{
+					int* sampleVotes = votes.data() + static_cast<size_t>(s) * classCount;
+					--sampleVotes[leafClasses[s * m_roots.size() + t]];
+					if (m_classLabels[BestClass(sampleVotes)] != referenceLabels[s])
+						++changeCount;
+				}
+
+				if (changeCount <= maxChangeCount)
+				{
+					keepTree[t] = false;
+					--keptTreeCount;
+				}
+				else
+				{
+					//restore the votes
+					for (int s = 0; s < sampleCount; ++s)
+					{
+						++votes[static_cast<size_t>(s) * classCount + leafClasses[s * m_roots.size() + t]];
+					}
+				}
+			}
+		}
+
+		//rebuild the (kept) trees in breadth-first order
+		std::vector<int> feature, child, classIndex, nodeClass, roots;
+		std::vector<float> threshold;
+		std::vector<unsigned char> defaultLeft;
+		feature.reserve(m_feature.size());
+		child.reserve(m_feature.size());
+		classIndex.reserve(m_feature.size());
+		nodeClass.reserve(m_feature.size());
+		threshold.reserve(m_feature.size());
+		defaultLeft.reserve(m_feature.size());
+
+		std::deque<int> queue;
+		for (size_t t = 0; t < m_roots.size(); ++t)
+		{
+			if (!keepTree[t])
+			{
+				continue;
+			}
+
+			int rootIndex = static_cast<int>(feature.size());
+			roots.push_back(rootIndex);
+			int nextFreeIndex = rootIndex + 1;
+			queue.push_back(m_roots[t]);
+			while (!queue.empty())
+			{
+				int oldIndex = queue.front();
+				queue.pop_front();
+				int index = static_cast<int>(feature.size());
+
+				if (collapsedClass[oldIndex] >= 0)
+				{
+					//leaf
+					feature.push_back(-1);
+					threshold.push_back(0.0f);
+					child.push_back(index);
+					defaultLeft.push_back(1);
+					classIndex.push_back(collapsedClass[oldIndex]);
+					nodeClass.push_back(-1);
+				}
+				else
+				{
+					feature.push_back(m_feature[oldIndex]);
+					threshold.push_back(m_threshold[oldIndex]);
+					child.push_back(nextFreeIndex);
+					defaultLeft.push_back(m_defaultLeft[oldIndex]);
+					classIndex.push_back(-1);
+					nodeClass.push_back(m_nodeClass[oldIndex]);
+
+					queue.push_back(m_child[oldIndex]);
+					queue.push_back(m_child[oldIndex] + 1);
+					nextFreeIndex += 2;
+				}
+			}
+		}
+
+		m_feature = std::move(feature);
+		m_threshold = std::move(threshold);
+		m_child = std::move(child);
+		m_defaultLeft = std::move(defaultLeft);
+		m_classIndex = std::move(classIndex);
+		m_nodeClass = std::move(nodeClass);
+		m_roots = std::move(roots);
+
+		report.nodeCountAfter = m_feature.size();
+		report.treeCountAfter = treeCount();
+		report.accuracyAfter = Accuracy();
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	return true;
+}
+
+//! Flattened forest file header
+static const char FlatForestMagic[] = "3DMASC_FLAT_FOREST";
+static const qint32 FlatForestVersion = 1;
+
+//! Serialized forest header
+struct SerializedHeader
+{
+	qint32 attributeCount;
+	qint32 classCount;
+	qint32 treeCount;
+	qint32 reserved;
+	qint64 nodeCount;
+};
+
+template <typename T> static void AppendArray(QByteArray& buffer, const std::vector<T>& vector)
+{
+	int offset = buffer.size();
+	buffer.resize(offset + static_cast<int>(vector.size() * sizeof(T)));
+	qToLittleEndian<T>(vector.data(), static_cast<qsizetype>(vector.size()), buffer.data() + offset);
+}
+
+template <typename T> static bool ReadArray(const uchar*& data, const uchar* end, size_t count, std::vector<T>& vector)
+{
+	if (static_cast<size_t>(end - data) < count * sizeof(T))
+	{
+		return false;
+	}
+	vector.resize(count);
+	qFromLittleEndian<T>(data, static_cast<qsizetype>(count), vector.data());
+	data += count * sizeof(T);
+	return true;
+}
+
+QByteArray FlatForest::serialize() const
+{
+	QByteArray buffer;
+
+	SerializedHeader header;
+	header.attributeCount = qToLittleEndian<qint32>(m_attributeCount);
+	header.classCount = qToLittleEndian<qint32>(static_cast<qint32>(m_classLabels.size()));
+	header.treeCount = qToLittleEndian<qint32>(static_cast<qint32>(m_roots.size()));
+	header.reserved = 0;
+	header.nodeCount = qToLittleEndian<qint64>(static_cast<qint64>(m_feature.size()));
+	buffer.append(reinterpret_cast<const char*>(&header), sizeof(SerializedHeader));
+
+	AppendArray(buffer, m_classLabels);
+	AppendArray(buffer, m_roots);
+	AppendArray(buffer, m_feature);
+	AppendArray(buffer, m_threshold);
+	AppendArray(buffer, m_child);
+	AppendArray(buffer, m_classIndex);
+	AppendArray(buffer, m_nodeClass);
+	buffer.append(reinterpret_cast<const char*>(m_defaultLeft.data()), static_cast<int>(m_defaultLeft.size()));
+
+	return buffer;
+}
+
+bool FlatForest::deserialize(const uchar* data, qint64 size, QString& error)
+{
+	m_roots.clear();
+
+	if (!data || size < static_cast<qint64>(sizeof(SerializedHeader)))
+	{
+		error = QObject::tr("Truncated forest data");
+		return false;
+	}
+
+	SerializedHeader header;
+	memcpy(&header, data, sizeof(SerializedHeader));
+	const uchar* current = data + sizeof(SerializedHeader);
+	const uchar* end = data + size;
+
+	qint32 classCount = qFromLittleEndian<qint32>(header.classCount);
+	qint32 treeCount = qFromLittleEndian<qint32>(header.treeCount);
+	qint64 nodeCount = qFromLittleEndian<qint64>(header.nodeCount);
+	m_attributeCount = qFromLittleEndian<qint32>(header.attributeCount);
+	if (classCount <= 0 || treeCount <= 0 || nodeCount <= 0 || m_attributeCount <= 0 || nodeCount > size)
+	{
+		error = QObject::tr("Corrupted forest data");
+		return false;
+	}
+
+	try
+	{
+		if (	!ReadArray(current, end, classCount, m_classLabels)
+			||	!ReadArray(current, end, treeCount, m_roots)
+			||	!ReadArray(current, end, nodeCount, m_feature)
+			||	!ReadArray(current, end, nodeCount, m_threshold)
+			||	!ReadArray(current, end, nodeCount, m_child)
+			||	!ReadArray(current, end, nodeCount, m_classIndex)
+			||	!ReadArray(current, end, nodeCount, m_nodeClass)
+			||	end - current < nodeCount)
+		{
+			error = QObject::tr("Truncated forest data");
+			m_roots.clear();
+			return false;
+		}
+		m_defaultLeft.assign(current, current + nodeCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = QObject::tr("Not enough memory");
+		m_roots.clear();
+		return false;
+	}
+
+	//consistency check
+	bool valid = true;
+	for (int root : m_roots)
+	{
+		valid = valid && (root >= 0 && root < nodeCount);
+	}
+	for (qint64 i = 0; valid && i < nodeCount; ++i)
+	{
+		if (m_feature[i] < 0)
+			valid = (m_classIndex[i] >= 0 && m_classIndex[i] < classCount);
+		else
+			valid = (m_feature[i] < m_attributeCount && m_child[i] > i && m_child[i] + 1 < nodeCount);
+	}
+	if (!valid)
+	{
+		error = QObject::tr("Corrupted forest data");
+		m_roots.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool FlatForest::toFile(QString filename, const QByteArray& signature, QString& error) const
+{
+	QFile file(filename);
+	if (!file.open(QFile::WriteOnly))
+	{
+		error = QObject::tr("Failed to open file %1 for writing").arg(filename);
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+	stream.writeRawData(FlatForestMagic, sizeof(FlatForestMagic));
+	stream << FlatForestVersion;
+	stream << signature;
+	stream << serialize();
+
+	if (stream.status() != QDataStream::Ok)
+	{
+		error = QObject::tr("Failed to write file %1").arg(filename);
+		return false;
+	}
+
+	return true;
+}
+
+bool FlatForest::fromFile(QString filename, const QByteArray& signature, QString& error)
+{
+	QFile file(filename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		error = QObject::tr("Failed to open file %1").arg(filename);
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setByteOrder(QDataStream::LittleEndian);
+
+	char magic[sizeof(FlatForestMagic)];
+	qint32 version = 0;
+	if (	stream.readRawData(magic, sizeof(FlatForestMagic)) != static_cast<int>(sizeof(FlatForestMagic))
+		||	memcmp(magic, FlatForestMagic, sizeof(FlatForestMagic)) != 0)
+	{
+		error = QObject::tr("Invalid file");
+		return false;
+	}
+	stream >> version;
+	if (version != FlatForestVersion)
+	{
+		error = QObject::tr("Unhandled file version (%1)").arg(version);
+		return false;
+	}
+
+	QByteArray fileSignature;
+	stream >> fileSignature;
+	if (fileSignature != signature)
+	{
+		error = QObject::tr("The file doesn't match the classifier");
+		return false;
+	}
+
+	QByteArray data;
+	stream >> data;
+	if (stream.status() != QDataStream::Ok)
+	{
+		error = QObject::tr("Failed to read file %1").arg(filename);
+		return false;
+	}
+
+	return deserialize(reinterpret_cast<const uchar*>(data.constData()), data.size(), error);
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Qt
+#include <QByteArray>
+#include <QString>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Flattened random forest (native inference engine)
+	/** The nodes of all the trees are stored in a compact struct-of-arrays layout (split variable,
+		threshold and child offset in contiguous arrays), in breadth-first order inside each tree,
+		so that the two children of a node are contiguous. The samples are processed by blocks,
+		tree by tree, several samples at once (SIMD comparisons when available).
+
+		The prediction rules are the ones of cv::ml::DTrees (ordered variables only), so that the
+		votes are strictly identical to the OpenCV ones on the same model.
+	**/
+	class FlatForest
+	{
+	public:
+
+		//! Converts a trained forest
+		/** Returns false if the forest can't be flattened (e.g. categorical variables).
+		**/
+		bool build(const cv::Ptr<cv::ml::RTrees>& rtrees, int attributeCount, QString& error);
+
+		//! Compaction parameters
+		struct CompactionParameters
+		{
+			//! Minimum number of (training) samples reaching a node (less = the subtree is replaced by a leaf, 0 = no pruning)
+			int minSupport = 0;
+			//! Maximum ratio of changed predictions when dropping trees (< 0 = no tree is dropped)
+			float maxTreeDropChange = -1.0f;
+		};
+
+		//! Compaction report
+		struct CompactionReport
+		{
+			size_t nodeCountBefore = 0;
+			size_t nodeCountAfter = 0;
+			int treeCountBefore = 0;
+			int treeCountAfter = 0;
+			//! Accuracy on the samples before the compaction
+			double accuracyBefore = 0.0;
+			//! Accuracy on the samples after the compaction
+			double accuracyAfter = 0.0;
+		};
+
+		//! Compacts the forest
+		/** The sibling leaves voting for the same class are merged (without any change on the
+			predictions), the subtrees reached by too few samples are pruned, and the trees that
+			barely change the predictions can be dropped.
+			\param params compaction parameters
+			\param samples reference (training) samples (row-major, 'attributeCount' values per sample)
+			\param labels labels of the reference samples
+			\param sampleCount number of reference samples
+			\param report compaction report (output)
+			\param error error message (if any)
+		**/
+		bool compact(	const CompactionParameters& params,
+						const float* samples,
+						const int* labels,
+						int sampleCount,
+						CompactionReport& report,
+						QString& error);
+
+		//! Serializes the forest (binary, little endian)
+		QByteArray serialize() const;
+		//! Deserializes the forest (see serialize)
+		bool deserialize(const uchar* data, qint64 size, QString& error);
+
+		//! Saves the forest to a (binary) file
+		/** \param signature signature of the original classifier file
+		**/
+		bool toFile(QString filename, const QByteArray& signature, QString& error) const;
+		//! Loads the forest from a (binary) file
+		/** \param signature expected signature (the file is rejected if it doesn't match)
+		**/
+		bool fromFile(QString filename, const QByteArray& signature, QString& error);
+
+		//! Returns whether the forest has been built
+		inline bool isValid() const { return !m_roots.empty(); }
+
+		//! Returns the number of trees
+		inline int treeCount() const { return static_cast<int>(m_roots.size()); }
+		//! Returns the number of classes
+		inline int classCount() const { return static_cast<int>(m_classLabels.size()); }
+		//! Returns the number of attributes per sample
+		inline int attributeCount() const { return m_attributeCount; }
+		//! Returns the total number of nodes
+		inline size_t nodeCount() const { return m_feature.size(); }
+		//! Returns the class labels (per class index)
+		inline const std::vector<int>& classLabels() const { return m_classLabels; }
+
+		//! Returns the root node of each tree
+		inline const std::vector<int>& roots() const { return m_roots; }
+		//! Returns the split variable of each node (-1 for the leaves)
+		inline const std::vector<int>& features() const { return m_feature; }
+		//! Returns the split threshold of each node
+		inline const std::vector<float>& thresholds() const { return m_threshold; }
+		//! Returns the index of the left child of each node
+		inline const std::vector<int>& children() const { return m_child; }
+		//! Returns the direction of each node for the missing values (1 = left)
+		inline const std::vector<unsigned char>& defaultLeft() const { return m_defaultLeft; }
+		//! Returns the class index of each leaf (-1 for the other nodes)
+		inline const std::vector<int>& classIndexes() const { return m_classIndex; }
+
+		//! Computes the vote histograms of a block of samples
+		/** \param samples samples (row-major, 'attributeCount' values per sample)
+			\param sampleCount number of samples
+			\param votes output histograms ('sampleCount' x 'classCount', row-major)
+		**/
+		void vote(const float* samples, int sampleCount, int* votes) const;
+
+		//! Predicts the label and the confidence of a block of samples
+		/** \param votes votes buffer (resized if necessary)
+		**/
+		bool predict(	const float* samples,
+						int sampleCount,
+						int* labels,
+						float* confidences,
+						std::vector<int>& votes) const;
+
+		//! Predicts the label and the confidence of a block of samples, stopping as soon as the label is known
+		/** The trees are evaluated in a fixed order, and the evaluation of a sample stops as soon as the
+			leading class can't be overturned by the remaining trees (the label is then the same as with
+			all the trees). If 'minConfidence' is > 0, it also stops as soon as the ratio of the evaluated
+			trees that voted for the leading class reaches this value (approximate label in this case).
+			The confidence is the number of evaluated trees that voted for the predicted label, divided by the
+			total number of trees: it is a lower bound of the confidence given by predict (never over-estimated).
+			\param evaluatedTreeCount total number of evaluated trees (output)
+		**/
+		bool predictEarlyExit(	const float* samples,
+								int sampleCount,
+								int* labels,
+								float* confidences,
+								std::vector<int>& votes,
+								float minConfidence,
+								size_t& evaluatedTreeCount) const;
+
+		//! Computes the votes of a single sample whose values are only requested when a split needs them
+		/** \param value functor returning the value of a given attribute (float(int))
+			\param votes output histogram ('classCount' values, must be zeroed by the caller)
+		**/
+		template <typename ValueFunc> void voteLazy(ValueFunc&& value, int* votes) const
+		{
+			const float MissingValue = cv::ml::TrainData::missingValue();
+
+			for (int root : m_roots)
+			{
+				int nodeIndex = root;
+				int feature = m_feature[nodeIndex];
+				while (feature >= 0)
+				{
+					float v = value(feature);
+					bool left = (v == MissingValue ? m_defaultLeft[nodeIndex] != 0 : v <= m_threshold[nodeIndex]);
+					nodeIndex = m_child[nodeIndex] + (left ? 0 : 1);
+					feature = m_feature[nodeIndex];
+				}
+				++votes[m_classIndex[nodeIndex]];
+			}
+		}
+
+		//! Converts vote histograms to labels and confidences (same rules as cv::ml::DTrees)
+		static void VotesToLabels(	const int* votes,
+									int sampleCount,
+									const std::vector<int>& classLabels,
+									int treeCount,
+									int* labels,
+									float* confidences);
+
+	protected:
+
+		//! Computes the votes of a single sample (scalar code, handles the missing values)
+		void voteScalar(const float* sample, int* votes) const;
+
+		//! Number of attributes per sample
+		int m_attributeCount = 0;
+
+		//! Split variable of each node (-1 for the leaves)
+		std::vector<int> m_feature;
+		//! Split threshold of each node (the sample goes to the left child if its value is <= threshold)
+		std::vector<float> m_threshold;
+		//! Index of the left child of each node (the right child is the next one). Leaves point to themselves.
+		std::vector<int> m_child;
+		//! Direction of each node for the missing values (1 = left)
+		std::vector<unsigned char> m_defaultLeft;
+		//! Class index of each leaf (-1 for the other nodes)
+		std::vector<int> m_classIndex;
+		//! Majority class index of each internal node (-1 for the leaves or if unknown)
+		std::vector<int> m_nodeClass;
+
+		//! Root node of each tree
+		std::vector<int> m_roots;
+		//! Class labels (per class index)
+		std::vector<int> m_classLabels;
+	};
+
+}; //namespace masc
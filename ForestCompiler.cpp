@@ -0,0 +1,401 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ForestCompiler.h"
+
+//qCC_db
+#include <ccLog.h>
+
+//Qt
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QObject>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTextStream>
+
+//system
+#include <algorithm>
+#include <cassert>
+
+using namespace masc;
+
+//exported symbols
+static const char SignatureSymbol[] = "masc_forest_signature";
+static const char AttributeCountSymbol[] = "masc_forest_attribute_count";
+static const char ClassCountSymbol[] = "masc_forest_class_count";
+static const char TreeCountSymbol[] = "masc_forest_tree_count";
+static const char VoteSymbol[] = "masc_forest_vote";
+
+QString CompiledForest::ModuleBaseName(QString yamlFilename)
+{
+	QFileInfo fi(yamlFilename);
+	return fi.absoluteDir().absoluteFilePath(fi.completeBaseName() + "_forest");
+}
+
+QString CompiledForest::ModuleFilename(QString yamlFilename)
+{
+#if defined(Q_OS_WIN)
+	return ModuleBaseName(yamlFilename) + ".dll";
+#elif defined(Q_OS_MAC)
+	return ModuleBaseName(yamlFilename) + ".dylib";
+#else
+	return ModuleBaseName(yamlFilename) + ".so";
+#endif
+}
+
+QString CompiledForest::ModuleHashFilename(QString yamlFilename)
+{
+	return ModuleBaseName(yamlFilename) + ".sha256";
+}
+
+bool CompiledForest::ComputeModuleHash(QString moduleFilename, QByteArray& hash, QString& error)
+{
+	QFile file(moduleFilename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		error = QObject::tr("Failed to open file %1").arg(moduleFilename);
+		return false;
+	}
+
+	QCryptographicHash hasher(QCryptographicHash::Sha256);
+	if (!hasher.addData(&file))
+	{
+		error = QObject::tr("Failed to read file %1").arg(moduleFilename);
+		return false;
+	}
+
+	hash = hasher.result().toHex();
+	return true;
+}
+
+bool CompiledForest::ComputeSignature(QString yamlFilename, QByteArray& signature, QString& error)
+{
+	QFile file(yamlFilename);
+	if (!file.open(QFile::ReadOnly))
+	{
+		error = QObject::tr("Failed to open file %1").arg(yamlFilename);
+		return false;
+	}
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	if (!hash.addData(&file))
+	{
+		error = QObject::tr("Failed to read file %1").arg(yamlFilename);
+		return false;
+	}
+
+	signature = hash.result().toHex();
+	return true;
+}
+
+//! Writes the code of a (sub)tree
+static void WriteNode(QTextStream& stream, const FlatForest& forest, int nodeIndex, int depth, bool branchless)
+{
+	int feature = forest.features()[nodeIndex];
+	if (feature < 0)
+	{
+		//leaf
+		int classIndex = forest.classIndexes()[nodeIndex];
+		if (branchless)
+			stream << classIndex;
+		else
+			stream << QString(depth, '\t') << "return " << classIndex << ";\n";
+		return;
+	}
+
+	//the exact (float) value of the threshold is written
+	QString condition = QString("L(s[%1], %2f, %3)")
+		.arg(feature)
+		.arg(QString::number(static_cast<double>(forest.thresholds()[nodeIndex]), 'e', 9))
+		.arg(forest.defaultLeft()[nodeIndex] ? "true" : "false");
+	int left = forest.children()[nodeIndex];
+
+	if (branchless)
+	{
+		stream << "(" << condition << " ? ";
+		WriteNode(stream, forest, left, depth + 1, branchless);
+		stream << " : ";
+		WriteNode(stream, forest, left + 1, depth + 1, branchless);
+		stream << ")";
+	}
+	else
+	{
+		QString tabs(depth, '\t');
+		stream << tabs << "if (" << condition << ")\n" << tabs << "{\n";
+		WriteNode(stream, forest, left, depth + 1, branchless);
+		stream << tabs << "}\n" << tabs << "else\n" << tabs << "{\n";
+		WriteNode(stream, forest, left + 1, depth + 1, branchless);
+		stream << tabs << "}\n";
+	}
+}
+
+bool CompiledForest::GenerateSource(const FlatForest& forest,
+									const QByteArray& signature,
+									QString sourceFilename,
+									bool branchless,
+									QString& error)
+{
+	if (!forest.isValid())
+	{
+		error = QObject::tr("Invalid forest");
+		return false;
+	}
+
+	QFile file(sourceFilename);
+	if (!file.open(QFile::WriteOnly | QFile::Text))
+	{
+		error = QObject::tr("Failed to open file %1 for writing").arg(sourceFilename);
+		return false;
+	}
+
+	QTextStream stream(&file);
+	stream << "// Random forest generated by q3DMASC - do not edit\n";
+	stream << "// Classifier signature: " << signature << "\n\n";
+	stream << "#include <cfloat>\n";
+	stream << "#include <cstddef>\n\n";
+	stream << "#if defined(_WIN32)\n";
+	stream << "#define MASC_EXPORT extern \"C\" __declspec(dllexport)\n";
+	stream << "#else\n";
+	stream << "#define MASC_EXPORT extern \"C\" __attribute__((visibility(\"default\")))\n";
+	stream << "#endif\n\n";
+	stream << "static const int AttributeCount = " << forest.attributeCount() << ";\n";
+	stream << "static const int ClassCount = " << forest.classCount() << ";\n";
+	stream << "static const int TreeCount = " << forest.treeCount() << ";\n\n";
+	stream << "// same rule as cv::ml::DTrees (missing values are equal to FLT_MAX)\n";
+	stream << "static inline bool L(float v, float t, bool defaultLeft) { return v == FLT_MAX ? defaultLeft : v <= t; }\n\n";
+
+	//one function per tree (returning the class index)
+	for (int t = 0; t < forest.treeCount(); ++t)
+	{
+		stream << "static int tree" << t << "(const float* s)\n{\n";
+		if (branchless)
+		{
+			stream << "\treturn ";
+			WriteNode(stream, forest, forest.roots()[t], 1, true);
+			stream << ";\n";
+		}
+		else
+		{
+			WriteNode(stream, forest, forest.roots()[t], 1, false);
+		}
+		stream << "}\n\n";
+	}
+
+	stream << "static int (*const Trees[TreeCount])(const float*) =\n{\n";
+	for (int t = 0; t < forest.treeCount(); ++t)
+	{
+		stream << "\ttree" << t << ",\n";
+	}
+	stream << "};\n\n";
+
+	stream << "MASC_EXPORT const char* " << SignatureSymbol << "() { return \"" << signature << "\"; }\n";
+	stream << "MASC_EXPORT int " << AttributeCountSymbol << "() { return AttributeCount; }\n";
+	stream << "MASC_EXPORT int " << ClassCountSymbol << "() { return ClassCount; }\n";
+	stream << "MASC_EXPORT int " << TreeCountSymbol << "() { return TreeCount; }\n\n";
+	stream << "MASC_EXPORT void " << VoteSymbol << "(const float* samples, int sampleCount, int* votes)\n{\n";
+	stream << "\tfor (int s = 0; s < sampleCount; ++s)\n\t{\n";
+	stream << "\t\tconst float* sample = samples + static_cast<size_t>(s) * AttributeCount;\n";
+	stream << "\t\tint* sampleVotes = votes + static_cast<size_t>(s) * ClassCount;\n";
+	stream << "\t\tfor (int k = 0; k < ClassCount; ++k)\n\t\t\tsampleVotes[k] = 0;\n";
+	stream << "\t\tfor (int t = 0; t < TreeCount; ++t)\n\t\t\t++sampleVotes[Trees[t](sample)];\n";
+	stream << "\t}\n}\n";
+
+	stream.flush();
+	if (file.error() != QFile::NoError)
+	{
+		error = QObject::tr("Failed to write file %1").arg(sourceFilename);
+		return false;
+	}
+
+	return true;
+}
+
+bool CompiledForest::BuildModule(QString sourceFilename, QString moduleFilename, QString hashFilename, QString& error)
+{
+	QString compiler = QProcessEnvironment::systemEnvironment().value("Q3DMASC_CXX");
+	if (compiler.isEmpty())
+	{
+#if defined(Q_OS_WIN)
+		error = QObject::tr("No compiler specified (set the Q3DMASC_CXX environment variable)");
+		return false;
+#else
+		compiler = "c++";
+#endif
+	}
+
+	QStringList arguments;
+	if (QFileInfo(compiler).completeBaseName().compare("cl", Qt::CaseInsensitive) == 0)
+	{
+		//MSVC
+		arguments << "/nologo" << "/O2" << "/LD" << sourceFilename << "/Fe:" + moduleFilename;
+	}
+	else
+	{
+		arguments << "-O2" << "-shared" << "-fPIC" << "-o" << moduleFilename << sourceFilename;
+	}
+
+	ccLog::Print(QObject::tr("[3DMASC] Building the forest module: %1 %2").arg(compiler, arguments.join(' ')));
+
+	QProcess process;
+	process.setProcessChannelMode(QProcess::MergedChannels);
+	process.setWorkingDirectory(QFileInfo(moduleFilename).absolutePath());
+	process.start(compiler, arguments);
+	if (!process.waitForStarted())
+	{
+		error = QObject::tr("Failed to start the compiler (%1)").arg(compiler);
+		return false;
+	}
+	process.waitForFinished(-1);
+
+	if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+	{
+		ccLog::Warning(QString::fromLocal8Bit(process.readAll()));
+		error = QObject::tr("Failed to build the forest module");
+		return false;
+	}
+
+	//record the hash of the module (it won't be loaded otherwise)
+	QByteArray hash;
+	if (!ComputeModuleHash(moduleFilename, hash, error))
+	{
+		return false;
+	}
+	QFile hashFile(hashFilename);
+	if (!hashFile.open(QFile::WriteOnly | QFile::Truncate) || hashFile.write(hash) != hash.size())
+	{
+		error = QObject::tr("Failed to write file %1").arg(hashFilename);
+		return false;
+	}
+
+	return true;
+}
+
+bool CompiledForest::load(QString yamlFilename, const FlatForest& reference, QString& error)
+{
+	m_vote = nullptr;
+	if (m_library.isLoaded())
+	{
+		m_library.unload();
+	}
+
+	QString moduleFilename = ModuleFilename(yamlFilename);
+	if (!QFileInfo(moduleFilename).exists())
+	{
+		error = QObject::tr("No compiled forest");
+		return false;
+	}
+
+	//loading the module runs its code: it must be the one that was built (see BuildModule)
+	QFile hashFile(ModuleHashFilename(yamlFilename));
+	if (!hashFile.open(QFile::ReadOnly))
+	{
+		error = QObject::tr("No recorded hash for the compiled forest");
+		return false;
+	}
+	QByteArray recordedHash = hashFile.readAll().trimmed();
+	QByteArray moduleHash;
+	if (!ComputeModuleHash(moduleFilename, moduleHash, error))
+	{
+		return false;
+	}
+	if (recordedHash.isEmpty() || moduleHash != recordedHash)
+	{
+		error = QObject::tr("The forest module doesn't match the recorded hash");
+		return false;
+	}
+
+	m_library.setFileName(moduleFilename);
+	if (!m_library.load())
+	{
+		error = m_library.errorString();
+		return false;
+	}
+
+	using SignatureFunction = const char* (*)();
+	using CountFunction = int (*)();
+	SignatureFunction signatureFunction = reinterpret_cast<SignatureFunction>(m_library.resolve(SignatureSymbol));
+	CountFunction attributeCountFunction = reinterpret_cast<CountFunction>(m_library.resolve(AttributeCountSymbol));
+	CountFunction classCountFunction = reinterpret_cast<CountFunction>(m_library.resolve(ClassCountSymbol));
+	CountFunction treeCountFunction = reinterpret_cast<CountFunction>(m_library.resolve(TreeCountSymbol));
+	VoteFunction voteFunction = reinterpret_cast<VoteFunction>(m_library.resolve(VoteSymbol));
+	if (!signatureFunction || !attributeCountFunction || !classCountFunction || !treeCountFunction || !voteFunction)
+	{
+		error = QObject::tr("Invalid forest module");
+		m_library.unload();
+		return false;
+	}
+
+	//make sure the module is not stale
+	QByteArray signature;
+	if (!ComputeSignature(yamlFilename, signature, error))
+	{
+		m_library.unload();
+		return false;
+	}
+	if (signature != QByteArray(signatureFunction()))
+	{
+		error = QObject::tr("The forest module is outdated");
+		m_library.unload();
+		return false;
+	}
+	if (	attributeCountFunction() != reference.attributeCount()
+		||	classCountFunction() != reference.classCount()
+		||	treeCountFunction() != reference.treeCount())
+	{
+		error = QObject::tr("The forest module doesn't match the classifier");
+		m_library.unload();
+		return false;
+	}
+
+	m_vote = voteFunction;
+	m_treeCount = reference.treeCount();
+	m_classLabels = reference.classLabels();
+
+	return true;
+}
+
+bool CompiledForest::predict(	const float* samples,
+								int sampleCount,
+								int* labels,
+								float* confidences,
+								std::vector<int>& votes) const
+{
+	if (!m_vote || !samples || !labels || !confidences)
+	{
+		assert(false);
+		return false;
+	}
+
+	size_t classCount = m_classLabels.size();
+	try
+	{
+		votes.resize(static_cast<size_t>(sampleCount) * classCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	m_vote(samples, sampleCount, votes.data());
+
+	FlatForest::VotesToLabels(votes.data(), sampleCount, m_classLabels, m_treeCount, labels, confidences);
+
+	return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FlatForest.h"
+
+//Qt
+#include <QLibrary>
+#include <QString>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Random forest compiled to native code
+	/** A trained forest can be converted to a C++ translation unit (one function per tree, made of
+		if-trees), to be built as a small shared module next to the classifier file. At classify time,
+		and only if the compiled engine has been requested, the module is loaded if its hash matches the
+		one recorded when it was built, and if it has been generated from the same classifier file
+		(otherwise the interpreted engines are used).
+	**/
+	class CompiledForest
+	{
+	public:
+
+		//! Returns the base name of the module (without extension) associated to a classifier (YAML) file
+		static QString ModuleBaseName(QString yamlFilename);
+		//! Returns the (platform specific) filename of the module associated to a classifier (YAML) file
+		static QString ModuleFilename(QString yamlFilename);
+		//! Returns the filename of the hash of the module, recorded when the module is built
+		static QString ModuleHashFilename(QString yamlFilename);
+
+		//! Computes the signature of a classifier (YAML) file
+		/** The signature is stored in the generated module, to detect stale modules.
+		**/
+		static bool ComputeSignature(QString yamlFilename, QByteArray& signature, QString& error);
+
+		//! Generates the C++ source code of a forest
+		/** \param forest flattened forest
+			\param signature signature of the classifier file
+			\param sourceFilename output filename (.cpp)
+			\param branchless whether the trees should be written as (nested) conditional expressions instead of if/else blocks
+			\param error error message (if any)
+		**/
+		static bool GenerateSource(	const FlatForest& forest,
+									const QByteArray& signature,
+									QString sourceFilename,
+									bool branchless,
+									QString& error);
+
+		//! Builds the shared module from the generated source
+		/** The compiler is given by the Q3DMASC_CXX environment variable (default: 'c++', except on Windows).
+			The hash of the module is saved in 'hashFilename' (see ModuleHashFilename).
+		**/
+		static bool BuildModule(QString sourceFilename, QString moduleFilename, QString hashFilename, QString& error);
+
+		//! Computes the hash of a module file
+		static bool ComputeModuleHash(QString moduleFilename, QByteArray& hash, QString& error);
+
+		//! Loads the module associated to a classifier (YAML) file
+		/** The module file must match the recorded hash (checked before the module is loaded, as loading it
+			already runs its code), must have been generated from the same file, and must match the reference
+			(flattened) forest.
+		**/
+		bool load(QString yamlFilename, const FlatForest& reference, QString& error);
+
+		//! Returns whether the module is loaded
+		inline bool isValid() const { return m_vote != nullptr; }
+
+		//! Predicts the label and the confidence of a block of samples
+		bool predict(	const float* samples,
+						int sampleCount,
+						int* labels,
+						float* confidences,
+						std::vector<int>& votes) const;
+
+	protected:
+
+		//! Vote function (exported by the module)
+		using VoteFunction = void (*)(const float* samples, int sampleCount, int* votes);
+
+		//! Module
+		QLibrary m_library;
+		//! Vote function
+		VoteFunction m_vote = nullptr;
+		//! Number of trees
+		int m_treeCount = 0;
+		//! Class labels (per class index)
+		std::vector<int> m_classLabels;
+	};
+
+}; //namespace masc
@@ -0,0 +1,490 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ForestPredictor.h"
+
+//qCC_db
+#include <ccLog.h>
+
+//Qt
+#include <QFileInfo>
+#include <QObject>
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace masc;
+
+bool ForestPredictor::Buffers::init(int blockSize, int attributeCount, int codeSize/*=0*/)
+{
+	try
+	{
+		//the binned samples are directly encoded (no need for the float values)
+		samples.resize(codeSize == 0 ? static_cast<size_t>(blockSize) * attributeCount : 0);
+		labels.resize(blockSize);
+		confidences.resize(blockSize);
+		codes.resize(static_cast<size_t>(blockSize) * attributeCount * codeSize);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool ForestPredictor::init(	const cv::Ptr<cv::ml::RTrees>& rtrees,
+							int attributeCount,
+							QString& error,
+							Engine engine/*=Engine::FlatForest*/,
+							QString yamlFilename/*=QString()*/)
+{
+	m_rtrees = rtrees;
+	m_direct = false;
+	m_useFlatForest = false;
+	m_useCompiledForest = false;
+	m_useBinnedForest = false;
+	m_attributeCount = attributeCount;
+	m_roots.clear();
+	m_nodes.clear();
+	m_splits.clear();
+	m_classLabels.clear();
+
+	if (!m_rtrees)
+	{
+		//flattened forest only (e.g. loaded from a bundle)
+		if (!m_forestOverride || !m_forestOverride->isValid() || m_forestOverride->attributeCount() != attributeCount)
+		{
+			error = QObject::tr("Invalid classifier");
+			return false;
+		}
+		if (engine == Engine::OpenCV)
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] No OpenCV model, the flattened forest will be used"));
+			engine = Engine::FlatForest;
+		}
+		m_classLabels = m_forestOverride->classLabels();
+		m_direct = true;
+	}
+	else
+	{
+		if (!m_rtrees->isTrained() || !m_rtrees->isClassifier() || attributeCount <= 0)
+		{
+			error = QObject::tr("Invalid classifier");
+			return false;
+		}
+
+		try
+		{
+			m_roots = m_rtrees->getRoots();
+			m_nodes = m_rtrees->getNodes();
+			m_splits = m_rtrees->getSplits();
+
+			//the class labels (per class index) are given by the first row of the votes matrix
+			cv::Mat sample = cv::Mat::zeros(1, attributeCount, CV_32FC1);
+			cv::Mat votes;
+			m_rtrees->getVotes(sample, votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+			m_classLabels.resize(votes.cols);
+			for (int col = 0; col < votes.cols; ++col)
+			{
+				m_classLabels[col] = votes.at<int>(0, col);
+			}
+		}
+		catch (const cv::Exception& cvex)
+		{
+			error = cvex.msg.c_str();
+			return false;
+		}
+		catch (const std::bad_alloc&)
+		{
+			error = QObject::tr("Not enough memory");
+			return false;
+		}
+
+		//the trees can only be traversed directly if all the variables are ordered (no categorical split),
+		//and if the split variable indexes are the columns of the samples (see FlatForest::build)
+		m_direct = m_rtrees->getSubsets().empty() && m_rtrees->getVarCount() == attributeCount && !m_roots.empty() && !m_classLabels.empty();
+		for (const cv::ml::DTrees::Split& split : m_splits)
+		{
+			if (split.varIdx < 0 || split.varIdx >= attributeCount)
+			{
+				m_direct = false;
+				break;
+			}
+		}
+	}
+
+	if (!m_direct)
+	{
+		ccLog::Warning(QObject::tr("[3DMASC] The classifier will use the (slower) OpenCV prediction methods"));
+	}
+	else if (engine != Engine::OpenCV)
+	{
+		if (m_forestOverride)
+		{
+			//the given forest replaces the original one (no comparison with OpenCV in this case)
+			m_flatForest = *m_forestOverride;
+			m_useFlatForest = true;
+			ccLog::Print(QObject::tr("[3DMASC] Flattened forest: %1 trees, %2 nodes").arg(m_flatForest.treeCount()).arg(m_flatForest.nodeCount()));
+		}
+		else
+		{
+			QString flatError;
+			if (!m_flatForest.build(m_rtrees, attributeCount, flatError))
+			{
+				ccLog::Warning(QObject::tr("[3DMASC] Failed to flatten the forest (%1), the standard traversal will be used").arg(flatError));
+			}
+			else
+			{
+				m_useFlatForest = true;
+				if (!checkAgainstReference())
+				{
+					m_useFlatForest = false;
+					ccLog::Warning(QObject::tr("[3DMASC] The flattened forest results differ from OpenCV, the standard traversal will be used"));
+				}
+				else
+				{
+					ccLog::Print(QObject::tr("[3DMASC] Flattened forest: %1 trees, %2 nodes").arg(m_flatForest.treeCount()).arg(m_flatForest.nodeCount()));
+				}
+			}
+		}
+
+		if (m_useFlatForest && engine == Engine::BinnedFeatures)
+		{
+			QString binnedError;
+			if (!m_binnedForest.build(m_flatForest, binnedError))
+			{
+				ccLog::Warning(QObject::tr("[3DMASC] Failed to bin the features (%1), the flattened forest will be used").arg(binnedError));
+			}
+			else
+			{
+				m_useBinnedForest = true;
+				if (!checkAgainstReference())
+				{
+					m_useBinnedForest = false;
+					ccLog::Warning(QObject::tr("[3DMASC] The binned forest results differ from the reference, the flattened forest will be used"));
+				}
+				else
+				{
+					ccLog::Print(QObject::tr("[3DMASC] Binned features: %1 byte(s) per value").arg(m_binnedForest.codeSize()));
+				}
+			}
+		}
+
+		//look for a compiled version of the forest (only on explicit request, as the module is native code)
+		if (m_useFlatForest && engine == Engine::CompiledForest && !yamlFilename.isEmpty())
+		{
+			QString compiledError;
+			if (m_compiledForest.load(yamlFilename, m_flatForest, compiledError))
+			{
+				m_useCompiledForest = true;
+				if (!checkAgainstReference())
+				{
+					m_useCompiledForest = false;
+					ccLog::Warning(QObject::tr("[3DMASC] The compiled forest results differ from the reference, it will be ignored"));
+				}
+				else
+				{
+					ccLog::Print(QObject::tr("[3DMASC] Compiled forest loaded from %1").arg(CompiledForest::ModuleFilename(yamlFilename)));
+				}
+			}
+			else
+			{
+				ccLog::Warning(QObject::tr("[3DMASC] The compiled forest can't be used (%1), the interpreted version will be used").arg(compiledError));
+			}
+		}
+	}
+
+	return true;
+}
+
+bool ForestPredictor::checkAgainstReference() const
+{
+	static const int SampleCount = 256;
+	try
+	{
+		//thresholds of the splits, per variable (the real values are generally far from the thresholds
+		//range, so the samples must be drawn around the thresholds to exercise both sides of the splits)
+		std::vector<std::vector<float>> thresholds(m_attributeCount);
+		for (size_t i = 0; i < m_flatForest.features().size(); ++i)
+		{
+			int feature = m_flatForest.features()[i];
+			if (feature >= 0 && feature < m_attributeCount)
+			{
+				thresholds[feature].push_back(m_flatForest.thresholds()[i]);
+			}
+		}
+
+		//deterministic pseudo-random samples (some of them with missing values)
+		std::vector<float> samples(static_cast<size_t>(SampleCount) * m_attributeCount);
+		unsigned state = 12345u;
+		auto next = [&state]() { state = state * 1664525u + 1013904223u; return state >> 8; };
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			const std::vector<float>& varThresholds = thresholds[i % m_attributeCount];
+			unsigned r = next();
+			if (r % 97 == 0)
+			{
+				samples[i] = cv::ml::TrainData::missingValue();
+			}
+			else if (varThresholds.empty())
+			{
+				samples[i] = static_cast<float>(r) / static_cast<float>(1 << 24) * 2.0f - 1.0f;
+			}
+			else
+			{
+				//a threshold of the variable, exactly or slightly below/above it
+				float threshold = varThresholds[next() % varThresholds.size()];
+				float epsilon = 1.0e-3f * std::max(1.0f, std::abs(threshold));
+				switch (r % 5)
+				{
+				case 0:
+					samples[i] = threshold;
+					break;
+				case 1:
+					samples[i] = std::nextafter(threshold, -std::numeric_limits<float>::infinity());
+					break;
+				case 2:
+					samples[i] = std::nextafter(threshold, std::numeric_limits<float>::infinity());
+					break;
+				case 3:
+					samples[i] = threshold - epsilon;
+					break;
+				default:
+					samples[i] = threshold + epsilon;
+					break;
+				}
+			}
+		}
+
+		std::vector<int> nativeLabels(SampleCount), referenceLabels(SampleCount);
+		std::vector<float> nativeConfidences(SampleCount), referenceConfidences(SampleCount);
+		std::vector<int> votes;
+		if (!predictAllTrees(samples.data(), SampleCount, nativeLabels.data(), nativeConfidences.data(), votes))
+		{
+			return false;
+		}
+
+		bool referenceSuccess = false;
+		if (m_forestOverride)
+		{
+			referenceSuccess = m_forestOverride->predict(samples.data(), SampleCount, referenceLabels.data(), referenceConfidences.data(), votes);
+		}
+		else
+		{
+			referenceSuccess = predictWithOpenCV(samples.data(), SampleCount, referenceLabels.data(), referenceConfidences.data());
+		}
+		if (!referenceSuccess)
+		{
+			return false;
+		}
+
+		return nativeLabels == referenceLabels && nativeConfidences == referenceConfidences;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+}
+
+bool ForestPredictor::predict(	const float* samples,
+								int sampleCount,
+								int* labels,
+								float* confidences,
+								std::vector<int>& votes) const
+{
+	if ((!m_rtrees && !m_useFlatForest) || !samples || !labels || !confidences)
+	{
+		assert(false);
+		return false;
+	}
+
+	if (usesEarlyExit())
+	{
+		size_t evaluatedTreeCount = 0;
+		if (!m_flatForest.predictEarlyExit(samples, sampleCount, labels, confidences, votes, m_earlyExitMinConfidence, evaluatedTreeCount))
+		{
+			return false;
+		}
+		m_evaluatedTreeCount += evaluatedTreeCount;
+		m_earlyExitSampleCount += sampleCount;
+		return true;
+	}
+
+	return predictAllTrees(samples, sampleCount, labels, confidences, votes);
+}
+
+bool ForestPredictor::predictAllTrees(	const float* samples,
+										int sampleCount,
+										int* labels,
+										float* confidences,
+										std::vector<int>& votes) const
+{
+	if (!m_direct)
+	{
+		return predictWithOpenCV(samples, sampleCount, labels, confidences);
+	}
+
+	if (m_useBinnedForest)
+	{
+		std::vector<unsigned char> codes;
+		try
+		{
+			codes.resize(static_cast<size_t>(sampleCount) * m_attributeCount * m_binnedForest.codeSize());
+		}
+		catch (const std::bad_alloc&)
+		{
+			return false;
+		}
+		m_binnedForest.encode(samples, sampleCount, codes.data());
+		return m_binnedForest.predict(codes.data(), sampleCount, labels, confidences, votes);
+	}
+
+	if (m_useCompiledForest)
+	{
+		return m_compiledForest.predict(samples, sampleCount, labels, confidences, votes);
+	}
+
+	if (m_useFlatForest)
+	{
+		return m_flatForest.predict(samples, sampleCount, labels, confidences, votes);
+	}
+
+	size_t classCount = m_classLabels.size();
+	try
+	{
+		votes.resize(classCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	const float MissingValue = cv::ml::TrainData::missingValue();
+	const int treeCount = static_cast<int>(m_roots.size());
+
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		const float* sample = samples + static_cast<size_t>(s) * m_attributeCount;
+		std::fill(votes.begin(), votes.end(), 0);
+
+		//same traversal as cv::ml::DTrees (ordered variables)
+		for (int root : m_roots)
+		{
+			int nodeIndex = root;
+			for (;;)
+			{
+				const cv::ml::DTrees::Node& node = m_nodes[nodeIndex];
+				if (node.split < 0)
+				{
+					break;
+				}
+				const cv::ml::DTrees::Split& split = m_splits[node.split];
+				float value = sample[split.varIdx];
+				if (value == MissingValue)
+				{
+					nodeIndex = (node.defaultDir < 0 ? node.left : node.right);
+				}
+				else
+				{
+					nodeIndex = (value <= split.c ? node.left : node.right);
+				}
+			}
+			++votes[m_nodes[nodeIndex].classIdx];
+		}
+
+		//the first class with the maximum number of votes wins (as with cv::ml::DTrees)
+		size_t bestIndex = 0;
+		for (size_t k = 1; k < classCount; ++k)
+		{
+			if (votes[bestIndex] < votes[k])
+			{
+				bestIndex = k;
+			}
+		}
+
+		labels[s] = m_classLabels[bestIndex];
+		confidences[s] = static_cast<float>(votes[bestIndex]) / treeCount;
+	}
+
+	return true;
+}
+
+double ForestPredictor::evaluatedTreeRatio() const
+{
+	size_t sampleCount = m_earlyExitSampleCount;
+	if (sampleCount == 0 || m_flatForest.treeCount() == 0)
+	{
+		return 1.0;
+	}
+	return static_cast<double>(m_evaluatedTreeCount) / (static_cast<double>(sampleCount) * m_flatForest.treeCount());
+}
+
+bool ForestPredictor::predictBinned(	const void* codes,
+									int sampleCount,
+									int* labels,
+									float* confidences,
+									std::vector<int>& votes) const
+{
+	if (!m_useBinnedForest)
+	{
+		assert(false);
+		return false;
+	}
+
+	return m_binnedForest.predict(codes, sampleCount, labels, confidences, votes);
+}
+
+bool ForestPredictor::predictWithOpenCV(const float* samples, int sampleCount, int* labels, float* confidences) const
+{
+	try
+	{
+		cv::Mat block(sampleCount, m_attributeCount, CV_32FC1, const_cast<float*>(samples));
+
+		cv::Mat predictions;
+		m_rtrees->predict(block, predictions, cv::ml::DTrees::PREDICT_MAX_VOTE);
+		cv::Mat votes;
+		m_rtrees->getVotes(block, votes, cv::ml::DTrees::PREDICT_MAX_VOTE);
+
+		int treeCount = static_cast<int>(m_roots.size());
+		for (int s = 0; s < sampleCount; ++s)
+		{
+			int predictedClass = static_cast<int>(predictions.at<float>(s));
+			labels[s] = predictedClass;
+			confidences[s] = std::numeric_limits<float>::quiet_NaN();
+
+			// look for the index of the predicted class
+			for (int col = 0; col < votes.cols; ++col)
+			{
+				if (predictedClass == votes.at<int>(0, col))
+				{
+					confidences[s] = static_cast<float>(votes.at<int>(s + 1, col)) / treeCount;
+					break;
+				}
+			}
+		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		ccLog::Warning(QString("[3DMASC] Prediction failed: ") + cvex.msg.c_str());
+		return false;
+	}
+
+	return true;
+}
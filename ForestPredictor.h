@@ -0,0 +1,197 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "BinnedForest.h"
+#include "FlatForest.h"
+#include "ForestCompiler.h"
+
+//Qt
+#include <QString>
+
+//OpenCV
+#include <opencv2/ml.hpp>
+
+//system
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace masc
+{
+	//! Random forest predictor
+	/** The predicted label and its number of votes (i.e. the confidence) are obtained with a single
+		traversal of each tree (instead of calling RTrees::predict and then RTrees::getVotes, which
+		traverse the whole forest twice). The samples are processed by blocks.
+	**/
+	class ForestPredictor
+	{
+	public:
+
+		//! Default number of samples predicted at once
+		static constexpr int DefaultBlockSize = 1024;
+
+		//! Buffers used by a single thread (to be reused from one block to the other)
+		struct Buffers
+		{
+			//! Samples (row-major, one row per sample)
+			std::vector<float> samples;
+			//! Predicted labels
+			std::vector<int> labels;
+			//! Confidence (= ratio of trees that voted for the predicted label)
+			std::vector<float> confidences;
+			//! Votes per class
+			std::vector<int> votes;
+			//! Binned samples (see BinnedForest)
+			std::vector<unsigned char> codes;
+
+			//! Allocates the buffers
+			/** \param codeSize size of the binned values (0 if the samples are not binned, otherwise the float samples are not allocated)
+			**/
+			bool init(int blockSize, int attributeCount, int codeSize = 0);
+		};
+
+		//! Inference engine
+		enum class Engine
+		{
+			OpenCV,			/*!< OpenCV trees (nodes traversed directly when possible) */
+			FlatForest,		/*!< Flattened forest (native engine, same results as OpenCV) */
+			BinnedFeatures,	/*!< Flattened forest working on binned features (same results as OpenCV) */
+			CompiledForest	/*!< Native module generated from the forest (see CompiledForest, must be explicitly requested as it runs external code) */
+		};
+
+		//! Initializes the predictor with a trained forest
+		/** \param engine requested inference engine (the predictor falls back to the next simpler engine if it can't be used)
+			\param yamlFilename classifier file (to look for a compiled version of the forest with the CompiledForest engine)
+		**/
+		bool init(	const cv::Ptr<cv::ml::RTrees>& rtrees,
+					int attributeCount,
+					QString& error,
+					Engine engine = Engine::FlatForest,
+					QString yamlFilename = QString());
+
+		//! Returns whether the flattened forest engine is used
+		inline bool usesFlatForest() const { return m_useFlatForest; }
+		//! Sets a flattened forest to be used instead of the OpenCV one (compacted forest, forest loaded from a bundle, etc.)
+		/** Must be called before init. Ignored with the OpenCV engine (if the OpenCV model is available).
+		**/
+		inline void setForestOverride(std::shared_ptr<const FlatForest> forest) { m_forestOverride = forest; }
+
+		//! Enables the early-exit mode (flattened forest engine only)
+		/** See FlatForest::predictEarlyExit.
+			\param minConfidence confidence threshold (0 = the predicted labels are exact)
+		**/
+		inline void setEarlyExit(bool enabled, float minConfidence = 0.0f) { m_earlyExit = enabled; m_earlyExitMinConfidence = minConfidence; }
+		//! Returns whether the early-exit mode is active
+		inline bool usesEarlyExit() const { return m_earlyExit && m_useFlatForest && !m_useBinnedForest; }
+		//! Returns the ratio of trees actually evaluated (early-exit mode)
+		double evaluatedTreeRatio() const;
+
+		//! Returns whether the compiled forest is used
+		inline bool usesCompiledForest() const { return m_useCompiledForest; }
+
+		//! Returns the binned forest if the samples should be binned (nullptr otherwise)
+		/** In this case, the samples can be binned directly (see BinnedForest::encode) and predicted with predictBinned.
+		**/
+		inline const BinnedForest* binnedForest() const { return m_useBinnedForest ? &m_binnedForest : nullptr; }
+
+		//! Returns the number of attributes per sample
+		inline int attributeCount() const { return m_attributeCount; }
+
+		//! Returns the number of trees
+		inline int treeCount() const { return m_useFlatForest ? m_flatForest.treeCount() : static_cast<int>(m_roots.size()); }
+
+		//! Predicts the label and the confidence of a block of samples
+		/** \param samples samples (row-major, 'attributeCount' values per sample)
+			\param sampleCount number of samples
+			\param labels output labels (at least 'sampleCount' values)
+			\param confidences output confidences (at least 'sampleCount' values)
+			\param votes votes buffer
+		**/
+		bool predict(	const float* samples,
+						int sampleCount,
+						int* labels,
+						float* confidences,
+						std::vector<int>& votes) const;
+
+		//! Predicts the label and the confidence of a block of binned samples (see binnedForest)
+		bool predictBinned(	const void* codes,
+							int sampleCount,
+							int* labels,
+							float* confidences,
+							std::vector<int>& votes) const;
+
+	protected:
+
+		//! Predicts a block of samples with all the trees (current engine)
+		bool predictAllTrees(	const float* samples,
+								int sampleCount,
+								int* labels,
+								float* confidences,
+								std::vector<int>& votes) const;
+
+		//! Checks that the current (native) engine gives the same results as the reference on a few samples
+		/** The reference is OpenCV, or the forest override if any. The values of the samples are drawn
+			around the thresholds of the splits (requires the flattened forest).
+		**/
+		bool checkAgainstReference() const;
+
+		//! Predicts a block of samples with the OpenCV methods (fallback)
+		bool predictWithOpenCV(const float* samples, int sampleCount, int* labels, float* confidences) const;
+
+		//! Random trees (OpenCV)
+		cv::Ptr<cv::ml::RTrees> m_rtrees;
+		//! Whether the trees can be traversed directly (ordered variables only)
+		bool m_direct = false;
+		//! Flattened forest
+		FlatForest m_flatForest;
+		//! Flattened forest to be used instead of the OpenCV one (optional)
+		std::shared_ptr<const FlatForest> m_forestOverride;
+		//! Whether the flattened forest is used
+		bool m_useFlatForest = false;
+		//! Compiled forest
+		CompiledForest m_compiledForest;
+		//! Whether the compiled forest is used
+		bool m_useCompiledForest = false;
+		//! Binned forest
+		BinnedForest m_binnedForest;
+		//! Whether the binned forest is used
+		bool m_useBinnedForest = false;
+		//! Whether the early-exit mode is enabled
+		bool m_earlyExit = false;
+		//! Early-exit confidence threshold
+		float m_earlyExitMinConfidence = 0.0f;
+		//! Number of evaluated trees (early-exit mode)
+		mutable std::atomic<size_t> m_evaluatedTreeCount{ 0 };
+		//! Number of predicted samples (early-exit mode)
+		mutable std::atomic<size_t> m_earlyExitSampleCount{ 0 };
+		//! Number of attributes per sample
+		int m_attributeCount = 0;
+
+		//! Root node of each tree
+		std::vector<int> m_roots;
+		//! Nodes
+		std::vector<cv::ml::DTrees::Node> m_nodes;
+		//! Splits
+		std::vector<cv::ml::DTrees::Split> m_splits;
+		//! Class labels (per class index)
+		std::vector<int> m_classLabels;
+	};
+
+}; //namespace masc
@@ -0,0 +1,563 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "GeometryKernel.h"
+
+//Local
+#include "CpuFeatures.h"
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+using namespace masc;
+
+static inline bool IsZero(double value)
+{
+	return std::abs(value) < std::numeric_limits<double>::epsilon();
+}
+
+static void AccumulateScalar(const double* x, const double* y, const double* z, size_t count, LocalGeometry::Sums& s)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		double vx = x[i];
+		double vy = y[i];
+		double vz = z[i];
+		s.x += vx;
+		s.y += vy;
+		s.z += vz;
+		s.xx += vx * vx;
+		s.xy += vx * vy;
+		s.xz += vx * vz;
+		s.yy += vy * vy;
+		s.yz += vy * vz;
+		s.zz += vz * vz;
+	}
+}
+
+#if defined(MASC_X86_SIMD)
+
+static void AccumulateSSE2(const double* x, const double* y, const double* z, size_t count, LocalGeometry::Sums& s)
+{
+	__m128d sx = _mm_setzero_pd(), sy = _mm_setzero_pd(), sz = _mm_setzero_pd();
+	__m128d sxx = _mm_setzero_pd(), sxy = _mm_setzero_pd(), sxz = _mm_setzero_pd();
+	__m128d syy = _mm_setzero_pd(), syz = _mm_setzero_pd(), szz = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128d vx = _mm_loadu_pd(x + i);
+		__m128d vy = _mm_loadu_pd(y + i);
+		__m128d vz = _mm_loadu_pd(z + i);
+		sx = _mm_add_pd(sx, vx);
+		sy = _mm_add_pd(sy, vy);
+		sz = _mm_add_pd(sz, vz);
+		sxx = _mm_add_pd(sxx, _mm_mul_pd(vx, vx));
+		sxy = _mm_add_pd(sxy, _mm_mul_pd(vx, vy));
+		sxz = _mm_add_pd(sxz, _mm_mul_pd(vx, vz));
+		syy = _mm_add_pd(syy, _mm_mul_pd(vy, vy));
+		syz = _mm_add_pd(syz, _mm_mul_pd(vy, vz));
+		szz = _mm_add_pd(szz, _mm_mul_pd(vz, vz));
+	}
+
+	double lanes[9][2];
+	_mm_storeu_pd(lanes[0], sx);
+	_mm_storeu_pd(lanes[1], sy);
+	_mm_storeu_pd(lanes[2], sz);
+	_mm_storeu_pd(lanes[3], sxx);
+	_mm_storeu_pd(lanes[4], sxy);
+	_mm_storeu_pd(lanes[5], sxz);
+	_mm_storeu_pd(lanes[6], syy);
+	_mm_storeu_pd(lanes[7], syz);
+	_mm_storeu_pd(lanes[8], szz);
+
+	s.x += lanes[0][0] + lanes[0][1];
+	s.y += lanes[1][0] + lanes[1][1];
+	s.z += lanes[2][0] + lanes[2][1];
+	s.xx += lanes[3][0] + lanes[3][1];
+	s.xy += lanes[4][0] + lanes[4][1];
+	s.xz += lanes[5][0] + lanes[5][1];
+	s.yy += lanes[6][0] + lanes[6][1];
+	s.yz += lanes[7][0] + lanes[7][1];
+	s.zz += lanes[8][0] + lanes[8][1];
+
+	//remaining point (if any)
+	AccumulateScalar(x + i, y + i, z + i, count - i, s);
+}
+
+MASC_TARGET_AVX2 static void AccumulateAVX2(const double* x, const double* y, const double* z, size_t count, LocalGeometry::Sums& s)
+{
+	__m256d sx = _mm256_setzero_pd(), sy = _mm256_setzero_pd(), sz = _mm256_setzero_pd();
+	__m256d sxx = _mm256_setzero_pd(), sxy = _mm256_setzero_pd(), sxz = _mm256_setzero_pd();
+	__m256d syy = _mm256_setzero_pd(), syz = _mm256_setzero_pd(), szz = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256d vx = _mm256_loadu_pd(x + i);
+		__m256d vy = _mm256_loadu_pd(y + i);
+		__m256d vz = _mm256_loadu_pd(z + i);
+		sx = _mm256_add_pd(sx, vx);
+		sy = _mm256_add_pd(sy, vy);
+		sz = _mm256_add_pd(sz, vz);
+		sxx = _mm256_fmadd_pd(vx, vx, sxx);
+		sxy = _mm256_fmadd_pd(vx, vy, sxy);
+		sxz = _mm256_fmadd_pd(vx, vz, sxz);
+		syy = _mm256_fmadd_pd(vy, vy, syy);
+		syz = _mm256_fmadd_pd(vy, vz, syz);
+		szz = _mm256_fmadd_pd(vz, vz, szz);
+	}
+
+	double lanes[9][4];
+	_mm256_storeu_pd(lanes[0], sx);
+	_mm256_storeu_pd(lanes[1], sy);
+	_mm256_storeu_pd(lanes[2], sz);
+	_mm256_storeu_pd(lanes[3], sxx);
+	_mm256_storeu_pd(lanes[4], sxy);
+	_mm256_storeu_pd(lanes[5], sxz);
+	_mm256_storeu_pd(lanes[6], syy);
+	_mm256_storeu_pd(lanes[7], syz);
+	_mm256_storeu_pd(lanes[8], szz);
+
+	double* sums[9] = { &s.x, &s.y, &s.z, &s.xx, &s.xy, &s.xz, &s.yy, &s.yz, &s.zz };
+	for (int k = 0; k < 9; ++k)
+	{
+		*sums[k] += (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+	}
+
+	//remaining points (if any)
+	AccumulateScalar(x + i, y + i, z + i, count - i, s);
+}
+
+#endif //MASC_X86_SIMD
+
+void LocalGeometry::Accumulate(const double* x, const double* y, const double* z, size_t count, Sums& sums)
+{
+#if defined(MASC_X86_SIMD)
+	switch (Cpu::BestInstructionSet())
+	{
+	case Cpu::InstructionSet::AVX2:
+		AccumulateAVX2(x, y, z, count, sums);
+		return;
+	case Cpu::InstructionSet::SSE2:
+		AccumulateSSE2(x, y, z, count, sums);
+		return;
+	default:
+		break;
+	}
+#endif
+	AccumulateScalar(x, y, z, count, sums);
+}
+
+//Helpers for the eigen decomposition
+static inline void Cross(const double a[3], const double b[3], double out[3])
+{
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline double Dot(const double a[3], const double b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void Normalize(double v[3])
+{
+	double n = std::sqrt(Dot(v, v));
+	if (n > 0)
+	{
+		v[0] /= n;
+		v[1] /= n;
+		v[2] /= n;
+	}
+}
+
+//! Builds an orthonormal basis (U, V) of the plane orthogonal to the (unit) vector W
+static void OrthogonalComplement(const double W[3], double U[3], double V[3])
+{
+	if (std::abs(W[0]) > std::abs(W[1]))
+	{
+		double invLength = 1.0 / std::sqrt(W[0] * W[0] + W[2] * W[2]);
+		U[0] = -W[2] * invLength;
+		U[1] = 0;
+		U[2] = W[0] * invLength;
+	}
+	else
+	{
+		double invLength = 1.0 / std::sqrt(W[1] * W[1] + W[2] * W[2]);
+		U[0] = 0;
+		U[1] = W[2] * invLength;
+		U[2] = -W[1] * invLength;
+	}
+	Cross(W, U, V);
+}
+
+//! Eigen vector of an eigen value with multiplicity 1 (cross product of the rows of A - lambda.I)
+static void IsolatedEigenVector(const double A[6], double lambda, double evec[3])
+{
+	double row0[3] = { A[0] - lambda, A[1], A[2] };
+	double row1[3] = { A[1], A[3] - lambda, A[4] };
+	double row2[3] = { A[2], A[4], A[5] - lambda };
+
+	double r0xr1[3], r0xr2[3], r1xr2[3];
+	Cross(row0, row1, r0xr1);
+	Cross(row0, row2, r0xr2);
+	Cross(row1, row2, r1xr2);
+	double d0 = Dot(r0xr1, r0xr1);
+	double d1 = Dot(r0xr2, r0xr2);
+	double d2 = Dot(r1xr2, r1xr2);
+
+	const double* best = r0xr1;
+	double dMax = d0;
+	if (d1 > dMax)
+	{
+		best = r0xr2;
+		dMax = d1;
+	}
+	if (d2 > dMax)
+	{
+		best = r1xr2;
+		dMax = d2;
+	}
+
+	if (dMax > 0)
+	{
+		double invLength = 1.0 / std::sqrt(dMax);
+		evec[0] = best[0] * invLength;
+		evec[1] = best[1] * invLength;
+		evec[2] = best[2] * invLength;
+	}
+	else
+	{
+		//A - lambda.I is null: any vector is an eigen vector
+		evec[0] = 1.0;
+		evec[1] = evec[2] = 0.0;
+	}
+}
+
+//! Eigen vector of 'lambda' in the plane orthogonal to the (already known) eigen vector W
+static void ComplementEigenVector(const double A[6], const double W[3], double lambda, double evec[3])
+{
+	double U[3], V[3];
+	OrthogonalComplement(W, U, V);
+
+	double AU[3] = {	A[0] * U[0] + A[1] * U[1] + A[2] * U[2],
+						A[1] * U[0] + A[3] * U[1] + A[4] * U[2],
+						A[2] * U[0] + A[4] * U[1] + A[5] * U[2] };
+	double AV[3] = {	A[0] * V[0] + A[1] * V[1] + A[2] * V[2],
+						A[1] * V[0] + A[3] * V[1] + A[4] * V[2],
+						A[2] * V[0] + A[4] * V[1] + A[5] * V[2] };
+
+	//restriction of (A - lambda.I) to the plane (U, V)
+	double m00 = Dot(U, AU) - lambda;
+	double m01 = Dot(U, AV);
+	double m11 = Dot(V, AV) - lambda;
+
+	double absM00 = std::abs(m00);
+	double absM01 = std::abs(m01);
+	double absM11 = std::abs(m11);
+	double a = 1.0, b = 0.0; //evec = a.U + b.V
+	if (absM00 >= absM11)
+	{
+		if (std::max(absM00, absM01) > 0)
+		{
+			if (absM00 >= absM01)
+			{
+				m01 /= m00;
+				m00 = 1.0 / std::sqrt(1.0 + m01 * m01);
+				m01 *= m00;
+			}
+			else
+			{
+				m00 /= m01;
+				m01 = 1.0 / std::sqrt(1.0 + m00 * m00);
+				m00 *= m01;
+			}
+			a = m01;
+			b = -m00;
+		}
+	}
+	else
+	{
+		if (std::max(absM11, absM01) > 0)
+		{
+			if (absM11 >= absM01)
+			{
+				m01 /= m11;
+				m11 = 1.0 / std::sqrt(1.0 + m01 * m01);
+				m01 *= m11;
+			}
+			else
+			{
+				m11 /= m01;
+				m01 = 1.0 / std::sqrt(1.0 + m11 * m11);
+				m11 *= m01;
+			}
+			a = m11;
+			b = -m01;
+		}
+	}
+
+	evec[0] = a * U[0] + b * V[0];
+	evec[1] = a * U[1] + b * V[1];
+	evec[2] = a * U[2] + b * V[2];
+}
+
+void LocalGeometry::SymmetricEigen3x3(const double inputA[6], double eigenValues[3], double eigenVectors[3][3])
+{
+	//scale the matrix to avoid overflow/underflow issues
+	double maxAbs = 0;
+	for (int i = 0; i < 6; ++i)
+	{
+		maxAbs = std::max(maxAbs, std::abs(inputA[i]));
+	}
+
+	if (maxAbs == 0)
+	{
+		//null matrix
+		for (int i = 0; i < 3; ++i)
+		{
+			eigenValues[i] = 0;
+			for (int j = 0; j < 3; ++j)
+				eigenVectors[i][j] = (i == j ? 1.0 : 0.0);
+		}
+		return;
+	}
+
+	double A[6];
+	for (int i = 0; i < 6; ++i)
+	{
+		A[i] = inputA[i] / maxAbs;
+	}
+
+	double offDiagonal = A[1] * A[1] + A[2] * A[2] + A[4] * A[4];
+	if (offDiagonal == 0)
+	{
+		//diagonal matrix: simply sort the diagonal terms
+		double d[3] = { A[0], A[3], A[5] };
+		int order[3] = { 0, 1, 2 };
+		std::sort(order, order + 3, [&d](int i, int j) { return d[i] > d[j]; });
+		for (int i = 0; i < 3; ++i)
+		{
+			eigenValues[i] = d[order[i]] * maxAbs;
+			for (int j = 0; j < 3; ++j)
+				eigenVectors[i][j] = (j == order[i] ? 1.0 : 0.0);
+		}
+		return;
+	}
+
+	//eigen values (trigonometric solution of the characteristic equation)
+	double q = (A[0] + A[3] + A[5]) / 3;
+	double b00 = A[0] - q;
+	double b11 = A[3] - q;
+	double b22 = A[5] - q;
+	double p = std::sqrt((b00 * b00 + b11 * b11 + b22 * b22 + 2 * offDiagonal) / 6);
+	double c00 = b11 * b22 - A[4] * A[4];
+	double c01 = A[1] * b22 - A[4] * A[2];
+	double c02 = A[1] * A[4] - b11 * A[2];
+	double det = (b00 * c00 - A[1] * c01 + A[2] * c02) / (p * p * p);
+	double halfDet = std::min(std::max(det / 2, -1.0), 1.0);
+	double phi = std::acos(halfDet) / 3;
+	static const double s_twoThirdsPi = 2.09439510239319549;
+
+	double l1 = q + 2 * p * std::cos(phi);					//largest
+	double l3 = q + 2 * p * std::cos(phi + s_twoThirdsPi);	//smallest
+	double l2 = 3 * q - l1 - l3;
+	//numerical safety
+	l2 = std::min(std::max(l2, l3), l1);
+
+	//eigen vectors: we start with the most isolated eigen value
+	double e1[3], e2[3], e3[3];
+	if (l1 - l2 >= l2 - l3)
+	{
+		IsolatedEigenVector(A, l1, e1);
+		ComplementEigenVector(A, e1, l2, e2);
+		Cross(e1, e2, e3);
+	}
+	else
+	{
+		IsolatedEigenVector(A, l3, e3);
+		ComplementEigenVector(A, e3, l2, e2);
+		Cross(e2, e3, e1);
+	}
+	Normalize(e1);
+	Normalize(e2);
+	Normalize(e3);
+
+	eigenValues[0] = l1 * maxAbs;
+	eigenValues[1] = l2 * maxAbs;
+	eigenValues[2] = l3 * maxAbs;
+	for (int j = 0; j < 3; ++j)
+	{
+		eigenVectors[0][j] = e1[j];
+		eigenVectors[1][j] = e2[j];
+		eigenVectors[2][j] = e3[j];
+	}
+}
+
+LocalGeometry::LocalGeometry()
+	: m_state(NOT_COMPUTED)
+	, m_count(0)
+	, m_origin(0, 0, 0)
+	, m_gravityCenter(0, 0, 0)
+{
+	m_eigenValues[0] = m_eigenValues[1] = m_eigenValues[2] = 0;
+}
+
+bool LocalGeometry::compute(const CCCoreLib::DgmOctree::NeighboursSet& neighbors, size_t count)
+{
+	if (m_state != NOT_COMPUTED)
+	{
+		//already computed
+		return (m_state == VALID);
+	}
+
+	assert(count <= neighbors.size());
+	m_count = count;
+	m_state = INVALID;
+	if (count < 3)
+	{
+		//not enough points
+		return false;
+	}
+
+	//gather the coordinates (SoA)
+	if (m_x.size() < count)
+	{
+		try
+		{
+			m_x.resize(count);
+			m_y.resize(count);
+			m_z.resize(count);
+		}
+		catch (const std::bad_alloc&)
+		{
+			return false;
+		}
+	}
+	m_origin = CCVector3d::fromArray(neighbors[0].point->u);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const CCVector3* P = neighbors[i].point;
+		m_x[i] = P->x - m_origin.x;
+		m_y[i] = P->y - m_origin.y;
+		m_z[i] = P->z - m_origin.z;
+	}
+
+	//covariance matrix
+	Sums s;
+	Accumulate(m_x.data(), m_y.data(), m_z.data(), count, s);
+
+	double n = static_cast<double>(count);
+	double mx = s.x / n;
+	double my = s.y / n;
+	double mz = s.z / n;
+	double cov[6] = {	s.xx / n - mx * mx,
+						s.xy / n - mx * my,
+						s.xz / n - mx * mz,
+						s.yy / n - my * my,
+						s.yz / n - my * mz,
+						s.zz / n - mz * mz };
+	m_gravityCenter = m_origin + CCVector3d(mx, my, mz);
+
+	//eigen decomposition
+	double eigenVectors[3][3];
+	SymmetricEigen3x3(cov, m_eigenValues, eigenVectors);
+	for (unsigned i = 0; i < 3; ++i)
+	{
+		m_eigenVectors[i] = CCVector3d::fromArray(eigenVectors[i]);
+	}
+
+	m_state = VALID;
+	return true;
+}
+
+double LocalGeometry::feature(Feature f) const
+{
+	static const double NaN = std::numeric_limits<double>::quiet_NaN();
+	if (!isValid())
+	{
+		return NaN;
+	}
+
+	double l1 = m_eigenValues[0];
+	double l2 = m_eigenValues[1];
+	double l3 = m_eigenValues[2];
+	double sum = l1 + l2 + l3;
+
+	switch (f)
+	{
+	case PCA1:
+		return IsZero(sum) ? NaN : l1 / sum;
+	case PCA2:
+		return IsZero(sum) ? NaN : l2 / sum;
+	case SurfaceVariation:
+		return IsZero(sum) ? NaN : l3 / sum;
+	case Sphericity:
+		return IsZero(l1) ? NaN : l3 / l1;
+	case Linearity:
+		return IsZero(l1) ? NaN : (l1 - l2) / l1;
+	case Planarity:
+		return IsZero(l1) ? NaN : (l2 - l3) / l1;
+	case Verticality:
+		return 1.0 - std::abs(m_eigenVectors[2].z);
+	default:
+		assert(false);
+		break;
+	}
+
+	return NaN;
+}
+
+double LocalGeometry::roughness(const CCVector3& P) const
+{
+	if (!isValid())
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	//distance to the least squares plane (which goes through the gravity center)
+	return std::abs((CCVector3d::fromArray(P.u) - m_gravityCenter).dot(m_eigenVectors[2]));
+}
+
+double LocalGeometry::momentOrder1(const CCVector3& P) const
+{
+	if (!isValid())
+	{
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+
+	//projection on the 2nd eigen vector
+	const CCVector3d& e2 = m_eigenVectors[1];
+	CCVector3d OP = CCVector3d::fromArray(P.u) - m_origin;
+	double offset = OP.dot(e2);
+
+	double m1 = 0.0;
+	double m2 = 0.0;
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		double dotProd = m_x[i] * e2.x + m_y[i] * e2.y + m_z[i] * e2.z - offset;
+		m1 += dotProd;
+		m2 += dotProd * dotProd;
+	}
+
+	return (m2 < std::numeric_limits<double>::epsilon() ? std::numeric_limits<double>::quiet_NaN() : (m1 * m1) / m2);
+}
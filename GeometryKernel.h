@@ -0,0 +1,126 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//CCLib
+#include <DgmOctree.h>
+#include <CCGeom.h>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	//! Local geometry of a neighborhood (gravity center, covariance matrix and its eigen decomposition)
+	/** The neighbors coordinates are gathered in a SoA layout (relative to the first neighbor, for accuracy),
+		the covariance matrix is accumulated with the best instruction set available at runtime (AVX2, SSE2
+		or scalar) and its eigen decomposition is computed analytically (instead of CCCoreLib's iterative
+		Jacobi solver).
+
+		The same instance can be shared by all the features computed on a given neighborhood: the geometry
+		is only computed once (see 'invalidate').
+	**/
+	class LocalGeometry
+	{
+	public:
+
+		//! Geometrical features derived from the eigen values / vectors
+		/** Same definitions as CCCoreLib::Neighbourhood::GeomFeature
+		**/
+		enum Feature
+		{
+			PCA1,				/*!< l1 / (l1 + l2 + l3) */
+			PCA2,				/*!< l2 / (l1 + l2 + l3) */
+			SurfaceVariation,	/*!< l3 / (l1 + l2 + l3) */
+			Sphericity,			/*!< l3 / l1 */
+			Linearity,			/*!< (l1 - l2) / l1 */
+			Planarity,			/*!< (l2 - l3) / l1 */
+			Verticality			/*!< 1 - |e3.Z| */
+		};
+
+		//! Default constructor
+		LocalGeometry();
+
+		//! Invalidates the current geometry (must be called before processing a new neighborhood)
+		inline void invalidate() { m_state = NOT_COMPUTED; }
+
+		//! Computes the geometry of the 'count' first neighbors (only once until 'invalidate' is called)
+		/** \return whether the geometry is valid (at least 3 points are required)
+		**/
+		bool compute(const CCCoreLib::DgmOctree::NeighboursSet& neighbors, size_t count);
+
+		//! Returns whether the geometry has been computed and is valid
+		inline bool isValid() const { return m_state == VALID; }
+
+		//! Returns the gravity center
+		inline const CCVector3d& gravityCenter() const { return m_gravityCenter; }
+		//! Returns the eigen values (sorted in decreasing order)
+		inline const double* eigenValues() const { return m_eigenValues; }
+		//! Returns the eigen vectors (sorted by decreasing eigen values)
+		inline const CCVector3d& eigenVector(unsigned index) const { return m_eigenVectors[index]; }
+		//! Returns the normal of the least squares plane (i.e. the eigen vector with the smallest eigen value)
+		inline const CCVector3d& planeNormal() const { return m_eigenVectors[2]; }
+
+		//! Computes a geometrical feature (NaN if invalid)
+		double feature(Feature f) const;
+
+		//! Computes the distance from a point to the least squares plane (NaN if invalid)
+		double roughness(const CCVector3& P) const;
+
+		//! Computes the 1st order moment (see "Contour detection in unstructured 3D point clouds", Hackel et al. 2016)
+		double momentOrder1(const CCVector3& P) const;
+
+	public: //low level kernels
+
+		//! Raw sums (relative to an arbitrary origin) required to compute a covariance matrix
+		struct Sums
+		{
+			double x = 0, y = 0, z = 0;
+			double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+		};
+
+		//! Accumulates the sums over SoA coordinates (dispatched at runtime: AVX2 / SSE2 / scalar)
+		static void Accumulate(const double* x, const double* y, const double* z, size_t count, Sums& sums);
+
+		//! Computes the eigen values (decreasing order) and the corresponding eigen vectors of a symmetric 3x3 matrix
+		/** Analytic (trigonometric) solution for the eigen values, and robust cross-product based eigen vectors.
+			\param A symmetric matrix as [a00, a01, a02, a11, a12, a22]
+		**/
+		static void SymmetricEigen3x3(const double A[6], double eigenValues[3], double eigenVectors[3][3]);
+
+	protected: //members
+
+		enum State { NOT_COMPUTED, VALID, INVALID };
+
+		//! Computation state
+		State m_state;
+
+		//! Number of points
+		size_t m_count;
+
+		//! SoA coordinates (relative to m_origin)
+		std::vector<double> m_x, m_y, m_z;
+		//! Origin of the SoA coordinates (first neighbor)
+		CCVector3d m_origin;
+
+		CCVector3d m_gravityCenter;
+		double m_eigenValues[3];
+		CCVector3d m_eigenVectors[3];
+	};
+
+}; //namespace masc
@@ -0,0 +1,568 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "LazyFeatureEvaluator.h"
+
+//Local
+#include "FlatForest.h"
+#include "q3DMASCTools.h"
+
+//qCC_db
+#include <ccLog.h>
+#include <ccPointCloud.h>
+
+//system
+#include <algorithm>
+#include <cassert>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace masc;
+
+QString LazyFeatureEvaluator::Statistics::toString() const
+{
+	auto Ratio = [](size_t value, size_t total) { return QString::number(total ? (100.0 * value) / total : 0.0, 'f', 1) + "%"; };
+
+	QString report = QString("[3DMASC] Lazy features: %1 points, %2 attribute(s)").arg(pointCount).arg(attributeCount);
+	report += QString("\nRequested attribute values: %1 / %2 (%3)").arg(requestedValueCount).arg(pointCount * attributeCount).arg(Ratio(requestedValueCount, pointCount * attributeCount));
+	report += QString("\nComputed scaled feature tasks: %1 / %2 (%3)").arg(computedTaskCount).arg(pointCount * taskCount).arg(Ratio(computedTaskCount, pointCount * taskCount));
+	report += QString("\nNeighborhood extractions: %1 / %2 (%3)").arg(extractionCount).arg(pointCount * cloudCount).arg(Ratio(extractionCount, pointCount * cloudCount));
+	return report;
+}
+
+bool LazyFeatureEvaluator::init(const CorePoints& corePoints,
+								Feature::Set& features,
+								QString& error,
+								CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/,
+								SFCollector* generatedScalarFields/*=nullptr*/)
+{
+	m_corePoints = corePoints;
+	m_features = features;
+	m_cloudTasks.clear();
+	m_cloudSearches.clear();
+	m_tasks.clear();
+	m_wrappers.clear();
+	m_attributeTasks.clear();
+	m_statistics = Statistics();
+
+	//the eager features are computed, the tasks of the scaled features are returned
+	if (!Tools::PrepareFeatures(corePoints, features, error, progressCb, generatedScalarFields, false, &m_cloudTasks))
+	{
+		return false;
+	}
+
+	try
+	{
+		m_cloudSearches.resize(m_cloudTasks.size());
+		for (size_t cloudIndex = 0; cloudIndex < m_cloudTasks.size(); ++cloudIndex)
+		{
+			const FeaturePlan::CloudTasks& tasks = m_cloudTasks[cloudIndex];
+			CloudSearch& search = m_cloudSearches[cloudIndex];
+
+			search.sqRadii.resize(tasks.scales.size());
+			for (size_t j = 0; j < tasks.scales.size(); ++j)
+			{
+				double radius = tasks.scales[j] / 2; //scale is the diameter!
+				search.sqRadii[j] = radius * radius;
+			}
+
+			search.octree = tasks.cloud->getOctree();
+			if (!search.octree)
+			{
+				ccLog::Print(QString("Computing octree of cloud %1 (%2 points)").arg(tasks.cloud->getName()).arg(tasks.cloud->size()));
+				search.octree = tasks.cloud->computeOctree(progressCb);
+				if (!search.octree)
+				{
+					error = "[LazyFeatureEvaluator] Failed to compute octree (not enough memory?)";
+					return false;
+				}
+			}
+			search.largestRadius = static_cast<PointCoordinateType>(tasks.scales.back() / 2); //scale is the diameter!
+			search.octreeLevel = search.octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(search.largestRadius);
+
+			//the tasks are listed in the eager execution order (from the largest to the smallest scale)
+			for (size_t j = 0; j < tasks.scales.size(); ++j)
+			{
+				size_t scaleIndex = tasks.scales.size() - 1 - j;
+				const FeaturePlan::ScaleTasks& scaleTasks = tasks.tasksPerScale[scaleIndex];
+
+				Task task;
+				task.cloudIndex = cloudIndex;
+				task.scaleIndex = scaleIndex;
+				task.type = Task::Gather;
+				for (task.taskIndex = 0; task.taskIndex < scaleTasks.gathers.size(); ++task.taskIndex)
+					m_tasks.push_back(task);
+				task.type = Task::Neighborhood;
+				for (task.taskIndex = 0; task.taskIndex < scaleTasks.neighborhoodValues.size(); ++task.taskIndex)
+					m_tasks.push_back(task);
+				task.type = Task::Context;
+				for (task.taskIndex = 0; task.taskIndex < scaleTasks.contextValues.size(); ++task.taskIndex)
+					m_tasks.push_back(task);
+			}
+		}
+
+		//the second operand of a MATH feature can only be combined once the first one is there
+		std::vector<const FeaturePlan::Output*> outputs;
+		std::vector<const FeaturePlan::Output*> previousOutputs;
+		for (size_t t = 0; t < m_tasks.size(); ++t)
+		{
+			taskOutputs(m_tasks[t], outputs);
+			for (const FeaturePlan::Output* output : outputs)
+			{
+				if (!output->combine)
+				{
+					continue;
+				}
+				for (size_t u = 0; u < t; ++u)
+				{
+					taskOutputs(m_tasks[u], previousOutputs);
+					for (const FeaturePlan::Output* previous : previousOutputs)
+					{
+						if (previous->sf == output->sf && !previous->combine)
+						{
+							m_tasks[t].dependencies.push_back(u);
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	m_statistics.taskCount = m_tasks.size();
+	m_statistics.cloudCount = m_cloudTasks.size();
+
+	return true;
+}
+
+void LazyFeatureEvaluator::taskOutputs(const Task& task, std::vector<const FeaturePlan::Output*>& outputs) const
+{
+	outputs.clear();
+
+	const FeaturePlan::ScaleTasks& scaleTasks = m_cloudTasks[task.cloudIndex].tasksPerScale[task.scaleIndex];
+	switch (task.type)
+	{
+	case Task::Gather:
+		for (const FeaturePlan::StatTask& statTask : scaleTasks.gathers[task.taskIndex].stats)
+			for (const FeaturePlan::Output& output : statTask.outputs)
+				outputs.push_back(&output);
+		break;
+	case Task::Neighborhood:
+		for (const FeaturePlan::Output& output : scaleTasks.neighborhoodValues[task.taskIndex].outputs)
+			outputs.push_back(&output);
+		break;
+	case Task::Context:
+		for (const FeaturePlan::Output& output : scaleTasks.contextValues[task.taskIndex].outputs)
+			outputs.push_back(&output);
+		break;
+	}
+}
+
+bool LazyFeatureEvaluator::bindAttributes(const Feature::Source::Set& sources, const std::vector<IScalarFieldWrapper::Shared>& wrappers, QString& error)
+{
+	if (sources.size() != wrappers.size() || !m_corePoints.cloud)
+	{
+		assert(false);
+		error = "Internal error: invalid attributes";
+		return false;
+	}
+
+	try
+	{
+		m_wrappers = wrappers;
+		m_attributeTasks.clear();
+		m_attributeTasks.resize(sources.size());
+
+		std::vector<const FeaturePlan::Output*> outputs;
+		for (size_t a = 0; a < sources.size(); ++a)
+		{
+			if (sources[a].type != Feature::Source::ScalarField)
+			{
+				//not computed by a scaled feature
+				continue;
+			}
+
+			const CCCoreLib::ScalarField* sf = Tools::RetrieveSF(m_corePoints.cloud, sources[a].name);
+			for (size_t t = 0; t < m_tasks.size(); ++t)
+			{
+				taskOutputs(m_tasks[t], outputs);
+				if (std::find_if(outputs.begin(), outputs.end(), [&](const FeaturePlan::Output* o) { return o->sf == sf; }) != outputs.end())
+				{
+					m_attributeTasks[a].push_back(t);
+				}
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	m_statistics.attributeCount = sources.size();
+
+	return true;
+}
+
+void LazyFeatureEvaluator::startPoint(Context& context, unsigned pointIndex) const
+{
+	context.pointIndex = pointIndex;
+	std::fill(context.taskDone.begin(), context.taskDone.end(), 0);
+	std::fill(context.attributeDone.begin(), context.attributeDone.end(), 0);
+	for (CloudNeighborhood& neighborhood : context.clouds)
+	{
+		neighborhood.extracted = false;
+		neighborhood.scaleNeighborsIndex = -1;
+	}
+}
+
+float LazyFeatureEvaluator::attributeValue(Context& context, int attributeIndex) const
+{
+	if (!context.attributeDone[attributeIndex])
+	{
+		for (size_t taskIndex : m_attributeTasks[attributeIndex])
+		{
+			if (!computeTask(context, taskIndex))
+			{
+				//the error message should be up to date
+				break;
+			}
+		}
+
+		context.attributeValues[attributeIndex] = static_cast<float>(m_wrappers[attributeIndex]->pointValue(context.pointIndex));
+		context.attributeDone[attributeIndex] = 1;
+		++context.statistics.requestedValueCount;
+	}
+
+	return context.attributeValues[attributeIndex];
+}
+
+bool LazyFeatureEvaluator::extractNeighborhood(Context& context, size_t cloudIndex) const
+{
+	const CloudSearch& search = m_cloudSearches[cloudIndex];
+	CloudNeighborhood& neighborhood = context.clouds[cloudIndex];
+	ScratchArena& arena = neighborhood.arena;
+	CCCoreLib::DgmOctree::NearestNeighboursSearchStruct& nNSS = arena.nNSS;
+
+	arena.resetNeighborhood(*m_corePoints.cloud->getPoint(context.pointIndex), search.octreeLevel);
+	search.octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+	search.octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+
+	//we extract the point's neighbors (unsorted) at the largest scale, and partition them by scale
+	unsigned kNN = search.octree->findNeighborsInASphereStartingFromCell(nNSS, search.largestRadius, false);
+	if (kNN != 0)
+	{
+		if (!arena.bucketNeighborsByScale(kNN, search.sqRadii, m_cloudTasks[cloudIndex].sortNeighbors))
+		{
+			context.error = "Not enough memory";
+			return false;
+		}
+	}
+	else
+	{
+		arena.neighborCountPerScale.assign(search.sqRadii.size(), 0);
+	}
+
+	for (LocalGeometry& geometry : neighborhood.geometries)
+	{
+		geometry.invalidate();
+	}
+	neighborhood.scaleNeighborsIndex = -1;
+	neighborhood.extracted = true;
+	++context.statistics.extractionCount;
+
+	return true;
+}
+
+bool LazyFeatureEvaluator::computeTask(Context& context, size_t taskIndex) const
+{
+	if (context.taskDone[taskIndex])
+	{
+		return true;
+	}
+	context.taskDone[taskIndex] = 1;
+
+	const Task& task = m_tasks[taskIndex];
+	for (size_t dependency : task.dependencies)
+	{
+		if (!computeTask(context, dependency))
+		{
+			return false;
+		}
+	}
+	++context.statistics.computedTaskCount;
+
+	CloudNeighborhood& neighborhood = context.clouds[task.cloudIndex];
+	if (!neighborhood.extracted && !extractNeighborhood(context, task.cloudIndex))
+	{
+		return false;
+	}
+	ScratchArena& arena = neighborhood.arena;
+
+	const FeaturePlan::CloudTasks& cloudTasks = m_cloudTasks[task.cloudIndex];
+	const FeaturePlan::ScaleTasks& scaleTasks = cloudTasks.tasksPerScale[task.scaleIndex];
+	unsigned pointIndex = context.pointIndex;
+	unsigned kNN = arena.neighborCountPerScale[task.scaleIndex];
+	if (kNN == 0)
+	{
+		//nothing to compute (same as the eager computation)
+		std::vector<const FeaturePlan::Output*> outputs;
+		taskOutputs(task, outputs);
+		for (const FeaturePlan::Output* output : outputs)
+		{
+			output->invalidate(pointIndex);
+		}
+		return true;
+	}
+
+	//some features need a neighbors set restricted to the current scale
+	auto ScaleNeighbors = [&]() -> CCCoreLib::DgmOctree::NeighboursSet&
+	{
+		if (neighborhood.scaleNeighborsIndex != static_cast<int>(task.scaleIndex))
+		{
+			const CCCoreLib::DgmOctree::NeighboursSet& neighbors = arena.nNSS.pointsInNeighbourhood;
+			neighborhood.scaleNeighbors.assign(neighbors.begin(), neighbors.begin() + kNN);
+			neighborhood.scaleNeighborsIndex = static_cast<int>(task.scaleIndex);
+		}
+		return neighborhood.scaleNeighbors;
+	};
+
+	try
+	{
+		switch (task.type)
+		{
+		case Task::Gather:
+		{
+			const FeaturePlan::GatherTask& gatherTask = scaleTasks.gathers[task.taskIndex];
+			std::vector<double>& values = arena.gatheredValues;
+			values.resize(kNN);
+			gatherTask.field->gather(arena.nNSS.pointsInNeighbourhood, kNN, values.data());
+
+			for (const FeaturePlan::StatTask& statTask : gatherTask.stats)
+			{
+				double outputValue = 0;
+				if (!PointFeature::ComputeStat(statTask.stat, values, arena.values, outputValue))
+				{
+					context.error = "An error occurred during the computation of " + Feature::StatToString(statTask.stat) + " of field " + gatherTask.field->getName() + " on cloud " + cloudTasks.cloud->getName();
+					return false;
+				}
+
+				ScalarType v = static_cast<ScalarType>(outputValue);
+				for (const FeaturePlan::Output& output : statTask.outputs)
+				{
+					output.write(pointIndex, v);
+				}
+			}
+		}
+		break;
+
+		case Task::Neighborhood:
+		{
+			const FeaturePlan::NeighborhoodTask& neighborhoodTask = scaleTasks.neighborhoodValues[task.taskIndex];
+			double outputValue = 0;
+			if (!neighborhoodTask.feature->computeValue(ScaleNeighbors(), arena.nNSS.queryPoint, outputValue, &neighborhood.geometries[task.scaleIndex]))
+			{
+				context.error = "An error occurred during the computation of feature " + neighborhoodTask.feature->toString() + " on cloud " + cloudTasks.cloud->getName();
+				return false;
+			}
+
+			ScalarType v = static_cast<ScalarType>(outputValue);
+			for (const FeaturePlan::Output& output : neighborhoodTask.outputs)
+			{
+				output.write(pointIndex, v);
+			}
+		}
+		break;
+
+		case Task::Context:
+		{
+			const FeaturePlan::ContextTask& contextTask = scaleTasks.contextValues[task.taskIndex];
+			ScalarType outputValue = 0;
+			if (!contextTask.feature->computeValue(ScaleNeighbors(), arena.nNSS.queryPoint, outputValue))
+			{
+				context.error = "An error occurred during the computation of feature " + contextTask.feature->toString() + " on cloud " + cloudTasks.cloud->getName();
+				return false;
+			}
+
+			for (const FeaturePlan::Output& output : contextTask.outputs)
+			{
+				output.write(pointIndex, outputValue);
+			}
+		}
+		break;
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		context.error = "Not enough memory";
+		return false;
+	}
+
+	return true;
+}
+
+bool LazyFeatureEvaluator::classify(const FlatForest& forest,
+									CCCoreLib::ScalarField* classificationSF,
+									CCCoreLib::ScalarField* confidenceSF,
+									QString& error,
+									CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!classificationSF || !confidenceSF || !m_corePoints.cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+	if (!forest.isValid() || forest.attributeCount() != static_cast<int>(m_wrappers.size()))
+	{
+		error = QString("Forest and attributes mismatch (%1 vs %2 attributes)").arg(forest.attributeCount()).arg(m_wrappers.size());
+		return false;
+	}
+
+#if defined(_OPENMP) && !defined(_DEBUG)
+	int threadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+	int threadCount = 1;
+#endif
+
+	//per-thread contexts
+	std::vector<Context> contexts;
+	try
+	{
+#if defined(_OPENMP)
+		contexts.resize(static_cast<size_t>(std::max(1, omp_get_max_threads())));
+#else
+		contexts.resize(1);
+#endif
+		for (Context& context : contexts)
+		{
+			context.taskDone.resize(m_tasks.size());
+			context.attributeDone.resize(m_wrappers.size());
+			context.attributeValues.resize(m_wrappers.size());
+			context.votes.resize(static_cast<size_t>(forest.classCount()));
+			context.clouds.resize(m_cloudTasks.size());
+			for (size_t cloudIndex = 0; cloudIndex < m_cloudTasks.size(); ++cloudIndex)
+			{
+				context.clouds[cloudIndex].geometries.resize(m_cloudTasks[cloudIndex].scales.size());
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		error = "Not enough memory";
+		return false;
+	}
+
+	unsigned pointCount = m_corePoints.size();
+	QString logMessage = QString("Classifying %1 core points (lazy features)").arg(pointCount);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Classify");
+		progressCb->setInfo(qPrintable(logMessage));
+		progressCb->start();
+	}
+	ccLog::Print("[3DMASC] " + logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	bool cancelled = false;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 64) num_threads(threadCount)
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+	if (!cancelled)
+	{
+#if defined(_OPENMP)
+		Context& context = contexts[static_cast<size_t>(omp_get_thread_num())];
+#else
+		Context& context = contexts.front();
+#endif
+		startPoint(context, static_cast<unsigned>(i));
+
+		std::fill(context.votes.begin(), context.votes.end(), 0);
+		forest.voteLazy([&](int attributeIndex) { return attributeValue(context, attributeIndex); }, context.votes.data());
+		if (!context.error.isEmpty())
+		{
+			cancelled = true;
+		}
+
+		int label = 0;
+		float confidence = 0.0f;
+		FlatForest::VotesToLabels(context.votes.data(), 1, forest.classLabels(), forest.treeCount(), &label, &confidence);
+		classificationSF->setValue(i, static_cast<ScalarType>(label));
+		confidenceSF->setValue(i, static_cast<ScalarType>(confidence));
+
+		if (progressCb && !nProgress.oneStep())
+		{
+			//process cancelled by the user
+			cancelled = true;
+		}
+	}
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	//merge the statistics
+	m_statistics.pointCount = pointCount;
+	m_statistics.requestedValueCount = m_statistics.computedTaskCount = m_statistics.extractionCount = 0;
+	for (const Context& context : contexts)
+	{
+		if (!context.error.isEmpty())
+		{
+			error = context.error;
+		}
+		m_statistics.requestedValueCount += context.statistics.requestedValueCount;
+		m_statistics.computedTaskCount += context.statistics.computedTaskCount;
+		m_statistics.extractionCount += context.statistics.extractionCount;
+	}
+
+	if (cancelled)
+	{
+		if (error.isEmpty())
+		{
+			error = "Process cancelled by the user";
+		}
+		return false;
+	}
+
+	return true;
+}
+
+bool LazyFeatureEvaluator::finish(QString& error)
+{
+	for (const Feature::Shared& feature : m_features)
+	{
+		//we have to 'finish' the process for scaled features
+		if (feature->scaled() && !feature->unused && !feature->finish(m_corePoints, error))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
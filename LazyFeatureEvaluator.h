@@ -0,0 +1,191 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeaturePlanner.h"
+#include "ScratchArena.h"
+
+//qCC_db
+#include <ccOctree.h>
+
+//CCLib
+#include <GenericProgressCallback.h>
+
+//Qt
+#include <QString>
+
+//system
+#include <vector>
+
+namespace masc
+{
+	class FlatForest;
+
+	//! Lazy (on demand) feature evaluator (experimental)
+	/** Instead of computing all the scaled features for all the core points before classifying them,
+		the forest is traversed point by point, and a feature value is only computed (and memoized)
+		when a split node needs it. The neighborhoods extracted for a point (one per cloud) and the
+		corresponding local geometries are kept for the whole traversal of the point.
+
+		The features computed when they are prepared (scale-less and dual-cloud features) remain eager.
+		The scaled feature values that are never requested are left undefined (NaN).
+	**/
+	class LazyFeatureEvaluator
+	{
+	public:
+
+		//! Statistics (for comparison with the eager computation)
+		struct Statistics
+		{
+			//! Number of classified points
+			size_t pointCount = 0;
+			//! Number of attributes per point
+			size_t attributeCount = 0;
+			//! Number of distinct attribute values requested by the trees (sum over all the points)
+			size_t requestedValueCount = 0;
+			//! Number of lazy tasks per point (= computed for each point in eager mode)
+			size_t taskCount = 0;
+			//! Number of tasks actually computed (sum over all the points)
+			size_t computedTaskCount = 0;
+			//! Number of neighborhood extractions (sum over all the points)
+			size_t extractionCount = 0;
+			//! Number of clouds with scaled features (= extractions per point in eager mode)
+			size_t cloudCount = 0;
+
+			//! Returns a (multi-line) report
+			QString toString() const;
+		};
+
+		//! Prepares the features and the lazy tasks
+		/** The eager features are computed at this stage (see Tools::PrepareFeatures).
+		**/
+		bool init(	const CorePoints& corePoints,
+					Feature::Set& features,
+					QString& error,
+					CCCoreLib::GenericProgressCallback* progressCb = nullptr,
+					SFCollector* generatedScalarFields = nullptr);
+
+		//! Binds the classifier attributes (must be called after init)
+		/** \param sources feature sources (one per attribute)
+			\param wrappers corresponding wrappers (on the core points cloud)
+		**/
+		bool bindAttributes(const Feature::Source::Set& sources, const std::vector<IScalarFieldWrapper::Shared>& wrappers, QString& error);
+
+		//! Classifies all the core points
+		bool classify(	const FlatForest& forest,
+						CCCoreLib::ScalarField* classificationSF,
+						CCCoreLib::ScalarField* confidenceSF,
+						QString& error,
+						CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Finishes the features (once all the points have been classified)
+		bool finish(QString& error);
+
+		//! Returns the statistics of the last classification
+		inline const Statistics& statistics() const { return m_statistics; }
+
+	protected: //types
+
+		//! Lazy task (a set of values computed at once on the same neighborhood)
+		struct Task
+		{
+			enum Type { Gather, Neighborhood, Context };
+
+			Type type = Gather;
+			size_t cloudIndex = 0;
+			size_t scaleIndex = 0;
+			size_t taskIndex = 0;
+			//! Tasks to compute first (the first operands of the MATH features combined by this task)
+			std::vector<size_t> dependencies;
+		};
+
+		//! Neighborhood extraction parameters (per cloud)
+		struct CloudSearch
+		{
+			ccOctree::Shared octree;
+			unsigned char octreeLevel = 0;
+			PointCoordinateType largestRadius = 0;
+			std::vector<double> sqRadii;
+		};
+
+		//! Neighborhood of the current point in a given cloud
+		struct CloudNeighborhood
+		{
+			bool extracted = false;
+			ScratchArena arena;
+			//! Local geometry per scale
+			std::vector<LocalGeometry> geometries;
+			//! Neighbors of a single scale (for the features requiring a dedicated set)
+			CCCoreLib::DgmOctree::NeighboursSet scaleNeighbors;
+			//! Scale of 'scaleNeighbors' (-1 if none)
+			int scaleNeighborsIndex = -1;
+		};
+
+		//! Per-thread evaluation context
+		struct Context
+		{
+			unsigned pointIndex = 0;
+			std::vector<unsigned char> taskDone;
+			std::vector<unsigned char> attributeDone;
+			std::vector<float> attributeValues;
+			std::vector<CloudNeighborhood> clouds;
+			std::vector<int> votes;
+			Statistics statistics;
+			//! Error message (if a value can't be computed)
+			QString error;
+		};
+
+	protected: //methods
+
+		//! Prepares a context for a new point
+		void startPoint(Context& context, unsigned pointIndex) const;
+
+		//! Returns the value of an attribute for the current point (computed on demand)
+		float attributeValue(Context& context, int attributeIndex) const;
+
+		//! Computes a task for the current point (and its dependencies)
+		bool computeTask(Context& context, size_t taskIndex) const;
+
+		//! Extracts the neighborhood of the current point in a given cloud
+		bool extractNeighborhood(Context& context, size_t cloudIndex) const;
+
+		//! Returns the outputs of a task
+		void taskOutputs(const Task& task, std::vector<const FeaturePlan::Output*>& outputs) const;
+
+	protected: //members
+
+		//! Core points
+		CorePoints m_corePoints;
+		//! Features
+		Feature::Set m_features;
+		//! Deferred tasks (per cloud and per scale)
+		std::vector<FeaturePlan::CloudTasks> m_cloudTasks;
+		//! Neighborhood extraction parameters (per cloud)
+		std::vector<CloudSearch> m_cloudSearches;
+		//! Lazy tasks
+		std::vector<Task> m_tasks;
+		//! Attribute wrappers
+		std::vector<IScalarFieldWrapper::Shared> m_wrappers;
+		//! Tasks to compute before reading each attribute (in execution order)
+		std::vector< std::vector<size_t> > m_attributeTasks;
+		//! Statistics
+		Statistics m_statistics;
+	};
+
+}; //namespace masc
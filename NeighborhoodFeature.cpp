@@ -17,6 +17,9 @@
 
 #include "NeighborhoodFeature.h"
 
+//Local
+#include "GeometryKernel.h"
+
 //CCLib
 #include <DgmOctreeReferenceCloud.h>
 #include <Neighbourhood.h>
@@ -107,23 +110,6 @@ bool NeighborhoodFeature::prepare(	const CorePoints& corePoints,
 	}
 	source.name = QString::fromStdString(sf1->getName());
 
-	// sf2 is not needed if sf1 was already existing!
-	if (cloud2 && op != Feature::NO_OPERATION && !sf1WasAlreadyExisting)
-	{
-		QString resultSFName2 = ToString(type) + "_" + cloud2Label + "@" + QString::number(scale);
-
-		assert(!sf2);
-
-		sf2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, resultSFName2);		
-		sf2 = PrepareSF(corePoints.cloud, resultSFName2, generatedScalarFields, sf2WasAlreadyExisting ? SFCollector::ALWAYS_KEEP : SFCollector::ALWAYS_REMOVE);
-
-		if (!sf2)
-		{
-			error = QString("Failed to prepare scalar field for %1 @ scale %2").arg(cloud2Label).arg(scale);
-			return false;
-		}
-	}
-
 	return true;
 }
 
@@ -153,38 +139,6 @@ bool NeighborhoodFeature::finish(const CorePoints& corePoints, QString& error)
 		}
 	}
 
-	if (sf2 && !sf1WasAlreadyExisting)
-	{
-		//now perform the math operation
-		if (op != Feature::NO_OPERATION)
-		{
-			if (!PerformMathOp(sf1, sf2, op))
-			{
-				error = "Failed to perform the MATH operation";
-				success = false;
-			}
-		}
-
-//		if (keepSF2)
-//		{
-//			sf2->computeMinAndMax();
-//		}
-//		else
-//		{
-//			int sfIndex2 = corePoints.cloud->getScalarFieldIndexByName(sf2->getName());
-//			if (sfIndex2 >= 0)
-//			{
-//				corePoints.cloud->deleteScalarField(sfIndex2);
-//			}
-//			else
-//			{
-//				assert(false);
-//				sf2->release();
-//			}
-//			sf2 = nullptr;
-//		}
-	}
-
 	return success;
 }
 
@@ -208,7 +162,7 @@ QString NeighborhoodFeature::toString() const
 	return description;
 }
 
-bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const CCVector3& queryPoint, double& outputValue) const
+bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const CCVector3& queryPoint, double& outputValue, LocalGeometry* geometry/*=nullptr*/) const
 {
 	outputValue = std::numeric_limits<double>::quiet_NaN();
 
@@ -219,6 +173,13 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 		return false;
 	}
 
+	//the local geometry is shared by all the features computed on the same neighborhood (if provided)
+	LocalGeometry localGeometry;
+	if (!geometry)
+	{
+		geometry = &localGeometry;
+	}
+
 	switch (type)
 	{
 	//features relying on the PCA
@@ -230,29 +191,29 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 	case PLANA:
 	case VERT:
 	{
-		CCCoreLib::Neighbourhood::GeomFeature f;
+		LocalGeometry::Feature f;
 		switch (type)
 		{
 		case PCA1:
-			f = CCCoreLib::Neighbourhood::PCA1;
+			f = LocalGeometry::PCA1;
 			break;
 		case PCA2:
-			f = CCCoreLib::Neighbourhood::PCA2;
+			f = LocalGeometry::PCA2;
 			break;
 		case PCA3:
-			f = CCCoreLib::Neighbourhood::SurfaceVariation;
+			f = LocalGeometry::SurfaceVariation;
 			break;
 		case SPHER:
-			f = CCCoreLib::Neighbourhood::Sphericity;
+			f = LocalGeometry::Sphericity;
 			break;
 		case LINEA:
-			f = CCCoreLib::Neighbourhood::Linearity;
+			f = LocalGeometry::Linearity;
 			break;
 		case PLANA:
-			f = CCCoreLib::Neighbourhood::Planarity;
+			f = LocalGeometry::Planarity;
 			break;
 		case VERT:
-			f = CCCoreLib::Neighbourhood::Verticality;
+			f = LocalGeometry::Verticality;
 			break;
 		default:
 			//impossible
@@ -260,35 +221,30 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 			return false;
 		}
 
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeFeature(f);
+		if (geometry->compute(pointsInNeighbourhood, kNN))
+		{
+			outputValue = geometry->feature(f);
+		}
 	}
 	break;
 
 	case FOM:
+	if (geometry->compute(pointsInNeighbourhood, kNN))
 	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeMomentOrder1(queryPoint);
+		outputValue = geometry->momentOrder1(queryPoint);
 	}
 	break;
 
 	case Dip:
 	case DipDir:
-	if (kNN >= 3)
+	if (geometry->compute(pointsInNeighbourhood, kNN))
 	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		const CCVector3* N = Z.getLSPlaneNormal();
-		if (N)
-		{
-			//force +Z
-			CCVector3 Np = (N->z < 0 ? -CCCoreLib::PC_ONE * *N : *N);
-			PointCoordinateType dip_deg, dipDir_deg;
-			ccNormalVectors::ConvertNormalToDipAndDipDir(Np, dip_deg, dipDir_deg);
-			outputValue = (type == Dip ? dip_deg : dipDir_deg);
-		}
+		const CCVector3d& N = geometry->planeNormal();
+		//force +Z
+		CCVector3 Np = CCVector3::fromArray((N.z < 0 ? -N : N).u);
+		PointCoordinateType dip_deg, dipDir_deg;
+		ccNormalVectors::ConvertNormalToDipAndDipDir(Np, dip_deg, dipDir_deg);
+		outputValue = (type == Dip ? dip_deg : dipDir_deg);
 	}
 	break;
 
@@ -297,10 +253,9 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 		break;
 
 	case ROUGH:
+	if (geometry->compute(pointsInNeighbourhood, kNN))
 	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		outputValue = Z.computeRoughness(queryPoint);
+		outputValue = geometry->roughness(queryPoint);
 	}
 	break;
 
@@ -348,20 +303,20 @@ bool NeighborhoodFeature::computeValue(CCCoreLib::DgmOctree::NeighboursSet& poin
 	break;
 
 	case ANISO:
-	if (kNN >= 3)
+	if (geometry->compute(pointsInNeighbourhood, kNN))
 	{
-		CCCoreLib::DgmOctreeReferenceCloud neighboursCloud(&pointsInNeighbourhood, static_cast<unsigned>(kNN));
-		CCCoreLib::Neighbourhood Z(&neighboursCloud);
-		const CCVector3* G = Z.getGravityCenter();
-		if (G)
+		//the neighbors are not necessarily sorted: look for the farthest one
+		double maxSquareDist = 0.0;
+		for (size_t k = 0; k < kNN; ++k)
+		{
+			maxSquareDist = std::max(maxSquareDist, pointsInNeighbourhood[k].squareDistd);
+		}
+		double r = sqrt(maxSquareDist);
+		if (r > std::numeric_limits<double>::epsilon())
 		{
-			double r = sqrt(pointsInNeighbourhood.back().squareDistd);
-			if (r > std::numeric_limits<double>::epsilon())
-			{
-				double d = (queryPoint - *G).normd();
-				//Ratio of distance to center of mass and radius of sphere
-				outputValue = d / r;
-			}
+			double d = (CCVector3d::fromArray(queryPoint.u) - geometry->gravityCenter()).normd();
+			//Ratio of distance to center of mass and radius of sphere
+			outputValue = d / r;
 		}
 	}
 	break;
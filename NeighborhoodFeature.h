@@ -22,6 +22,8 @@
 
 namespace masc
 {
+	class LocalGeometry;
+
 	//! Neighborhood-based feature
 	struct NeighborhoodFeature : public Feature
 	{
@@ -155,7 +157,6 @@ namespace masc
 		NeighborhoodFeature(NeighborhoodFeatureType p_type)
 			: type(p_type)
 			, sf1(nullptr)
-			, sf2(nullptr)
 		{
 		}
 
@@ -168,7 +169,13 @@ namespace masc
 		virtual QString toString() const override;
 
 		//! Compute the feature value on a set of points
-		bool computeValue(CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const CCVector3& queryPoint, double& outputValue) const;
+		/** \param geometry optional local geometry, shared by all the features computed on the same neighborhood
+				(must be invalidated by the caller each time the neighborhood changes)
+		**/
+		bool computeValue(	CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood,
+							const CCVector3& queryPoint,
+							double& outputValue,
+							LocalGeometry* geometry = nullptr) const;
 
 	public: //members
 
@@ -178,6 +185,8 @@ namespace masc
 		NeighborhoodFeatureType type;
 
 		//! Feature values
-		CCCoreLib::ScalarField *sf1, *sf2;
+		/** For MATH features, the two operands are directly combined in this field (see FeaturePlan).
+		**/
+		CCCoreLib::ScalarField* sf1;
 	};
 }
@@ -27,12 +27,17 @@ namespace masc
 		//int maxCategories = 0;	//Normally not important as there is no categorical variable
 		int activeVarCount = 0;		//Use 0 as the default parameter (works best)
 		int maxTreeCount = 100;		//Left as a parameter of the training plugin (default: 100)
+		bool compact = false;		//Compacts the forest after training (see FlatForest::compact)
+		int compactMinSupport = 0;	//Subtrees reached by less training samples are pruned (0 = no pruning)
+		float compactMaxTreeDropChange = -1.0f;	//Trees are dropped as long as at most this ratio of the training predictions changes (< 0 = no tree dropped)
 	};
 
 	struct TrainParameters
 	{
 		RandomTreesParams rt;
 		float testDataRatio = 0.2f; //percentage of test data
+		unsigned seed = 0; //seed of the random train/test split
+		bool stratifiedSplit = false; //whether the train/test split respects the ratio in each class
 	};
 
 }; //namespace masc
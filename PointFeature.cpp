@@ -18,7 +18,9 @@
 #include "PointFeature.h"
 
 //Local
+#include "FeaturePlanner.h"
 #include "q3DMASCTools.h"
+#include "ScratchArena.h"
 
 #if defined(_OPENMP)
 #include <omp.h>
@@ -246,6 +248,62 @@ bool PointFeature::checkValidity(QString corePointRole, QString &error) const
 	return true;
 }
 
+void PointFeature::getRequiredAttributes(QStringList& sfNames, int& sfCount, bool& colors, bool& normals) const
+{
+	switch (type)
+	{
+	case PointFeature::Intensity:
+		sfNames << LAS_FIELD_NAMES[LAS_INTENSITY];
+		break;
+	case PointFeature::NbRet:
+		sfNames << LAS_FIELD_NAMES[LAS_NUMBER_OF_RETURNS];
+		break;
+	case PointFeature::RetNb:
+		sfNames << LAS_FIELD_NAMES[LAS_RETURN_NUMBER];
+		break;
+	case PointFeature::EchoRat:
+		sfNames << LAS_FIELD_NAMES[LAS_NUMBER_OF_RETURNS] << LAS_FIELD_NAMES[LAS_RETURN_NUMBER];
+		break;
+	case PointFeature::R:
+	case PointFeature::G:
+	case PointFeature::B:
+		colors = true;
+		break;
+	case PointFeature::NIR:
+		sfNames << s_NIRSFName;
+		break;
+	case PointFeature::Dip:
+	case PointFeature::DipDir:
+		normals = true;
+		break;
+	case PointFeature::M3C2:
+		sfNames << s_M3C2SFName;
+		break;
+	case PointFeature::PCV:
+		sfNames << s_PCVSFName;
+		break;
+	case PointFeature::SF:
+		sfCount = std::max(sfCount, sourceSFIndex + 1);
+		break;
+	default:
+		//coordinates only
+		break;
+	}
+}
+
+IScalarFieldWrapper::Shared PointFeature::RetrieveField(PointFeatureType type, ccPointCloud* cloud, QString& error)
+{
+	if (type == PointFeature::SF)
+	{
+		assert(false);
+		error = "internal error (a scalar field index is required)";
+		return nullptr;
+	}
+
+	PointFeature feature(type);
+	return feature.retrieveField(cloud, error);
+}
+
 IScalarFieldWrapper::Shared PointFeature::retrieveField(ccPointCloud* cloud, QString& error)
 {
 	if (!cloud)
@@ -379,49 +437,20 @@ IScalarFieldWrapper::Shared PointFeature::retrieveField(ccPointCloud* cloud, QSt
 static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 												const IScalarFieldWrapper& field1,
 												CCCoreLib::ScalarField* outSF,
-												ccPointCloud& cloud2,
+												const NearestNeighborJoin& join,
 												const IScalarFieldWrapper& field2,
 												masc::Feature::Operation op,
-												QString& error,
-												CCCoreLib::GenericProgressCallback* progressCb = nullptr)
+												QString& error)
 {
-	if (op == masc::Feature::NO_OPERATION || !outSF || outSF->size() != corePoints.size())
+	if (op == masc::Feature::NO_OPERATION || !outSF || outSF->size() != corePoints.size() || join.nearestIndexes.size() != corePoints.size())
 	{
 		//invalid input parameters
 		assert(false);
 		error = "invalid input parameters";
 		return false;
 	}
-	
-	ccOctree::Shared octree = cloud2.getOctree();
-	if (!octree)
-	{
-		octree = cloud2.computeOctree(progressCb);
-		if (!octree)
-		{
-			error = "failed to compute octree on cloud " + cloud2.getName();
-			return false;
-		}
-	}
-
-	//now extract the neighborhoods
-	unsigned char octreeLevel = octree->findBestLevelForAGivenPopulationPerCell(3);
-	ccLog::Print(QString("[Initial octree level] level = %1").arg(octreeLevel));
 
 	unsigned pointCount = corePoints.size();
-	QString logMessage = QString("Extracting %1 core points nearest neighbors in cloud %2").arg(pointCount).arg(cloud2.getName());
-	if (progressCb)
-	{
-		progressCb->setMethodTitle("Compute math operation");
-		progressCb->setInfo(qPrintable(logMessage));
-	}
-	ccLog::Print(logMessage);
-	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
-
-	double meanNeighborhoodSize = 0;
-	int tenth = pointCount / 10;
-	error.clear();
-	bool cancelled = false;
 #ifndef _DEBUG
 #if defined(_OPENMP)
 #pragma omp parallel for num_threads(std::max(1, omp_get_max_threads() - 2))
@@ -429,67 +458,22 @@ static bool ComputeMathOpWithNearestNeighbor(	const CorePoints& corePoints,
 #endif
 	for (int i = 0; i < static_cast<int>(pointCount); ++i)
 	{
-	if (!cancelled)
-	{
-		const CCVector3* P = corePoints.cloud->getPoint(i);
-		CCCoreLib::ReferenceCloud Yk(&cloud2);
-		double maxSquareDist = 0;
-
 		ScalarType s = CCCoreLib::NAN_VALUE;
 
-		int neighborhoodSize = 0;
-		if (octree->findPointNeighbourhood(P, &Yk, 1, octreeLevel, maxSquareDist, 0.0, &neighborhoodSize) >= 1)
+		unsigned nearestIndex = join.nearestIndexes[i];
+		if (nearestIndex != NearestNeighborJoin::InvalidIndex)
 		{
 			double s1 = field1.pointValue(corePoints.originIndex(i));
-			double s2 = field2.pointValue(Yk.getPointGlobalIndex(0));
+			double s2 = field2.pointValue(nearestIndex);
 			s = masc::Feature::PerformMathOp(s1, s2, op);
 		}
 
 		outSF->setValue(i, s);
-
-		if (i && (i % tenth) == 0)
-		{
-			double density = meanNeighborhoodSize / tenth;
-			if (density < 1.1)
-			{
-				if (octreeLevel + 1 < CCCoreLib::DgmOctree::MAX_OCTREE_LEVEL)
-					++octreeLevel;
-			}
-			else while (density > 2.9)
-			{
-				if (octreeLevel <= 5)
-					break;
-				--octreeLevel;
-				density /= 2.0;
-			}
-			ccLog::Print(QString("[Adaptative octree level] Mean neighborhood size: %1 --> new level = %2").arg(meanNeighborhoodSize / tenth).arg(octreeLevel));
-			meanNeighborhoodSize = 0;
-		}
-		else
-		{
-			meanNeighborhoodSize += neighborhoodSize;
-		}
-
-		if (progressCb)
-		{
-			cancelled = !nProgress.oneStep();
-			if (cancelled)
-			{
-				//process cancelled by the user
-				error = "[Point feature] Process cancelled";
-			}
-		}
-	}
 	}
 
 	outSF->computeMinAndMax();
 
-	if (progressCb)
-	{
-		progressCb->stop();
-	}
-
-	return error.isEmpty();
+	return true;
 }
 
 bool PointFeature::prepare(	const CorePoints& corePoints,
@@ -598,30 +582,18 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 		}
 		source.name = QString::fromStdString(statSF1->getName());
 
-		if (field2 && op != Feature::NO_OPERATION && !sf1WasAlreadyExisting) // nothing to do if statSF1 was already there
-		{
-			QString resultSF2Name = field2->getName() + QString("_") + cloud2Label + "_" + Feature::StatToString(stat) + "@" + QString::number(scale);
-			//keepStatSF2 = (corePoints.cloud->getScalarFieldIndexByName(resultSFName2) >= 0); //we remember that the scalar field was already existing!
-
-			assert(!statSF2);
-			sf2WasAlreadyExisting = CheckSFExistence(corePoints.cloud, resultSF2Name);
-			if (sf2WasAlreadyExisting)
-				statSF2 = PrepareSF(corePoints.cloud, resultSF2Name, generatedScalarFields, SFCollector::ALWAYS_KEEP);
-			else
-				statSF2 = PrepareSF(corePoints.cloud, resultSF2Name, generatedScalarFields, SFCollector::ALWAYS_REMOVE);
-			if (!statSF2)
-			{
-				error = QString("Failed to prepare scalar field for field '%1' @ scale %2").arg(field2->getName()).arg(scale);
-				return false;
-			}
-		}
-
 		return true;
 	}
 	else //non scaled feature
 	{
 		assert(cloud1 == corePoints.cloud || cloud1 == corePoints.origin);
 
+		if (op == NO_OPERATION && !corePoints.keepFeatureFields && aliasSource(corePoints))
+		{
+			//no need to duplicate the source field
+			return true;
+		}
+
 		//retrieve/create a SF to host the result
 		int sfIdx = corePoints.cloud->getScalarFieldIndexByName(resultSF1Name.toStdString());
 
@@ -653,14 +625,25 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 			}
 			else if (field2)
 			{
+				//the nearest neighbors may be shared with other features (see FeaturePlan)
+				if (!nearestNeighborJoin)
+				{
+					nearestNeighborJoin.reset(new NearestNeighborJoin);
+				}
+				if (!nearestNeighborJoin->isComputed() && !nearestNeighborJoin->compute(corePoints, *cloud2, error, progressCb))
+				{
+					error = "Failed to perform the MATH operation (" + error + ")";
+					resultSF->release();
+					return false;
+				}
+
 				if (!ComputeMathOpWithNearestNeighbor(	corePoints,
 														*field1,
 														resultSF,
-														*cloud2,
+														*nearestNeighborJoin,
 														*field2,
 														op,
-														error,
-														progressCb)
+														error)
 					)
 				{
 					error = "Failed to perform the MATH operation (" + error + ")";
@@ -679,13 +662,77 @@ bool PointFeature::prepare(	const CorePoints& corePoints,
 			corePoints.cloud->setCurrentDisplayedScalarField(newSFIdx);
 		}
 
-		source.name = QString::fromStdString(resultSF->getName());
+		//the copied values are read from the scalar field (whatever the original source: colors, normals, etc.)
+		source = { Source::ScalarField, QString::fromStdString(resultSF->getName()) };
 
 		return true;
 	}
 }
 
-bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const IScalarFieldWrapper::Shared& sourceField, double& outputValue) const
+bool PointFeature::aliasSource(const CorePoints& corePoints)
+{
+	if (!corePoints.cloud || !field1)
+	{
+		assert(false);
+		return false;
+	}
+
+	switch (type)
+	{
+	case PointFeature::X:
+	case PointFeature::Y:
+	case PointFeature::Z:
+		//the source has been set by the constructor
+		return true;
+
+	case PointFeature::R:
+	case PointFeature::G:
+	case PointFeature::B:
+		//the source has been set by the constructor
+		return corePoints.cloud->hasColors();
+
+	case PointFeature::EchoRat:
+		if (	!Tools::RetrieveSF(corePoints.cloud, LAS_FIELD_NAMES[LAS_RETURN_NUMBER], false)
+			||	!Tools::RetrieveSF(corePoints.cloud, LAS_FIELD_NAMES[LAS_NUMBER_OF_RETURNS], false))
+		{
+			return false;
+		}
+		source = { Source::EchoRatio, field1->getName() };
+		return true;
+
+	case PointFeature::Dip:
+	case PointFeature::DipDir:
+		if (!corePoints.cloud->hasNormals())
+		{
+			return false;
+		}
+		source = { type == PointFeature::Dip ? Source::NormDip : Source::NormDipDir, field1->getName() };
+		return true;
+
+	default:
+	{
+		//the field must be a 'real' scalar field, also present on the core points cloud
+		//(the core points cloud is either the origin cloud or a partial clone of it)
+		if (!dynamic_cast<const ScalarFieldWrapper*>(field1.data()))
+		{
+			return false;
+		}
+		QString sfName = field1->getName();
+		int sfIdx = corePoints.cloud->getScalarFieldIndexByName(sfName.toStdString());
+		if (sfIdx < 0 || corePoints.cloud->getScalarField(sfIdx)->size() != corePoints.size())
+		{
+			return false;
+		}
+		source = { Source::ScalarField, sfName };
+		return true;
+	}
+	}
+}
+
+bool PointFeature::computeStat(	const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood,
+								const IScalarFieldWrapper::Shared& sourceField,
+								double& outputValue,
+								ScratchArena& arena) const
 {
 	outputValue = std::numeric_limits<double>::quiet_NaN();
 
@@ -703,29 +750,51 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 		return false;
 	}
 
+	//gather the values (in the per-thread buffer)
+	std::vector<double>& values = arena.gatheredValues;
+	try
+	{
+		values.resize(kNN);
+	}
+	catch (const std::bad_alloc&)
+	{
+		ccLog::Warning("Not enough memory");
+		return false;
+	}
+	for (size_t k = 0; k < kNN; ++k)
+	{
+		values[k] = sourceField->pointValue(pointsInNeighbourhood[k].pointIndex);
+	}
+
+	return ComputeStat(stat, values, arena.values, outputValue);
+}
+
+bool PointFeature::ComputeStat(Feature::Stat stat, const std::vector<double>& values, std::vector<ScalarType>& buffer, double& outputValue)
+{
+	outputValue = std::numeric_limits<double>::quiet_NaN();
+
+	size_t kNN = values.size();
+	if (kNN == 0)
+	{
+		assert(false);
+		return false;
+	}
+
 	//specific case
 	if (stat == Feature::RANGE)
 	{
-		double minValue = 0;
-		double maxValue = 0;
+		double minValue = values[0];
+		double maxValue = values[0];
 
-		for (size_t k = 0; k < kNN; ++k)
+		for (size_t k = 1; k < kNN; ++k)
 		{
-			unsigned index = pointsInNeighbourhood[k].pointIndex;
-			double v = sourceField->pointValue(index);
+			double v = values[k];
 
 			//track min and max values
-			if (k != 0)
-			{
-				if (v < minValue)
-					minValue = v;
-				else if (v > maxValue)
-					maxValue = v;
-			}
-			else
-			{
-				minValue = maxValue = v;
-			}
+			if (v < minValue)
+				minValue = v;
+			else if (v > maxValue)
+				maxValue = v;
 		}
 
 		outputValue = maxValue - minValue;
@@ -738,12 +807,12 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 		double sum = 0.0;
 		double sum2 = 0.0;
 
-		std::vector<ScalarType> values;
 		if (storeValues)
 		{
 			try
 			{
-				values.resize(kNN);
+				//the buffer capacity is kept (no reallocation if it is reused)
+				buffer.resize(kNN);
 			}
 			catch (const std::bad_alloc&)
 			{
@@ -752,10 +821,9 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 			}
 		}
 
-		for (unsigned k = 0; k < kNN; ++k)
+		for (size_t k = 0; k < kNN; ++k)
 		{
-			unsigned index = pointsInNeighbourhood[k].pointIndex;
-			double v = sourceField->pointValue(index);
+			double v = values[k];
 
 			if (withSums)
 			{
@@ -766,7 +834,7 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 
 			if (storeValues)
 			{
-				values[k] = static_cast<ScalarType>(v);
+				buffer[k] = static_cast<ScalarType>(v);
 			}
 		}
 
@@ -781,7 +849,7 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 		case Feature::MODE:
 		{
 			CCCoreLib::WeibullDistribution w;
-			if (w.computeParameters(CCCoreLib::WeibullDistribution::VectorAsScalarContainer(values)))
+			if (w.computeParameters(CCCoreLib::WeibullDistribution::VectorAsScalarContainer(buffer)))
 			{
 				outputValue = w.computeMode();
 			}
@@ -790,9 +858,9 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 
 		case Feature::MEDIAN:
 		{
-			size_t medianIndex = values.size() / 2;
-			std::nth_element(values.begin(), values.begin() + medianIndex, values.end());
-			outputValue = values[medianIndex];
+			size_t medianIndex = buffer.size() / 2;
+			std::nth_element(buffer.begin(), buffer.begin() + medianIndex, buffer.end());
+			outputValue = buffer[medianIndex];
 		}
 		break;
 
@@ -812,7 +880,7 @@ bool PointFeature::computeStat(const CCCoreLib::DgmOctree::NeighboursSet& points
 		case Feature::SKEW:
 		{
 			CCCoreLib::WeibullDistribution w;
-			if (w.computeParameters(CCCoreLib::WeibullDistribution::VectorAsScalarContainer(values)))
+			if (w.computeParameters(CCCoreLib::WeibullDistribution::VectorAsScalarContainer(buffer)))
 			{
 				outputValue = w.computeSkewness();
 			}
@@ -864,36 +932,6 @@ bool PointFeature::finish(const CorePoints& corePoints, QString& error)
 		}
 	}
 
-	if (statSF2 && !sf1WasAlreadyExisting)
-	{
-		//now perform the math operation
-		if (op != Feature::NO_OPERATION)
-		{
-			if (!PerformMathOp(statSF1, statSF2, op))
-			{
-				error = "Failed to perform the MATH operation";
-				success = false;
-			}
-		}
-//		statSF2->computeMinAndMax();
-
-		//DGM: we don't delete it now! As it could be used by other features!
-		//if (!keepStatSF2)
-		//{
-		//	int sfIndex2 = corePoints.cloud->getScalarFieldIndexByName(statSF2->getName());
-		//	if (sfIndex2 >= 0)
-		//	{
-		//		corePoints.cloud->deleteScalarField(sfIndex2);
-		//	}
-		//	else
-		//	{
-		//		assert(false);
-		//		statSF2->release();
-		//	}
-		//	statSF2 = nullptr;
-		//}
-	}
-
 	return success;
 }
 
@@ -23,9 +23,13 @@
 
 //Qt
 #include <QSharedPointer>
+#include <QStringList>
 
 namespace masc
 {
+	struct NearestNeighborJoin;
+	struct ScratchArena;
+
 	//! Point feature
 	struct PointFeature : public Feature
 	{
@@ -151,7 +155,6 @@ namespace masc
 			, field1(nullptr)
 			, field2(nullptr)
 			, statSF1(nullptr)
-			, statSF2(nullptr)
 		{
 			//auomatically set the right source for specific features
 			switch (type)
@@ -192,13 +195,38 @@ namespace masc
 		virtual QString toString() const override;
 
 		//! Compute the associated 'stat' on a set of points (and with a given field)
-		bool computeStat(const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood, const IScalarFieldWrapper::Shared& sourceField, double& outputValue) const;
+		/** \param arena per-thread buffers (the gathered values and the copy required by MEDIAN, MODE and SKEW)
+		**/
+		bool computeStat(	const CCCoreLib::DgmOctree::NeighboursSet& pointsInNeighbourhood,
+							const IScalarFieldWrapper::Shared& sourceField,
+							double& outputValue,
+							ScratchArena& arena) const;
+
+		//! Computes a 'stat' on a set of (already gathered) values
+		/** \param buffer buffer for the STAT measures requiring a copy of the values (MEDIAN, MODE, SKEW)
+		**/
+		static bool ComputeStat(Feature::Stat stat, const std::vector<double>& values, std::vector<ScalarType>& buffer, double& outputValue);
+
+		//inherited from Feature
+		virtual void getRequiredAttributes(QStringList& sfNames, int& sfCount, bool& colors, bool& normals) const override;
+
+		//! Returns the field corresponding to a given point feature type on a given cloud
+		/** Can be used by the other feature types (e.g. the intensity of both clouds for DualCloudFeature::IDIFF).
+			\warning the SF type is not supported (it requires a scalar field index)
+		**/
+		static IScalarFieldWrapper::Shared RetrieveField(PointFeatureType type, ccPointCloud* cloud, QString& error);
 
 	protected: //methods
 
 		//! Returns the 'source' field from a given cloud
 		IScalarFieldWrapper::Shared retrieveField(ccPointCloud* cloud, QString& error);
 
+		//! Makes the feature source directly reference the source field (scale-less features without MATH operation)
+		/** No scalar field is created (nor copied). Returns false if the source field can't be referenced
+			on the core points cloud.
+		**/
+		bool aliasSource(const CorePoints& corePoints);
+
 	public:	//members
 
 		//! Point feature type
@@ -216,7 +244,13 @@ namespace masc
 		IScalarFieldWrapper::Shared field2;
 
 		//! For scaled features
+		/** For MATH features, the two operands are directly combined in this field (see FeaturePlan).
+		**/
 		CCCoreLib::ScalarField* statSF1;
-		CCCoreLib::ScalarField* statSF2;
+
+		//! Nearest neighbors of the core points in the second cloud (for scale-less MATH features)
+		/** Shared by all the features involving the same cloud (see FeaturePlan).
+		**/
+		QSharedPointer<NearestNeighborJoin> nearestNeighborJoin;
 	};
 }
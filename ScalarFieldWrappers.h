@@ -20,6 +20,7 @@
 //qCC_db
 #include <ccPointCloud.h>
 //CCLib
+#include <DgmOctree.h>
 #include <ScalarField.h>
 
 //Qt
@@ -34,6 +35,15 @@ public:
 	virtual bool isValid() const = 0;
 	virtual QString getName() const = 0;
 	virtual size_t size() const = 0;
+
+	//! Gathers the values of the 'count' first neighbors in a contiguous buffer
+	virtual void gather(const CCCoreLib::DgmOctree::NeighboursSet& neighbors, unsigned count, double* values) const
+	{
+		for (unsigned k = 0; k < count; ++k)
+		{
+			values[k] = pointValue(neighbors[k].pointIndex);
+		}
+	}
 };
 
 class ScalarFieldWrapper : public IScalarFieldWrapper
@@ -47,6 +57,14 @@ public:
 	inline bool isValid() const override { return m_sf != nullptr; }
 	inline QString getName() const override { return QString::fromStdString(m_sf->getName()); }
 	size_t size() const override { return m_sf->size(); }
+	void gather(const CCCoreLib::DgmOctree::NeighboursSet& neighbors, unsigned count, double* values) const override
+	{
+		//no virtual call per value
+		for (unsigned k = 0; k < count; ++k)
+		{
+			values[k] = m_sf->getValue(neighbors[k].pointIndex);
+		}
+	}
 
 protected:
 	CCCoreLib::ScalarField* m_sf;
@@ -123,6 +141,27 @@ protected:
 	Dim m_dim;
 };
 
+//! Constant value (placeholder for the attributes that are not used)
+class ConstantScalarFieldWrapper : public IScalarFieldWrapper
+{
+public:
+	ConstantScalarFieldWrapper(size_t size, QString name, double value = 0.0)
+		: m_size(size)
+		, m_name(name)
+		, m_value(value)
+	{}
+
+	inline double pointValue(unsigned /*index*/) const override { return m_value; }
+	inline bool isValid() const override { return true; }
+	inline QString getName() const override { return m_name; }
+	inline size_t size() const override { return m_size; }
+
+protected:
+	size_t m_size;
+	QString m_name;
+	double m_value;
+};
+
 class ColorScalarFieldWrapper : public IScalarFieldWrapper
 {
 public:
@@ -0,0 +1,84 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "ScratchArena.h"
+
+using namespace masc;
+
+bool ScratchArena::bucketNeighborsByScale(unsigned kNN, const std::vector<double>& sqRadii, bool sortBuckets)
+{
+	CCCoreLib::DgmOctree::NeighboursSet& neighbors = nNSS.pointsInNeighbourhood;
+	assert(kNN <= neighbors.size());
+	size_t bucketCount = sqRadii.size();
+
+	std::vector<unsigned>& counts = neighborCountPerScale;
+	try
+	{
+		counts.assign(bucketCount + 1, 0);
+		bucketBuffer.resize(kNN);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return false;
+	}
+
+	//count the points per bucket (the first bucket containing the point, i.e. the smallest scale)
+	for (unsigned k = 0; k < kNN; ++k)
+	{
+		size_t b = 0;
+		while (b + 1 < bucketCount && neighbors[k].squareDistd > sqRadii[b])
+		{
+			++b;
+		}
+		++counts[b + 1];
+	}
+
+	//cumulative counts (counts[j] = first slot of the bucket j)
+	for (size_t b = 1; b <= bucketCount; ++b)
+	{
+		counts[b] += counts[b - 1];
+	}
+
+	//scatter
+	for (unsigned k = 0; k < kNN; ++k)
+	{
+		size_t b = 0;
+		while (b + 1 < bucketCount && neighbors[k].squareDistd > sqRadii[b])
+		{
+			++b;
+		}
+		bucketBuffer[counts[b]++] = neighbors[k];
+	}
+	//now counts[j] = number of points in the buckets 0 to j (= the neighborhood of scale j)
+	counts.pop_back();
+
+	std::swap(neighbors, bucketBuffer);
+
+	if (sortBuckets)
+	{
+		unsigned start = 0;
+		for (unsigned end : counts)
+		{
+			std::sort(	neighbors.begin() + start,
+						neighbors.begin() + end,
+						[](const CCCoreLib::DgmOctree::PointDescriptor& a, const CCCoreLib::DgmOctree::PointDescriptor& b) { return a.squareDistd < b.squareDistd; });
+			start = end;
+		}
+	}
+
+	return true;
+}
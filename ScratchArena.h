@@ -0,0 +1,121 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "GeometryKernel.h"
+
+//CCLib
+#include <DgmOctree.h>
+
+//system
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace masc
+{
+	//! Scratch memory used by a single thread during the feature computation
+	/** All the buffers only grow (their capacity is kept between two core points),
+		so that the computation loop doesn't allocate anything once warmed up.
+	**/
+	struct ScratchArena
+	{
+		//! Spherical neighborhood extraction structure
+		CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+		//! Gathered field values (on the current neighborhood)
+		std::vector<double> gatheredValues;
+		//! Values buffer (for the STAT measures requiring all the values: MEDIAN, MODE, SKEW)
+		std::vector<ScalarType> values;
+		//! Local geometry (shared by all the neighborhood features of a given scale)
+		LocalGeometry geometry;
+		//! Buffer used to partition the neighbors by scale
+		CCCoreLib::DgmOctree::NeighboursSet bucketBuffer;
+		//! Number of neighbors per scale (cumulative, by increasing scale)
+		std::vector<unsigned> neighborCountPerScale;
+
+		//! Prepares the neighborhood extraction structure for a new query point
+		/** The vectors are cleared but their capacity is kept.
+		**/
+		void resetNeighborhood(const CCVector3& queryPoint, unsigned char level)
+		{
+			nNSS.queryPoint = queryPoint;
+			nNSS.level = level;
+			nNSS.minimalCellsSetToVisit.clear();
+			nNSS.pointsInNeighbourhood.clear();
+			nNSS.alreadyVisitedNeighbourhoodSize = 0;
+			nNSS.theNearestPointIndex = 0;
+			nNSS.maxSearchSquareDistd = 0;
+			geometry.invalidate();
+		}
+
+		//! Partitions the 'kNN' first neighbors by scale (in O(k), without sorting them)
+		/** \param sqRadii squared radii of the scales (increasing order)
+			\param sortBuckets whether the neighbors should be sorted inside each bucket (i.e. globally sorted by increasing distance)
+			On output, the neighbors of the scale j are the 'neighborCountPerScale[j]' first ones.
+		**/
+		bool bucketNeighborsByScale(unsigned kNN, const std::vector<double>& sqRadii, bool sortBuckets);
+	};
+
+	//! Set of scratch arenas (one per thread)
+	class ScratchArenas
+	{
+	public:
+
+		//! Allocates one arena per (potential) thread
+		bool init()
+		{
+#if defined(_OPENMP)
+			int threadCount = std::max(1, omp_get_max_threads());
+#else
+			int threadCount = 1;
+#endif
+			try
+			{
+				m_arenas.resize(static_cast<size_t>(threadCount));
+			}
+			catch (const std::bad_alloc&)
+			{
+				return false;
+			}
+			return true;
+		}
+
+		//! Returns the arena of the current thread
+		/** \warning init must have been called before
+		**/
+		inline ScratchArena& local()
+		{
+#if defined(_OPENMP)
+			size_t index = static_cast<size_t>(omp_get_thread_num());
+#else
+			size_t index = 0;
+#endif
+			assert(index < m_arenas.size());
+			return m_arenas[index];
+		}
+
+	protected:
+
+		std::vector<ScratchArena> m_arenas;
+	};
+
+}; //namespace masc
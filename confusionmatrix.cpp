@@ -47,6 +47,23 @@ ConfusionMatrix::ConfusionMatrix(	const CCCoreLib::GenericDistribution::ScalarCo
 
 	compute(actual, predicted);
 
+	setupTable();
+}
+
+ConfusionMatrix::ConfusionMatrix(const Counts& counts)
+	: m_ui(new Ui::ConfusionMatrix)
+	, m_overallAccuracy(0.0f)
+{
+	m_ui->setupUi(this);
+	this->setWindowFlag(Qt::WindowStaysOnTopHint);
+
+	compute(counts);
+
+	setupTable();
+}
+
+void ConfusionMatrix::setupTable()
+{
 	this->m_ui->tableWidget->resizeColumnsToContents();
 	this->m_ui->tableWidget->setSizeAdjustPolicy(QAbstractScrollArea::AdjustToContents);
 	QSize tableSize = this->m_ui->tableWidget->sizeHint();
@@ -145,11 +162,23 @@ float ConfusionMatrix::computeOverallAccuracy(cv::Mat& matrix)
 
 void ConfusionMatrix::compute(const CCCoreLib::GenericDistribution::ScalarContainer& actual, const CCCoreLib::GenericDistribution::ScalarContainer& predicted)
 {
-	// get the set of classes with the contents of the actual classes
-	std::set<ScalarType> classes;
+	Counts counts;
 	for (size_t i = 0; i < actual.size(); ++i)
 	{
-		classes.insert(actual.getValue(i));
+		++counts[std::make_pair(static_cast<int>(actual.getValue(i)), static_cast<int>(predicted.getValue(i)))];
+	}
+
+	compute(counts);
+}
+
+void ConfusionMatrix::compute(const Counts& counts)
+{
+	// get the set of classes (actual and predicted)
+	std::set<ScalarType> classes;
+	for (const auto& entry : counts)
+	{
+		classes.insert(static_cast<ScalarType>(entry.first.first));
+		classes.insert(static_cast<ScalarType>(entry.first.second));
 	}
 	int nbClasses = static_cast<int>(classes.size());
 	m_confusionMatrix = cv::Mat(nbClasses, nbClasses, CV_32S, cv::Scalar(0));
@@ -157,13 +186,11 @@ void ConfusionMatrix::compute(const CCCoreLib::GenericDistribution::ScalarContai
 	cv::Mat vec_TP_FN(nbClasses, 1, CV_32S, cv::Scalar(0));
 
 	// fill the confusion matrix
-	for (int i = 0; i < actual.size(); i++)
+	for (const auto& entry : counts)
 	{
-		int actualClass = static_cast<int>(actual.getValue(i));
-		int idxActual = std::distance(classes.begin(), classes.find(actualClass));
-		int predictedClass = static_cast<int>(predicted.getValue(i));
-		int idxPredicted = std::distance(classes.begin(), classes.find(predictedClass));
-		m_confusionMatrix.at<int>(idxActual, idxPredicted)++;
+		int idxActual = static_cast<int>(std::distance(classes.begin(), classes.find(static_cast<ScalarType>(entry.first.first))));
+		int idxPredicted = static_cast<int>(std::distance(classes.begin(), classes.find(static_cast<ScalarType>(entry.first.second))));
+		m_confusionMatrix.at<int>(idxActual, idxPredicted) += static_cast<int>(entry.second);
 	}
 
 	// compute precision recall F1-score
@@ -235,13 +262,15 @@ void ConfusionMatrix::compute(const CCCoreLib::GenericDistribution::ScalarContai
 		{
 			double val = m_confusionMatrix.at<int>(row, column);
 			QTableWidgetItem *newItem = new QTableWidgetItem(QString::number(val));
+			int TP_FN = vec_TP_FN.at<int>(row, 0);
+			double ratio = (TP_FN != 0 ? val / TP_FN : 0.0); // a predicted class may have no actual sample
 			if (row == column)
 			{
-				newItem->setBackground(GetColor(val / vec_TP_FN.at<int>(row, 0), 0, 128, 255));
+				newItem->setBackground(GetColor(ratio, 0, 128, 255));
 			}
 			else
 			{
-				newItem->setBackground(GetColor(val / vec_TP_FN.at<int>(row, 0), 200, 50, 50));
+				newItem->setBackground(GetColor(ratio, 200, 50, 50));
 			}
 			this->m_ui->tableWidget->setItem(2 + row, + 2 + column, newItem);
 		}
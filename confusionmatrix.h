@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QWidget>
+#include <map>
 #include <set>
 
 #include <GenericDistribution.h>
@@ -25,19 +26,26 @@ public:
 		F1_SCORE = 2
 	};
 
+	//! Number of samples per (actual class, predicted class) pair
+	using Counts = std::map<std::pair<int, int>, unsigned>;
+
 	explicit ConfusionMatrix(	const CCCoreLib::GenericDistribution::ScalarContainer& actual,
 								const CCCoreLib::GenericDistribution::ScalarContainer& predicted );
+	explicit ConfusionMatrix(const Counts& counts);
 	~ConfusionMatrix() override;
 
 	void computePrecisionRecallF1Score(cv::Mat& matrix, cv::Mat& precisionRecallF1Score, cv::Mat &vec_TP_FN);
 	float computeOverallAccuracy(cv::Mat& matrix);
 	void compute(	const CCCoreLib::GenericDistribution::ScalarContainer& actual,
 					const CCCoreLib::GenericDistribution::ScalarContainer& predicted );
+	void compute(const Counts& counts);
 	void setSessionRun(QString session, int run);
 	bool save(QString filePath);
 	float getOverallAccuracy() const;
 
 private:
+	void setupTable();
+
 	Ui::ConfusionMatrix* m_ui;
 	cv::Mat m_confusionMatrix;
 	cv::Mat m_precisionRecallF1Score;
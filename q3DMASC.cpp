@@ -20,9 +20,11 @@
 //local
 #include "q3DMASCDisclaimerDialog.h"
 #include "q3DMASCClassifier.h"
+#include "FeatureSelection.h"
 #include "q3DMASCTools.h"
 #include "qClassify3DMASCDialog.h"
 #include "qTrain3DMASCDialog.h"
+#include "qFeatureSelectionDialog.h"
 #include "q3DMASCCommands.h"
 
 //qCC_db
@@ -107,7 +109,7 @@ void q3DMASCPlugin::doClassifyAction()
 		QSettings settings;
 		settings.beginGroup("3DMASC");
 		QString inputPath = settings.value("FilePath", QCoreApplication::applicationDirPath()).toString();
-		inputFilename = QFileDialog::getOpenFileName(m_app->getMainWindow(), "Load 3DMASC classifier file", inputPath, "*.txt");
+		inputFilename = QFileDialog::getOpenFileName(m_app->getMainWindow(), "Load 3DMASC classifier file", inputPath, "3DMASC classifier (*.txt *.3dmasc)");
 		if (inputFilename.isNull())
 		{
 			//process cancelled by the user
@@ -177,11 +179,25 @@ void q3DMASCPlugin::doClassifyAction()
 	masc::CorePoints corePoints;
 	corePoints.origin = corePoints.cloud = clouds[mainCloudLabel];
 	corePoints.role = mainCloudLabel;
+	corePoints.keepFeatureFields = s_keepAttributes;
+	unsigned propagationKNN = 1;
+	classifDlg.getCorePointsSubsampling(corePoints, propagationKNN);
 
 	//prepare the main cloud
 	ccProgressDialog progressDlg(true, m_app->getMainWindow());
 	progressDlg.show();
 	progressDlg.setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
+	if (!corePoints.prepare(&progressDlg))
+	{
+		m_app->dispToConsole("Failed to subsample the core points", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+		return;
+	}
+	//the subsampled core points (if any) are only temporary
+	QScopedPointer<ccPointCloud> subsampledCorePoints(corePoints.cloud != corePoints.origin ? corePoints.cloud : nullptr);
+	if (subsampledCorePoints)
+	{
+		m_app->dispToConsole(QString("[3DMASC] Core points: %1 / %2 points").arg(corePoints.size()).arg(corePoints.origin->size()), ccMainAppInterface::STD_CONSOLE_MESSAGE);
+	}
 	QString error;
 	SFCollector generatedScalarFields;
     if (!masc::Tools::PrepareFeatures(corePoints, features, error, &progressDlg, &generatedScalarFields))
@@ -206,6 +222,17 @@ void q3DMASCPlugin::doClassifyAction()
 		}
 
 		generatedScalarFields.releaseSFs(s_keepAttributes);
+
+		if (subsampledCorePoints)
+		{
+			progressDlg.setAutoClose(true);
+			if (!masc::Tools::PropagateClassification(corePoints, propagationKNN, errorMessage, &progressDlg))
+			{
+				m_app->dispToConsole(errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+				return;
+			}
+			corePoints.origin->redrawDisplay();
+		}
 	}
 }
 
@@ -389,6 +416,10 @@ void q3DMASCPlugin::doTrainAction()
 	trainDlg.minSampleCountSpinBox->setValue(s_params.rt.minSampleCount);
 	trainDlg.testDataRatioSpinBox->setValue(static_cast<int>(s_params.testDataRatio * 100));
 	trainDlg.testDataRatioSpinBox->setEnabled(testCloud == nullptr);
+	trainDlg.seedSpinBox->setValue(static_cast<int>(s_params.seed));
+	trainDlg.seedSpinBox->setEnabled(testCloud == nullptr);
+	trainDlg.stratifiedSplitCheckBox->setChecked(s_params.stratifiedSplit);
+	trainDlg.stratifiedSplitCheckBox->setEnabled(testCloud == nullptr);
 	trainDlg.setInputFilePath(inputFilename);
 
 	//display the loaded features and let the user select the ones to use
@@ -474,8 +505,12 @@ void q3DMASCPlugin::doTrainAction()
 	//train / test subsets
 	QSharedPointer<CCCoreLib::ReferenceCloud> trainSubset, testSubset;
 	float previousTestSubsetRatio = -1.0f;
+	unsigned previousTestSubsetSeed = 0;
+	bool previousTestSubsetStratified = false;
 	SFCollector generatedScalarFields;
 	SFCollector generatedScalarFieldsTest;
+	//measured computation cost of the features (for the automatic feature selection)
+	masc::FeatureCosts featureCosts;
 
 	//we will train + evaluate the classifier, then display the results
 	//then let the user change parameters and (potentially) start again
@@ -512,7 +547,7 @@ void q3DMASCPlugin::doTrainAction()
 			{
 				progressDlg.show();
 				QString error;
-				if (!masc::Tools::PrepareFeatures(corePoints, toPrepare, error, &progressDlg, &generatedScalarFields))
+				if (!masc::Tools::PrepareFeatures(corePoints, toPrepare, error, &progressDlg, &generatedScalarFields, false, nullptr, &featureCosts))
 				{
 					m_app->dispToConsole(error, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 					generatedScalarFields.releaseSFs(false);
@@ -542,6 +577,8 @@ void q3DMASCPlugin::doTrainAction()
 			{
 				//we need to generate test subsets
 				testDataRatio = s_params.testDataRatio = trainDlg.testDataRatioSpinBox->value() / 100.0f;
+				s_params.seed = static_cast<unsigned>(trainDlg.seedSpinBox->value());
+				s_params.stratifiedSplit = trainDlg.stratifiedSplitCheckBox->isChecked();
 				if (testDataRatio < 0.0f || testDataRatio > 0.99f)
 				{
 					assert(false);
@@ -549,7 +586,9 @@ void q3DMASCPlugin::doTrainAction()
 					trainSubset.clear();
 					testSubset.clear();
 				}
-				else if (previousTestSubsetRatio != testDataRatio)
+				else if (	previousTestSubsetRatio != testDataRatio
+						||	previousTestSubsetSeed != s_params.seed
+						||	previousTestSubsetStratified != s_params.stratifiedSplit)
 				{
 					if (!trainSubset)
 						trainSubset.reset(new CCCoreLib::ReferenceCloud(corePoints.cloud));
@@ -560,14 +599,16 @@ void q3DMASCPlugin::doTrainAction()
 					testSubset->clear();
 
 					//randomly select the training points
-					if (!masc::Tools::RandomSubset(corePoints.cloud, testDataRatio, testSubset.data(), trainSubset.data()))
+					if (!masc::Tools::RandomSubset(corePoints.cloud, testDataRatio, testSubset.data(), trainSubset.data(), s_params.seed, s_params.stratifiedSplit))
 					{
-						m_app->dispToConsole("Not enough memory to generate the test subsets", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+						m_app->dispToConsole("Failed to generate the test subsets (see the Console)", ccMainAppInterface::ERR_CONSOLE_MESSAGE);
 						generatedScalarFields.releaseSFs(false);
 						generatedScalarFieldsTest.releaseSFs(false);
 						return;
 					}
 					previousTestSubsetRatio = testDataRatio;
+					previousTestSubsetSeed = s_params.seed;
+					previousTestSubsetStratified = s_params.stratifiedSplit;
 				}
 			}
 
@@ -745,11 +786,81 @@ void q3DMASCPlugin::doTrainAction()
 					s_keepAttributes = true;
 				else
 					s_keepAttributes = false;
+				if (s_keepAttributes && !corePoints.materialize())
+				{
+					m_app->dispToConsole("Not enough memory to copy the original attributes to the core points", ccMainAppInterface::WRN_CONSOLE_MESSAGE);
+				}
 				generatedScalarFields.releaseSFs(s_keepAttributes);
 				generatedScalarFieldsTest.releaseSFs(s_keepAttributes);
 				return;
 			}
 
+			//if the automatic feature selection has been requested
+			if (trainDlg.shouldSelectFeatures())
+			{
+				trainDlg.setFeaturesSelected();
+
+				//extract the samples of the features used in the last run (once for all the subsets)
+				masc::Feature::Source::Set trainSources, testSources;
+				masc::Feature::ExtractSources(features, trainSources);
+				masc::Feature::ExtractSources(testCloud && needTestSuite ? featuresTest : features, testSources);
+				cv::Mat trainSamples, trainLabels, testSamples, testLabels;
+				QString errorMessage;
+				masc::FeatureSelection selection;
+				masc::FeatureSelection::Parameters selectionParams;
+				selectionParams.rt = s_params.rt;
+				selectionParams.candidateCount = trainDlg.selectionCandidatesSpinBox->value();
+				selectionParams.seed = s_params.seed;
+
+				progressDlg.show();
+				QCoreApplication::processEvents();
+				bool success = (	masc::Classifier::ExtractSamples(corePoints.cloud, trainSources, trainSubset.data(), trainSamples, trainLabels, errorMessage)
+								&&	masc::Classifier::ExtractSamples(testCloud ? testCloud : corePoints.cloud, testSources, testCloud ? nullptr : testSubset.data(), testSamples, testLabels, errorMessage)
+								&&	selection.init(features, trainSamples, trainLabels, testSamples, testLabels, featureCosts, errorMessage)
+								&&	selection.run(selectionParams, errorMessage, &progressDlg) );
+				progressDlg.hide();
+				QCoreApplication::processEvents();
+				if (!success)
+				{
+					m_app->dispToConsole("Feature selection failed: " + errorMessage, ccMainAppInterface::ERR_CONSOLE_MESSAGE);
+					continue;
+				}
+				m_app->dispToConsole("[3DMASC] Feature selection:\n" + selection.toString(), ccMainAppInterface::STD_CONSOLE_MESSAGE);
+
+				//show the Pareto front and let the user export the reduced classifiers
+				FeatureSelectionDialog selectionDlg(selection, m_app->getMainWindow());
+				QObject::connect(&selectionDlg, &FeatureSelectionDialog::exportRequested, [&](int subsetIndex)
+				{
+					//ask for the output filename
+					QString outputFilename;
+					{
+						QSettings settings;
+						settings.beginGroup("3DMASC");
+						QString outputPath = settings.value("FilePath", QCoreApplication::applicationDirPath()).toString();
+						outputFilename = QFileDialog::getSaveFileName(&selectionDlg, "Save reduced 3DMASC classifier", outputPath, "*.txt");
+						if (outputFilename.isNull())
+						{
+							//process cancelled by the user
+							return;
+						}
+						settings.setValue("FilePath", QFileInfo(outputFilename).absolutePath());
+						settings.endGroup();
+					}
+
+					const masc::FeatureSelection::Subset& subset = selection.subsets()[subsetIndex];
+					if (masc::Tools::SaveClassifier(outputFilename, selection.features(subset), mainCloudLabel, subset.classifier, &selectionDlg))
+					{
+						m_app->dispToConsole(QString("Reduced classifier (%1 features, accuracy = %2) succesfully saved to %3").arg(subset.features.size()).arg(subset.accuracy).arg(outputFilename), ccMainAppInterface::STD_CONSOLE_MESSAGE);
+					}
+					else
+					{
+						m_app->dispToConsole("Failed to save classifier file");
+					}
+				});
+				selectionDlg.exec();
+				continue;
+			}
+
 			//if the save button has been clicked
 			if (trainDlg.shouldSaveClassifier())
 			{
@@ -798,4 +909,6 @@ void q3DMASCPlugin::registerCommands(ccCommandLineInterface* cmd)
 	}
 	
 	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCClassif));
+	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCCompileForest));
+	cmd->registerCommand(ccCommandLineInterface::Command::Shared(new Command3DMASCConvertClassifier));
 }
@@ -18,6 +18,9 @@
 #include "q3DMASCClassifier.h"
 
 //Local
+#include "ForestCompiler.h"
+#include "ForestPredictor.h"
+#include "LazyFeatureEvaluator.h"
 #include "ScalarFieldWrappers.h"
 #include "q3DMASCTools.h"
 
@@ -35,6 +38,8 @@
 
 //Qt
 #include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QProgressDialog>
 #include <QtConcurrent>
 #include <QMessageBox>
@@ -42,6 +47,9 @@
 #include "qTrain3DMASCDialog.h"
 #include "confusionmatrix.h"
 
+//system
+#include <algorithm>
+
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
@@ -56,9 +64,84 @@ Classifier::Classifier()
 {
 }
 
+//! Returns the filename of the compacted forest associated to a classifier (YAML) file
+static QString CompactForestFilename(QString yamlFilename)
+{
+	QFileInfo fi(yamlFilename);
+	return fi.absoluteDir().absoluteFilePath(fi.completeBaseName() + "_compact.bin");
+}
+
 bool Classifier::isValid() const
 {
-	return (m_rtrees && m_rtrees->isClassifier() && m_rtrees->isTrained());
+	return (m_rtrees && m_rtrees->isClassifier() && m_rtrees->isTrained()) || (m_flatForest && m_flatForest->isValid());
+}
+
+std::shared_ptr<const FlatForest> Classifier::getFlatForest(QString& errorMessage) const
+{
+	if (m_flatForest)
+	{
+		return m_flatForest;
+	}
+	if (!m_rtrees)
+	{
+		errorMessage = QObject::tr("Invalid classifier");
+		return nullptr;
+	}
+
+	std::shared_ptr<FlatForest> forest(new FlatForest);
+	if (!forest->build(m_rtrees, m_rtrees->getVarCount(), errorMessage))
+	{
+		return nullptr;
+	}
+	return forest;
+}
+
+bool Classifier::getUsedAttributes(std::vector<bool>& used, QString& errorMessage) const
+{
+	try
+	{
+		if (m_flatForest)
+		{
+			used.assign(static_cast<size_t>(m_flatForest->attributeCount()), false);
+			for (int feature : m_flatForest->features())
+			{
+				if (feature >= 0)
+				{
+					used[feature] = true;
+				}
+			}
+			return true;
+		}
+		if (!m_rtrees)
+		{
+			errorMessage = QObject::tr("Invalid classifier");
+			return false;
+		}
+
+		int varCount = m_rtrees->getVarCount();
+		used.assign(static_cast<size_t>(varCount), false);
+		for (const cv::ml::DTrees::Split& split : m_rtrees->getSplits())
+		{
+			if (split.varIdx >= 0 && split.varIdx < varCount)
+			{
+				used[split.varIdx] = true;
+			}
+		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+
+	return true;
+}
+
+void Classifier::setFlatForest(std::shared_ptr<const FlatForest> forest, QString filename)
+{
+	m_rtrees.release();
+	m_flatForest = forest;
+	m_filename = QFileInfo(filename).absoluteFilePath();
 }
 
 static IScalarFieldWrapper::Shared GetSource(const Feature::Source& fs, const ccPointCloud* cloud)
@@ -102,47 +185,52 @@ static IScalarFieldWrapper::Shared GetSource(const Feature::Source& fs, const cc
 	case Feature::Source::Blue:
 		source.reset(new ColorScalarFieldWrapper(cloud, ColorScalarFieldWrapper::Blue));
 		break;
-	}
-
-	return source;
-}
 
-bool Classifier::classify(	const Feature::Source::Set& featureSources,
-							ccPointCloud* cloud,
-							QString& errorMessage,
-							QWidget* parentWidget/*=nullptr*/,
-							ccMainAppInterface* app/*nullptr*/
-						)
-{
-	if (!cloud)
-	{
-		assert(false);
-		errorMessage = QObject::tr("Invalid input");
-		return false;
-	}
-	
-	if (!isValid())
+	case Feature::Source::EchoRatio:
 	{
-		errorMessage = QObject::tr("Invalid classifier");
-		return false;
+		CCCoreLib::ScalarField* retNumberSF = Tools::RetrieveSF(cloud, LAS_FIELD_NAMES[LAS_RETURN_NUMBER], false);
+		CCCoreLib::ScalarField* numberOfRetSF = Tools::RetrieveSF(cloud, LAS_FIELD_NAMES[LAS_NUMBER_OF_RETURNS], false);
+		if (!retNumberSF || !numberOfRetSF)
+		{
+			ccLog::Warning(QObject::tr("Internal error: can't compute the echo ratio (missing 'return number' or 'number of returns' scalar field)"));
+			return IScalarFieldWrapper::Shared(nullptr);
+		}
+		source.reset(new ScalarFieldRatioWrapper(retNumberSF, numberOfRetSF, fs.name));
 	}
+	break;
 
-	if (featureSources.empty())
-	{
-		errorMessage = QObject::tr("Training method called without any feature (source)?!");
-		return false;
+	case Feature::Source::NormDip:
+		source.reset(new NormDipAndDipDirFieldWrapper(cloud, NormDipAndDipDirFieldWrapper::Dip));
+		break;
+	case Feature::Source::NormDipDir:
+		source.reset(new NormDipAndDipDirFieldWrapper(cloud, NormDipAndDipDirFieldWrapper::DipDir));
+		break;
+
+	case Feature::Source::Placeholder:
+		source.reset(new ConstantScalarFieldWrapper(cloud->size(), fs.name));
+		break;
 	}
 
+	return source;
+}
+
+//! Creates the classification and confidence fields (an existing classification field is renamed "Classification_backup")
+static bool PrepareClassificationSFs(	ccPointCloud* cloud,
+										CCCoreLib::ScalarField*& classificationSF,
+										ccScalarField*& cvConfidenceSF,
+										ccScalarField*& classifSFBackup,
+										QString& errorMessage)
+{
 	// add a ccConfidence value if needed
 	int cvConfidenceIdx = cloud->getScalarFieldIndexByName("Classification_confidence");
 	if (cvConfidenceIdx >= 0) // if the scalar field exists, delete it
 		cloud->deleteScalarField(cvConfidenceIdx);
 	cvConfidenceIdx = cloud->addScalarField("Classification_confidence");
-	ccScalarField* cvConfidenceSF = static_cast<ccScalarField*>(cloud->getScalarField(cvConfidenceIdx));
+	cvConfidenceSF = static_cast<ccScalarField*>(cloud->getScalarField(cvConfidenceIdx));
 
 	//look for the classification field
-	CCCoreLib::ScalarField* classificationSF = Tools::GetClassificationSF(cloud);
-	ccScalarField* classifSFBackup = nullptr;
+	classificationSF = Tools::GetClassificationSF(cloud);
+	classifSFBackup = nullptr;
 
 	if (classificationSF) //save classification field (if any) by renaming it "Classification_backup"
 	{
@@ -170,6 +258,43 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 	assert(classificationSF);
 	classificationSF->fill(0); //0 = no classification?
 
+	return true;
+}
+
+bool Classifier::classify(	const Feature::Source::Set& featureSources,
+							ccPointCloud* cloud,
+							QString& errorMessage,
+							QWidget* parentWidget/*=nullptr*/,
+							ccMainAppInterface* app/*nullptr*/
+						)
+{
+	if (!cloud)
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid input");
+		return false;
+	}
+	
+	if (!isValid())
+	{
+		errorMessage = QObject::tr("Invalid classifier");
+		return false;
+	}
+
+	if (featureSources.empty())
+	{
+		errorMessage = QObject::tr("Training method called without any feature (source)?!");
+		return false;
+	}
+
+	ccScalarField* cvConfidenceSF = nullptr;
+	CCCoreLib::ScalarField* classificationSF = nullptr;
+	ccScalarField* classifSFBackup = nullptr;
+	if (!PrepareClassificationSFs(cloud, classificationSF, cvConfidenceSF, classifSFBackup, errorMessage))
+	{
+		return false;
+	}
+
 	int sampleCount = static_cast<int>(cloud->size());
 	int attributesPerSample = static_cast<int>(featureSources.size());
 
@@ -205,72 +330,139 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 	}
 	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), cloud->size());
 
+	//the forest is traversed once per point (label and votes at once)
+	ForestPredictor predictor;
+	predictor.setForestOverride(m_flatForest);
+	predictor.setEarlyExit(m_earlyExit, m_earlyExitMinConfidence);
+	if (!predictor.init(m_rtrees, attributesPerSample, errorMessage, m_backend, m_filename))
+	{
+		return false;
+	}
+
+	//the points are classified by blocks, with per-thread buffers
+#if defined(_OPENMP) && !defined(_DEBUG)
+	int threadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+	int threadCount = 1;
+#endif
+	const int blockSize = ForestPredictor::DefaultBlockSize;
+	std::vector<ForestPredictor::Buffers> threadBuffers;
+	try
+	{
+		threadBuffers.resize(threadCount);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+	//with binned features, the (float) values are directly converted to codes
+	const BinnedForest* binnedForest = predictor.binnedForest();
+	int codeSize = (binnedForest ? binnedForest->codeSize() : 0);
+	for (ForestPredictor::Buffers& buffers : threadBuffers)
+	{
+		if (!buffers.init(blockSize, attributesPerSample, codeSize))
+		{
+			errorMessage = QObject::tr("Not enough memory");
+			return false;
+		}
+	}
+	int blockCount = (sampleCount + blockSize - 1) / blockSize;
+
 	bool success = true;
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
 	bool cancelled = false;
 
 #ifndef _DEBUG
 #if defined(_OPENMP)
-#pragma omp parallel for num_threads(omp_get_max_threads() - 2)
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
 #endif
 #endif
-	for (int i = 0; i < static_cast<int>(cloud->size()); ++i)
+	for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
 	{
+	if (!cancelled)
 	{
-		//allocate the data matrix
-		cv::Mat test_data;
-		try
+#if defined(_OPENMP)
+		ForestPredictor::Buffers& buffers = threadBuffers[omp_get_thread_num()];
+#else
+		ForestPredictor::Buffers& buffers = threadBuffers.front();
+#endif
+		int firstIndex = blockIndex * blockSize;
+		int count = std::min(blockSize, sampleCount - firstIndex);
+
+		//fill the data matrix (one row per point)
+		bool predicted = false;
+		if (binnedForest)
 		{
-			test_data.create(1, attributesPerSample, CV_32FC1);
+			for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+			{
+				const IScalarFieldWrapper& wrapper = *wrappers[fIndex];
+				if (codeSize == 1)
+				{
+					uint8_t* code = buffers.codes.data() + fIndex;
+					for (int s = 0; s < count; ++s, code += attributesPerSample)
+					{
+						*code = static_cast<uint8_t>(binnedForest->encode(fIndex, static_cast<float>(wrapper.pointValue(firstIndex + s))));
+					}
+				}
+				else
+				{
+					uint16_t* code = reinterpret_cast<uint16_t*>(buffers.codes.data()) + fIndex;
+					for (int s = 0; s < count; ++s, code += attributesPerSample)
+					{
+						*code = static_cast<uint16_t>(binnedForest->encode(fIndex, static_cast<float>(wrapper.pointValue(firstIndex + s))));
+					}
+				}
+			}
+
+			predicted = predictor.predictBinned(buffers.codes.data(), count, buffers.labels.data(), buffers.confidences.data(), buffers.votes);
 		}
-		catch (const cv::Exception& cvex)
+		else
 		{
-			errorMessage = cvex.msg.c_str();
-			success = false;
-			cancelled = true;
+			for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+			{
+				const IScalarFieldWrapper& wrapper = *wrappers[fIndex];
+				float* value = buffers.samples.data() + fIndex;
+				for (int s = 0; s < count; ++s, value += attributesPerSample)
+				{
+					*value = static_cast<float>(wrapper.pointValue(firstIndex + s));
+				}
+			}
+
+			predicted = predictor.predict(buffers.samples.data(), count, buffers.labels.data(), buffers.confidences.data(), buffers.votes);
 		}
 
-		if (!cancelled)
+		if (predicted)
 		{
-		for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
-		{
-			double value = wrappers[fIndex]->pointValue(i);
-			test_data.at<float>(0, fIndex) = static_cast<float>(value);
-		}
+			for (int s = 0; s < count; ++s)
+			{
+				classificationSF->setValue(firstIndex + s, static_cast<ScalarType>(buffers.labels[s]));
+				cvConfidenceSF->setValue(firstIndex + s, static_cast<ScalarType>(buffers.confidences[s]));
+			}
 
-		float predictedClass = m_rtrees->predict(test_data.row(0), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-		classificationSF->setValue(i, static_cast<int>(predictedClass));
-		// compute the confidence
-		cv::Mat result;
-		m_rtrees->getVotes(test_data, result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-		int classIndex = -1;
-		for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-			if (predictedClass == result.at<int>(0, col))
+			if (pDlg && !nProgress.steps(count))
 			{
-				classIndex = col;
-				break;
+				//process cancelled by the user
+				success = false;
+				cancelled = true;
 			}
-		if (classIndex != -1)
-		{
-			float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-			cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
 		}
 		else
-			cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
-
-		if (pDlg && !nProgress.oneStep())
 		{
-			//process cancelled by the user
+			errorMessage = QObject::tr("Prediction failed");
 			success = false;
 			cancelled = true;
 		}
-		}
 	}
 	}
 
 	classificationSF->computeMinAndMax();
 	cvConfidenceSF->computeMinAndMax();
 
+	if (predictor.usesEarlyExit())
+	{
+		ccLog::Print(QObject::tr("[3DMASC] Early exit: %1% of the trees evaluated").arg(predictor.evaluatedTreeRatio() * 100.0, 0, 'f', 1));
+	}
+
 	//show the classification field by default
 	{
 		int classifSFIdx = cloud->getScalarFieldIndexByName(classificationSF->getName());
@@ -297,6 +489,107 @@ bool Classifier::classify(	const Feature::Source::Set& featureSources,
 	return success;
 }
 
+bool Classifier::classifyLazy(	const CorePoints& corePoints,
+								Feature::Set& features,
+								QString& errorMessage,
+								SFCollector* generatedScalarFields/*=nullptr*/,
+								QWidget* parentWidget/*=nullptr*/)
+{
+	ccPointCloud* cloud = corePoints.cloud;
+	if (!cloud)
+	{
+		//invalid input
+		assert(false);
+		errorMessage = QObject::tr("Invalid input");
+		return false;
+	}
+
+	if (!isValid())
+	{
+		errorMessage = QObject::tr("Invalid classifier");
+		return false;
+	}
+
+	std::shared_ptr<const FlatForest> forest = getFlatForest(errorMessage);
+	if (!forest)
+	{
+		return false;
+	}
+
+	QScopedPointer<ccProgressDialog> pDlg;
+	if (parentWidget)
+	{
+		pDlg.reset(new ccProgressDialog(true, parentWidget));
+		pDlg->setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	//the eager features are computed here
+	LazyFeatureEvaluator evaluator;
+	if (!evaluator.init(corePoints, features, errorMessage, pDlg.data(), generatedScalarFields))
+	{
+		return false;
+	}
+	qint64 prepareTime_ms = timer.restart();
+
+	Feature::Source::Set featureSources;
+	Feature::ExtractSources(features, featureSources);
+
+	std::vector< IScalarFieldWrapper::Shared > wrappers;
+	wrappers.reserve(featureSources.size());
+	for (const Feature::Source& fs : featureSources)
+	{
+		IScalarFieldWrapper::Shared source = GetSource(fs, cloud);
+		if (!source || !source->isValid())
+		{
+			assert(false);
+			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
+			return false;
+		}
+		wrappers.push_back(source);
+	}
+	if (!evaluator.bindAttributes(featureSources, wrappers, errorMessage))
+	{
+		return false;
+	}
+
+	ccScalarField* cvConfidenceSF = nullptr;
+	CCCoreLib::ScalarField* classificationSF = nullptr;
+	ccScalarField* classifSFBackup = nullptr;
+	if (!PrepareClassificationSFs(cloud, classificationSF, cvConfidenceSF, classifSFBackup, errorMessage))
+	{
+		return false;
+	}
+
+	if (!evaluator.classify(*forest, classificationSF, cvConfidenceSF, errorMessage, pDlg.data()))
+	{
+		return false;
+	}
+	qint64 classifyTime_ms = timer.elapsed();
+
+	if (!evaluator.finish(errorMessage))
+	{
+		return false;
+	}
+
+	classificationSF->computeMinAndMax();
+	cvConfidenceSF->computeMinAndMax();
+
+	ccLog::Print(evaluator.statistics().toString());
+	ccLog::Print(QObject::tr("[3DMASC] Lazy features: preparation (eager features) %1 s., lazy features + classification %2 s.").arg(prepareTime_ms / 1000.0, 0, 'f', 3).arg(classifyTime_ms / 1000.0, 0, 'f', 3));
+
+	//show the classification field by default
+	{
+		int classifSFIdx = cloud->getScalarFieldIndexByName(classificationSF->getName());
+		cloud->setCurrentDisplayedScalarField(classifSFIdx);
+		cloud->showSF(true);
+	}
+
+	return true;
+}
+
 bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 							ccPointCloud* testCloud,
 							AccuracyMetrics& metrics,
@@ -317,7 +610,7 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 	metrics.sampleCount = metrics.goodGuess = 0;
 	metrics.ratio = 0.0f;
 
-	if (!m_rtrees || !m_rtrees->isTrained())
+	if (!isValid())
 	{
 		errorMessage = QObject::tr("Classifier hasn't been trained yet");
 		return false;
@@ -368,24 +661,30 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 		cvConfidenceSF = static_cast<ccScalarField*>(testCloud->getScalarField(cvConfidenceIdx));
 	}
 
-	unsigned testSampleCount = (testSubset ? testSubset->size() : testCloud->size());
+	int testSampleCount = static_cast<int>(testSubset ? testSubset->size() : testCloud->size());
 	int attributesPerSample = static_cast<int>(featureSources.size());
 
 	ccLog::Print(QObject::tr("[3DMASC] Testing data: %1 samples with %2 feature(s)").arg(testSampleCount).arg(attributesPerSample));
 
-	//allocate the data matrix
-	cv::Mat test_data;
-	try
-	{
-		test_data.create(static_cast<int>(testSampleCount), attributesPerSample, CV_32FC1);
-	}
-	catch (const cv::Exception& cvex)
+	//create the field wrappers
+	std::vector< IScalarFieldWrapper::Shared > wrappers;
 	{
-		errorMessage = cvex.msg.c_str();
-		return false;
-	}
-
-	QScopedPointer<ccProgressDialog> pDlg;
+		wrappers.reserve(attributesPerSample);
+		for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+		{
+			const Feature::Source& fs = featureSources[fIndex];
+			IScalarFieldWrapper::Shared source = GetSource(fs, testCloud);
+			if (!source || !source->isValid())
+			{
+				assert(false);
+				errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
+				return false;
+			}
+			wrappers.push_back(source);
+		}
+	}
+
+	QScopedPointer<ccProgressDialog> pDlg;
 	if (parentWidget)
 	{
 		pDlg.reset(new ccProgressDialog(parentWidget));
@@ -395,96 +694,185 @@ bool Classifier::evaluate(const Feature::Source::Set& featureSources,
 	}
 	CCCoreLib::NormalizedProgress nProgress(pDlg.data(), testSampleCount);
 
-	//fill the data matrix
-	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
+	//the forest is traversed once per sample (label and votes at once)
+	ForestPredictor predictor;
+	predictor.setForestOverride(m_flatForest);
+	if (!predictor.init(m_rtrees, attributesPerSample, errorMessage, m_backend, m_filename))
 	{
-		const Feature::Source& fs = featureSources[fIndex];
-		IScalarFieldWrapper::Shared source = GetSource(fs, testCloud);
-		if (!source || !source->isValid())
+		return false;
+	}
+
+	//if the forest has been compacted, the original forest is evaluated as well (to measure the accuracy change on the test samples)
+	QScopedPointer<ForestPredictor> originalPredictor;
+	if (m_flatForest && predictor.usesFlatForest() && m_rtrees && m_rtrees->isTrained())
+	{
+		originalPredictor.reset(new ForestPredictor);
+		if (!originalPredictor->init(m_rtrees, attributesPerSample, errorMessage, Backend::FlatForest))
 		{
-			assert(false);
-			errorMessage = QObject::tr("Internal error: invalid source '%1'").arg(fs.name);
 			return false;
 		}
+	}
 
-		for (unsigned i = 0; i < testSampleCount; ++i)
+	//the test samples are streamed by blocks (no global data matrix), with per-thread buffers and confusion counts
+#if defined(_OPENMP) && !defined(_DEBUG)
+	int threadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+	int threadCount = 1;
+#endif
+	const int blockSize = ForestPredictor::DefaultBlockSize;
+	std::vector<ForestPredictor::Buffers> threadBuffers;
+	std::vector<ConfusionMatrix::Counts> threadCounts;
+	std::vector<unsigned> threadGoodGuesses;
+	std::vector<unsigned> threadOriginalGoodGuesses;
+	try
+	{
+		threadBuffers.resize(threadCount);
+		threadCounts.resize(threadCount);
+		threadGoodGuesses.resize(threadCount, 0);
+		threadOriginalGoodGuesses.resize(threadCount, 0);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+	for (ForestPredictor::Buffers& buffers : threadBuffers)
+	{
+		if (!buffers.init(blockSize, attributesPerSample))
 		{
-			unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(i) : i);
-			double value = source->pointValue(pointIndex);
-			test_data.at<float>(i, fIndex) = static_cast<float>(value);
+			errorMessage = QObject::tr("Not enough memory");
+			return false;
 		}
 	}
+	int blockCount = (testSampleCount + blockSize - 1) / blockSize;
 
-	int numberOfTrees = static_cast<int>(m_rtrees->getRoots().size());
+	bool success = true;
+	bool cancelled = false;
 
-	//estimate the efficiency of the classifier
-	std::vector<ScalarType> actualClass(testSampleCount);
-	std::vector<ScalarType> predictectedClass(testSampleCount);
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
+#endif
+#endif
+	for (int blockIndex = 0; blockIndex < blockCount; ++blockIndex)
 	{
-		metrics.sampleCount = testSampleCount;
-		metrics.goodGuess = 0;
+	if (!cancelled)
+	{
+#if defined(_OPENMP)
+		int threadIndex = omp_get_thread_num();
+#else
+		int threadIndex = 0;
+#endif
+		ForestPredictor::Buffers& buffers = threadBuffers[threadIndex];
+		int firstIndex = blockIndex * blockSize;
+		int count = std::min(blockSize, testSampleCount - firstIndex);
 
-		for (unsigned i = 0; i < testSampleCount; ++i)
+		//fill the data matrix (one row per point)
+		for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
 		{
-			unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(i) : i);
-			ScalarType pointClass = classifSF->getValue(pointIndex);
-			int iClass = static_cast<int>(pointClass);
-			//if (iClass < 0 || iClass > 255)
-			//{
-			//	errorMessage = QObject::tr("Classification values out of range (0-255)");
-			//	return false;
-			//}
+			const IScalarFieldWrapper& wrapper = *wrappers[fIndex];
+			float* value = buffers.samples.data() + fIndex;
+			for (int s = 0; s < count; ++s, value += attributesPerSample)
+			{
+				unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(firstIndex + s) : firstIndex + s);
+				*value = static_cast<float>(wrapper.pointValue(pointIndex));
+			}
+		}
 
-			float fPredictedClass = m_rtrees->predict(test_data.row(i), cv::noArray(), cv::ml::DTrees::PREDICT_MAX_VOTE);
-			int iPredictedClass = static_cast<int>(fPredictedClass);
-			actualClass.at(i) = iClass;
-			predictectedClass.at(i) = iPredictedClass;
-			if (iPredictedClass == iClass)
+		if (predictor.predict(buffers.samples.data(), count, buffers.labels.data(), buffers.confidences.data(), buffers.votes))
+		{
+			ConfusionMatrix::Counts& counts = threadCounts[threadIndex];
+			for (int s = 0; s < count; ++s)
 			{
-				++metrics.goodGuess;
+				unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(firstIndex + s) : firstIndex + s);
+				int iClass = static_cast<int>(classifSF->getValue(pointIndex));
+				int iPredictedClass = buffers.labels[s];
+
+				++counts[std::make_pair(iClass, iPredictedClass)];
+				if (iPredictedClass == iClass)
+				{
+					++threadGoodGuesses[threadIndex];
+				}
+				if (outSF)
+				{
+					outSF->setValue(pointIndex, static_cast<ScalarType>(iPredictedClass));
+					if (cvConfidenceSF)
+					{
+						cvConfidenceSF->setValue(pointIndex, static_cast<ScalarType>(buffers.confidences[s])); // the confidence
+					}
+				}
 			}
-			if (outSF)
+
+			//same samples with the original forest (the labels and the confidences are not needed anymore)
+			if (originalPredictor && originalPredictor->predict(buffers.samples.data(), count, buffers.labels.data(), buffers.confidences.data(), buffers.votes))
 			{
-				outSF->setValue(pointIndex, static_cast<ScalarType>(iPredictedClass));
-				if (cvConfidenceSF)
+				for (int s = 0; s < count; ++s)
 				{
-					// compute the confidence
-					cv::Mat result;
-					m_rtrees->getVotes(test_data.row(i), result, cv::ml::DTrees::PREDICT_MAX_VOTE);
-					int classIndex = -1;
-					for (int col = 0; col < result.cols; col++) // look for the index of the predicted class
-						if (iPredictedClass == result.at<int>(0, col))
-						{
-							classIndex = col;
-							break;
-						}
-					if (classIndex != -1)
+					unsigned pointIndex = (testSubset ? testSubset->getPointGlobalIndex(firstIndex + s) : firstIndex + s);
+					if (buffers.labels[s] == static_cast<int>(classifSF->getValue(pointIndex)))
 					{
-						float nbVotes = result.at<int>(1, classIndex); // get the number of votes
-						cvConfidenceSF->setValue(i, static_cast<ScalarType>(nbVotes / numberOfTrees)); // compute the confidence
+						++threadOriginalGoodGuesses[threadIndex];
 					}
-					else
-						cvConfidenceSF->setValue(i, CCCoreLib::NAN_VALUE);
 				}
 			}
 
-			if (pDlg && !nProgress.oneStep())
+			if (pDlg && !nProgress.steps(count))
 			{
 				//process cancelled by the user
-				return false;
+				success = false;
+				cancelled = true;
 			}
 		}
+		else
+		{
+			errorMessage = QObject::tr("Prediction failed");
+			success = false;
+			cancelled = true;
+		}
+	}
+	}
 
-		if (outSF)
-			outSF->computeMinAndMax();
-		if (cvConfidenceSF)
-			cvConfidenceSF->computeMinAndMax();
+	if (!success)
+	{
+		return false;
+	}
 
-		metrics.ratio = static_cast<float>(metrics.goodGuess) / metrics.sampleCount;
+	//merge the per-thread results
+	ConfusionMatrix::Counts counts;
+	metrics.sampleCount = static_cast<unsigned>(testSampleCount);
+	metrics.goodGuess = 0;
+	for (int t = 0; t < threadCount; ++t)
+	{
+		metrics.goodGuess += threadGoodGuesses[t];
+		for (const auto& entry : threadCounts[t])
+		{
+			counts[entry.first] += entry.second;
+		}
 	}
+	metrics.ratio = (metrics.sampleCount != 0 ? static_cast<float>(metrics.goodGuess) / metrics.sampleCount : 0.0f);
 
-	ConfusionMatrix* confusionMatrix = new ConfusionMatrix(	CCCoreLib::GenericDistribution::VectorAsScalarContainer(actualClass),
-															CCCoreLib::GenericDistribution::VectorAsScalarContainer(predictectedClass) );
+	if (originalPredictor && metrics.sampleCount != 0)
+	{
+		unsigned originalGoodGuess = 0;
+		for (int t = 0; t < threadCount; ++t)
+		{
+			originalGoodGuess += threadOriginalGoodGuesses[t];
+		}
+		QString message = QObject::tr("[3DMASC] Compacted forest: test accuracy %1% (original forest: %2%)")
+			.arg(metrics.ratio * 100.0, 0, 'f', 2)
+			.arg(static_cast<double>(originalGoodGuess) * 100.0 / metrics.sampleCount, 0, 'f', 2);
+		if (app)
+			app->dispToConsole(message);
+		else
+			ccLog::Print(message);
+	}
+
+	if (outSF)
+		outSF->computeMinAndMax();
+	if (cvConfidenceSF)
+		cvConfidenceSF->computeMinAndMax();
+
+	ConfusionMatrix* confusionMatrix = new ConfusionMatrix(counts);
 	train3DMASCDialog.addConfusionMatrixAndSaveTraces(confusionMatrix);
 	if (app)
 	{
@@ -533,6 +921,131 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		return false;
 	}
 
+	int sampleCount = static_cast<int>(trainSubset ? trainSubset->size() : cloud->size());
+	int attributesPerSample = static_cast<int>(featureSources.size());
+
+	if (app)
+	{
+		app->dispToConsole(QString("[3DMASC] Training data: %1 samples with %2 feature(s)").arg(sampleCount).arg(attributesPerSample));
+	}
+
+	cv::Mat training_data, train_labels;
+	if (!ExtractSamples(cloud, featureSources, trainSubset, training_data, train_labels, errorMessage))
+	{
+		return false;
+	}
+
+	QScopedPointer<QProgressDialog> pDlg;
+	if (parentWidget)
+	{
+		pDlg.reset(new QProgressDialog(parentWidget));
+		pDlg->setRange(0, 0); //infinite loop
+		pDlg->setLabelText("Training classifier");
+		pDlg->show();
+		QCoreApplication::processEvents();
+	}
+
+	QFuture<bool> future = QtConcurrent::run([&]()
+	{
+		// Code in this block will run in another thread
+		return train(training_data, train_labels, params, errorMessage);
+	});
+
+	while (!future.isFinished())
+	{
+#if defined(CC_WINDOWS)
+		::Sleep(500);
+#else
+		usleep(500 * 1000);
+#endif
+		if (pDlg)
+		{
+			if (pDlg->wasCanceled())
+			{
+//				future.cancel();
+				QMessageBox msgBox;
+				msgBox.setText("The training is still in progress, not possible to cancel.");
+				msgBox.exec();
+//				break;
+				pDlg->reset();
+				pDlg->show();
+			}
+			pDlg->setValue(pDlg->value() + 1);
+		}
+		QCoreApplication::processEvents();
+	}
+
+	if (pDlg)
+	{
+		pDlg->close();
+		QCoreApplication::processEvents();
+	}
+
+	if (future.isCanceled() || !future.result() || !m_rtrees->isTrained())
+	{
+		errorMessage = QObject::tr("Training failed for an unknown reason...");
+		m_rtrees.release();
+		return false;
+	}
+
+	if (params.compact)
+	{
+		//compact the forest with the training samples
+		FlatForest::CompactionParameters compactionParams;
+		compactionParams.minSupport = params.compactMinSupport;
+		compactionParams.maxTreeDropChange = params.compactMaxTreeDropChange;
+
+		std::shared_ptr<FlatForest> forest(new FlatForest);
+		FlatForest::CompactionReport report;
+		QString compactionError;
+		bool compacted = false;
+		if (forest->build(m_rtrees, attributesPerSample, compactionError))
+		{
+			std::vector<int> labels(sampleCount);
+			for (int i = 0; i < sampleCount; ++i)
+			{
+				labels[i] = static_cast<int>(train_labels.at<float>(i));
+			}
+			compacted = forest->compact(compactionParams, training_data.ptr<float>(0), labels.data(), sampleCount, report, compactionError);
+		}
+
+		if (compacted)
+		{
+			m_flatForest = forest;
+			QString message = QObject::tr("[3DMASC] Compacted forest: %1 -> %2 trees, %3 -> %4 nodes, training accuracy %5% -> %6%")
+				.arg(report.treeCountBefore)
+				.arg(report.treeCountAfter)
+				.arg(report.nodeCountBefore)
+				.arg(report.nodeCountAfter)
+				.arg(report.accuracyBefore * 100.0, 0, 'f', 2)
+				.arg(report.accuracyAfter * 100.0, 0, 'f', 2);
+			if (app)
+				app->dispToConsole(message);
+			else
+				ccLog::Print(message);
+		}
+		else
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] Failed to compact the forest: %1").arg(compactionError));
+		}
+	}
+
+	return true;
+}
+
+bool Classifier::ExtractSamples(	const ccPointCloud* cloud,
+								const Feature::Source::Set& featureSources,
+								const CCCoreLib::ReferenceCloud* subset,
+								cv::Mat& samples,
+								cv::Mat& labels,
+								QString& errorMessage)
+{
+	if (!cloud)
+	{
+		errorMessage = QObject::tr("Invalid input cloud");
+		return false;
+	}
+
 	//look for the classification field
 	CCCoreLib::ScalarField* classifSF = Tools::GetClassificationSF(cloud);
 	if (!classifSF || classifSF->size() < cloud->size())
@@ -542,19 +1055,13 @@ bool Classifier::train(	const ccPointCloud* cloud,
 		return false;
 	}
 
-	int sampleCount = static_cast<int>(trainSubset ? trainSubset->size() : cloud->size());
+	int sampleCount = static_cast<int>(subset ? subset->size() : cloud->size());
 	int attributesPerSample = static_cast<int>(featureSources.size());
 
-	if (app)
-	{
-		app->dispToConsole(QString("[3DMASC] Training data: %1 samples with %2 feature(s)").arg(sampleCount).arg(attributesPerSample));
-	}
-
-	cv::Mat training_data, train_labels;
 	try
 	{
-		training_data.create(sampleCount, attributesPerSample, CV_32FC1);
-		train_labels.create(sampleCount, 1, CV_32FC1);
+		samples.create(sampleCount, attributesPerSample, CV_32FC1);
+		labels.create(sampleCount, 1, CV_32FC1);
 	}
 	catch (const cv::Exception& cvex)
 	{
@@ -566,7 +1073,7 @@ bool Classifier::train(	const ccPointCloud* cloud,
 	{
 		for (int i = 0; i < sampleCount; ++i)
 		{
-			int pointIndex = (trainSubset ? static_cast<int>(trainSubset->getPointGlobalIndex(i)) : i);
+			int pointIndex = (subset ? static_cast<int>(subset->getPointGlobalIndex(i)) : i);
 			ScalarType pointClass = classifSF->getValue(pointIndex);
 			int iClass = static_cast<int>(pointClass);
 			//if (iClass < 0 || iClass > 255)
@@ -575,11 +1082,11 @@ bool Classifier::train(	const ccPointCloud* cloud,
 			//	return false;
 			//}
 
-			train_labels.at<float>(i) = static_cast<unsigned char>(iClass);
+			labels.at<float>(i) = static_cast<unsigned char>(iClass);
 		}
 	}
 
-	//fill the training data matrix
+	//fill the data matrix
 	for (int fIndex = 0; fIndex < attributesPerSample; ++fIndex)
 	{
 		const Feature::Source& fs = featureSources[fIndex];
@@ -594,22 +1101,28 @@ bool Classifier::train(	const ccPointCloud* cloud,
 
 		for (int i = 0; i < sampleCount; ++i)
 		{
-			int pointIndex = (trainSubset ? static_cast<int>(trainSubset->getPointGlobalIndex(i)) : i);
+			int pointIndex = (subset ? static_cast<int>(subset->getPointGlobalIndex(i)) : i);
 			double value = source->pointValue(pointIndex);
-			training_data.at<float>(i, fIndex) = static_cast<float>(value);
+			samples.at<float>(i, fIndex) = static_cast<float>(value);
 		}
 	}
 
-	QScopedPointer<QProgressDialog> pDlg;
-	if (parentWidget)
+	return true;
+}
+
+bool Classifier::train(	const cv::Mat& samples,
+						const cv::Mat& labels,
+						const RandomTreesParams& params,
+						QString& errorMessage)
+{
+	if (samples.empty() || samples.rows != labels.rows)
 	{
-		pDlg.reset(new QProgressDialog(parentWidget));
-		pDlg->setRange(0, 0); //infinite loop
-		pDlg->setLabelText("Training classifier");
-		pDlg->show();
-		QCoreApplication::processEvents();
+		assert(false);
+		errorMessage = QObject::tr("Invalid training samples");
+		return false;
 	}
 
+	m_flatForest.reset();
 	m_rtrees = cv::ml::RTrees::create();
 	m_rtrees->setMaxDepth(params.maxDepth);
 	m_rtrees->setMinSampleCount(params.minSampleCount);
@@ -623,87 +1136,95 @@ bool Classifier::train(	const ccPointCloud* cloud,
 	cv::TermCriteria terminationCriteria(cv::TermCriteria::MAX_ITER, params.maxTreeCount, std::numeric_limits<double>::epsilon());
 	m_rtrees->setTermCriteria(terminationCriteria);
 
-	QFuture<bool> future = QtConcurrent::run([&]()
+	try
 	{
-		// Code in this block will run in another thread
-		try
-		{
-			cv::Mat sampleIndexes = cv::Mat::zeros(1, training_data.rows, CV_8U);
-//			cv::Mat trainSamples = sampleIndexes.colRange(0, sampleCount);
-//			trainSamples.setTo(cv::Scalar::all(1));
-			
-			cv::Mat varTypes(training_data.cols + 1, 1, CV_8U);
-			varTypes.setTo(cv::Scalar::all(cv::ml::VAR_ORDERED));
-			varTypes.at<uchar>(training_data.cols) = cv::ml::VAR_CATEGORICAL;
-			
-			cv::Ptr<cv::ml::TrainData> trainData = cv::ml::TrainData::create(training_data, cv::ml::ROW_SAMPLE, train_labels,  /* samples layout responses */
-																			 cv::noArray(), sampleIndexes, /* varIdx sampleIdx */
-																			 cv::noArray(), varTypes); // sampleWeights varType
-
-			bool success = m_rtrees->train(trainData);
-			if (!success || !m_rtrees->isClassifier())
-			{
-				errorMessage = "Training failed";
-				return false;
-			}
-		}
-		catch (const cv::Exception& cvex)
-		{
-			m_rtrees.release();
-			errorMessage = cvex.msg.c_str();
-			return false;
-		}
-		catch (const std::exception& stdex)
-		{
-			errorMessage = stdex.what();
-			return false;
-		}
-		catch (...)
+		cv::Mat sampleIndexes = cv::Mat::zeros(1, samples.rows, CV_8U);
+//		cv::Mat trainSamples = sampleIndexes.colRange(0, sampleCount);
+//		trainSamples.setTo(cv::Scalar::all(1));
+
+		cv::Mat varTypes(samples.cols + 1, 1, CV_8U);
+		varTypes.setTo(cv::Scalar::all(cv::ml::VAR_ORDERED));
+		varTypes.at<uchar>(samples.cols) = cv::ml::VAR_CATEGORICAL;
+
+		cv::Ptr<cv::ml::TrainData> trainData = cv::ml::TrainData::create(samples, cv::ml::ROW_SAMPLE, labels,  /* samples layout responses */
+																		 cv::noArray(), sampleIndexes, /* varIdx sampleIdx */
+																		 cv::noArray(), varTypes); // sampleWeights varType
+
+		bool success = m_rtrees->train(trainData);
+		if (!success || !m_rtrees->isClassifier())
 		{
-			errorMessage = QObject::tr("Unknown error");
+			errorMessage = "Training failed";
 			return false;
 		}
+	}
+	catch (const cv::Exception& cvex)
+	{
+		m_rtrees.release();
+		errorMessage = cvex.msg.c_str();
+		return false;
+	}
+	catch (const std::exception& stdex)
+	{
+		errorMessage = stdex.what();
+		return false;
+	}
+	catch (...)
+	{
+		errorMessage = QObject::tr("Unknown error");
+		return false;
+	}
 
-		return true;
-	});
+	return true;
+}
 
-	while (!future.isFinished())
+bool Classifier::predict(const cv::Mat& samples, std::vector<int>& labels, QString& errorMessage) const
+{
+	if (!isValid())
 	{
-#if defined(CC_WINDOWS)
-		::Sleep(500);
-#else
-		usleep(500 * 1000);
-#endif
-		if (pDlg)
-		{
-			if (pDlg->wasCanceled())
-			{
-//				future.cancel();
-				QMessageBox msgBox;
-				msgBox.setText("The training is still in progress, not possible to cancel.");
-				msgBox.exec();
-//				break;
-				pDlg->reset();
-				pDlg->show();
-			}
-			pDlg->setValue(pDlg->value() + 1);
-		}
-		QCoreApplication::processEvents();
+		errorMessage = QObject::tr("Classifier hasn't been trained yet");
+		return false;
+	}
+	if (samples.type() != CV_32FC1 || !samples.isContinuous())
+	{
+		assert(false);
+		errorMessage = QObject::tr("Invalid samples");
+		return false;
 	}
 
-	if (pDlg)
+	ForestPredictor predictor;
+	predictor.setForestOverride(m_flatForest);
+	if (!predictor.init(m_rtrees, samples.cols, errorMessage, m_backend, m_filename))
 	{
-		pDlg->close();
-		QCoreApplication::processEvents();
+		return false;
 	}
 
-	if (future.isCanceled() || !future.result() || !m_rtrees->isTrained())
+	const int blockSize = ForestPredictor::DefaultBlockSize;
+	ForestPredictor::Buffers buffers;
+	try
 	{
-		errorMessage = QObject::tr("Training failed for an unknown reason...");
-		m_rtrees.release();
+		labels.resize(samples.rows);
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorMessage = QObject::tr("Not enough memory");
+		return false;
+	}
+	if (!buffers.init(blockSize, samples.cols))
+	{
+		errorMessage = QObject::tr("Not enough memory");
 		return false;
 	}
 
+	for (int firstIndex = 0; firstIndex < samples.rows; firstIndex += blockSize)
+	{
+		int count = std::min(blockSize, samples.rows - firstIndex);
+		if (!predictor.predict(samples.ptr<float>(firstIndex), count, labels.data() + firstIndex, buffers.confidences.data(), buffers.votes))
+		{
+			errorMessage = QObject::tr("Prediction failed");
+			return false;
+		}
+	}
+
 	return true;
 }
 
@@ -724,6 +1245,18 @@ bool Classifier::toFile(QString filename, QWidget* parentWidget/*=nullptr*/) con
 
 	cv::String cvFilename = filename.toStdString();
 	m_rtrees->save(cvFilename);
+
+	//save the compacted forest next to the classifier (it depends on the saved file)
+	if (m_flatForest)
+	{
+		QByteArray signature;
+		QString errorMessage;
+		if (	!CompiledForest::ComputeSignature(filename, signature, errorMessage)
+			||	!m_flatForest->toFile(CompactForestFilename(filename), signature, errorMessage))
+		{
+			ccLog::Warning(QObject::tr("Failed to save the compacted forest: %1").arg(errorMessage));
+		}
+	}
 	
 	pDlg.close();
 	QCoreApplication::processEvents();
@@ -745,6 +1278,7 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		QCoreApplication::processEvents();
 	}
 	
+	m_filename.clear();
 	try
 	{
 		m_rtrees = cv::ml::RTrees::load(filename.toStdString());
@@ -772,5 +1306,71 @@ bool Classifier::fromFile(QString filename, QWidget* parentWidget/*=nullptr*/)
 		ccLog::Warning(QObject::tr("Loaded classifier doesn't seem to be trained"));
 	}
 
+	m_filename = QFileInfo(filename).absoluteFilePath();
+
+	//load the compacted forest (if any)
+	m_flatForest.reset();
+	QString compactFilename = CompactForestFilename(m_filename);
+	if (QFileInfo(compactFilename).exists())
+	{
+		QByteArray signature;
+		QString errorMessage;
+		std::shared_ptr<FlatForest> forest(new FlatForest);
+		if (	CompiledForest::ComputeSignature(m_filename, signature, errorMessage)
+			&&	forest->fromFile(compactFilename, signature, errorMessage))
+		{
+			m_flatForest = forest;
+			ccLog::Print(QObject::tr("[3DMASC] Compacted forest loaded from %1").arg(compactFilename));
+		}
+		else
+		{
+			ccLog::Warning(QObject::tr("[3DMASC] The compacted forest can't be used (%1), the original forest will be used").arg(errorMessage));
+		}
+	}
+
+	return true;
+}
+
+bool Classifier::compile(bool branchless, bool buildModule, QString& errorMessage) const
+{
+	if (!isValid() || m_filename.isEmpty())
+	{
+		errorMessage = QObject::tr("No classifier file loaded");
+		return false;
+	}
+
+	std::shared_ptr<const FlatForest> forest = getFlatForest(errorMessage);
+	if (!forest)
+	{
+		return false;
+	}
+
+	QByteArray signature;
+	if (!CompiledForest::ComputeSignature(m_filename, signature, errorMessage))
+	{
+		return false;
+	}
+
+	QString sourceFilename = CompiledForest::ModuleBaseName(m_filename) + ".cpp";
+	if (!CompiledForest::GenerateSource(*forest, signature, sourceFilename, branchless, errorMessage))
+	{
+		return false;
+	}
+	ccLog::Print(QObject::tr("[3DMASC] Forest source code saved to %1").arg(sourceFilename));
+
+	if (buildModule)
+	{
+		QString moduleFilename = CompiledForest::ModuleFilename(m_filename);
+		if (!CompiledForest::BuildModule(sourceFilename, moduleFilename, CompiledForest::ModuleHashFilename(m_filename), errorMessage))
+		{
+			return false;
+		}
+		ccLog::Print(QObject::tr("[3DMASC] Forest module saved to %1").arg(moduleFilename));
+	}
+	else
+	{
+		ccLog::Print(QObject::tr("[3DMASC] Note: a module built manually won't be loaded (no recorded hash)"));
+	}
+
 	return true;
 }
@@ -20,10 +20,15 @@
 //Local
 #include "Parameters.h"
 #include "FeaturesInterface.h"
+#include "ForestPredictor.h"
 
 //Qt
 #include <QString>
 
+//system
+#include <memory>
+#include <vector>
+
 //CCLib
 #include <ReferenceCloud.h>
 
@@ -54,6 +59,25 @@ namespace masc
 					ccMainAppInterface* app = nullptr,
 					QWidget* parentWidget = nullptr);
 
+		//! Trains the classifier on a set of samples (synchronous, without any UI)
+		/** \param samples samples (one row per sample, CV_32FC1)
+			\param labels labels (one row per sample, CV_32FC1)
+		**/
+		bool train(	const cv::Mat& samples,
+					const cv::Mat& labels,
+					const RandomTreesParams& params,
+					QString& errorMessage);
+
+		//! Extracts the samples (features values) and the labels of a cloud
+		/** \param subset optional subset of points (all the points otherwise)
+		**/
+		static bool ExtractSamples(	const ccPointCloud* cloud,
+									const Feature::Source::Set& featureSources,
+									const CCCoreLib::ReferenceCloud* subset,
+									cv::Mat& samples,
+									cv::Mat& labels,
+									QString& errorMessage);
+
 		//! Classifier accuracy metrics
 		struct AccuracyMetrics
 		{
@@ -73,6 +97,11 @@ namespace masc
 						QWidget* parentWidget = nullptr,
 						ccMainAppInterface* app = nullptr);
 
+		//! Predicts the labels of a set of samples (single thread, without any UI)
+		/** \param samples samples (one row per sample, CV_32FC1)
+		**/
+		bool predict(const cv::Mat& samples, std::vector<int>& labels, QString& errorMessage) const;
+
 		//! Applies the classifier
 		bool classify(	const Feature::Source::Set& featureSources,
 						ccPointCloud* cloud,
@@ -80,6 +109,16 @@ namespace masc
 						QWidget* parentWidget = nullptr,
 						ccMainAppInterface* app = nullptr);
 
+		//! Applies the classifier with lazy features (experimental, see LazyFeatureEvaluator)
+		/** The features are prepared here (they must not have been computed before), and the scaled
+			features are only computed when the trees need them. Requires the FlatForest engine.
+		**/
+		bool classifyLazy(	const CorePoints& corePoints,
+							Feature::Set& features,
+							QString& errorMessage,
+							SFCollector* generatedScalarFields = nullptr,
+							QWidget* parentWidget = nullptr);
+
 		//! Returns whether the classifier is valid or not
 		bool isValid() const;
 
@@ -88,12 +127,57 @@ namespace masc
 		//! Loads the classifier from file
 		bool fromFile(QString filename, QWidget* parentWidget = nullptr);
 
+		//! Returns the flattened version of the forest
+		std::shared_ptr<const FlatForest> getFlatForest(QString& errorMessage) const;
+
+		//! Returns which attributes are used by at least one split of the forest
+		bool getUsedAttributes(std::vector<bool>& used, QString& errorMessage) const;
+
+		//! Sets the forest directly (e.g. from a bundle, see ClassifierBundle)
+		/** The OpenCV model is released.
+			\param filename file from which the forest was loaded (to look for a compiled module)
+		**/
+		void setFlatForest(std::shared_ptr<const FlatForest> forest, QString filename);
+
+		//! Compiles the classifier (loaded from a file) to a native module
+		/** The module is built next to the classifier file, with the SHA-256 hash of the module. It is only
+			loaded afterwards if the CompiledForest backend is explicitly requested (COMPILED_FOREST option)
+			and if the module still matches the recorded hash (see CompiledForest). Requires the FlatForest backend.
+			\param branchless whether the trees should be written as conditional expressions
+			\param buildModule whether the module should be built (otherwise only the source file is generated)
+		**/
+		bool compile(bool branchless, bool buildModule, QString& errorMessage) const;
+
 		inline cv::Mat getVarImportance() const { return m_rtrees->getVarImportance(); }
 
+		//! Inference backend
+		using Backend = ForestPredictor::Engine;
+
+		//! Sets the inference backend
+		inline void setBackend(Backend backend) { m_backend = backend; }
+		//! Returns the inference backend
+		inline Backend backend() const { return m_backend; }
+
+		//! Enables the early-exit mode when classifying (see FlatForest::predictEarlyExit)
+		/** \param minConfidence confidence threshold (0 = the predicted labels are the same as with all the trees)
+		**/
+		inline void setEarlyExit(bool enabled, float minConfidence = 0.0f) { m_earlyExit = enabled; m_earlyExitMinConfidence = minConfidence; }
+
 	protected:
 
 		//! Random trees (OpenCV)
 		cv::Ptr<cv::ml::RTrees> m_rtrees;
+		//! Classifier file (if loaded from a file)
+		QString m_filename;
+		//! Flattened forest used instead of the OpenCV one (compacted forest, or forest loaded from a bundle)
+		std::shared_ptr<const FlatForest> m_flatForest;
+
+		//! Inference backend
+		Backend m_backend = Backend::FlatForest;
+		//! Whether the early-exit mode is enabled
+		bool m_earlyExit = false;
+		//! Early-exit confidence threshold
+		float m_earlyExitMinConfidence = 0.0f;
 	};
 
 }; //namespace masc
@@ -22,18 +22,36 @@
 
 //Local
 #include "q3DMASCTools.h"
+#include "ClassifierBundle.h"
 
 //qCC_db
 #include <ccProgressDialog.h>
 
 //Qt
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QFileInfo>
 
 static const char COMMAND_3DMASC_CLASSIFY[] = "3DMASC_CLASSIFY";
 static const char COMMAND_3DMASC_KEEP_ATTRIBS[] = "KEEP_ATTRIBUTES";
 static const char COMMAND_3DMASC_ONLY_FEATURES[] = "ONLY_FEATURES";
 static const char COMMAND_3DMASC_SKIP_FEATURES[] = "SKIP_FEATURES";
+static const char COMMAND_3DMASC_PLAN_ONLY[] = "PLAN_ONLY";
+static const char COMMAND_3DMASC_BINNED_FEATURES[] = "BINNED_FEATURES";
+static const char COMMAND_3DMASC_COMPILED_FOREST[] = "COMPILED_FOREST";
+static const char COMMAND_3DMASC_EARLY_EXIT[] = "EARLY_EXIT";
+static const char COMMAND_3DMASC_SUBSAMPLE[] = "SUBSAMPLE";
+static const char COMMAND_3DMASC_SUBSAMPLE_SPATIAL[] = "SPATIAL";
+static const char COMMAND_3DMASC_SUBSAMPLE_RANDOM[] = "RANDOM";
+static const char COMMAND_3DMASC_PROPAGATE_KNN[] = "PROPAGATE_KNN";
+static const char COMMAND_3DMASC_CASCADE[] = "CASCADE";
+static const char COMMAND_3DMASC_LAZY_FEATURES[] = "LAZY_FEATURES";
+static const char COMMAND_3DMASC_LAZY_FEATURES_COMPARE[] = "COMPARE";
+static const char COMMAND_3DMASC_DROP_UNUSED_ATTRIBUTES[] = "DROP_UNUSED_ATTRIBUTES";
+static const char COMMAND_3DMASC_COMPILE_FOREST[] = "3DMASC_COMPILE_FOREST";
+static const char COMMAND_3DMASC_CONVERT_CLASSIFIER[] = "3DMASC_CONVERT_CLASSIFIER";
+static const char COMMAND_3DMASC_BRANCHLESS[] = "BRANCHLESS";
+static const char COMMAND_3DMASC_SOURCE_ONLY[] = "SOURCE_ONLY";
 
 struct Command3DMASCClassif : public ccCommandLineInterface::Command
 {
@@ -51,13 +69,26 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		int minArgumentCount = 2;
 		if (cmd.arguments().size() < minArgumentCount)
 		{
-			return cmd.error(QString("Missing parameter(s): options, classifier filename (.txt) and cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
+			return cmd.error(QString("Missing parameter(s): options, classifier filename (.txt or .3dmasc) and cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
 		}
 
 		bool keepAttributes = false;
 		bool onlyFeatures = false;
 		bool skipFeatures = false;
+		bool planOnly = false;
+		bool binnedFeatures = false;
+		bool compiledForest = false;
+		bool earlyExit = false;
+		float earlyExitMinConfidence = 0.0f;
+		masc::CorePoints::SubSamplingMethod subsamplingMethod = masc::CorePoints::NONE;
+		double subsamplingParam = 0.0;
+		unsigned propagationKNN = 1;
+		bool lazyFeatures = false;
+		bool compareLazyFeatures = false;
+		QString cascadeFilename;
+		float cascadeMinConfidence = 0.0f;
 		QString featureSourceFilename;
+		bool dropUnusedAttributes = false;
 		while (true)
 		{
 			QString argument = cmd.arguments().front();
@@ -95,6 +126,146 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				//we only expect the classifier filename now
 				--minArgumentCount;
 			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_PLAN_ONLY))
+			{
+				planOnly = true;
+				cmd.print("Will only display the feature computation plan");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_COMPILED_FOREST))
+			{
+				compiledForest = true;
+				cmd.print("Will classify with the compiled forest module (if its hash matches the recorded one)");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_BINNED_FEATURES))
+			{
+				binnedFeatures = true;
+				cmd.print("Will classify with binned features");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_EARLY_EXIT))
+			{
+				earlyExit = true;
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				//optional confidence threshold
+				if (!cmd.arguments().empty())
+				{
+					bool ok = false;
+					float minConfidence = cmd.arguments().front().toFloat(&ok);
+					if (ok)
+					{
+						if (minConfidence <= 0.0f || minConfidence > 1.0f)
+						{
+							return cmd.error(QString("Invalid confidence threshold after \"-%1\" (should be in ]0, 1])").arg(COMMAND_3DMASC_EARLY_EXIT));
+						}
+						earlyExitMinConfidence = minConfidence;
+						cmd.arguments().pop_front();
+					}
+				}
+
+				if (earlyExitMinConfidence > 0.0f)
+					cmd.print(QString("Will stop evaluating the trees once the confidence reaches %1").arg(earlyExitMinConfidence));
+				else
+					cmd.print("Will stop evaluating the trees once the label is known");
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_SUBSAMPLE))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().size() < 2)
+				{
+					return cmd.error(QString("Missing parameter(s): subsampling method (%1 or %2) and parameter after \"-%3\"").arg(COMMAND_3DMASC_SUBSAMPLE_SPATIAL).arg(COMMAND_3DMASC_SUBSAMPLE_RANDOM).arg(COMMAND_3DMASC_SUBSAMPLE));
+				}
+				QString method = cmd.arguments().takeFirst().toUpper();
+				if (method == COMMAND_3DMASC_SUBSAMPLE_SPATIAL)
+				{
+					subsamplingMethod = masc::CorePoints::SPATIAL;
+				}
+				else if (method == COMMAND_3DMASC_SUBSAMPLE_RANDOM)
+				{
+					subsamplingMethod = masc::CorePoints::RANDOM;
+				}
+				else
+				{
+					return cmd.error(QString("Unknown subsampling method '%1' (expecting %2 or %3)").arg(method).arg(COMMAND_3DMASC_SUBSAMPLE_SPATIAL).arg(COMMAND_3DMASC_SUBSAMPLE_RANDOM));
+				}
+
+				bool ok = false;
+				subsamplingParam = cmd.arguments().takeFirst().toDouble(&ok);
+				if (!ok || subsamplingParam <= 0.0)
+				{
+					return cmd.error(QString("Invalid subsampling parameter after \"-%1 %2\"").arg(COMMAND_3DMASC_SUBSAMPLE).arg(method));
+				}
+
+				if (subsamplingMethod == masc::CorePoints::SPATIAL)
+					cmd.print(QString("Will only classify core points spaced by at least %1").arg(subsamplingParam));
+				else
+					cmd.print(QString("Will only classify a random subset of the points (ratio: %1)").arg(subsamplingParam));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_LAZY_FEATURES))
+			{
+				lazyFeatures = true;
+				cmd.print("[Experimental] The scaled features will only be computed when the trees need them");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				//optional comparison with the eager computation
+				if (!cmd.arguments().empty() && cmd.arguments().front().toUpper() == COMMAND_3DMASC_LAZY_FEATURES_COMPARE)
+				{
+					compareLazyFeatures = true;
+					cmd.print("The lazy features will be compared with the regular (eager) computation");
+					cmd.arguments().pop_front();
+				}
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_CASCADE))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				if (cmd.arguments().size() < 2)
+				{
+					return cmd.error(QString("Missing parameter(s): second classifier filename and confidence threshold after \"-%1\"").arg(COMMAND_3DMASC_CASCADE));
+				}
+				cascadeFilename = cmd.arguments().takeFirst();
+
+				bool ok = false;
+				cascadeMinConfidence = cmd.arguments().takeFirst().toFloat(&ok);
+				if (!ok || cascadeMinConfidence <= 0.0f || cascadeMinConfidence > 1.0f)
+				{
+					return cmd.error(QString("Invalid confidence threshold after \"-%1\" (should be in ]0, 1])").arg(COMMAND_3DMASC_CASCADE));
+				}
+
+				cmd.print(QString("Points with a confidence below %1 will be classified again with: %2").arg(cascadeMinConfidence).arg(cascadeFilename));
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_DROP_UNUSED_ATTRIBUTES))
+			{
+				dropUnusedAttributes = true;
+				cmd.print("The attributes (scalar fields, colors, normals) not needed by the features will be dropped after loading");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_PROPAGATE_KNN))
+			{
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+
+				bool ok = false;
+				propagationKNN = cmd.arguments().empty() ? 0 : cmd.arguments().front().toUInt(&ok);
+				if (!ok || propagationKNN == 0)
+				{
+					return cmd.error(QString("Missing or invalid number of neighbors after \"-%1\"").arg(COMMAND_3DMASC_PROPAGATE_KNN));
+				}
+				cmd.arguments().pop_front();
+
+				cmd.print(QString("Labels will be propagated by a majority vote of the %1 nearest core points").arg(propagationKNN));
+			}
 			else
 			{
 				//urecognized option
@@ -106,10 +277,34 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		{
 			return cmd.error("Can't compute only the features and skip them at the same time :p");
 		}
+		if (planOnly && skipFeatures)
+		{
+			return cmd.error("Can't display the feature computation plan and skip the features at the same time");
+		}
+		if (compiledForest && binnedFeatures)
+		{
+			return cmd.error(QString("Options \"-%1\" and \"-%2\" are mutually exclusive").arg(COMMAND_3DMASC_COMPILED_FOREST).arg(COMMAND_3DMASC_BINNED_FEATURES));
+		}
+		if (lazyFeatures && (skipFeatures || onlyFeatures || planOnly || binnedFeatures || compiledForest || earlyExit))
+		{
+			return cmd.error(QString("Option \"-%1\" can only be used alone (with the default inference engine)").arg(COMMAND_3DMASC_LAZY_FEATURES));
+		}
+		if (!cascadeFilename.isEmpty() && (skipFeatures || onlyFeatures || planOnly))
+		{
+			return cmd.error(QString("Option \"-%1\" can't be combined with \"-%2\", \"-%3\" or \"-%4\"").arg(COMMAND_3DMASC_CASCADE).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_ONLY_FEATURES).arg(COMMAND_3DMASC_PLAN_ONLY));
+		}
+		if (dropUnusedAttributes && (skipFeatures || !cascadeFilename.isEmpty()))
+		{
+			return cmd.error(QString("Option \"-%1\" can't be combined with \"-%2\" or \"-%3\"").arg(COMMAND_3DMASC_DROP_UNUSED_ATTRIBUTES).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_CASCADE));
+		}
+		if (subsamplingMethod != masc::CorePoints::NONE && (skipFeatures || onlyFeatures))
+		{
+			return cmd.error(QString("Option \"-%1\" can't be combined with \"-%2\" or \"-%3\"").arg(COMMAND_3DMASC_SUBSAMPLE).arg(COMMAND_3DMASC_SKIP_FEATURES).arg(COMMAND_3DMASC_ONLY_FEATURES));
+		}
 
 		if (cmd.arguments().size() < minArgumentCount)
 		{
-			return cmd.error(QString("Missing parameter(s): classifier filename (.txt) and/or cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
+			return cmd.error(QString("Missing parameter(s): classifier filename (.txt or .3dmasc) and/or cloud roles after \"-%1\"").arg(COMMAND_3DMASC_CLASSIFY));
 		}
 
 		QString classifierFilename = cmd.arguments().front();
@@ -118,6 +313,12 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		cmd.arguments().pop_front();
 
 		ccPointCloud* classifiedCloud = nullptr;
+		masc::CorePoints corePoints;
+		QScopedPointer<ccPointCloud> subsampledCorePoints;
+		masc::Tools::NamedClouds cloudPerRole;
+		QString mainCloudRole;
+		masc::Feature::Set features;
+		masc::Classifier classifier;
 		SFCollector generatedScalarFields;
 		masc::Feature::Source::Set featureSources;
 
@@ -132,8 +333,6 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			//process the cloud roles description
 			QStringList tokens = cloudRolesStr.simplified().split(QChar(' '), QString::SkipEmptyParts);
 
-			masc::Tools::NamedClouds cloudPerRole;
-			QString mainCloudRole;
 			for (const QString& token : tokens)
 			{
 				QStringList subTokens = token.split("=");
@@ -192,10 +391,9 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				}
 			}
 
-			//load features
-			masc::Feature::Set features;
+			//load features (and the classifier, so that the features it doesn't use are skipped)
 			std::vector<double> scales;
-			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, nullptr, nullptr, cmd.widgetParent()))
+			if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, onlyFeatures ? nullptr : &classifier, nullptr, cmd.widgetParent(), dropUnusedAttributes))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
@@ -214,9 +412,12 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			}
 
 			//the 'main cloud' is the cloud that should be classified
-			masc::CorePoints corePoints;
 			corePoints.origin = corePoints.cloud = classifiedCloud = cloudPerRole[mainCloudRole];
 			corePoints.role = mainCloudRole;
+			//the features that are exported must all have their own scalar field
+			corePoints.keepFeatureFields = (onlyFeatures || keepAttributes);
+			corePoints.selectionMethod = subsamplingMethod;
+			corePoints.selectionParam = subsamplingParam;
 
 			//prepare the main cloud
 			QScopedPointer<ccProgressDialog> pDlg;
@@ -226,13 +427,40 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 				pDlg->setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
 			}
 
+			if (subsamplingMethod != masc::CorePoints::NONE)
+			{
+				if (!corePoints.prepare(pDlg.data()))
+				{
+					return cmd.error("Failed to subsample the core points");
+				}
+				if (corePoints.cloud != corePoints.origin)
+				{
+					subsampledCorePoints.reset(corePoints.cloud);
+				}
+				cmd.print(QString("Core points: %1 / %2 points").arg(corePoints.size()).arg(corePoints.origin->size()));
+				if (keepAttributes)
+				{
+					cmd.warning("The features are computed on the subsampled core points only: they won't be kept");
+				}
+			}
+
 			QString errorMessage;
-			if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields))
+			if (lazyFeatures)
+			{
+				//the features will be prepared and computed when classifying
+			}
+			else if (!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, pDlg.data(), &generatedScalarFields, planOnly))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
 			}
 
+			if (planOnly)
+			{
+				//nothing has been computed
+				return true;
+			}
+
 			if (pDlg)
 			{
 				pDlg->setAutoClose(true); //restore the default behavior of the progress dialog
@@ -241,7 +469,10 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 			}
 
 			//don't forget to extract the sources before finishing this step
-			masc::Feature::ExtractSources(features, featureSources);
+			if (!lazyFeatures)
+			{
+				masc::Feature::ExtractSources(features, featureSources);
+			}
 
 			if (onlyFeatures)
 			{
@@ -273,20 +504,224 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		//apply classifier
 		if (!onlyFeatures)
 		{
-			masc::Classifier classifier;
-			if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
+			if (!classifier.isValid() && !masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
 			{
 				return cmd.error("Failed to load the classifier");
 			}
+			if (binnedFeatures)
+			{
+				classifier.setBackend(masc::Classifier::Backend::BinnedFeatures);
+			}
+			else if (compiledForest)
+			{
+				classifier.setBackend(masc::Classifier::Backend::CompiledForest);
+			}
+			if (earlyExit && !cascadeFilename.isEmpty())
+			{
+				//the cascade threshold applies to the exact confidence of the first stage
+				cmd.warning(QString("Option \"-%1\" only applies to the second stage of the cascade").arg(COMMAND_3DMASC_EARLY_EXIT));
+				classifier.setEarlyExit(false);
+			}
+			else
+			{
+				classifier.setEarlyExit(earlyExit, earlyExitMinConfidence);
+			}
 
 			QString errorMessage;
-			if (!classifier.classify(featureSources, classifiedCloud, errorMessage, cmd.widgetParent()))
+			ccPointCloud* classifiedCorePoints = (subsampledCorePoints ? subsampledCorePoints.data() : classifiedCloud);
+			if (lazyFeatures)
+			{
+				qint64 eagerTime_ms = 0;
+				std::vector<ScalarType> eagerLabels;
+				if (compareLazyFeatures)
+				{
+					//regular computation first (reference)
+					bool hadClassification = (masc::Tools::GetClassificationSF(classifiedCorePoints) != nullptr);
+					SFCollector eagerScalarFields;
+					QElapsedTimer eagerTimer;
+					eagerTimer.start();
+					if (	!masc::Tools::PrepareFeatures(corePoints, features, errorMessage, nullptr, &eagerScalarFields)
+						||	!masc::Feature::ExtractSources(features, featureSources)
+						||	!classifier.classify(featureSources, classifiedCorePoints, errorMessage, nullptr))
+					{
+						eagerScalarFields.releaseSFs(false);
+						return cmd.error(errorMessage);
+					}
+					eagerTime_ms = eagerTimer.elapsed();
+
+					const CCCoreLib::ScalarField* eagerSF = masc::Tools::GetClassificationSF(classifiedCorePoints);
+					eagerLabels.resize(eagerSF->size());
+					for (unsigned i = 0; i < eagerSF->size(); ++i)
+					{
+						eagerLabels[i] = eagerSF->getValue(i);
+					}
+					eagerScalarFields.releaseSFs(false);
+
+					//restore the initial state of the cloud
+					for (const char* sfName : { "Classification", "Classification_confidence" })
+					{
+						int sfIdx = classifiedCorePoints->getScalarFieldIndexByName(sfName);
+						if (sfIdx >= 0)
+							classifiedCorePoints->deleteScalarField(sfIdx);
+					}
+					if (hadClassification)
+					{
+						CCCoreLib::ScalarField* backupSF = masc::Tools::RetrieveSF(classifiedCorePoints, "Classification_backup");
+						if (backupSF)
+							backupSF->setName("Classification");
+					}
+
+					//the features can only be prepared once
+					features.clear();
+					std::vector<double> scales;
+					if (!masc::Tools::LoadFile(classifierFilename, &cloudPerRole, true, &features, &scales, nullptr, nullptr, nullptr, cmd.widgetParent()))
+					{
+						return cmd.error("Failed to reload the classifier features");
+					}
+					masc::Tools::MarkUnusedFeatures(classifier, features);
+				}
+
+				QElapsedTimer lazyTimer;
+				lazyTimer.start();
+				if (!classifier.classifyLazy(corePoints, features, errorMessage, &generatedScalarFields, cmd.silentMode() ? nullptr : cmd.widgetParent()))
+				{
+					generatedScalarFields.releaseSFs(false);
+					return cmd.error(errorMessage);
+				}
+				qint64 lazyTime_ms = lazyTimer.elapsed();
+
+				if (compareLazyFeatures)
+				{
+					const CCCoreLib::ScalarField* lazySF = masc::Tools::GetClassificationSF(classifiedCorePoints);
+					unsigned identicalCount = 0;
+					for (unsigned i = 0; i < lazySF->size() && i < eagerLabels.size(); ++i)
+					{
+						if (lazySF->getValue(i) == eagerLabels[i])
+							++identicalCount;
+					}
+					cmd.print(QString("[Lazy features] Eager: %1 s. / Lazy: %2 s. (speedup: x%3)").arg(eagerTime_ms / 1000.0, 0, 'f', 3).arg(lazyTime_ms / 1000.0, 0, 'f', 3).arg(lazyTime_ms > 0 ? static_cast<double>(eagerTime_ms) / lazyTime_ms : 0.0, 0, 'f', 2));
+					cmd.print(QString("[Lazy features] Identical labels: %1 / %2").arg(identicalCount).arg(eagerLabels.size()));
+				}
+			}
+			else if (!classifier.classify(featureSources, classifiedCorePoints, errorMessage, cmd.widgetParent()))
 			{
 				generatedScalarFields.releaseSFs(false);
 				return cmd.error(errorMessage);
 			}
 
 			generatedScalarFields.releaseSFs(keepAttributes);
+
+			if (subsampledCorePoints)
+			{
+				QScopedPointer<ccProgressDialog> pDlg;
+				if (!cmd.silentMode())
+				{
+					pDlg.reset(new ccProgressDialog(true, cmd.widgetParent()));
+				}
+				if (!masc::Tools::PropagateClassification(corePoints, propagationKNN, errorMessage, pDlg.data()))
+				{
+					return cmd.error(errorMessage);
+				}
+			}
+
+			if (!cascadeFilename.isEmpty())
+			{
+				//second stage: only the low confidence points are classified again (with the expensive features)
+				const CCCoreLib::ScalarField* confidenceSF = masc::Tools::RetrieveSF(classifiedCloud, "Classification_confidence");
+				if (!confidenceSF)
+				{
+					return cmd.error("Missing confidence field after the first stage");
+				}
+
+				masc::CorePoints lowConfidencePoints;
+				lowConfidencePoints.origin = classifiedCloud;
+				lowConfidencePoints.role = mainCloudRole;
+				lowConfidencePoints.selection.reset(new CCCoreLib::ReferenceCloud(classifiedCloud));
+				for (unsigned i = 0; i < classifiedCloud->size(); ++i)
+				{
+					ScalarType confidence = confidenceSF->getValue(i);
+					if (!(confidence >= cascadeMinConfidence)) //NaN values are classified again as well
+					{
+						if (!lowConfidencePoints.selection->addPointIndex(i))
+						{
+							return cmd.error("Not enough memory");
+						}
+					}
+				}
+
+				unsigned lowConfidenceCount = lowConfidencePoints.selection->size();
+				cmd.print(QString("[Cascade] %1 / %2 points below the confidence threshold (%3%)").arg(lowConfidenceCount).arg(classifiedCloud->size()).arg(100.0 * lowConfidenceCount / std::max(1u, classifiedCloud->size()), 0, 'f', 1));
+
+				if (lowConfidenceCount != 0)
+				{
+					//load the second stage features and classifier
+					masc::Feature::Set cascadeFeatures;
+					std::vector<double> cascadeScales;
+					masc::Classifier cascadeClassifier;
+					if (!masc::Tools::LoadFile(cascadeFilename, &cloudPerRole, true, &cascadeFeatures, &cascadeScales, nullptr, &cascadeClassifier, nullptr, cmd.widgetParent()))
+					{
+						return cmd.error("Failed to load the second stage classifier");
+					}
+					if (binnedFeatures)
+					{
+						cascadeClassifier.setBackend(masc::Classifier::Backend::BinnedFeatures);
+					}
+					else if (compiledForest)
+					{
+						cascadeClassifier.setBackend(masc::Classifier::Backend::CompiledForest);
+					}
+					cascadeClassifier.setEarlyExit(earlyExit, earlyExitMinConfidence);
+
+					if (!lowConfidencePoints.prepare())
+					{
+						return cmd.error("Failed to extract the low confidence points");
+					}
+					QScopedPointer<ccPointCloud> lowConfidenceCloud(lowConfidencePoints.cloud);
+
+					//the first stage labels are not a ground truth
+					for (const char* sfName : { "Classification", "Classification_confidence" })
+					{
+						int sfIdx = lowConfidenceCloud->getScalarFieldIndexByName(sfName);
+						if (sfIdx >= 0)
+							lowConfidenceCloud->deleteScalarField(sfIdx);
+					}
+
+					QScopedPointer<ccProgressDialog> pDlg;
+					if (!cmd.silentMode())
+					{
+						pDlg.reset(new ccProgressDialog(true, cmd.widgetParent()));
+						pDlg->setAutoClose(false); //we don't want the progress dialog to 'pop' for each feature
+					}
+
+					SFCollector cascadeScalarFields;
+					if (!masc::Tools::PrepareFeatures(lowConfidencePoints, cascadeFeatures, errorMessage, pDlg.data(), &cascadeScalarFields))
+					{
+						cascadeScalarFields.releaseSFs(false);
+						return cmd.error(errorMessage);
+					}
+
+					if (pDlg)
+					{
+						pDlg->setAutoClose(true); //restore the default behavior of the progress dialog
+						pDlg->close();
+						QCoreApplication::processEvents();
+					}
+
+					masc::Feature::Source::Set cascadeSources;
+					masc::Feature::ExtractSources(cascadeFeatures, cascadeSources);
+					if (!cascadeClassifier.classify(cascadeSources, lowConfidenceCloud.data(), errorMessage, cmd.widgetParent()))
+					{
+						cascadeScalarFields.releaseSFs(false);
+						return cmd.error(errorMessage);
+					}
+					cascadeScalarFields.releaseSFs(false);
+
+					if (!masc::Tools::MergeCorePointsClassification(lowConfidencePoints, errorMessage))
+					{
+						return cmd.error(errorMessage);
+					}
+				}
+			}
 		}
 
 		if (cmd.autoSaveMode() || onlyFeatures)
@@ -308,3 +743,99 @@ struct Command3DMASCClassif : public ccCommandLineInterface::Command
 		return true;
 	}
 };
+
+struct Command3DMASCCompileForest : public ccCommandLineInterface::Command
+{
+	Command3DMASCCompileForest() : ccCommandLineInterface::Command("3DMASC Compile forest", COMMAND_3DMASC_COMPILE_FOREST) {}
+
+	virtual bool process(ccCommandLineInterface& cmd) override
+	{
+		cmd.print("[3DMASC]");
+
+		bool branchless = false;
+		bool sourceOnly = false;
+		while (!cmd.arguments().empty())
+		{
+			QString argument = cmd.arguments().front();
+			if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_BRANCHLESS))
+			{
+				branchless = true;
+				cmd.print("Trees will be written as conditional expressions");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else if (ccCommandLineInterface::IsCommand(argument, COMMAND_3DMASC_SOURCE_ONLY))
+			{
+				sourceOnly = true;
+				cmd.print("Will only generate the source code");
+				//local option confirmed, we can move on
+				cmd.arguments().pop_front();
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if (cmd.arguments().empty())
+		{
+			return cmd.error(QString("Missing parameter: classifier filename (.txt) after \"-%1\"").arg(COMMAND_3DMASC_COMPILE_FOREST));
+		}
+
+		QString classifierFilename = cmd.arguments().takeFirst();
+		cmd.print("Classifier filename: " + classifierFilename);
+
+		masc::Classifier classifier;
+		if (!masc::Tools::LoadFile(classifierFilename, nullptr, false, nullptr, nullptr, nullptr, &classifier, nullptr, cmd.widgetParent()))
+		{
+			return cmd.error("Failed to load the classifier");
+		}
+
+		QString errorMessage;
+		if (!classifier.compile(branchless, !sourceOnly, errorMessage))
+		{
+			return cmd.error(errorMessage);
+		}
+
+		return true;
+	}
+};
+
+struct Command3DMASCConvertClassifier : public ccCommandLineInterface::Command
+{
+	Command3DMASCConvertClassifier() : ccCommandLineInterface::Command("3DMASC Convert classifier", COMMAND_3DMASC_CONVERT_CLASSIFIER) {}
+
+	virtual bool process(ccCommandLineInterface& cmd) override
+	{
+		cmd.print("[3DMASC]");
+
+		if (cmd.arguments().empty())
+		{
+			return cmd.error(QString("Missing parameter: classifier filename (.txt) after \"-%1\"").arg(COMMAND_3DMASC_CONVERT_CLASSIFIER));
+		}
+
+		QString classifierFilename = cmd.arguments().takeFirst();
+		cmd.print("Classifier filename: " + classifierFilename);
+
+		//optional output filename (same base name by default)
+		QString bundleFilename;
+		if (!cmd.arguments().empty() && masc::ClassifierBundle::IsBundle(cmd.arguments().front()))
+		{
+			bundleFilename = cmd.arguments().takeFirst();
+		}
+		else
+		{
+			QFileInfo fi(classifierFilename);
+			bundleFilename = fi.absolutePath() + "/" + fi.completeBaseName() + "." + masc::ClassifierBundle::Extension;
+		}
+
+		QString errorMessage;
+		if (!masc::ClassifierBundle::Convert(classifierFilename, bundleFilename, errorMessage))
+		{
+			return cmd.error(errorMessage);
+		}
+		cmd.print("Bundle saved to: " + bundleFilename);
+
+		return true;
+	}
+};
@@ -18,10 +18,16 @@
 #include "q3DMASCTools.h"
 
 //Local
+#include "ClassifierBundle.h"
 #include "PointFeature.h"
 #include "NeighborhoodFeature.h"
 #include "DualCloudFeature.h"
 #include "ContextBasedFeature.h"
+#include "CorePointsScheduler.h"
+#include "FeaturePlanner.h"
+#include "FeatureSelection.h"
+#include "CpuFeatures.h"
+#include "ScratchArena.h"
 #include "ccMainAppInterface.h"
 
 //qCC_io
@@ -38,11 +44,16 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QMutex>
 #include <QCoreApplication>
 
 //system
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
 
 #if defined(_OPENMP)
 #include <omp.h>
@@ -112,6 +123,45 @@ bool Tools::SaveClassifier(	QString filename,
 	return true;
 }
 
+//! Opens a classifier (or training) file for reading
+/** The file can be a text file or a bundle (see ClassifierBundle). In the latter case,
+	the stream reads the description stored in the bundle.
+**/
+static bool OpenClassifierFile(	const QString& filename,
+								QFile& file,
+								QString& bundleDescription,
+								QTextStream& stream,
+								ClassifierBundle::Shared* _bundle = nullptr)
+{
+	if (ClassifierBundle::IsBundle(filename))
+	{
+		QString error;
+		ClassifierBundle::Shared bundle = ClassifierBundle::Load(filename, error);
+		if (!bundle)
+		{
+			ccLog::Warning(QString("Failed to load bundle '%1': %2").arg(filename, error));
+			return false;
+		}
+		bundleDescription = bundle->description();
+		stream.setString(&bundleDescription, QIODevice::ReadOnly);
+		if (_bundle)
+		{
+			*_bundle = bundle;
+		}
+		return true;
+	}
+
+	file.setFileName(filename);
+	if (!file.open(QFile::Text | QFile::ReadOnly))
+	{
+		ccLog::Warning(QString("Can't open file '%1'").arg(filename));
+		return false;
+	}
+	stream.setDevice(&file);
+
+	return true;
+}
+
 bool Tools::LoadClassifierCloudLabels(QString filename, QList<QString>& labels, QString& corePointsLabel, bool& filenamesSpecified, QMap<QString, QString>& rolesAndNames)
 {
 	//just in case
@@ -119,14 +169,14 @@ bool Tools::LoadClassifierCloudLabels(QString filename, QList<QString>& labels,
 	labels.clear();
 	rolesAndNames.clear();
 
-	QFile file(filename);
-	if (!file.open(QFile::Text | QFile::ReadOnly))
+	QFile file;
+	QString bundleDescription;
+	QTextStream stream;
+	if (!OpenClassifierFile(filename, file, bundleDescription, stream))
 	{
-		ccLog::Warning(QString("Can't open file '%1'").arg(filename));
 		return false;
 	}
 
-	QTextStream stream(&file);
 	int filenameCount = 0;
 	for (int lineNumber = 0; ; ++lineNumber)
 	{
@@ -690,7 +740,20 @@ static bool ReadCorePoints(const QString& command, const Tools::NamedClouds& clo
 	return true;
 }
 
-static bool ReadCloud(const QString& command, Tools::NamedClouds& clouds, const QDir& defaultDir, int lineNumber, FileIOFilter::LoadParameters& loadParameters)
+//! Cloud declared in a classifier (or training) file
+struct CloudEntry
+{
+	//! Role
+	QString name;
+	//! Absolute filename
+	QString filename;
+	//! Line of the declaration
+	int lineNumber = 0;
+	//! Loaded cloud
+	ccPointCloud* cloud = nullptr;
+};
+
+static bool ReadCloud(const QString& command, const QDir& defaultDir, int lineNumber, CloudEntry& entry)
 {
 	QStringList tokens = command.split('=');
 	if (tokens.size() != 2)
@@ -699,43 +762,120 @@ static bool ReadCloud(const QString& command, Tools::NamedClouds& clouds, const
 		return false;
 	}
 
-	QString pcName = tokens[0].trimmed();
-	QString pcFilename = defaultDir.absoluteFilePath(tokens[1].trimmed());
+	entry.name = tokens[0].trimmed();
+	entry.filename = defaultDir.absoluteFilePath(tokens[1].trimmed());
+	entry.lineNumber = lineNumber;
+
+	return true;
+}
+
+static bool LoadCloud(CloudEntry& entry, FileIOFilter::LoadParameters& loadParameters)
+{
+	QElapsedTimer timer;
+	timer.start();
+
 	//try to open the cloud
+	CC_FILE_ERROR error = CC_FERR_NO_ERROR;
+	ccHObject* object = FileIOFilter::LoadFromFile(entry.filename, loadParameters, error);
+	if (error != CC_FERR_NO_ERROR || !object)
+	{
+		//error message already issued
+		if (object)
+			delete object;
+		return false;
+	}
+	ccHObject::Container cloudsInFile;
+	object->filterChildren(cloudsInFile, false, CC_TYPES::POINT_CLOUD, true);
+	if (cloudsInFile.empty())
+	{
+		ccLog::Warning("File doesn't contain a single cloud");
+		delete object;
+		return false;
+	}
+	else if (cloudsInFile.size() > 1)
+	{
+		ccLog::Warning("File contains more than one cloud, only the first one will be kept");
+	}
+	ccPointCloud* pc = static_cast<ccPointCloud*>(cloudsInFile.front());
+	for (size_t i = 1; i < cloudsInFile.size(); ++i)
+	{
+		delete cloudsInFile[i];
+	}
+	if (pc->getParent())
+		pc->getParent()->detachChild(pc);
+	pc->setName(entry.name); //DGM: warning, may not be acceptable in the GUI version?
+	entry.cloud = pc;
+
+	ccLog::Print(QString("[3DMASC] Cloud %1 loaded from %2 in %3 s (%4 points)").arg(entry.name, entry.filename).arg(timer.elapsed() / 1000.0, 0, 'f', 2).arg(pc->size()));
+
+	return true;
+}
+
+//! Loads the clouds
+/** The clouds are loaded one after the other, on the calling thread, with the same parameters (the
+	global shift is decided with the first cloud, and the loading dialogs are displayed as usual).
+	They are not loaded concurrently, as CloudCompare's I/O layer is not reentrant (unique ID generator,
+	session counter, and the internal state of some filters). The clouds are added in their declaration
+	order, and none of them is kept if one fails to load.
+**/
+static bool LoadClouds(std::vector<CloudEntry>& entries, Tools::NamedClouds& clouds, FileIOFilter::LoadParameters& loadParameters)
+{
+	if (entries.empty())
+	{
+		return true;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	bool success = true;
+	for (CloudEntry& entry : entries)
 	{
-		CC_FILE_ERROR error = CC_FERR_NO_ERROR;
-		ccHObject* object = FileIOFilter::LoadFromFile(pcFilename, loadParameters, error);
-		if (error != CC_FERR_NO_ERROR || !object)
+		if (!LoadCloud(entry, loadParameters))
 		{
-			//error message already issued
-			if (object)
-				delete object;
-			return false;
+			success = false;
+			break;
 		}
-		ccHObject::Container cloudsInFile;
-		object->filterChildren(cloudsInFile, false, CC_TYPES::POINT_CLOUD, true);
-		if (cloudsInFile.empty())
+	}
+
+	//merge the clouds in their declaration order
+	for (CloudEntry& entry : entries)
+	{
+		if (!entry.cloud)
 		{
-			ccLog::Warning("File doesn't contain a single cloud");
-			delete object;
-			return false;
+			continue;
 		}
-		else if (cloudsInFile.size() > 1)
+		if (success)
 		{
-			ccLog::Warning("File contains more than one cloud, only the first one will be kept");
+			clouds.insert(entry.name, entry.cloud);
 		}
-		ccPointCloud* pc = static_cast<ccPointCloud*>(cloudsInFile.front());
-		for (size_t i = 1; i < cloudsInFile.size(); ++i)
+		else
 		{
-			delete cloudsInFile[i];
+			delete entry.cloud;
 		}
-		if (pc->getParent())
-			pc->getParent()->detachChild(pc);
-		pc->setName(pcName); //DGM: warning, may not be acceptable in the GUI version?
-		clouds.insert(pcName, pc);
+		entry.cloud = nullptr;
 	}
 
-	return true;
+	if (success && entries.size() > 1)
+	{
+		ccLog::Print(QString("[3DMASC] %1 clouds loaded in %2 s").arg(entries.size()).arg(timer.elapsed() / 1000.0, 0, 'f', 2));
+	}
+
+	return success;
+}
+
+//! Strips out the comments of a line (returns an empty line if the whole line is a comment)
+static QString StripComment(const QString& line)
+{
+	if (line.startsWith("#"))
+	{
+		//comment
+		return QString();
+	}
+
+	//strip out the potential comment at the end of the line as well
+	int commentIndex = line.indexOf('#');
+	return (commentIndex >= 0 ? line.left(commentIndex) : line);
 }
 
 bool Tools::LoadFile(	const QString& filename,
@@ -746,7 +886,8 @@ bool Tools::LoadFile(	const QString& filename,
 						masc::CorePoints* corePoints/*=nullptr*/,				//requires 'clouds'
 						masc::Classifier* classifier/*=nullptr*/,
 						TrainParameters* parameters/*=nullptr*/,
-						QWidget* parent/*=nullptr*/)
+						QWidget* parent/*=nullptr*/,
+						bool dropUnusedAttributes/*=false*/)
 {
 	QFileInfo fi(filename);
 	if (!fi.exists())
@@ -755,12 +896,20 @@ bool Tools::LoadFile(	const QString& filename,
 		return false;
 	}
 
-	QFile file(filename);
-	if (!file.open(QFile::Text | QFile::ReadOnly))
+	QFile file;
+	QString bundleDescription;
+	QTextStream stream;
+	ClassifierBundle::Shared bundle;
+	if (!OpenClassifierFile(filename, file, bundleDescription, stream, &bundle))
 	{
-		ccLog::Warning(QString("Can't open file '%1'").arg(filename));
 		return false;
 	}
+	if (bundle && classifier)
+	{
+		//the forest is stored in the bundle
+		classifier->setFlatForest(bundle->forest(), filename);
+		ccLog::Print("[3DMASC] Classifier data loaded from " + filename);
+	}
 
 	//to use the same 'global shift' for multiple files
 	CCVector3d loadCoordinatesShift(0, 0, 0);
@@ -783,28 +932,57 @@ bool Tools::LoadFile(	const QString& filename,
 		assert(!rawFeatures || rawFeatures->empty());
 		std::vector<double> scales;
 
-		QTextStream stream(&file);
-		bool badFeatures = false;
-		for (int lineNumber = 1; ; ++lineNumber)
+		QStringList lines;
+		while (!stream.atEnd())
 		{
-			if (stream.atEnd())
-				break;
-			QString line = stream.readLine();
-			if (line.isEmpty())
+			lines << stream.readLine();
+		}
+
+		//the clouds are loaded first (sequentially, see LoadClouds)
+		if (clouds && !cloudsAreProvided)
+		{
+			std::vector<CloudEntry> cloudEntries;
+			for (int lineNumber = 1; lineNumber <= lines.size(); ++lineNumber)
 			{
-				continue;
+				QString line = StripComment(lines[lineNumber - 1]);
+				QString upperLine = line.toUpper();
+				CloudEntry entry;
+				if (upperLine.startsWith("CLOUD:")) //clouds
+				{
+					if (!ReadCloud(line.mid(6), fi.absoluteDir(), lineNumber, entry))
+					{
+						return false;
+					}
+				}
+				else if (upperLine.startsWith("TEST:")) //test cloud
+				{
+					//add the TEST keyword so that the cloud will be loaded as the TEST cloud
+					if (!ReadCloud("TEST=" + line.mid(5), fi.absoluteDir(), lineNumber, entry))
+					{
+						return false;
+					}
+				}
+				else
+				{
+					continue;
+				}
+				cloudEntries.push_back(entry);
 			}
 
-			if (line.startsWith("#"))
+			if (!LoadClouds(cloudEntries, *clouds, loadParameters))
 			{
-				//comment
-				continue;
+				return false;
 			}
+		}
 
-			//strip out the potential comment at the end of the line as well
-			int commentIndex = line.indexOf('#');
-			if (commentIndex >= 0)
-				line = line.left(commentIndex);
+		bool badFeatures = false;
+		for (int lineNumber = 1; lineNumber <= lines.size(); ++lineNumber)
+		{
+			QString line = StripComment(lines[lineNumber - 1]);
+			if (line.isEmpty())
+			{
+				continue;
+			}
 
 			QString upperLine = line.toUpper();
 			if (upperLine.startsWith("CLASSIFIER:")) //classifier
@@ -828,31 +1006,10 @@ bool Tools::LoadFile(	const QString& filename,
 				}
 				ccLog::Print("[3DMASC] Classifier data loaded from " + yamlAbsoluteFilename);
 			}
-			else if (upperLine.startsWith("CLOUD:")) //clouds
-			{
-				if (!clouds || cloudsAreProvided)
-				{
-					//no need to load the clouds in this case
-					continue;
-				}
-				QString command = line.mid(6);
-				if (!ReadCloud(command, *clouds, fi.absoluteDir(), lineNumber, loadParameters))
-				{
-					return false;
-				}
-			}
-			else if (upperLine.startsWith("TEST:")) //test cloud
+			else if (upperLine.startsWith("CLOUD:") || upperLine.startsWith("TEST:")) //clouds and test cloud
 			{
-				if (!clouds || cloudsAreProvided)
-				{
-					//no need to load the clouds in this case
-					continue;
-				}
-				QString command = line.mid(5);
-				if (!ReadCloud("TEST=" + command, *clouds, fi.absoluteDir(), lineNumber, loadParameters)) //add the TEST keyword so that the cloud will be loaded as the TEST cloud
-				{
-					return false;
-				}
+				//already loaded (if necessary)
+				continue;
 			}
 			else if (upperLine.startsWith("CORE_POINTS:")) //core points
 			{
@@ -939,6 +1096,26 @@ bool Tools::LoadFile(	const QString& filename,
 					{
 						parameters->testDataRatio = tokens[1].toFloat(&ok);
 					}
+					else if (tokens[0] == "PARAM_SEED")
+					{
+						parameters->seed = tokens[1].toUInt(&ok);
+					}
+					else if (tokens[0] == "PARAM_STRATIFIED_SPLIT")
+					{
+						parameters->stratifiedSplit = (tokens[1].toInt(&ok) != 0);
+					}
+					else if (tokens[0] == "PARAM_COMPACT")
+					{
+						parameters->rt.compact = (tokens[1].toInt(&ok) != 0);
+					}
+					else if (tokens[0] == "PARAM_COMPACT_MIN_SUPPORT")
+					{
+						parameters->rt.compactMinSupport = tokens[1].toInt(&ok);
+					}
+					else if (tokens[0] == "PARAM_COMPACT_MAX_TREE_DROP_CHANGE")
+					{
+						parameters->rt.compactMaxTreeDropChange = tokens[1].toFloat(&ok);
+					}
 					else
 					{
 						ccLog::Warning(QString("Line #%1: unrecognized parameter: ").arg(lineNumber) + tokens[0]);
@@ -968,11 +1145,133 @@ bool Tools::LoadFile(	const QString& filename,
 	}
 
 	if (rawFeatures)
+	{
 		rawFeatures->shrink_to_fit();
 
+		if (classifier && classifier->isValid())
+		{
+			//no need to compute the features that the classifier doesn't use
+			MarkUnusedFeatures(*classifier, *rawFeatures);
+		}
+
+		if (dropUnusedAttributes && clouds)
+		{
+			DropUnusedAttributes(*rawFeatures, *clouds);
+		}
+	}
+
 	return true;
 }
 
+size_t Tools::DropUnusedAttributes(const Feature::Set& features, const NamedClouds& clouds)
+{
+	//required attributes per cloud
+	struct RequiredAttributes
+	{
+		QStringList sfNames;
+		int sfCount = 0;
+		bool colors = false;
+		bool normals = false;
+	};
+	QMap<ccPointCloud*, RequiredAttributes> requiredAttributes;
+	for (ccPointCloud* cloud : clouds)
+	{
+		if (cloud)
+		{
+			requiredAttributes.insert(cloud, RequiredAttributes());
+		}
+	}
+
+	for (const Feature::Shared& feature : features)
+	{
+		if (!feature || feature->unused)
+		{
+			continue;
+		}
+
+		for (ccPointCloud* cloud : { feature->cloud1, feature->cloud2 })
+		{
+			if (cloud && requiredAttributes.contains(cloud))
+			{
+				RequiredAttributes& attributes = requiredAttributes[cloud];
+				feature->getRequiredAttributes(attributes.sfNames, attributes.sfCount, attributes.colors, attributes.normals);
+			}
+		}
+	}
+
+	size_t droppedCount = 0;
+	for (QMap<ccPointCloud*, RequiredAttributes>::const_iterator it = requiredAttributes.constBegin(); it != requiredAttributes.constEnd(); ++it)
+	{
+		ccPointCloud* cloud = it.key();
+		const RequiredAttributes& attributes = it.value();
+		const CCCoreLib::ScalarField* classifSF = GetClassificationSF(cloud);
+
+		QStringList droppedAttributes;
+		for (int sfIndex = static_cast<int>(cloud->getNumberOfScalarFields()) - 1; sfIndex >= attributes.sfCount; --sfIndex)
+		{
+			const CCCoreLib::ScalarField* sf = cloud->getScalarField(sfIndex);
+			QString sfName = QString::fromStdString(sf->getName());
+			if (sf == classifSF || attributes.sfNames.contains(sfName, Qt::CaseInsensitive))
+			{
+				continue;
+			}
+			droppedAttributes.prepend(sfName);
+			cloud->deleteScalarField(sfIndex);
+		}
+		if (!attributes.colors && cloud->hasColors())
+		{
+			droppedAttributes << "RGB colors";
+			cloud->unallocateColors();
+		}
+		if (!attributes.normals && cloud->hasNormals())
+		{
+			droppedAttributes << "normals";
+			cloud->unallocateNorms();
+		}
+
+		if (!droppedAttributes.empty())
+		{
+			ccLog::Print(QString("[3DMASC] Cloud %1: %2 unused attribute(s) dropped (%3)").arg(cloud->getName()).arg(droppedAttributes.size()).arg(droppedAttributes.join(", ")));
+			droppedCount += static_cast<size_t>(droppedAttributes.size());
+		}
+	}
+
+	return droppedCount;
+}
+
+int Tools::MarkUnusedFeatures(const masc::Classifier& classifier, Feature::Set& features)
+{
+	QString errorMessage;
+	std::vector<bool> used;
+	if (!classifier.getUsedAttributes(used, errorMessage))
+	{
+		ccLog::Warning("[3DMASC] Failed to retrieve the attributes used by the classifier: " + errorMessage);
+		return -1;
+	}
+	if (used.size() != features.size())
+	{
+		ccLog::Warning(QString("[3DMASC] The classifier expects %1 attribute(s) but %2 feature(s) are defined").arg(used.size()).arg(features.size()));
+		return -1;
+	}
+
+	int unusedCount = 0;
+	for (size_t i = 0; i < features.size(); ++i)
+	{
+		features[i]->unused = !used[i];
+		if (features[i]->unused)
+		{
+			++unusedCount;
+		}
+	}
+
+	if (unusedCount != 0)
+	{
+		ccLog::Print(QString("[3DMASC] %1 / %2 feature(s) are not used by any split of the classifier").arg(unusedCount).arg(features.size()));
+	}
+
+	return unusedCount;
+}
+
 bool Tools::LoadClassifier(QString filename, NamedClouds& clouds, Feature::Set& rawFeatures, masc::Classifier& classifier, QWidget* parent/*=nullptr*/)
 {
 	return LoadFile(filename, &clouds, true, &rawFeatures, nullptr, nullptr, &classifier, nullptr, parent);
@@ -987,7 +1286,8 @@ bool Tools::LoadTrainingFile(	QString filename,
 								QWidget* parentWidget/*=nullptr*/)
 {
 	bool cloudsWereProvided = !loadedClouds.empty();
-	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, parentWidget))
+	//the clouds loaded from the training file are private: the attributes the features don't need can be dropped
+	if (LoadFile(filename, &loadedClouds, cloudsWereProvided, &rawFeatures, &rawScales, corePoints, nullptr, &parameters, parentWidget, !cloudsWereProvided))
 	{
 		return true;
 	}
@@ -1038,171 +1338,265 @@ CCCoreLib::ScalarField* Tools::RetrieveSF(const ccPointCloud* cloud, const QStri
 	}
 }
 
-struct FeaturesAndScales
+//! Invalidates the MATH results waiting for a second operand (when the corresponding tasks are skipped for a given core point)
+static void InvalidatePendingOutputs(const FeaturePlan::ScaleTasks& scaleTasks, unsigned pointIndex)
 {
-	std::vector<double> scales;
-	size_t featureCount = 0;
-	QMap<double, std::vector<PointFeature::Shared> > pointFeaturesPerScale;
-	QMap<double, std::vector<NeighborhoodFeature::Shared> > neighborhoodFeaturesPerScale;
-	QMap<double, std::vector<ContextBasedFeature::Shared> > contextBasedFeaturesPerScale;
-};
+	for (const FeaturePlan::GatherTask& gatherTask : scaleTasks.gathers)
+	{
+		for (const FeaturePlan::StatTask& statTask : gatherTask.stats)
+		{
+			for (const FeaturePlan::Output& output : statTask.outputs)
+			{
+				output.invalidate(pointIndex);
+			}
+		}
+	}
+	for (const FeaturePlan::NeighborhoodTask& task : scaleTasks.neighborhoodValues)
+	{
+		for (const FeaturePlan::Output& output : task.outputs)
+		{
+			output.invalidate(pointIndex);
+		}
+	}
+	for (const FeaturePlan::ContextTask& task : scaleTasks.contextValues)
+	{
+		for (const FeaturePlan::Output& output : task.outputs)
+		{
+			output.invalidate(pointIndex);
+		}
+	}
+}
 
-bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& errorStr,
-							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/)
+//! Returns the number of scaled values computed per core point by a plan
+static size_t ScaledValueCount(const FeaturePlan& plan)
 {
-	if (features.empty() || !corePoints.origin)
+	size_t count = 0;
+	for (const FeaturePlan::Node& node : plan.nodes())
 	{
-		//invalid input parameters
-		assert(false);
-		return false;
+		switch (node.type)
+		{
+		case FeaturePlan::NodeType::Stat:
+		case FeaturePlan::NodeType::NeighborhoodValue:
+		case FeaturePlan::NodeType::ContextValue:
+		case FeaturePlan::NodeType::DualCloudValue:
+			if (std::isfinite(node.scale))
+				++count;
+			break;
+		default:
+			break;
+		}
 	}
+	return count;
+}
 
-	//gather all the scales that need to be extracted
-	QMap<ccPointCloud*, FeaturesAndScales> cloudsWithScaledFeatures;
-	//and prepare the features (scalar fields, etc.) at the same time
-	for (const Feature::Shared& feature : features)
+//! Returns the nodes of a plan computed during a given phase (for the cost measurement)
+/** \param cloud cloud of the scaled features phase (or nullptr for the dual-cloud features phase)
+**/
+static std::vector<size_t> PhaseNodes(const FeaturePlan& plan, const ccPointCloud* cloud)
+{
+	const std::vector<FeaturePlan::Node>& nodes = plan.nodes();
+
+	//the dual-cloud features and their extractions are computed in a dedicated phase
+	std::vector<bool> dualCloud(nodes.size(), false);
+	for (size_t i = 0; i < nodes.size(); ++i)
 	{
-		QString errorMessage("invalid pointer");
-		assert(!corePoints.role.isEmpty());
-		if (!feature || !feature->checkValidity(corePoints.role, errorMessage))
+		if (nodes[i].type == FeaturePlan::NodeType::DualCloudValue)
 		{
-			errorStr = "Invalid rule/feature: " + errorMessage;
-			return false;
+			dualCloud[i] = true;
+			for (size_t inputIndex : nodes[i].inputs)
+			{
+				dualCloud[inputIndex] = true;
+			}
 		}
+	}
 
-		//prepare the feature
-		if (!feature->prepare(corePoints, errorStr, progressCb, generatedScalarFields))
+	std::vector<size_t> nodeIndexes;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const FeaturePlan::Node& node = nodes[i];
+		if (!cloud)
 		{
-			//something failed (error should be up to date)
-			return false;
+			if (dualCloud[i])
+				nodeIndexes.push_back(i);
+			continue;
 		}
 
-		if (feature->scaled())
+		if (dualCloud[i] || node.cloud != cloud || !std::isfinite(node.scale) || node.type == FeaturePlan::NodeType::MathOp)
+		{
+			continue;
+		}
+		if (!node.consumers.empty())
 		{
-			try
+			//the values whose scalar fields were already existing are not computed
+			bool computed = false;
+			for (const FeaturePlan::Consumer& consumer : node.consumers)
 			{
-				switch (feature->getType())
-				{
-				//Point features
-				case Feature::Type::PointFeature:
+				if (!consumer.feature->sf1WasAlreadyExisting)
 				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !feature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
-					{
-						if(!feature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!feature->sf2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								++fas.featureCount;
-								fas.pointFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<PointFeature>(feature));
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
+					computed = true;
+					break;
 				}
-				break;
+			}
+			if (!computed)
+				continue;
+		}
+		nodeIndexes.push_back(i);
+	}
 
-				//Neighborhood features
-				case Feature::Type::NeighborhoodFeature:
-				{
-					//build the scaled feature list attached to the first cloud
-					if (feature->cloud1
-						&& !feature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-
-					//build the scaled feature list attached to the second cloud (if any)
-					if (feature->cloud2
-						&& feature->cloud2 != feature->cloud1
-						&& feature->op != Feature::NO_OPERATION)
-					{
-						if (!feature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-						{
-							if (!feature->sf2WasAlreadyExisting)
-							{
-								FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud2];
-								fas.neighborhoodFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<NeighborhoodFeature>(feature));
-								++fas.featureCount;
-								if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-								{
-									fas.scales.push_back(feature->scale);
-								}
-							}
-						}
-					}
-				}
-				break;
+	return nodeIndexes;
+}
 
-				//Context-based features
-				case Feature::Type::ContextBasedFeature:
-				{
-					//build the scaled feature list attached to the context cloud
-					if (feature->cloud1
-						&& !feature->sf1WasAlreadyExisting) // nothing to compute if the scalar field was already there
-					{
-						FeaturesAndScales& fas = cloudsWithScaledFeatures[feature->cloud1];
-						fas.contextBasedFeaturesPerScale[feature->scale].push_back(qSharedPointerCast<ContextBasedFeature>(feature));
-						++fas.featureCount;
-						if (std::find(fas.scales.begin(), fas.scales.end(), feature->scale) == fas.scales.end())
-						{
-							fas.scales.push_back(feature->scale);
-						}
-					}
-				}
-				break;
+bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& allFeatures, QString& errorStr,
+							CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/, SFCollector* generatedScalarFields/*=nullptr*/,
+							bool dryRun/*=false*/, std::vector<FeaturePlan::CloudTasks>* deferredTasks/*=nullptr*/,
+							FeatureCosts* costs/*=nullptr*/)
+{
+	if (allFeatures.empty() || !corePoints.origin)
+	{
+		//invalid input parameters
+		assert(false);
+		return false;
+	}
 
-				default:
-					assert(false);
-					break;
-				}
-			}
-			catch (const std::bad_alloc&)
+	//the features unused by the classifier are not computed
+	Feature::Set features;
+	try
+	{
+		features.reserve(allFeatures.size());
+		for (const Feature::Shared& feature : allFeatures)
+		{
+			if (feature && !feature->unused)
 			{
-				errorStr = "Not enough memory";
-				return false;
+				features.push_back(feature);
 			}
 		}
+	}
+	catch (const std::bad_alloc&)
+	{
+		errorStr = "Not enough memory";
+		return false;
+	}
+
+	if (features.size() != allFeatures.size())
+	{
+		size_t skippedCount = allFeatures.size() - features.size();
+		if (features.empty())
+		{
+			ccLog::Print(QString("[3DMASC] None of the %1 feature(s) is used by the classifier: nothing to compute").arg(skippedCount));
+			return true;
+		}
+
+		//compare the plans (to report the saved computations)
+		FeaturePlan fullPlan, reducedPlan;
+		if (	fullPlan.build(corePoints, allFeatures, errorStr)
+			&&	reducedPlan.build(corePoints, features, errorStr))
+		{
+			ccLog::Print(QString("[3DMASC] %1 of the %2 feature(s) are not used by the classifier and will be skipped: %3 primitive computations instead of %4 (%5 scaled values per core point instead of %6)")
+				.arg(skippedCount)
+				.arg(allFeatures.size())
+				.arg(reducedPlan.nodes().size())
+				.arg(fullPlan.nodes().size())
+				.arg(ScaledValueCount(reducedPlan))
+				.arg(ScaledValueCount(fullPlan)));
+		}
+		errorStr.clear();
+	}
+
+	//check the features validity
+	for (const Feature::Shared& feature : features)
+	{
+		QString errorMessage("invalid pointer");
+		assert(!corePoints.role.isEmpty());
+		if (!feature || !feature->checkValidity(corePoints.role, errorMessage))
+		{
+			errorStr = "Invalid rule/feature: " + errorMessage;
+			return false;
+		}
+	}
+
+	//decompose the features in (deduplicated) primitive computations
+	FeaturePlan plan;
+	if (!plan.build(corePoints, features, errorStr))
+	{
+		return false;
+	}
+	if (dryRun)
+	{
+		ccLog::Print(plan.toString());
+		return true;
+	}
+	ccLog::Print(plan.summary());
+
+	//the nearest neighbors joins are shared by the scale-less features
+	if (!plan.attachJoins(errorStr))
+	{
+		return false;
+	}
+
+	if (costs && !costs->addDependencies(plan))
+	{
+		errorStr = "Not enough memory";
+		return false;
+	}
+	QElapsedTimer timer;
+
+	//prepare the features (scalar fields, etc.)
+	for (const Feature::Shared& feature : features)
+	{
+		timer.start();
+		if (!feature->prepare(corePoints, errorStr, progressCb, generatedScalarFields))
+		{
+			//something failed (error should be up to date)
+			return false;
+		}
+		if (costs)
+		{
+			costs->addPreparation(feature, timer.nsecsElapsed() / 1.0e9, corePoints.size());
+		}
+	}
 
+	//gather the tasks to perform for each cloud and each scale
+	std::vector<FeaturePlan::CloudTasks> cloudTasks;
+	if (!plan.buildTasks(cloudTasks, errorStr))
+	{
+		return false;
 	}
 
 	bool success = true;
 
+	if (deferredTasks)
+	{
+		//the scaled features will be computed on demand
+		std::swap(*deferredTasks, cloudTasks);
+	}
+
 	//if we have scaled features
-	if (!cloudsWithScaledFeatures.empty())
+	if (!cloudTasks.empty())
 	{
-		//for each cloud
-		for (QMap<ccPointCloud*, FeaturesAndScales>::iterator it = cloudsWithScaledFeatures.begin(); success && it != cloudsWithScaledFeatures.end(); ++it)
+		//per-thread scratch memory (reused for all the core points and all the clouds)
+		ScratchArenas arenas;
+		if (!arenas.init())
 		{
-			FeaturesAndScales& fas = it.value();
-			ccPointCloud* sourceCloud = it.key();
+			errorStr = "Not enough memory";
+			return false;
+		}
 
-			//sort the scales
-			std::sort(fas.scales.begin(), fas.scales.end());
+		//for each cloud
+		for (size_t cloudIndex = 0; success && cloudIndex < cloudTasks.size(); ++cloudIndex)
+		{
+			const FeaturePlan::CloudTasks& tasks = cloudTasks[cloudIndex];
+			ccPointCloud* sourceCloud = tasks.cloud;
+			timer.start();
+			const std::vector<double>& scales = tasks.scales; //sorted
+			bool sortNeighbors = tasks.sortNeighbors;
+
+			//squared radii of the scales (= neighbors bucket boundaries)
+			std::vector<double> sqRadii(scales.size());
+			for (size_t j = 0; j < scales.size(); ++j)
+			{
+				double radius = scales[j] / 2; //scale is the diameter!
+				sqRadii[j] = radius * radius;
+			}
 
 			//get the octree
 			ccOctree::Shared octree = sourceCloud->getOctree();
@@ -1221,209 +1615,261 @@ bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features
 			}
 
 			//now extract the neighborhoods from the biggest to the smallest scale
-			double largetScale = fas.scales.back();
+			double largetScale = scales.back();
 			PointCoordinateType largestRadius = static_cast<PointCoordinateType>(largetScale / 2); //scale is the diameter!
 			unsigned char octreeLevel = octree->findBestLevelForAGivenNeighbourhoodSizeExtraction(largestRadius);
 
 			unsigned pointCount = corePoints.size();
-			QString logMessage = QString("Computing %1 features on cloud %2 at %3 core points").arg(fas.featureCount).arg(sourceCloud->getName()).arg(pointCount);
+			QString logMessage = QString("Computing %1 feature values on cloud %2 at %3 core points").arg(tasks.valueCount).arg(sourceCloud->getName()).arg(pointCount);
 			if (progressCb)
 			{
 				progressCb->setMethodTitle("Compute features");
 				progressCb->setInfo(qPrintable(logMessage));
 			}
 			ccLog::Print(logMessage);
+			ccLog::Print(QString("Local geometry kernels: %1").arg(Cpu::ToString(Cpu::BestInstructionSet())));
 			CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
 
+			//balance the core points between the threads, based on their estimated cost
+#if defined(_OPENMP) && !defined(_DEBUG)
+			int threadCount = std::max(1, omp_get_max_threads() - 2);
+#else
+			int threadCount = 1;
+#endif
+			std::vector<unsigned> pointCosts;
+			std::vector<CorePointsScheduler::Chunk> chunks;
+			if (	!CorePointsScheduler::EstimateCosts(*octree, octreeLevel, *corePoints.cloud, pointCosts)
+				||	!CorePointsScheduler::BuildChunks(pointCosts, threadCount, chunks))
+			{
+				errorStr = "Not enough memory";
+				return false;
+			}
+			pointCosts.clear();
+			pointCosts.shrink_to_fit();
+
+			ThreadUtilizationMonitor monitor;
+			monitor.start(threadCount);
+
 			bool cancelled = false;
 
 #ifndef _DEBUG
 #if defined(_OPENMP)
-#pragma omp parallel for num_threads(std::max(1, omp_get_max_threads() - 2))
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threadCount)
 #endif
 #endif
-			for (int i = 0; i < static_cast<int>(pointCount); ++i)
-			{
-			if (!cancelled)
+			for (int chunkIndex = 0; chunkIndex < static_cast<int>(chunks.size()); ++chunkIndex)
 			{
-				QString localErrorStr;
-				bool localSuccess = true;
-
-				//spherical neighborhood extraction structure
-				CCCoreLib::DgmOctree::NearestNeighboursSearchStruct nNSS;
+				const CorePointsScheduler::Chunk& chunk = chunks[chunkIndex];
+				double chunkStart = monitor.now();
+				for (int i = static_cast<int>(chunk.first); i < static_cast<int>(chunk.last); ++i)
 				{
-					nNSS.level = octreeLevel;
-					nNSS.queryPoint = *corePoints.cloud->getPoint(i);
-					octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
-					octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
-				}
-
-				//we extract the point's neighbors
-				unsigned kNN = octree->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, true);
-				if (kNN != 0)
+				if (!cancelled)
 				{
-					nNSS.pointsInNeighbourhood.resize(kNN);
+					QString localErrorStr;
+					bool localSuccess = true;
 
-					//for each scale (from the largest to the smallest)
-					for (size_t scaleIndex = 0; scaleIndex < fas.scales.size(); ++scaleIndex)
+					//spherical neighborhood extraction structure (reused by the current thread)
+					ScratchArena& arena = arenas.local();
+					CCCoreLib::DgmOctree::NearestNeighboursSearchStruct& nNSS = arena.nNSS;
 					{
-						double currentScale = fas.scales[fas.scales.size() - 1 - scaleIndex]; //from the biggest to the smallest!
+						arena.resetNeighborhood(*corePoints.cloud->getPoint(i), octreeLevel);
+						octree->getTheCellPosWhichIncludesThePoint(&nNSS.queryPoint, nNSS.cellPos, nNSS.level);
+						octree->computeCellCenter(nNSS.cellPos, nNSS.level, nNSS.cellCenter);
+					}
+
+					//number of scales processed for this point
+					size_t processedScaleCount = 0;
 
-						if (scaleIndex != 0)
+					//we extract the point's neighbors (unsorted)
+					unsigned kNN = octree->findNeighborsInASphereStartingFromCell(nNSS, largestRadius, false);
+					if (kNN != 0)
+					{
+						//partition them by scale
+						if (!arena.bucketNeighborsByScale(kNN, sqRadii, sortNeighbors))
 						{
-							double radius = currentScale / 2; //scale is the diameter!
-							double sqRadius = radius * radius;
-							//remove the farthest points
-							for (; kNN > 0; --kNN)
-							{
-								if (nNSS.pointsInNeighbourhood[kNN - 1].squareDistd <= sqRadius)
-								{
-									break;
-								}
-							}
+							localErrorStr = "Not enough memory";
+							localSuccess = false;
+							kNN = 0;
+						}
+					}
+					if (kNN != 0)
+					{
+
+						//local geometry (shared by all the neighborhood features of a given scale)
+						LocalGeometry& geometry = arena.geometry;
 
+						//for each scale (from the largest to the smallest)
+						for (size_t scaleIndex = 0; scaleIndex < scales.size(); ++scaleIndex)
+						{
+							size_t currentScaleIndex = scales.size() - 1 - scaleIndex; //from the biggest to the smallest!
+							double currentScale = scales[currentScaleIndex];
+							const FeaturePlan::ScaleTasks& scaleTasks = tasks.tasksPerScale[currentScaleIndex];
+
+							//keep the neighbors of the current scale (cumulative buckets)
+							kNN = arena.neighborCountPerScale[currentScaleIndex];
 							if (kNN == 0)
 							{
 								//no need to go further
 								break;
 							}
 							nNSS.pointsInNeighbourhood.resize(kNN);
-						}
+							geometry.invalidate();
 
-						//Point features
-						for (PointFeature::Shared& feature : fas.pointFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->statSF1 && feature->field1 && localSuccess)
+							//Point features (each field is gathered once, for all its stat. measures)
+							for (const FeaturePlan::GatherTask& gatherTask : scaleTasks.gathers)
 							{
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field1, outputValue))
+								std::vector<double>& values = arena.gatheredValues;
+								values.resize(kNN);
+								gatherTask.field->gather(nNSS.pointsInNeighbourhood, kNN, values.data());
+
+								for (const FeaturePlan::StatTask& statTask : gatherTask.stats)
 								{
-									//an error occurred
-									localErrorStr = "An error occurred during the computation of feature " + feature->toString() + " on cloud " + feature->cloud1->getName();
-									localSuccess = false;
-									break;
+									double outputValue = 0;
+									if (!PointFeature::ComputeStat(statTask.stat, values, arena.values, outputValue))
+									{
+										//an error occurred
+										localErrorStr = "An error occurred during the computation of " + Feature::StatToString(statTask.stat) + " of field " + gatherTask.field->getName() + " on cloud " + sourceCloud->getName();
+										localSuccess = false;
+										break;
+									}
+
+									ScalarType v = static_cast<ScalarType>(outputValue);
+									for (const FeaturePlan::Output& output : statTask.outputs)
+									{
+										output.write(i, v);
+									}
 								}
 
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->statSF1->setValue(i, v1);
+								if (!localSuccess)
+									break;
 							}
 
-							if (feature->cloud2 == sourceCloud && feature->statSF2 && feature->field2 && localSuccess)
+							//Neighborhood features
+							for (const FeaturePlan::NeighborhoodTask& task : scaleTasks.neighborhoodValues)
 							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeStat(nNSS.pointsInNeighbourhood, feature->field2, outputValue))
-								{
-									//an error occurred
-									localErrorStr = "An error occurred during the computation of feature " + feature->toString() + " on cloud " + feature->cloud2->getName();
-									localSuccess = false;
+								if (!localSuccess)
 									break;
-								}
 
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->statSF2->setValue(i, v2);
-							}
-						}
-
-						//Neighborhood features
-						for (NeighborhoodFeature::Shared& feature : fas.neighborhoodFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->sf1 && localSuccess)
-							{
 								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
+								if (!task.feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue, &geometry))
 								{
 									//an error occurred
-									localErrorStr = "An error occurred during the computation of feature " + feature->toString() + " on cloud " + feature->cloud1->getName();
+									localErrorStr = "An error occurred during the computation of feature " + task.feature->toString() + " on cloud " + sourceCloud->getName();
 									localSuccess = false;
 									break;
 								}
 
-								ScalarType v1 = static_cast<ScalarType>(outputValue);
-								feature->sf1->setValue(i, v1);
-							}
-
-							if (feature->cloud2 == sourceCloud && feature->sf2 && localSuccess)
-							{
-								assert(feature->op != Feature::NO_OPERATION);
-								double outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
+								ScalarType v = static_cast<ScalarType>(outputValue);
+								for (const FeaturePlan::Output& output : task.outputs)
 								{
-									//an error occurred
-									localErrorStr = "An error occurred during the computation of feature " + feature->toString() + " on cloud " + feature->cloud2->getName();
-									localSuccess = false;
-									break;
+									output.write(i, v);
 								}
-
-								ScalarType v2 = static_cast<ScalarType>(outputValue);
-								feature->sf2->setValue(i, v2);
 							}
-						}
 
-						//Context-based features
-						for (ContextBasedFeature::Shared& feature : fas.contextBasedFeaturesPerScale[currentScale])
-						{
-							if (feature->cloud1 == sourceCloud && feature->sf && localSuccess)
+							//Context-based features
+							for (const FeaturePlan::ContextTask& task : scaleTasks.contextValues)
 							{
+								if (!localSuccess)
+									break;
+
 								ScalarType outputValue = 0;
-								if (!feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
+								if (!task.feature->computeValue(nNSS.pointsInNeighbourhood, nNSS.queryPoint, outputValue))
 								{
 									//an error occurred
-									localErrorStr = "An error occurred during the computation of feature " + feature->toString() + " on cloud " + feature->cloud1->getName();
+									localErrorStr = "An error occurred during the computation of feature " + task.feature->toString() + " on cloud " + sourceCloud->getName();
 									localSuccess = false;
 									break;
 								}
 
-								feature->sf->setValue(i, outputValue);
+								for (const FeaturePlan::Output& output : task.outputs)
+								{
+									output.write(i, outputValue);
+								}
 							}
-						}
 
-						if (!localSuccess)
+							if (!localSuccess)
+							{
+								localErrorStr = localErrorStr + " at scale  " + QString::number(currentScale) + " on point " + QString::number(i);
+								break;
+							}
+
+							++processedScaleCount;
+
+						} //for each scale
+					}
+
+					if (localSuccess)
+					{
+						//the MATH features waiting for a second operand at the skipped scales can't be computed
+						for (size_t scaleIndex = processedScaleCount; scaleIndex < scales.size(); ++scaleIndex)
 						{
-							localErrorStr = localErrorStr + " at scale  " + QString::number(currentScale) + " on point " + QString::number(i);
-							break;
+							InvalidatePendingOutputs(tasks.tasksPerScale[scales.size() - 1 - scaleIndex], i);
 						}
+					}
 
-					} //for each scale
-				}
-
-				if (!localSuccess)
-				{
-					cancelled = true;
-					success = false;
+					if (!localSuccess)
+					{
+						cancelled = true;
+						success = false;
 #if defined(_OPENMP)
-					errorStr = "Feature computation failed for point " + QString::number(i) + " (using OpenMP with " + QString::number(omp_get_num_threads()) +  " threads)";
+						errorStr = "Feature computation failed for point " + QString::number(i) + " (using OpenMP with " + QString::number(omp_get_num_threads()) +  " threads)";
 #else
-					errorStr = "Feature computation failed for point " + QString::number(i);
+						errorStr = "Feature computation failed for point " + QString::number(i);
 #endif
-					ccLog::Error(localErrorStr);
-				}
+						ccLog::Error(localErrorStr);
+					}
 
-				if (progressCb)
-				{
-					if (!cancelled)
+					if (progressCb)
 					{
-						cancelled = !nProgress.oneStep();
-						if (cancelled)
+						if (!cancelled)
 						{
-							//process cancelled by the user
+							cancelled = !nProgress.oneStep();
+							if (cancelled)
+							{
+								//process cancelled by the user
 #if defined(_OPENMP)
-							errorStr = "Process cancelled at point " + QString::number(i) + " (using OpenMP with " + QString::number(omp_get_num_threads()) +  " threads)";
+								errorStr = "Process cancelled at point " + QString::number(i) + " (using OpenMP with " + QString::number(omp_get_num_threads()) +  " threads)";
 #else
-					        errorStr = "Process cancelled at point " + QString::number(i);
+						        errorStr = "Process cancelled at point " + QString::number(i);
 #endif
-							ccLog::Warning(errorStr);
-							success = false;
+								ccLog::Warning(errorStr);
+								success = false;
+							}
 						}
 					}
 				}
+				} //for each point
+				monitor.record(chunkStart, monitor.now());
+			} //for each chunk
+
+			ccLog::Print(monitor.report());
+
+			if (costs && success)
+			{
+				costs->addPhase(plan, PhaseNodes(plan, sourceCloud), timer.nsecsElapsed() / 1.0e9, pointCount);
 			}
-			} //for each point
 
 		} //for each cloud
 
 	}
 
+	//dual-cloud features (the neighborhoods are extracted in both clouds at once)
+	timer.start();
+	if (success && !DualCloudFeature::ComputeFeatures(corePoints, features, errorStr, progressCb))
+	{
+		return false;
+	}
+	if (costs && success)
+	{
+		costs->addPhase(plan, PhaseNodes(plan, nullptr), timer.nsecsElapsed() / 1.0e9, corePoints.size());
+	}
+
+	if (deferredTasks)
+	{
+		//the scaled features will be 'finished' once computed
+		return true;
+	}
+
 	for (const Feature::Shared& feature : features)
 	{
 		//we have to 'finish' the process for scaled features
@@ -1436,7 +1882,21 @@ bool Tools::PrepareFeatures(const CorePoints& corePoints, Feature::Set& features
 	return success;
 }
 
-bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset)
+//! SplitMix64 hash (used as a counter-based random generator)
+static inline uint64_t SplitMix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+bool Tools::RandomSubset(	ccPointCloud* cloud,
+							float ratio,
+							CCCoreLib::ReferenceCloud* inRatioSubset,
+							CCCoreLib::ReferenceCloud* outRatioSubset,
+							unsigned seed/*=0*/,
+							bool stratified/*=false*/)
 {
 	if (!cloud)
 	{
@@ -1459,24 +1919,14 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 		return false;
 	}
 
-	unsigned inSampleCount = static_cast<unsigned>(floor(cloud->size() * ratio));
-	assert(inSampleCount <= cloud->size());
-	unsigned outSampleCount = cloud->size() - inSampleCount;
+	int pointCount = static_cast<int>(cloud->size());
+	uint64_t seedKey = SplitMix64(seed);
 
-	//we draw the smallest population (faster)
-	unsigned targetCount = inSampleCount;
-	bool defaultState = false;
-	if (outSampleCount < inSampleCount)
-	{
-		targetCount = outSampleCount;
-		defaultState = true;
-	}
-
-	//reserve memory
-	std::vector<bool> pointInsideRatio;
+	//flag the 'in' points
+	std::vector<char> pointInsideRatio;
 	try
 	{
-		pointInsideRatio.resize(cloud->size(), defaultState);
+		pointInsideRatio.resize(pointCount, 0);
 	}
 	catch (const std::bad_alloc&)
 	{
@@ -1484,6 +1934,88 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 		return false;
 	}
 
+	unsigned inSampleCount = 0;
+	if (stratified)
+	{
+		//draw the same ratio of points in each class (partial Fisher-Yates shuffle)
+		const CCCoreLib::ScalarField* classifSF = GetClassificationSF(cloud);
+		if (!classifSF)
+		{
+			ccLog::Warning("Stratified subsets require a 'Classification' field");
+			return false;
+		}
+
+		//the non-finite (or out of range) values can't be converted to a class: they form their own stratum
+		std::map<int, std::vector<unsigned>> classIndexes;
+		std::vector<unsigned> invalidIndexes;
+		try
+		{
+			for (int i = 0; i < pointCount; ++i)
+			{
+				ScalarType value = classifSF->getValue(i);
+				if (std::isfinite(value) && std::abs(value) < static_cast<ScalarType>(std::numeric_limits<int>::max()))
+				{
+					classIndexes[static_cast<int>(value)].push_back(static_cast<unsigned>(i));
+				}
+				else
+				{
+					invalidIndexes.push_back(static_cast<unsigned>(i));
+				}
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			ccLog::Warning("Not enough memory");
+			return false;
+		}
+
+		//each stratum has its own random sequence (so that the split of a class doesn't depend on the others)
+		auto DrawStratum = [&](std::vector<unsigned>& indexes, uint64_t state)
+		{
+			size_t classInCount = static_cast<size_t>(std::round(indexes.size() * static_cast<double>(ratio)));
+			for (size_t k = 0; k < classInCount; ++k)
+			{
+				state = SplitMix64(state);
+				size_t j = k + static_cast<size_t>(state % (indexes.size() - k));
+				std::swap(indexes[k], indexes[j]);
+				pointInsideRatio[indexes[k]] = 1;
+			}
+			inSampleCount += static_cast<unsigned>(classInCount);
+		};
+
+		for (auto& it : classIndexes)
+		{
+			DrawStratum(it.second, seedKey ^ SplitMix64(static_cast<uint64_t>(static_cast<int64_t>(it.first))));
+		}
+		if (!invalidIndexes.empty())
+		{
+			ccLog::Warning(QString("[3DMASC] %1 points have an invalid classification value (they are split as a separate class)").arg(invalidIndexes.size()));
+			DrawStratum(invalidIndexes, SplitMix64(~seedKey));
+		}
+	}
+	else
+	{
+		//each point is drawn independently (its hash is compared to the ratio)
+		uint64_t threshold = (ratio >= 1.0f ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(static_cast<double>(ratio) * 18446744073709551616.0));
+		int count = 0;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for reduction(+:count)
+#endif
+#endif
+		for (int i = 0; i < pointCount; ++i)
+		{
+			if (SplitMix64(seedKey ^ static_cast<uint64_t>(i)) < threshold)
+			{
+				pointInsideRatio[i] = 1;
+				++count;
+			}
+		}
+		inSampleCount = static_cast<unsigned>(count);
+	}
+	unsigned outSampleCount = cloud->size() - inSampleCount;
+
+	//reserve memory
 	if (!inRatioSubset->reserve(inSampleCount) || !outRatioSubset->reserve(outSampleCount))
 	{
 		ccLog::Warning("Not enough memory");
@@ -1492,19 +2024,6 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 		return false;
 	}
 
-	//randomly choose the 'in' or 'out' indexes
-	int randIndex = 0;
-	unsigned randomCount = 0;
-	while (randomCount < targetCount)
-	{
-		randIndex = ((randIndex + std::rand()) % cloud->size());
-		if (pointInsideRatio[randIndex] == defaultState)
-		{
-			pointInsideRatio[randIndex] = !defaultState;
-			++randomCount;
-		}
-	}
-
 	//now dispatch the points
 	{
 		for (unsigned i = 0; i < cloud->size(); ++i)
@@ -1518,6 +2037,8 @@ bool Tools::RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceC
 		assert(outRatioSubset->size() == outSampleCount);
 	}
 
+	ccLog::Print(QString("[3DMASC] Random subsets (seed: %1%2): %3 / %4 points").arg(seed).arg(stratified ? ", stratified" : "").arg(inSampleCount).arg(outSampleCount));
+
 	return true;
 }
 
@@ -1537,3 +2058,202 @@ CCCoreLib::ScalarField* Tools::GetClassificationSF(const ccPointCloud* cloud)
 	}
 	return cloud->getScalarField(classifSFIdx);
 }
+
+bool Tools::PropagateClassification(const CorePoints& corePoints, unsigned kNN, QString& error, CCCoreLib::GenericProgressCallback* progressCb/*=nullptr*/)
+{
+	if (!corePoints.origin || !corePoints.cloud || kNN == 0)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	if (corePoints.cloud == corePoints.origin)
+	{
+		//nothing to do
+		return true;
+	}
+
+	ccPointCloud* origin = corePoints.origin;
+	ccPointCloud* coreCloud = corePoints.cloud;
+	if (coreCloud->size() == 0)
+	{
+		error = "No core point";
+		return false;
+	}
+
+	const CCCoreLib::ScalarField* coreClassifSF = GetClassificationSF(coreCloud);
+	if (!coreClassifSF)
+	{
+		error = "Core points have not been classified";
+		return false;
+	}
+	const CCCoreLib::ScalarField* coreConfidenceSF = RetrieveSF(coreCloud, "Classification_confidence");
+
+	//same convention as Classifier::classify: the existing labels (if any) are kept as a backup
+	int sfIdx = origin->getScalarFieldIndexByName("Classification_confidence");
+	if (sfIdx >= 0)
+		origin->deleteScalarField(sfIdx);
+	CCCoreLib::ScalarField* originClassifSF = GetClassificationSF(origin);
+	if (originClassifSF)
+	{
+		sfIdx = origin->getScalarFieldIndexByName("Classification_backup");
+		if (sfIdx >= 0)
+			origin->deleteScalarField(sfIdx);
+		originClassifSF->setName("Classification_backup");
+	}
+
+	ccScalarField* classifSF = new ccScalarField(LAS_FIELD_NAMES[LAS_CLASSIFICATION]);
+	ccScalarField* confidenceSF = new ccScalarField("Classification_confidence");
+	if (!classifSF->resizeSafe(origin->size()) || !confidenceSF->resizeSafe(origin->size()))
+	{
+		classifSF->release();
+		confidenceSF->release();
+		error = "Not enough memory";
+		return false;
+	}
+	origin->addScalarField(classifSF);
+	origin->addScalarField(confidenceSF);
+
+	ccOctree::Shared octree = coreCloud->getOctree();
+	if (!octree)
+	{
+		octree = coreCloud->computeOctree(progressCb);
+		if (!octree)
+		{
+			error = "Failed to compute the core points octree (not enough memory?)";
+			return false;
+		}
+	}
+	unsigned char octreeLevel = octree->findBestLevelForAGivenPopulationPerCell(std::max(3u, kNN));
+
+	unsigned pointCount = origin->size();
+	QString logMessage = QString("Propagating the labels of %1 core points to %2 points (%3 nearest neighbor(s))").arg(coreCloud->size()).arg(pointCount).arg(kNN);
+	if (progressCb)
+	{
+		progressCb->setMethodTitle("Propagate classification");
+		progressCb->setInfo(qPrintable(logMessage));
+		progressCb->start();
+	}
+	ccLog::Print("[3DMASC] " + logMessage);
+	CCCoreLib::NormalizedProgress nProgress(progressCb, pointCount);
+
+	error.clear();
+	bool cancelled = false;
+#ifndef _DEBUG
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(std::max(1, omp_get_max_threads() - 2))
+#endif
+#endif
+	for (int i = 0; i < static_cast<int>(pointCount); ++i)
+	{
+	if (!cancelled)
+	{
+		const CCVector3* P = origin->getPoint(i);
+		CCCoreLib::ReferenceCloud Yk(coreCloud);
+		double maxSquareDist = 0;
+
+		ScalarType label = CCCoreLib::NAN_VALUE;
+		ScalarType confidence = CCCoreLib::NAN_VALUE;
+
+		unsigned neighborCount = octree->findPointNeighbourhood(P, &Yk, kNN, octreeLevel, maxSquareDist);
+		neighborCount = std::min(neighborCount, kNN);
+		if (neighborCount == 1)
+		{
+			unsigned index = Yk.getPointGlobalIndex(0);
+			label = coreClassifSF->getValue(index);
+			confidence = coreConfidenceSF ? coreConfidenceSF->getValue(index) : 1.0f;
+		}
+		else if (neighborCount > 1)
+		{
+			//majority vote (the neighbors are sorted by increasing distance, so that ties go to the nearest label)
+			unsigned bestVotes = 0;
+			ScalarType bestConfidenceSum = 0;
+			for (unsigned k = 0; k < neighborCount; ++k)
+			{
+				ScalarType candidate = coreClassifSF->getValue(Yk.getPointGlobalIndex(k));
+				unsigned votes = 0;
+				ScalarType confidenceSum = 0;
+				for (unsigned n = 0; n < neighborCount; ++n)
+				{
+					unsigned index = Yk.getPointGlobalIndex(n);
+					if (coreClassifSF->getValue(index) == candidate)
+					{
+						++votes;
+						confidenceSum += (coreConfidenceSF ? coreConfidenceSF->getValue(index) : 1.0f);
+					}
+				}
+				if (votes > bestVotes)
+				{
+					bestVotes = votes;
+					bestConfidenceSum = confidenceSum;
+					label = candidate;
+				}
+			}
+			//the confidence of the winning core points, weighted by the share of the votes they got
+			confidence = bestConfidenceSum / neighborCount;
+		}
+
+		classifSF->setValue(i, label);
+		confidenceSF->setValue(i, confidence);
+
+		if (progressCb && !nProgress.oneStep())
+		{
+			//process cancelled by the user
+			cancelled = true;
+		}
+	}
+	}
+
+	if (progressCb)
+	{
+		progressCb->stop();
+	}
+
+	if (cancelled)
+	{
+		error = "Process cancelled by the user";
+		return false;
+	}
+
+	classifSF->computeMinAndMax();
+	confidenceSF->computeMinAndMax();
+
+	//show the classification field by default
+	origin->setCurrentDisplayedScalarField(origin->getScalarFieldIndexByName(classifSF->getName()));
+	origin->showSF(true);
+
+	return true;
+}
+
+bool Tools::MergeCorePointsClassification(const CorePoints& corePoints, QString& error)
+{
+	if (!corePoints.origin || !corePoints.cloud)
+	{
+		assert(false);
+		error = "Invalid input";
+		return false;
+	}
+
+	const CCCoreLib::ScalarField* coreClassifSF = GetClassificationSF(corePoints.cloud);
+	const CCCoreLib::ScalarField* coreConfidenceSF = RetrieveSF(corePoints.cloud, "Classification_confidence");
+	CCCoreLib::ScalarField* classifSF = GetClassificationSF(corePoints.origin);
+	CCCoreLib::ScalarField* confidenceSF = RetrieveSF(corePoints.origin, "Classification_confidence");
+	if (!coreClassifSF || !coreConfidenceSF || !classifSF || !confidenceSF)
+	{
+		error = "Missing classification field(s)";
+		return false;
+	}
+
+	for (unsigned i = 0; i < corePoints.size(); ++i)
+	{
+		unsigned index = corePoints.originIndex(i);
+		classifSF->setValue(index, coreClassifSF->getValue(i));
+		confidenceSF->setValue(index, coreConfidenceSF->getValue(i));
+	}
+
+	classifSF->computeMinAndMax();
+	confidenceSF->computeMinAndMax();
+
+	return true;
+}
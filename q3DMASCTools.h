@@ -19,6 +19,7 @@
 
 //Local
 #include "FeaturesInterface.h"
+#include "FeaturePlanner.h"
 #include "q3DMASCClassifier.h"
 
 //CCLib
@@ -32,6 +33,8 @@ class QWidget;
 //! 3DMASC classifier
 namespace masc
 {
+	class FeatureCosts;
+
 	class Tools
 	{
 	public:
@@ -52,14 +55,59 @@ namespace masc
 								masc::CorePoints* corePoints = nullptr, //requires 'clouds'
 								masc::Classifier* classifier = nullptr,
 								TrainParameters* parameters = nullptr,
-								QWidget* parent = nullptr);
+								QWidget* parent = nullptr,
+								bool dropUnusedAttributes = false); //see DropUnusedAttributes
+
+		//! Removes the attributes of the clouds that are not required to compute the features (scalar fields, colors and normals)
+		/** The 'Classification' field is always kept. As the SFn features refer to the scalar fields by
+			their index, the fields preceding the last one referred to by such a feature are kept as well.
+			The features unused by the classifier are ignored.
+			\return the number of removed attributes
+		**/
+		static size_t DropUnusedAttributes(const Feature::Set& features, const NamedClouds& clouds);
+
+		//! Flags the features that are not used by any split of the classifier (they won't be computed)
+		/** \return the number of unused features (or -1 on error)
+		**/
+		static int MarkUnusedFeatures(const masc::Classifier& classifier, Feature::Set& features);
 
 		static bool SaveClassifier(QString filename, const Feature::Set& features, const QString corePointsRole, const masc::Classifier& classifier, QWidget* parent = nullptr);
 
+		//! Prepares and computes the features on the core points
+		/** \param dryRun if true, the feature computation plan is only printed (nothing is computed)
+			\param deferredTasks if set, the scaled features are not computed: the corresponding tasks are returned
+			instead (see LazyFeatureEvaluator) and the features are not 'finished'
+			\param costs if set, the time spent to compute the features is measured (see FeatureSelection)
+		**/
 		static bool PrepareFeatures(const CorePoints& corePoints, Feature::Set& features, QString& error,
-									CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr);
-
-		static bool RandomSubset(ccPointCloud* cloud, float ratio, CCCoreLib::ReferenceCloud* inRatioSubset, CCCoreLib::ReferenceCloud* outRatioSubset);
+									CCCoreLib::GenericProgressCallback* progressCb = nullptr, SFCollector* generatedScalarFields = nullptr,
+									bool dryRun = false, std::vector<FeaturePlan::CloudTasks>* deferredTasks = nullptr,
+									FeatureCosts* costs = nullptr);
+
+		//! Propagates the classification of subsampled core points to all the points of the origin cloud
+		/** Each origin point gets the label of its nearest core point, or the majority label of its kNN nearest core points.
+			The 'Classification' and 'Classification_confidence' fields are created on the origin cloud (an existing
+			'Classification' field is renamed 'Classification_backup', as in Classifier::classify).
+		**/
+		static bool PropagateClassification(const CorePoints& corePoints, unsigned kNN, QString& error, CCCoreLib::GenericProgressCallback* progressCb = nullptr);
+
+		//! Copies the classification of the core points back to the corresponding points of the origin cloud
+		/** Both clouds must already have the 'Classification' and 'Classification_confidence' fields.
+		**/
+		static bool MergeCorePointsClassification(const CorePoints& corePoints, QString& error);
+
+		//! Randomly splits a cloud in two subsets (the first one gathering 'ratio' of the points)
+		/** The split only depends on the seed (reproducible across platforms). By default, each point is
+			drawn independently, so that the size of the subsets is only approximately respected. If the
+			split is stratified, the exact ratio of points of each class (see the 'Classification' field)
+			is drawn.
+		**/
+		static bool RandomSubset(	ccPointCloud* cloud,
+									float ratio,
+									CCCoreLib::ReferenceCloud* inRatioSubset,
+									CCCoreLib::ReferenceCloud* outRatioSubset,
+									unsigned seed = 0,
+									bool stratified = false);
 
 		static CCCoreLib::ScalarField* RetrieveSF(const ccPointCloud* cloud, const QString& sfName, bool caseSensitive = true);
 
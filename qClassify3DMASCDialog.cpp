@@ -109,6 +109,8 @@ Classify3DMASCDialog::Classify3DMASCDialog(ccMainAppInterface* app, bool trainMo
 		label->setText(tr("Trainer file"));
 		warningLabel->setVisible(false);
 		warningLabel->setText("Assign each role to the right cloud, and select the cloud on which to train the classifier");
+		//the training core points are defined in the parameter file
+		subsamplingGroupBox->setVisible(false);
 	}
 
 	onCloudChanged(0);
@@ -127,6 +129,10 @@ void Classify3DMASCDialog::readSettings()
 	settings.beginGroup("3DMASC");
 	bool keepAttributes = settings.value("keepAttributes", false).toBool();
 	this->keepAttributesCheckBox->setChecked(keepAttributes);
+	subsamplingGroupBox->setChecked(settings.value("subsampleCorePoints", false).toBool());
+	subsamplingMethodComboBox->setCurrentIndex(settings.value("subsamplingMethod", 0).toInt());
+	subsamplingParamDoubleSpinBox->setValue(settings.value("subsamplingParam", subsamplingParamDoubleSpinBox->value()).toDouble());
+	propagationKNNSpinBox->setValue(settings.value("propagationKNN", 1).toInt());
 }
 
 void Classify3DMASCDialog::writeSettings()
@@ -134,6 +140,27 @@ void Classify3DMASCDialog::writeSettings()
 	QSettings settings;
 	settings.beginGroup("3DMASC");
 	settings.setValue("keepAttributes", keepAttributesCheckBox->isChecked());
+	if (!subsamplingGroupBox->isHidden())
+	{
+		settings.setValue("subsampleCorePoints", subsamplingGroupBox->isChecked());
+		settings.setValue("subsamplingMethod", subsamplingMethodComboBox->currentIndex());
+		settings.setValue("subsamplingParam", subsamplingParamDoubleSpinBox->value());
+		settings.setValue("propagationKNN", propagationKNNSpinBox->value());
+	}
+}
+
+void Classify3DMASCDialog::getCorePointsSubsampling(masc::CorePoints& corePoints, unsigned& propagationKNN) const
+{
+	if (!subsamplingGroupBox->isHidden() && subsamplingGroupBox->isChecked())
+	{
+		corePoints.selectionMethod = (subsamplingMethodComboBox->currentIndex() == 0 ? masc::CorePoints::SPATIAL : masc::CorePoints::RANDOM);
+		corePoints.selectionParam = subsamplingParamDoubleSpinBox->value();
+	}
+	else
+	{
+		corePoints.selectionMethod = masc::CorePoints::NONE;
+	}
+	propagationKNN = static_cast<unsigned>(propagationKNNSpinBox->value());
 }
 
 void Classify3DMASCDialog::setComboBoxIndex(const QMap<QString, QString>& rolesAndNames, QLabel* label, const QMap<QString, QVariant>& namesAndUniqueIds, QComboBox* comboBox)
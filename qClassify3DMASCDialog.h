@@ -17,6 +17,9 @@
 //#                                                                        #
 //##########################################################################
 
+//Local
+#include "CorePoints.h"
+
 //Qt
 #include <QDialog>
 
@@ -50,6 +53,9 @@ public:
 	//! Returns the selected point clouds
 	void getClouds(QMap<QString, ccPointCloud*>& clouds) const;
 
+	//! Returns the core points subsampling parameters (classification mode only)
+	void getCorePointsSubsampling(masc::CorePoints& corePoints, unsigned& propagationKNN) const;
+
 protected slots:
 
 	void onCloudChanged(int);
@@ -0,0 +1,117 @@
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+#include "qFeatureSelectionDialog.h"
+
+//Qt
+#include <QTableWidgetItem>
+
+static const int SubsetIndexRole = Qt::UserRole;
+
+FeatureSelectionDialog::FeatureSelectionDialog(const masc::FeatureSelection& selection, QWidget* parent/*=nullptr*/)
+	: QDialog(parent)
+	, Ui::FeatureSelectionDialog()
+	, m_selection(selection)
+{
+	setupUi(this);
+
+	const std::vector<masc::FeatureSelection::Subset>& subsets = m_selection.subsets();
+	subsetsTableWidget->setSortingEnabled(false);
+	subsetsTableWidget->setRowCount(static_cast<int>(subsets.size()));
+	for (int row = 0; row < static_cast<int>(subsets.size()); ++row)
+	{
+		const masc::FeatureSelection::Subset& subset = subsets[row];
+
+		QTableWidgetItem* countItem = new QTableWidgetItem;
+		countItem->setData(Qt::DisplayRole, static_cast<int>(subset.features.size()));
+		countItem->setData(SubsetIndexRole, row);
+		subsetsTableWidget->setItem(row, 0, countItem);
+
+		QTableWidgetItem* accuracyItem = new QTableWidgetItem;
+		accuracyItem->setData(Qt::DisplayRole, subset.accuracy);
+		subsetsTableWidget->setItem(row, 1, accuracyItem);
+
+		QTableWidgetItem* featureCostItem = new QTableWidgetItem;
+		featureCostItem->setData(Qt::DisplayRole, subset.featureCost * 1.0e6);
+		subsetsTableWidget->setItem(row, 2, featureCostItem);
+
+		QTableWidgetItem* inferenceCostItem = new QTableWidgetItem;
+		inferenceCostItem->setData(Qt::DisplayRole, subset.inferenceCost * 1.0e6);
+		subsetsTableWidget->setItem(row, 3, inferenceCostItem);
+
+		QTableWidgetItem* runtimeItem = new QTableWidgetItem;
+		runtimeItem->setData(Qt::DisplayRole, subset.runtime() * 1.0e6);
+		subsetsTableWidget->setItem(row, 4, runtimeItem);
+
+		subsetsTableWidget->setItem(row, 5, new QTableWidgetItem(subset.paretoOptimal ? tr("yes") : tr("no")));
+		subsetsTableWidget->setItem(row, 6, new QTableWidgetItem(subset.removedFeature));
+	}
+	subsetsTableWidget->setSortingEnabled(true);
+	subsetsTableWidget->sortByColumn(4, Qt::AscendingOrder);
+	subsetsTableWidget->resizeColumnsToContents();
+
+	if (!subsets.empty())
+	{
+		summaryLabel->setText(tr("Accuracy vs. classification runtime (per core point) of the %1 subsets of the backward elimination (all features: accuracy = %2, runtime = %3 µs/pt)")
+			.arg(subsets.size())
+			.arg(subsets.front().accuracy)
+			.arg(subsets.front().runtime() * 1.0e6, 0, 'f', 2));
+	}
+
+	updateRows();
+
+	connect(subsetsTableWidget, &QTableWidget::itemSelectionChanged, this, &FeatureSelectionDialog::onSelectionChanged);
+	connect(paretoOnlyCheckBox, &QCheckBox::toggled, this, &FeatureSelectionDialog::updateRows);
+	connect(exportPushButton, &QPushButton::clicked, this, &FeatureSelectionDialog::onExport);
+}
+
+int FeatureSelectionDialog::selectedSubset() const
+{
+	QList<QTableWidgetItem*> selectedItems = subsetsTableWidget->selectedItems();
+	if (selectedItems.empty())
+	{
+		return -1;
+	}
+
+	QTableWidgetItem* countItem = subsetsTableWidget->item(selectedItems.front()->row(), 0);
+	return countItem ? countItem->data(SubsetIndexRole).toInt() : -1;
+}
+
+void FeatureSelectionDialog::onSelectionChanged()
+{
+	exportPushButton->setEnabled(selectedSubset() >= 0);
+}
+
+void FeatureSelectionDialog::onExport()
+{
+	int subsetIndex = selectedSubset();
+	if (subsetIndex >= 0)
+	{
+		Q_EMIT exportRequested(subsetIndex);
+	}
+}
+
+void FeatureSelectionDialog::updateRows()
+{
+	const std::vector<masc::FeatureSelection::Subset>& subsets = m_selection.subsets();
+	bool paretoOnly = paretoOnlyCheckBox->isChecked();
+	for (int row = 0; row < subsetsTableWidget->rowCount(); ++row)
+	{
+		int subsetIndex = subsetsTableWidget->item(row, 0)->data(SubsetIndexRole).toInt();
+		subsetsTableWidget->setRowHidden(row, paretoOnly && !subsets[subsetIndex].paretoOptimal);
+	}
+}
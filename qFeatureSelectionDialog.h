@@ -0,0 +1,55 @@
+#pragma once
+
+//##########################################################################
+//#                                                                        #
+//#                     CLOUDCOMPARE PLUGIN: q3DMASC                       #
+//#                                                                        #
+//#  This program is free software; you can redistribute it and/or modify  #
+//#  it under the terms of the GNU General Public License as published by  #
+//#  the Free Software Foundation; version 2 or later of the License.      #
+//#                                                                        #
+//#  This program is distributed in the hope that it will be useful,       #
+//#  but WITHOUT ANY WARRANTY; without even the implied warranty of        #
+//#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          #
+//#  GNU General Public License for more details.                          #
+//#                                                                        #
+//#                 COPYRIGHT: Dimitri Lague / CNRS / UEB                  #
+//#                                                                        #
+//##########################################################################
+
+//Local
+#include "FeatureSelection.h"
+
+//Qt
+#include <QDialog>
+
+#include <ui_FeatureSelectionDialog.h>
+
+//! 3DMASC plugin 'feature selection' dialog (accuracy vs. runtime of the selected subsets)
+class FeatureSelectionDialog : public QDialog, public Ui::FeatureSelectionDialog
+{
+	Q_OBJECT
+
+public:
+
+	//! Default constructor
+	FeatureSelectionDialog(const masc::FeatureSelection& selection, QWidget* parent = nullptr);
+
+	//! Returns the index of the selected subset (or -1 if none)
+	int selectedSubset() const;
+
+Q_SIGNALS:
+
+	//! Emitted when the user wants to export the classifier of a subset
+	void exportRequested(int subsetIndex);
+
+protected slots:
+
+	void onSelectionChanged();
+	void onExport();
+	void updateRows();
+
+protected: //members
+
+	const masc::FeatureSelection& m_selection;
+};
@@ -38,6 +38,7 @@ Train3DMASCDialog::Train3DMASCDialog(QWidget* parent/*=nullptr*/)
 	, Ui::Train3DMASCDialog()
 	, classifierSaved(false)
 	, saveRequested(false)
+	, selectionRequested(false)
 	, traceFileConfigured(false)
 	, m_traceFile(nullptr)
 	, run(0)
@@ -52,6 +53,7 @@ Train3DMASCDialog::Train3DMASCDialog(QWidget* parent/*=nullptr*/)
 
 	connect(closePushButton, SIGNAL(clicked()), this, SLOT(onClose()));
 	connect(savePushButton, SIGNAL(clicked()), this, SLOT(onSave()));
+	connect(selectFeaturesPushButton, SIGNAL(clicked()), this, SLOT(onSelectFeatures()));
 	connect(exportToolButton, SIGNAL(clicked()), this, SLOT(onExportResults()));
 }
 
@@ -144,6 +146,7 @@ void Train3DMASCDialog::setFirstRunDone()
 {
 	runPushButton->setText(tr("Retry"));
 	savePushButton->setEnabled(true);
+	selectFeaturesPushButton->setEnabled(true);
 }
 
 bool Train3DMASCDialog::isFeatureSelected(QString featureName) const
@@ -192,6 +195,14 @@ void Train3DMASCDialog::onClose()
 void Train3DMASCDialog::onSave()
 {
 	saveRequested = true;
+	selectionRequested = false;
+	accept();
+}
+
+void Train3DMASCDialog::onSelectFeatures()
+{
+	saveRequested = false;
+	selectionRequested = true;
 	accept();
 }
 
@@ -296,7 +307,7 @@ bool Train3DMASCDialog::openTraceFile()
 		traceFileConfigured = true;
 		ccLog::Print("save trace in: " + traceFilePath);
 		m_traceStream.setDevice(m_traceFile);
-		m_traceStream << "run overallAccuracy\n";
+		m_traceStream << "run overallAccuracy seed stratified\n";
 		return true;
 	}
 	else
@@ -332,7 +343,7 @@ void Train3DMASCDialog::saveTraces(ConfusionMatrix *confusionMatrix)
 
 		// save the run number and the overall accuracy
 		if (m_traceStream.device())
-			m_traceStream << run << " " << confusionMatrix->getOverallAccuracy() << Qt::endl;
+			m_traceStream << run << " " << confusionMatrix->getOverallAccuracy() << " " << seedSpinBox->value() << " " << (stratifiedSplitCheckBox->isChecked() ? 1 : 0) << Qt::endl;
 		confusionMatrix->save(m_tracePath + "/" + "run_" + QString::number(run) + "_confusion_matrix.txt");
 
 	}
@@ -58,6 +58,9 @@ public:
 	void sortByFeatureImportance();
 	
 	inline bool shouldSaveClassifier() const { return saveRequested; }
+	//! Returns whether the automatic feature selection has been requested
+	inline bool shouldSelectFeatures() const { return selectionRequested; }
+	inline void setFeaturesSelected() { selectionRequested = false; }
 
 	void addConfusionMatrixAndSaveTraces(ConfusionMatrix* ptr);
 	void setInputFilePath(QString filename);
@@ -73,12 +76,14 @@ protected slots:
 
 	void onClose();
 	void onSave();
+	void onSelectFeatures();
 	void onExportResults(QString filePath = "");
 
 protected: //members
 
 	bool classifierSaved;
 	bool saveRequested;
+	bool selectionRequested;
 	std::vector<ConfusionMatrix*> toDeleteLater;
 	bool traceFileConfigured;
 	QFile *m_traceFile;